@@ -16,6 +16,34 @@
 #include "../common/utils.h"
 #include "../../3rd_party/ketopt.h"
 
+// *******************************************************************************************
+// Long options of create and append
+static char opt_max_memory[] = "max-memory";
+static char opt_checkpoint[] = "checkpoint";
+static char opt_resume[] = "resume";
+static char opt_raw_clusters[] = "raw-clusters";
+static char opt_numa[] = "numa";
+static char opt_bgzf[] = "bgzf";
+static const int opt_max_memory_id = 300;
+static const int opt_checkpoint_id = 301;
+static const int opt_resume_id = 302;
+static const int opt_raw_clusters_id = 303;
+static const int opt_numa_id = 304;
+static const int opt_bgzf_id = 305;
+static const ko_longopt_t compression_long_opts[] = {
+	{ opt_max_memory, ko_required_argument, opt_max_memory_id },
+	{ opt_checkpoint, ko_required_argument, opt_checkpoint_id },
+	{ opt_resume, ko_no_argument, opt_resume_id },
+	{ opt_raw_clusters, ko_no_argument, opt_raw_clusters_id },
+	{ opt_numa, ko_required_argument, opt_numa_id },
+	{ nullptr, 0, 0 } };
+
+// Long options of getcol and getset
+static const ko_longopt_t decompression_long_opts[] = {
+	{ opt_numa, ko_required_argument, opt_numa_id },
+	{ opt_bgzf, ko_no_argument, opt_bgzf_id },
+	{ nullptr, 0, 0 } };
+
 // *******************************************************************************************
 bool CApplication::parse_params(const int argc, const char** argv)
 {
@@ -47,6 +75,12 @@ bool CApplication::parse_params(const int argc, const char** argv)
             usage_listctg();
         else if (execution_params.mode == "info")
             usage_info();
+        else if (execution_params.mode == "stats")
+            usage_stats();
+        else if (execution_params.mode == "subset")
+            usage_subset();
+        else if (execution_params.mode == "merge")
+            usage_merge();
         else
         {
             cerr << "Unknown mode: " << execution_params.mode << endl;
@@ -73,6 +107,12 @@ bool CApplication::parse_params(const int argc, const char** argv)
             return parse_params_listctg(argc - 1, argv + 1);
         else if (execution_params.mode == "info")
             return parse_params_info(argc - 1, argv + 1);
+        else if (execution_params.mode == "stats")
+            return parse_params_stats(argc - 1, argv + 1);
+        else if (execution_params.mode == "subset")
+            return parse_params_subset(argc - 1, argv + 1);
+        else if (execution_params.mode == "merge")
+            return parse_params_merge(argc - 1, argv + 1);
         else
         {
             cerr << "Unknown mode: " << execution_params.mode << endl;
@@ -98,6 +138,9 @@ void CApplication::usage() const
     cerr << "   listset  - list sample names in archive\n";
     cerr << "   listctg  - list sample and contig names in archive\n";
     cerr << "   info     - show some statistics of the compressed data\n";
+    cerr << "   stats    - show detailed statistics of the archive (JSON)\n";
+    cerr << "   subset   - create archive with selected samples from existing archive\n";
+    cerr << "   merge    - merge archives (e.g., compressed in parallel) into a single archive\n";
     cerr << "Note: run agc <command> to see command-specific options\n";
 }
 
@@ -111,14 +154,23 @@ void CApplication::usage_create() const
 	cerr << "   -b <int>       - batch size " << execution_params.pack_cardinality.info() << "\n";
     cerr << "   -c             - concatenated genomes in a single file (default: " << boolalpha << execution_params.concatenated_genomes << noboolalpha << ")\n";
     cerr << "   -d             - do not store cmd-line (default: " << boolalpha << execution_params.store_cmd_line << noboolalpha << ")\n";
+	cerr << "   -e <int>       - delta coder version (2 - text, 3 - binary) " << execution_params.lz_diff_version.info() << "\n";
 	cerr << "   -f <float>     - fraction of fall-back minimizers " << execution_params.fallback_frac.info() << "\n";
 	cerr << "   -i <file_name> - file with FASTA file names (alterantive to listing file names explicitely in command line)\n";
+	cerr << "   -j <file_name> - store instrumentation report (JSON) in file (only in builds with INSTRUMENTATION=true)\n";
     cerr << "   -k <int>       - k-mer length" << execution_params.k.info() << "\n";
     cerr << "   -l <int>       - min. match length " << execution_params.min_match_length.info() << "\n";
+	cerr << "   -m <int>       - memory limit for indexes of segment references in MB (0 - no limit or 1/4 of --max-memory) " << execution_params.lz_index_memory.info() << "\n";
     cerr << "   -o <file_name> - output to file (default: output is sent to stdout)\n";
 	cerr << "   -s <int>       - expected segment size " << execution_params.segment_size.info() << "\n";
     cerr << "   -t <int>       - no of threads " << execution_params.no_threads.info() << "\n";
     cerr << "   -v <int>       - verbosity level " << execution_params.verbosity.info() << "\n";
+	cerr << "   -z <int>       - train zstd dictionaries after given no. of samples (0 - no dictionaries) " << execution_params.dict_training_samples.info() << "\n";
+	cerr << "   --max-memory <int> - memory limit for queues and buffers in MB (0 - no limit); input reading is slowed down near the limit " << execution_params.max_memory.info() << "\n";
+	cerr << "   --checkpoint <int> - store checkpoint after at least given no. of samples (at batch boundaries; 0 - no checkpoints; needs -o) " << execution_params.checkpoint_samples.info() << "\n";
+	cerr << "   --resume       - continue interrupted compression from the last checkpoint of the output archive (samples present in it are skipped)\n";
+	cerr << "   --raw-clusters - delta-code similar segments without splitters instead of storing them in raw groups (default: " << boolalpha << execution_params.raw_clusters << noboolalpha << ")\n";
+	cerr << "   --numa <int>   - NUMA mode: threads pinned to nodes (0 - off, 1 - nodes of the system, >1 - emulated nodes for testing) " << execution_params.numa_nodes.info() << "\n";
 }
 
 // *******************************************************************************************
@@ -127,7 +179,7 @@ bool CApplication::parse_params_create(const int argc, const char** argv)
 	ketopt_t o = KETOPT_INIT;
 	int i, c;
 
-	while ((c = ketopt(&o, argc, argv, 1, "t:b:s:k:f:l:acdfi:o:v:", 0)) >= 0) {
+	while ((c = ketopt(&o, argc, argv, 1, "t:b:s:k:f:l:acde:fi:j:m:o:v:z:", compression_long_opts)) >= 0) {
 		if (c == 't') {
 			execution_params.no_threads.assign(atoi(o.arg));
 		} else if (c == 'b') {
@@ -146,14 +198,32 @@ bool CApplication::parse_params_create(const int argc, const char** argv)
 			execution_params.concatenated_genomes = true;
 		} else if (c == 'd') {
 			execution_params.store_cmd_line = false;
+		} else if (c == 'e') {
+			execution_params.lz_diff_version.assign(atoi(o.arg));
 		} else if (c == 'i') {
 			if (!load_file_names(o.arg, execution_params.input_names))
 				return false;
+		} else if (c == 'j') {
+			execution_params.instr_report_name = o.arg;
+		} else if (c == 'm') {
+			execution_params.lz_index_memory.assign(atoi(o.arg));
 		} else if (c == 'o') {
 			execution_params.out_archive_name = o.arg;
 			execution_params.use_stdout = false;
 		} else if (c == 'v') {
 			execution_params.verbosity.assign(atoi(o.arg));
+		} else if (c == 'z') {
+			execution_params.dict_training_samples.assign(atoi(o.arg));
+		} else if (c == opt_max_memory_id) {
+			execution_params.max_memory.assign(atoi(o.arg));
+		} else if (c == opt_checkpoint_id) {
+			execution_params.checkpoint_samples.assign(atoi(o.arg));
+		} else if (c == opt_resume_id) {
+			execution_params.resume = true;
+		} else if (c == opt_raw_clusters_id) {
+			execution_params.raw_clusters = true;
+		} else if (c == opt_numa_id) {
+			execution_params.numa_nodes.assign(atoi(o.arg));
 		}
 	}
 
@@ -162,6 +232,11 @@ bool CApplication::parse_params_create(const int argc, const char** argv)
 		return false;
 	}
 
+	if ((execution_params.checkpoint_samples() || execution_params.resume) && (execution_params.use_stdout || execution_params.concatenated_genomes)) {
+		cerr << "Checkpoints and resuming need output to a file (-o) and are not available for concatenated genomes (-c)\n";
+		return false;
+	}
+
 	execution_params.input_names.insert(execution_params.input_names.begin(), string(argv[o.ind]));
 
 	for (i = o.ind + 1; i < argc; ++i)
@@ -181,9 +256,18 @@ void CApplication::usage_append() const
     cerr << "   -d             - do not store cmd-line (default: " << boolalpha << execution_params.store_cmd_line << noboolalpha << ")\n";
 	cerr << "   -f <float>     - fraction of fall-back minimizers " << execution_params.fallback_frac.info() << "\n";
 	cerr << "   -i <file_name> - file with FASTA file names (alterantive to listing file names explicitely in command line)\n";
+	cerr << "   -j <file_name> - store instrumentation report (JSON) in file (only in builds with INSTRUMENTATION=true)\n";
+	cerr << "   -m <int>       - memory limit for indexes of segment references in MB (0 - no limit or 1/4 of --max-memory) " << execution_params.lz_index_memory.info() << "\n";
     cerr << "   -o <file_name> - output to file (default: output is sent to stdout)\n";
 	cerr << "   -t <int>       - no of threads " << execution_params.no_threads.info() << "\n";
+	cerr << "   -u             - update input archive in place (only new data are written; -o is ignored) (default: " << boolalpha << execution_params.in_place << noboolalpha << ")\n";
     cerr << "   -v <int>       - verbosity level " << execution_params.verbosity.info() << "\n";
+	cerr << "   -z <int>       - train zstd dictionaries after given no. of samples (0 - no dictionaries) " << execution_params.dict_training_samples.info() << "\n";
+	cerr << "   --max-memory <int> - memory limit for queues and buffers in MB (0 - no limit); input reading is slowed down near the limit " << execution_params.max_memory.info() << "\n";
+	cerr << "   --checkpoint <int> - store checkpoint after at least given no. of samples (at batch boundaries; 0 - no checkpoints; needs -u) " << execution_params.checkpoint_samples.info() << "\n";
+	cerr << "   --resume       - continue interrupted appending from the last checkpoint (samples present in the archive are skipped; needs -u)\n";
+	cerr << "   --raw-clusters - delta-code similar segments without splitters instead of storing them in raw groups (default: " << boolalpha << execution_params.raw_clusters << noboolalpha << ")\n";
+	cerr << "   --numa <int>   - NUMA mode: threads pinned to nodes (0 - off, 1 - nodes of the system, >1 - emulated nodes for testing) " << execution_params.numa_nodes.info() << "\n";
 }
 
 // *******************************************************************************************
@@ -192,7 +276,7 @@ bool CApplication::parse_params_append(const int argc, const char** argv)
 	ketopt_t o = KETOPT_INIT;
 	int i, c;
 
-	while ((c = ketopt(&o, argc, argv, 1, "t:f:acdfi:o:v:", 0)) >= 0) {
+	while ((c = ketopt(&o, argc, argv, 1, "t:f:acdfi:j:m:o:uv:z:", compression_long_opts)) >= 0) {
 		if (c == 't') {
 			execution_params.no_threads.assign(atoi(o.arg));
 		}
@@ -209,11 +293,29 @@ bool CApplication::parse_params_append(const int argc, const char** argv)
 		else if (c == 'i') {
 			if (!load_file_names(o.arg, execution_params.input_names))
 				return false;
+		} else if (c == 'j') {
+			execution_params.instr_report_name = o.arg;
+		} else if (c == 'm') {
+			execution_params.lz_index_memory.assign(atoi(o.arg));
 		} else if (c == 'o') {
 			execution_params.out_archive_name = o.arg;
 			execution_params.use_stdout = false;
+		} else if (c == 'u') {
+			execution_params.in_place = true;
 		} else if (c == 'v') {
 			execution_params.verbosity.assign(atoi(o.arg));
+		} else if (c == 'z') {
+			execution_params.dict_training_samples.assign(atoi(o.arg));
+		} else if (c == opt_max_memory_id) {
+			execution_params.max_memory.assign(atoi(o.arg));
+		} else if (c == opt_checkpoint_id) {
+			execution_params.checkpoint_samples.assign(atoi(o.arg));
+		} else if (c == opt_resume_id) {
+			execution_params.resume = true;
+		} else if (c == opt_raw_clusters_id) {
+			execution_params.raw_clusters = true;
+		} else if (c == opt_numa_id) {
+			execution_params.numa_nodes.assign(atoi(o.arg));
 		}
 	}
 
@@ -222,8 +324,19 @@ bool CApplication::parse_params_append(const int argc, const char** argv)
 		return false;
 	}
 
+	if ((execution_params.checkpoint_samples() || execution_params.resume) && (!execution_params.in_place || execution_params.concatenated_genomes)) {
+		cerr << "Checkpoints and resuming need in-place appending (-u) and are not available for concatenated genomes (-c)\n";
+		return false;
+	}
+
 	execution_params.in_archive_name = argv[o.ind];
 
+	if (execution_params.in_place)
+	{
+		execution_params.out_archive_name = execution_params.in_archive_name;
+		execution_params.use_stdout = false;
+	}
+
 	for (i = o.ind + 1; i < argc; ++i)
 		execution_params.input_names.emplace_back(argv[i]);
 
@@ -243,6 +356,8 @@ void CApplication::usage_getcol() const
 	cerr << "   -r               - without reference (default: " << boolalpha << execution_params.no_ref << ")\n";
 	cerr << "   -t <int>         - no of threads " << execution_params.no_threads.info() << "\n";
     cerr << "   -v <int>         - verbosity level " << execution_params.verbosity.info() << "\n";
+	cerr << "   --numa <int>     - NUMA mode: threads pinned to nodes (0 - off, 1 - nodes of the system, >1 - emulated nodes for testing) " << execution_params.numa_nodes.info() << "\n";
+	cerr << "   --bgzf           - BGZF output (level given by -g, default 6) with .fai and .gzi indexes of output files (default: " << boolalpha << execution_params.bgzf << ")\n";
 }
 
 // *******************************************************************************************
@@ -253,7 +368,7 @@ bool CApplication::parse_params_getcol(const int argc, const char** argv)
 
 	execution_params.prefetch = true;
 
-	while ((c = ketopt(&o, argc, argv, 1, "g:t:l:o:v:fr", 0)) >= 0) {
+	while ((c = ketopt(&o, argc, argv, 1, "g:t:l:o:v:fr", decompression_long_opts)) >= 0) {
 		if (c == 'g') {
 			execution_params.gzip_level.assign(atoi(o.arg));
 		}
@@ -276,6 +391,12 @@ bool CApplication::parse_params_getcol(const int argc, const char** argv)
 		else if (c == 'v') {
 			execution_params.verbosity.assign(atoi(o.arg));
 		}
+		else if (c == opt_numa_id) {
+			execution_params.numa_nodes.assign(atoi(o.arg));
+		}
+		else if (c == opt_bgzf_id) {
+			execution_params.bgzf = true;
+		}
 	}
 
 	if (o.ind >= argc) {
@@ -301,6 +422,8 @@ void CApplication::usage_getset() const
 	cerr << "   -s             - enable streaming mode (slower but need less memory)" << "\n";
 	cerr << "   -t <int>       - no of threads " << execution_params.no_threads.info() << "\n";
     cerr << "   -v <int>       - verbosity level " << execution_params.verbosity.info() << "\n";
+	cerr << "   --numa <int>   - NUMA mode: threads pinned to nodes (0 - off, 1 - nodes of the system, >1 - emulated nodes for testing) " << execution_params.numa_nodes.info() << "\n";
+	cerr << "   --bgzf         - BGZF output (level given by -g, default 6) with .fai and .gzi indexes of output file (default: " << boolalpha << execution_params.bgzf << ")\n";
 }
 
 // *******************************************************************************************
@@ -311,7 +434,7 @@ bool CApplication::parse_params_getset(const int argc, const char** argv)
 
 	execution_params.prefetch = true;
 
-	while ((c = ketopt(&o, argc, argv, 1, "g:t:l:o:psv:", 0)) >= 0) {
+	while ((c = ketopt(&o, argc, argv, 1, "g:t:l:o:psv:", decompression_long_opts)) >= 0) {
 		if (c == 'g') {
 			execution_params.gzip_level.assign(atoi(o.arg));
 		}
@@ -332,6 +455,17 @@ bool CApplication::parse_params_getset(const int argc, const char** argv)
 		else if (c == 'v') {
 			execution_params.verbosity.assign(atoi(o.arg));
 		}
+		else if (c == opt_numa_id) {
+			execution_params.numa_nodes.assign(atoi(o.arg));
+		}
+		else if (c == opt_bgzf_id) {
+			execution_params.bgzf = true;
+		}
+	}
+
+	if (execution_params.bgzf && execution_params.streaming) {
+		cerr << "BGZF output is not available in streaming mode\n";
+		return false;
 	}
 
 	if (o.ind >= argc) {
@@ -566,6 +700,157 @@ bool CApplication::parse_params_info(const int argc, const char** argv)
 	return true;
 }
 
+// *******************************************************************************************
+void CApplication::usage_stats() const
+{
+	cerr << AGC_VERSION << endl;
+	cerr << "Usage: agc stats [options] <in.agc> > <out.json>\n";
+    cerr << "Options:\n";
+	cerr << "   -d <sample>    - measure decompression time of given sample (default: no measurement)\n";
+    cerr << "   -o <file_name> - output to file (default: output is sent to stdout)\n";
+	cerr << "   -t <int>       - no of threads (for measurement) " << execution_params.no_threads.info() << "\n";
+}
+
+// *******************************************************************************************
+bool CApplication::parse_params_stats(const int argc, const char** argv)
+{
+	ketopt_t o = KETOPT_INIT;
+	int c;
+
+	execution_params.prefetch = false;
+
+	while ((c = ketopt(&o, argc, argv, 1, "d:o:t:", 0)) >= 0) {
+		if (c == 'd') {
+			execution_params.sample_names.emplace_back(o.arg);
+		} else if (c == 'o') {
+			execution_params.output_name = o.arg;
+			execution_params.use_stdout = false;
+		} else if (c == 't') {
+			execution_params.no_threads.assign(atoi(o.arg));
+		}
+	}
+
+	if (o.ind >= argc) {
+		cerr << "No archive name\n";
+		return false;
+	}
+
+	execution_params.in_archive_name = argv[o.ind];
+
+	return true;
+}
+
+// *******************************************************************************************
+void CApplication::usage_subset() const
+{
+	cerr << AGC_VERSION << endl;
+	cerr << "Usage: agc subset [options] <in.agc> [<sample_name1> ...] > <out.agc>\n";
+    cerr << "Options:\n";
+	cerr << "   -i <file_name> - file with sample names (alternative to listing sample names explicitely in command line)\n";
+    cerr << "   -o <file_name> - output to file (default: output is sent to stdout)\n";
+	cerr << "   -t <int>       - no of threads " << execution_params.no_threads.info() << "\n";
+    cerr << "   -v <int>       - verbosity level " << execution_params.verbosity.info() << "\n";
+	cerr << "   -x             - keep all samples except the listed ones (default: " << boolalpha << execution_params.exclude << noboolalpha << ")\n";
+}
+
+// *******************************************************************************************
+bool CApplication::parse_params_subset(const int argc, const char** argv)
+{
+	ketopt_t o = KETOPT_INIT;
+	int i, c;
+
+	execution_params.prefetch = false;
+
+	while ((c = ketopt(&o, argc, argv, 1, "i:o:t:v:x", 0)) >= 0) {
+		if (c == 'i') {
+			if (!load_file_names(o.arg, execution_params.sample_names))
+				return false;
+		} else if (c == 'o') {
+			execution_params.out_archive_name = o.arg;
+			execution_params.use_stdout = false;
+		} else if (c == 't') {
+			execution_params.no_threads.assign(atoi(o.arg));
+		} else if (c == 'v') {
+			execution_params.verbosity.assign(atoi(o.arg));
+		} else if (c == 'x') {
+			execution_params.exclude = true;
+		}
+	}
+
+	if (o.ind >= argc) {
+		cerr << "No archive name\n";
+		return false;
+	}
+
+	execution_params.in_archive_name = argv[o.ind];
+
+	for (i = o.ind + 1; i < argc; ++i)
+		execution_params.sample_names.emplace_back(argv[i]);
+
+	if (execution_params.sample_names.empty() && !execution_params.exclude) {
+		cerr << "No sample name\n";
+		return false;
+	}
+
+	if (!execution_params.use_stdout && execution_params.out_archive_name == execution_params.in_archive_name) {
+		cerr << "Output archive must differ from input archive\n";
+		return false;
+	}
+
+	return true;
+}
+
+// *******************************************************************************************
+void CApplication::usage_merge() const
+{
+	cerr << AGC_VERSION << endl;
+	cerr << "Usage: agc merge [options] <in1.agc> <in2.agc> [<in3.agc> ...] > <out.agc>\n";
+    cerr << "Options:\n";
+	cerr << "   -i <file_name> - file with archive names (alternative to listing archive names explicitely in command line)\n";
+    cerr << "   -o <file_name> - output to file (default: output is sent to stdout)\n";
+	cerr << "   -t <int>       - no of threads " << execution_params.no_threads.info() << "\n";
+    cerr << "   -v <int>       - verbosity level " << execution_params.verbosity.info() << "\n";
+}
+
+// *******************************************************************************************
+bool CApplication::parse_params_merge(const int argc, const char** argv)
+{
+	ketopt_t o = KETOPT_INIT;
+	int i, c;
+
+	execution_params.prefetch = false;
+
+	while ((c = ketopt(&o, argc, argv, 1, "i:o:t:v:", 0)) >= 0) {
+		if (c == 'i') {
+			if (!load_file_names(o.arg, execution_params.input_names))
+				return false;
+		} else if (c == 'o') {
+			execution_params.out_archive_name = o.arg;
+			execution_params.use_stdout = false;
+		} else if (c == 't') {
+			execution_params.no_threads.assign(atoi(o.arg));
+		} else if (c == 'v') {
+			execution_params.verbosity.assign(atoi(o.arg));
+		}
+	}
+
+	for (i = o.ind; i < argc; ++i)
+		execution_params.input_names.emplace_back(argv[i]);
+
+	if (execution_params.input_names.size() < 2) {
+		cerr << "At least two archives must be given\n";
+		return false;
+	}
+
+	for (auto& x : execution_params.input_names)
+		if (!execution_params.use_stdout && execution_params.out_archive_name == x) {
+			cerr << "Output archive must differ from input archives\n";
+			return false;
+		}
+
+	return true;
+}
+
 // *******************************************************************************************
 bool CApplication::load_file_names(const string &fn, vector<string>& v_file_names)
 {
@@ -55,6 +55,7 @@ struct CParams
 	string reference_name;
 	string splitters_name;
 	string output_name;
+	string instr_report_name;
 	vector<string> sample_names;
 	vector<string> contig_names;
 	string contig_name;
@@ -69,6 +70,12 @@ struct CParams
 	b_value<uint32_t> verbosity{ 0, 0, 2 };
 	b_value<uint32_t> gzip_level{ 0, 0, 9 };
 	b_value<double> fallback_frac{ 0, 0, 0.05 };
+	b_value<uint32_t> dict_training_samples{ 0, 0, 1'000'000 };
+	b_value<uint32_t> lz_diff_version{ 2, 2, 3 };
+	b_value<uint32_t> lz_index_memory{ 0, 0, 1'000'000 };
+	b_value<uint32_t> max_memory{ 0, 0, 100'000'000 };
+	b_value<uint32_t> checkpoint_samples{ 0, 0, 1'000'000'000 };
+	b_value<uint32_t> numa_nodes{ 0, 0, 1024 };
 
 	uint32_t no_segments = 0;
 	bool concatenated_genomes = false;
@@ -79,6 +86,11 @@ struct CParams
 	bool no_ref = false;
 	bool fast = false;
 	bool streaming = false;
+	bool in_place = false;
+	bool exclude = false;
+	bool resume = false;
+	bool raw_clusters = false;
+	bool bgzf = false;
 
 	CParams() = default;
 };
@@ -100,6 +112,9 @@ class CApplication
 	void usage_listset() const;
 	void usage_listctg() const;
 	void usage_info() const;
+	void usage_stats() const;
+	void usage_subset() const;
+	void usage_merge() const;
 
 	bool load_file_names(const string & fn, vector<string>& v_file_names);
 
@@ -112,6 +127,9 @@ class CApplication
 	bool parse_params_listset(const int argc, const char** argv);
 	bool parse_params_listctg(const int argc, const char** argv);
 	bool parse_params_info(const int argc, const char** argv);
+	bool parse_params_stats(const int argc, const char** argv);
+	bool parse_params_subset(const int argc, const char** argv);
+	bool parse_params_merge(const int argc, const char** argv);
 
 	void sanitize_input_file_names(vector<string> &v_file_names);
 	void remove_common_suffixes(string& sample_name);
@@ -125,6 +143,9 @@ class CApplication
 	bool listset();
 	bool listctg();
 	bool info();
+	bool stats();
+	bool subset();
+	bool merge();
 
 public:
 	CApplication() = default;
@@ -14,6 +14,7 @@
 #include <vector>
 #include <algorithm>
 #include <filesystem>
+#include <unordered_set>
 
 #ifdef _MSC_VER 
 #include <mimalloc.h>
@@ -58,6 +59,12 @@ int CApplication::Run(const int argc, const char** argv)
         listctg();
     else if (execution_params.mode == "info")
         info();
+    else if (execution_params.mode == "stats")
+        stats();
+    else if (execution_params.mode == "subset")
+        subset();
+    else if (execution_params.mode == "merge")
+        merge();
     else
     {
         cerr << "Unknown mode: " << execution_params.mode << endl;
@@ -72,25 +79,78 @@ int CApplication::Run(const int argc, const char** argv)
     return 0;
 }
 
+// *******************************************************************************************
+// Samples already present in the archive (e.g., before the checkpoint the compression is resumed from) are not compressed again
+static void skip_archived_samples(CAGCCompressor& agc_c, vector<pair<string, string>>& v_sample_file_names, const uint32_t verbosity)
+{
+    vector<string> v_archived;
+    agc_c.ListSamples(v_archived);
+
+    unordered_set<string> s_archived(v_archived.begin(), v_archived.end());
+
+    auto p = remove_if(v_sample_file_names.begin(), v_sample_file_names.end(), [&](const auto& x) {return s_archived.count(x.first) > 0; });
+    auto no_skipped = distance(p, v_sample_file_names.end());
+    v_sample_file_names.erase(p, v_sample_file_names.end());
+
+    if (verbosity > 0)
+        cerr << "Resuming: " << no_skipped << " samples already in the archive, " << v_sample_file_names.size() << " samples to compress\n";
+}
+
 // *******************************************************************************************
 bool CApplication::create()
 {
-    CAGCCompressor agc_c;
+    auto agc_c = make_unique<CAGCCompressor>();
 
     sanitize_input_file_names(execution_params.input_names);
 
-    bool r = agc_c.Create(
-        execution_params.out_archive_name,
-        execution_params.pack_cardinality(),
-        execution_params.k(),
-        execution_params.input_names.front(),
-        execution_params.segment_size(),
-        execution_params.min_match_length(),
-        execution_params.concatenated_genomes,
-        execution_params.adaptive_compression,
-        execution_params.verbosity(),
-        execution_params.no_threads(),
-        execution_params.fallback_frac());
+    agc_c->SetMaxMemory(execution_params.max_memory());
+    agc_c->SetDictTraining(execution_params.dict_training_samples());
+
+    // Interrupted compression is continued (by in-place appending) from the last checkpoint
+    bool resume = execution_params.resume && filesystem::exists(execution_params.out_archive_name);
+
+    if (resume)
+    {
+        resume = agc_c->Append(
+            execution_params.out_archive_name,
+            execution_params.out_archive_name,
+            execution_params.verbosity(),
+            true,
+            execution_params.concatenated_genomes,
+            execution_params.adaptive_compression,
+            execution_params.no_threads(),
+            execution_params.fallback_frac(),
+            true);
+
+        // Compression interrupted before the first checkpoint (or not started) cannot be resumed
+        if (!resume)
+        {
+            cerr << "No checkpoint in archive " << execution_params.out_archive_name << "; compression starts from scratch\n";
+            agc_c = make_unique<CAGCCompressor>();
+            agc_c->SetMaxMemory(execution_params.max_memory());
+            agc_c->SetDictTraining(execution_params.dict_training_samples());
+        }
+    }
+
+    bool r = resume;
+
+    if (!resume)
+    {
+        agc_c->SetLZDiffVersion(execution_params.lz_diff_version());
+
+        r = agc_c->Create(
+            execution_params.out_archive_name,
+            execution_params.pack_cardinality(),
+            execution_params.k(),
+            execution_params.input_names.front(),
+            execution_params.segment_size(),
+            execution_params.min_match_length(),
+            execution_params.concatenated_genomes,
+            execution_params.adaptive_compression,
+            execution_params.verbosity(),
+            execution_params.no_threads(),
+            execution_params.fallback_frac());
+    }
 
     if (!r)
     {
@@ -98,6 +158,17 @@ bool CApplication::create()
         return false;
     }
 
+    if (!agc_c->SetCheckpoints(execution_params.checkpoint_samples()))
+        cerr << "Warning: checkpoints are not available for archive " << execution_params.out_archive_name << endl;
+
+    if (!execution_params.instr_report_name.empty())
+        agc_c->SetInstrumentationReport(execution_params.instr_report_name);
+
+
+    agc_c->SetLZIndexMemory(execution_params.lz_index_memory());
+    agc_c->SetRawClustering(execution_params.raw_clusters);
+    agc_c->SetNuma(execution_params.numa_nodes());
+
     if (execution_params.verbosity() > 0)
         cerr << "Start of compression\n";
 
@@ -110,13 +181,16 @@ bool CApplication::create()
         v_sample_file_names.emplace_back(sample_name, fn);
     }
 
+    if (resume)
+        skip_archived_samples(*agc_c, v_sample_file_names, execution_params.verbosity());
+
     if(r)
-        r &= agc_c.AddSampleFiles(v_sample_file_names, execution_params.no_threads());
+        r &= agc_c->AddSampleFiles(v_sample_file_names, execution_params.no_threads());
 
     if (r && execution_params.store_cmd_line)
-        agc_c.AddCmdLine(cmd_line);
+        agc_c->AddCmdLine(cmd_line);
 
-    r &= agc_c.Close(execution_params.no_threads());
+    r &= agc_c->Close(execution_params.no_threads());
 
     return r;
 }
@@ -128,6 +202,9 @@ bool CApplication::append()
 
     sanitize_input_file_names(execution_params.input_names);
 
+    agc_c.SetMaxMemory(execution_params.max_memory());
+    agc_c.SetDictTraining(execution_params.dict_training_samples());
+
     bool r = agc_c.Append(
         execution_params.in_archive_name, 
         execution_params.out_archive_name, 
@@ -136,14 +213,29 @@ bool CApplication::append()
         execution_params.concatenated_genomes, 
         execution_params.adaptive_compression,
         execution_params.no_threads(),
-        execution_params.fallback_frac());
+        execution_params.fallback_frac(),
+        execution_params.in_place);
 
     if (!r)
     {
-        cerr << "Cannot open archive " << execution_params.in_archive_name << " or create archive " << execution_params.out_archive_name << endl;
+        if (execution_params.in_place)
+            cerr << "Cannot open archive " << execution_params.in_archive_name << " for appending" << endl;
+        else
+            cerr << "Cannot open archive " << execution_params.in_archive_name << " or create archive " << execution_params.out_archive_name << endl;
         return false;
     }
 
+    if (!agc_c.SetCheckpoints(execution_params.checkpoint_samples()))
+        cerr << "Warning: checkpoints are not available for archive " << execution_params.in_archive_name << endl;
+
+    if (!execution_params.instr_report_name.empty())
+        agc_c.SetInstrumentationReport(execution_params.instr_report_name);
+
+
+    agc_c.SetLZIndexMemory(execution_params.lz_index_memory());
+    agc_c.SetRawClustering(execution_params.raw_clusters);
+    agc_c.SetNuma(execution_params.numa_nodes());
+
     vector<pair<string, string>> v_sample_file_names;
 
     for (auto& fn : execution_params.input_names)
@@ -153,6 +245,9 @@ bool CApplication::append()
         v_sample_file_names.emplace_back(sample_name, fn);
     }
 
+    if (execution_params.resume)
+        skip_archived_samples(agc_c, v_sample_file_names, execution_params.verbosity());
+
     if (execution_params.verbosity() > 0)
         cerr << "Start of compression\n";
 
@@ -167,11 +262,50 @@ bool CApplication::append()
     return r;
 }
 
+// *******************************************************************************************
+bool CApplication::subset()
+{
+    CAGCCompressor agc_c;
+
+    bool r = agc_c.Subset(
+        execution_params.in_archive_name,
+        execution_params.out_archive_name,
+        execution_params.sample_names,
+        execution_params.exclude,
+        execution_params.verbosity(),
+        execution_params.no_threads());
+
+    if (!r)
+        cerr << "Cannot create subset of archive " << execution_params.in_archive_name << endl;
+
+    return r;
+}
+
+// *******************************************************************************************
+bool CApplication::merge()
+{
+    CAGCCompressor agc_c;
+
+    bool r = agc_c.Merge(
+        execution_params.input_names,
+        execution_params.out_archive_name,
+        execution_params.verbosity(),
+        execution_params.no_threads());
+
+    if (!r)
+        cerr << "Cannot merge archives\n";
+
+    return r;
+}
+
 // *******************************************************************************************
 bool CApplication::getcol()
 {
     CAGCDecompressor agc_d(true);
 
+    agc_d.SetNuma(execution_params.numa_nodes());
+    agc_d.SetBgzf(execution_params.bgzf);
+
     bool r = agc_d.Open(execution_params.in_archive_name, execution_params.prefetch);
         
     if (!r)
@@ -199,6 +333,9 @@ bool CApplication::getset()
 {
     CAGCDecompressor agc_d(true);
 
+    agc_d.SetNuma(execution_params.numa_nodes());
+    agc_d.SetBgzf(execution_params.bgzf);
+
     bool r = agc_d.Open(execution_params.in_archive_name, execution_params.prefetch);
 
     if (!r)
@@ -422,6 +559,46 @@ bool CApplication::info()
     return true;
 }
 
+// *******************************************************************************************
+bool CApplication::stats()
+{
+    CAGCDecompressor agc_d(true);
+
+    bool r = agc_d.Open(execution_params.in_archive_name, execution_params.prefetch);
+
+    if (!r)
+        return false;
+
+    string json_stats;
+    string timed_sample = execution_params.sample_names.empty() ? "" : execution_params.sample_names.front();
+
+    r &= agc_d.GetArchiveStats(json_stats, timed_sample, execution_params.no_threads());
+
+    if (!r)
+    {
+        cerr << "Cannot collect statistics of archive " << execution_params.in_archive_name << endl;
+        agc_d.Close();
+        return false;
+    }
+
+    COutFile outf;
+    r &= outf.Open(execution_params.output_name);
+
+    if (!r)
+    {
+        cerr << "Cannot open output file " << execution_params.output_name << endl;
+        return false;
+    }
+
+    outf.Write(json_stats);
+
+    outf.Close();
+
+    r &= agc_d.Close();
+
+    return r;
+}
+
 // *******************************************************************************************
 int main(int argc, char** argv)
 {
@@ -0,0 +1,920 @@
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include "bench.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "../core/agc_compressor.h"
+#include "../core/agc_decompressor.h"
+#include "../core/genome_io.h"
+#include "../core/kmer.h"
+#include "../core/kmer_scanner.h"
+#include "../common/lz_diff.h"
+#include "../common/segment.h"
+#include "../common/archive.h"
+#include "../common/numa.h"
+#include "../lib-cxx/agc-api.h"
+#include "../../3rd_party/ketopt.h"
+
+using namespace std::chrono;
+using namespace std::filesystem;
+
+// *******************************************************************************************
+CBenchmark::CBenchmark(const CBenchParams& _params) : params(_params), mt(_params.seed)
+{
+	archive_create_name = (path(params.work_dir) / "bench_create.agc").string();
+	archive_append_name = (path(params.work_dir) / "bench_append.agc").string();
+}
+
+// *******************************************************************************************
+uint64_t CBenchmark::peak_rss_kb()
+{
+#ifndef _WIN32
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+#ifdef __APPLE__
+	return (uint64_t) usage.ru_maxrss / 1024;		// bytes on macOS
+#else
+	return (uint64_t) usage.ru_maxrss;
+#endif
+#else
+	return 0;
+#endif
+}
+
+// *******************************************************************************************
+void CBenchmark::add_result(const string& name, double time, uint64_t bytes, const string& extra)
+{
+	v_results.emplace_back(result_t{ name, time, bytes, peak_rss_kb(), extra });
+
+	cerr << name << ": " << time << " s";
+	if (bytes && time > 0)
+		cerr << " (" << bytes / time / 1e6 << " MB/s)";
+	cerr << endl;
+}
+
+// *******************************************************************************************
+double CBenchmark::measure(const function<bool()>& fun, bool& ok)
+{
+	auto t1 = high_resolution_clock::now();
+	ok = fun();
+	auto t2 = high_resolution_clock::now();
+
+	return duration<double>(t2 - t1).count();
+}
+
+// *******************************************************************************************
+// Apply SNPs and short indels to the sequence (numeric codes)
+void CBenchmark::mutate(const contig_t& src, contig_t& dest)
+{
+	uniform_real_distribution<double> dist_event(0.0, 1.0);
+	uniform_int_distribution<int> dist_base(0, 3);
+	uniform_int_distribution<int> dist_indel_len(1, 10);
+
+	const double snp_rate = params.divergence * 0.9;
+	const double indel_rate = params.divergence * 0.1;
+
+	dest.clear();
+	dest.reserve(src.size() + src.size() / 100);
+
+	for (size_t i = 0; i < src.size(); ++i)
+	{
+		double r = dist_event(mt);
+
+		if (r < snp_rate)
+			dest.emplace_back((uint8_t) ((src[i] + 1 + dist_base(mt) % 3) % 4));
+		else if (r < snp_rate + indel_rate / 2)
+			i += dist_indel_len(mt) - 1;						// deletion
+		else if (r < snp_rate + indel_rate)
+		{
+			int len = dist_indel_len(mt);						// insertion
+			for (int j = 0; j < len; ++j)
+				dest.emplace_back((uint8_t) dist_base(mt));
+			dest.emplace_back(src[i]);
+		}
+		else
+			dest.emplace_back(src[i]);
+	}
+}
+
+// *******************************************************************************************
+// Generate synthetic collection: random reference and its mutated copies (each derived from a random earlier sample)
+void CBenchmark::gen_collection()
+{
+	const char sym[] = "ACGT";
+	uniform_int_distribution<int> dist_base(0, 3);
+	vector<vector<contig_t>> v_genomes;
+
+	create_directories(params.work_dir);
+
+	uint64_t contig_len = max<uint64_t>(params.genome_length / params.no_contigs, 1000);
+
+	for (uint32_t i = 0; i < params.no_samples; ++i)
+	{
+		vector<contig_t> genome(params.no_contigs);
+
+		if (i == 0)
+		{
+			for (auto& ctg : genome)
+			{
+				ctg.resize(contig_len);
+				for (auto& c : ctg)
+					c = (uint8_t) dist_base(mt);
+			}
+		}
+		else
+		{
+			uniform_int_distribution<uint32_t> dist_parent(0, i - 1);
+			auto& parent = v_genomes[dist_parent(mt)];
+
+			for (uint32_t j = 0; j < params.no_contigs; ++j)
+				mutate(parent[j], genome[j]);
+		}
+
+		string sample_name = "sample_" + to_string(i);
+		string file_name = (path(params.work_dir) / (sample_name + ".fa")).string();
+
+		ofstream ofs(file_name, ios::binary);
+		string line;
+
+		for (uint32_t j = 0; j < params.no_contigs; ++j)
+		{
+			ofs << ">ctg" << j << "\n";
+
+			for (size_t k = 0; k < genome[j].size(); k += 80)
+			{
+				line.clear();
+				for (size_t l = k; l < min<size_t>(k + 80, genome[j].size()); ++l)
+					line.push_back(sym[genome[j][l]]);
+				line.push_back('\n');
+				ofs.write(line.data(), line.size());
+			}
+		}
+
+		input_size += (uint64_t) ofs.tellp();
+
+		v_sample_files.emplace_back(file_name);
+		v_sample_names.emplace_back(sample_name);
+		v_genomes.emplace_back(move(genome));
+	}
+}
+
+// *******************************************************************************************
+bool CBenchmark::load_input_list()
+{
+	ifstream inf(params.input_list_name);
+
+	if (!inf.is_open())
+	{
+		cerr << "Cannot open file: " << params.input_list_name << endl;
+		return false;
+	}
+
+	string fn;
+
+	while (inf >> fn)
+	{
+		error_code ec;
+		auto fs = file_size(fn, ec);
+
+		if (ec)
+		{
+			cerr << "Cannot open file: " << fn << endl;
+			return false;
+		}
+
+		input_size += fs;
+		v_sample_files.emplace_back(fn);
+		v_sample_names.emplace_back(path(fn).stem().string());
+	}
+
+	if (v_sample_files.size() < 2)
+	{
+		cerr << "At least 2 input files are necessary\n";
+		return false;
+	}
+
+	create_directories(params.work_dir);
+	params.no_samples = (uint32_t) v_sample_files.size();
+	params.no_appended = min(params.no_appended, params.no_samples - 1);
+
+	return true;
+}
+
+// *******************************************************************************************
+bool CBenchmark::load_fasta_seqs(const string& file_name, vector<pair<string, contig_t>>& v_seqs)
+{
+	CGenomeIO gio;
+	string id;
+	contig_t ctg;
+
+	if (!gio.Open(file_name, false))
+		return false;
+
+	v_seqs.clear();
+
+	while (gio.ReadContigConverted(id, ctg))
+		v_seqs.emplace_back(id, ctg);
+
+	gio.Close();
+
+	return !v_seqs.empty();
+}
+
+// *******************************************************************************************
+bool CBenchmark::bench_create()
+{
+	bool ok;
+	uint32_t no_in_create = params.no_samples - params.no_appended;
+	uint64_t bytes = 0;
+
+	for (uint32_t i = 0; i < no_in_create; ++i)
+		bytes += file_size(v_sample_files[i]);
+
+	double time = measure([&] {
+		CAGCCompressor agc_c;
+
+		if (!agc_c.Create(archive_create_name, params.pack_cardinality, params.kmer_length, v_sample_files.front(), params.segment_size,
+			params.min_match_length, false, false, 0, params.no_threads, 0.0))
+			return false;
+
+		vector<pair<string, string>> v_sample_file_names;
+		for (uint32_t i = 0; i < no_in_create; ++i)
+			v_sample_file_names.emplace_back(v_sample_names[i], v_sample_files[i]);
+
+		bool r = agc_c.AddSampleFiles(v_sample_file_names, params.no_threads);
+		r &= agc_c.Close(params.no_threads);
+
+		return r;
+		}, ok);
+
+	if (ok)
+		add_result("create", time, bytes, "\"no_samples\": " + to_string(no_in_create) + ", \"archive_size\": " + to_string(file_size(archive_create_name)));
+
+	return ok;
+}
+
+// *******************************************************************************************
+bool CBenchmark::bench_append()
+{
+	bool ok;
+	uint32_t no_in_create = params.no_samples - params.no_appended;
+	uint64_t bytes = 0;
+
+	for (uint32_t i = no_in_create; i < params.no_samples; ++i)
+		bytes += file_size(v_sample_files[i]);
+
+	double time = measure([&] {
+		CAGCCompressor agc_c;
+
+		if (!agc_c.Append(archive_create_name, archive_append_name, 0, true, false, false, params.no_threads, 0.0))
+			return false;
+
+		vector<pair<string, string>> v_sample_file_names;
+		for (uint32_t i = no_in_create; i < params.no_samples; ++i)
+			v_sample_file_names.emplace_back(v_sample_names[i], v_sample_files[i]);
+
+		bool r = agc_c.AddSampleFiles(v_sample_file_names, params.no_threads);
+		r &= agc_c.Close(params.no_threads);
+
+		return r;
+		}, ok);
+
+	if (ok)
+		add_result("append", time, bytes, "\"no_samples\": " + to_string(params.no_appended) + ", \"archive_size\": " + to_string(file_size(archive_append_name)));
+
+	return ok;
+}
+
+// *******************************************************************************************
+bool CBenchmark::bench_getcol()
+{
+	bool ok;
+	path col_dir = path(params.work_dir) / "col";
+
+	create_directories(col_dir);
+
+	double time = measure([&] {
+		CAGCDecompressor agc_d(false);
+
+		if (!agc_d.Open(archive_append_name, true))
+			return false;
+
+		bool r = agc_d.GetCollectionFiles(col_dir.string(), 80, params.no_threads, 0, false, false, 0);
+		r &= agc_d.Close();
+
+		return r;
+		}, ok);
+
+	uint64_t bytes = 0;
+	for (auto& f : directory_iterator(col_dir))
+		bytes += f.file_size();
+
+	if (ok)
+		add_result("getcol", time, bytes);
+
+	return ok;
+}
+
+// *******************************************************************************************
+bool CBenchmark::bench_getset()
+{
+	bool ok;
+	string out_name = (path(params.work_dir) / "getset.fa").string();
+	string sample_name = v_sample_names[v_sample_names.size() / 2];
+
+	double time = measure([&] {
+		CAGCDecompressor agc_d(false);
+
+		if (!agc_d.Open(archive_append_name, true))
+			return false;
+
+		bool r = agc_d.GetSampleFile(out_name, { sample_name }, 80, params.no_threads, 0, 0);
+		r &= agc_d.Close();
+
+		return r;
+		}, ok);
+
+	if (ok)
+		add_result("getset", time, file_size(out_name), "\"sample\": \"" + sample_name + "\"");
+
+	return ok;
+}
+
+// *******************************************************************************************
+// Random ranges of contigs via library API
+bool CBenchmark::bench_ctg_ranges()
+{
+	CAGCFile agc_file;
+	vector<string> v_samples;
+	vector<pair<string, string>> v_sample_ctg;
+	vector<int> v_ctg_len;
+
+	if (!agc_file.Open(archive_append_name, true))
+		return false;
+
+	agc_file.ListSample(v_samples);
+
+	for (auto& s : v_samples)
+	{
+		vector<string> v_ctgs;
+		agc_file.ListCtg(s, v_ctgs);
+
+		for (auto& c : v_ctgs)
+		{
+			int len = agc_file.GetCtgLen(s, c);
+			if (len > 0)
+			{
+				v_sample_ctg.emplace_back(s, c);
+				v_ctg_len.emplace_back(len);
+			}
+		}
+	}
+
+	if (v_sample_ctg.empty())
+		return false;
+
+	uniform_int_distribution<size_t> dist_ctg(0, v_sample_ctg.size() - 1);
+	vector<tuple<size_t, int, int>> v_queries;
+
+	for (uint32_t i = 0; i < params.no_queries; ++i)
+	{
+		size_t id = dist_ctg(mt);
+		int q_len = min<int>(params.query_length, v_ctg_len[id]);
+		uniform_int_distribution<int> dist_start(0, v_ctg_len[id] - q_len);
+		int start = dist_start(mt);
+
+		v_queries.emplace_back(id, start, start + q_len - 1);
+	}
+
+	bool ok;
+	uint64_t bytes = 0;
+	string seq;
+
+	double time = measure([&] {
+		for (auto& q : v_queries)
+		{
+			auto& sc = v_sample_ctg[get<0>(q)];
+			if (agc_file.GetCtgSeq(sc.first, sc.second, get<1>(q), get<2>(q), seq) < 0)
+				return false;
+			bytes += seq.size();
+		}
+		return true;
+		}, ok);
+
+	agc_file.Close();
+
+	if (ok)
+		add_result("ctg_ranges", time, bytes, "\"no_queries\": " + to_string(params.no_queries) + ", \"queries_per_s\": " + to_string(time > 0 ? params.no_queries / time : 0.0));
+
+	return ok;
+}
+
+// *******************************************************************************************
+// LZ-diff encoding and decoding of segments of a sample against the corresponding segments of the reference
+bool CBenchmark::bench_lz_diff()
+{
+	vector<pair<string, contig_t>> v_ref, v_seq;
+
+	if (!load_fasta_seqs(v_sample_files.front(), v_ref) || !load_fasta_seqs(v_sample_files.back(), v_seq))
+		return false;
+
+	vector<pair<contig_t, contig_t>> v_pairs;
+
+	for (size_t i = 0; i < min(v_ref.size(), v_seq.size()); ++i)
+	{
+		auto& ref = v_ref[i].second;
+		auto& seq = v_seq[i].second;
+
+		for (size_t j = 0; j + params.segment_size <= min(ref.size(), seq.size()); j += params.segment_size)
+			v_pairs.emplace_back(contig_t(ref.begin() + j, ref.begin() + j + params.segment_size), contig_t(seq.begin() + j, seq.begin() + j + params.segment_size));
+	}
+
+	uint64_t bytes = 0;
+
+	for (auto& x : v_pairs)
+		bytes += x.second.size();
+
+	// Both delta coders (text V2 and binary V3) are measured on the same pairs
+	for (uint32_t lz_ver : { 2u, 3u })
+	{
+		auto make_lz_diff = [&]() -> unique_ptr<CLZDiffBase> {
+			unique_ptr<CLZDiffBase> lz_diff;
+			if (lz_ver == 2)
+				lz_diff = make_unique<CLZDiff_V2>();
+			else
+				lz_diff = make_unique<CLZDiff_V3>();
+			lz_diff->SetMinMatchLen(params.min_match_length);
+			return lz_diff;
+		};
+
+		string kernel_name = lz_ver == 2 ? "kernel_lz_diff" : "kernel_lz_diff_v3";
+
+		vector<contig_t> v_encoded(v_pairs.size());
+		contig_t decoded;
+		uint64_t encoded_bytes = 0;
+		bool ok;
+
+		double time_enc = measure([&] {
+			for (uint32_t r = 0; r < params.kernel_repeats; ++r)
+				for (size_t i = 0; i < v_pairs.size(); ++i)
+				{
+					auto lz_diff = make_lz_diff();
+					lz_diff->Prepare(v_pairs[i].first);
+					lz_diff->Encode(v_pairs[i].second, v_encoded[i]);
+				}
+			return true;
+			}, ok);
+
+		// Deltas are packed and compressed with zstd as in the archive
+		contig_t pack;
+		for (auto& x : v_encoded)
+		{
+			encoded_bytes += x.size();
+			pack.insert(pack.end(), x.begin(), x.end());
+			pack.emplace_back(0xff);
+		}
+
+		vector<uint8_t> v_zstd(ZSTD_compressBound(pack.size()));
+		size_t zstd_bytes = ZSTD_compress(v_zstd.data(), v_zstd.size(), pack.data(), pack.size(), 17);
+
+		add_result(kernel_name + "_encode", time_enc, bytes * params.kernel_repeats, "\"no_segments\": " + to_string(v_pairs.size()) + 
+			", \"encoded_size\": " + to_string(encoded_bytes) + ", \"zstd_size\": " + to_string(zstd_bytes));
+
+		double time_dec = measure([&] {
+			auto lz_diff = make_lz_diff();
+
+			for (uint32_t r = 0; r < params.kernel_repeats; ++r)
+				for (size_t i = 0; i < v_pairs.size(); ++i)
+				{
+					lz_diff->Decode(v_pairs[i].first, v_encoded[i], decoded);
+					if (decoded != v_pairs[i].second)
+						return false;
+				}
+			return true;
+			}, ok);
+
+		if (!ok)
+		{
+			cerr << "LZ-diff decoding error\n";
+			return false;
+		}
+
+		add_result(kernel_name + "_decode", time_dec, bytes * params.kernel_repeats);
+	}
+
+	return true;
+}
+
+// *******************************************************************************************
+// Canonical k-mer scanning of the reference
+bool CBenchmark::bench_kmer()
+{
+	vector<pair<string, contig_t>> v_ref;
+
+	if (!load_fasta_seqs(v_sample_files.front(), v_ref))
+		return false;
+
+	uint64_t bytes = 0;
+	uint64_t checksum = 0;
+	bool ok;
+
+	for (auto& x : v_ref)
+		bytes += x.second.size();
+
+	double time = measure([&] {
+		CKmer kmer(params.kmer_length, kmer_mode_t::canonical);
+
+		for (uint32_t r = 0; r < params.kernel_repeats; ++r)
+			for (auto& x : v_ref)
+			{
+				kmer.Reset();
+
+				for (auto c : x.second)
+				{
+					if (c > 3)
+					{
+						kmer.Reset();
+						continue;
+					}
+
+					kmer.insert(c);
+
+					if (kmer.is_full())
+						checksum += kmer.data_canonical();
+				}
+			}
+		return true;
+		}, ok);
+
+	add_result("kernel_kmer_scan", time, bytes * params.kernel_repeats, "\"checksum\": " + to_string(checksum));
+
+	// Scanner specialized for the k-mer length (as used for splitter detection)
+	checksum = 0;
+
+	time = measure([&] {
+		for (uint32_t r = 0; r < params.kernel_repeats; ++r)
+			for (auto& x : v_ref)
+				for_each_kmer(x.second, params.kmer_length, [&](uint64_t, uint64_t kmer_dir, uint64_t kmer_rc) {
+					checksum += min(kmer_dir, kmer_rc);
+					});
+		return true;
+		}, ok);
+
+	add_result("kernel_kmer_scan_specialized", time, bytes * params.kernel_repeats, "\"checksum\": " + to_string(checksum));
+
+	return true;
+}
+
+// *******************************************************************************************
+// Conversion of the reference to tuples (as for storing of group references) and back
+bool CBenchmark::bench_tuples()
+{
+	vector<pair<string, contig_t>> v_ref;
+
+	if (!load_fasta_seqs(v_sample_files.front(), v_ref))
+		return false;
+
+	uint64_t bytes = 0;
+	bool ok;
+	vector<uint8_t> v_tuples, v_bytes;
+
+	for (auto& x : v_ref)
+		bytes += x.second.size();
+
+	double time_b2t = measure([&] {
+		for (uint32_t r = 0; r < params.kernel_repeats; ++r)
+			for (auto& x : v_ref)
+			{
+				v_tuples.clear();
+				CSegment::bytes2tuples(x.second, v_tuples);
+			}
+		return true;
+		}, ok);
+
+	add_result("kernel_bytes2tuples", time_b2t, bytes * params.kernel_repeats);
+
+	double time_t2b = measure([&] {
+		for (uint32_t r = 0; r < params.kernel_repeats; ++r)
+			for (auto& x : v_ref)
+			{
+				v_tuples.clear();
+				CSegment::bytes2tuples(x.second, v_tuples);
+				v_bytes.clear();
+				CSegment::tuples2bytes(v_tuples, v_bytes);
+				if (v_bytes != x.second)
+					return false;
+			}
+		return true;
+		}, ok);
+
+	if (!ok)
+	{
+		cerr << "Tuples conversion error\n";
+		return false;
+	}
+
+	add_result("kernel_bytes2tuples2bytes", time_t2b, bytes * params.kernel_repeats);
+
+	return true;
+}
+
+// *******************************************************************************************
+// Reading of all parts of all streams of the archive
+bool CBenchmark::bench_get_part()
+{
+	bool ok;
+	uint64_t bytes = 0;
+	uint64_t no_parts = 0;
+
+	double time = measure([&] {
+		CArchive archive(true);
+
+		if (!archive.Open(archive_append_name))
+			return false;
+
+		vector<uint8_t> v_data;
+		uint64_t metadata;
+
+		for (int i = 0; i < (int) archive.GetNoStreams(); ++i)
+		{
+			size_t n = archive.GetNoParts(i);
+
+			for (size_t j = 0; j < n; ++j)
+			{
+				archive.GetPart(i, (int) j, v_data, metadata);
+				bytes += v_data.size();
+				++no_parts;
+			}
+		}
+
+		archive.Close();
+
+		return true;
+		}, ok);
+
+	if (ok)
+		add_result("archive_get_part", time, bytes, "\"no_parts\": " + to_string(no_parts));
+
+	return ok;
+}
+
+// *******************************************************************************************
+void CBenchmark::store_results()
+{
+	ostringstream oss;
+
+	oss << "{\n";
+	oss << "  \"version\": \"" << AGC_VER_MAJOR << "." << AGC_VER_MINOR << "." << AGC_VER_BUGFIX << " [build " << AGC_VER_BUILD << "]\",\n";
+	oss << "  \"params\": {\"no_samples\": " << params.no_samples << ", \"no_appended\": " << params.no_appended
+		<< ", \"no_contigs\": " << params.no_contigs << ", \"genome_length\": " << params.genome_length
+		<< ", \"divergence\": " << params.divergence << ", \"no_threads\": " << params.no_threads
+		<< ", \"input_size\": " << input_size << ", \"synthetic\": " << boolalpha << params.input_list_name.empty() << noboolalpha << "},\n";
+	oss << "  \"results\": [\n";
+
+	for (size_t i = 0; i < v_results.size(); ++i)
+	{
+		auto& r = v_results[i];
+
+		oss << "    {\"name\": \"" << r.name << "\", \"time_s\": " << r.time << ", \"bytes\": " << r.bytes
+			<< ", \"throughput_MBps\": " << (r.time > 0 ? r.bytes / r.time / 1e6 : 0.0)
+			<< ", \"peak_rss_kb\": " << r.peak_rss_kb;
+		if (!r.extra.empty())
+			oss << ", " << r.extra;
+		oss << "}" << (i + 1 < v_results.size() ? ",\n" : "\n");
+	}
+
+	oss << "  ],\n";
+	oss << "  \"peak_rss_kb\": " << peak_rss_kb() << "\n";
+	oss << "}\n";
+
+	if (params.output_name.empty())
+		cout << oss.str();
+	else
+	{
+		ofstream ofs(params.output_name);
+		ofs << oss.str();
+	}
+}
+
+// *******************************************************************************************
+// Scaling over NUMA nodes: create and getcol with the threads of a single node and with all threads, without and with
+// the NUMA mode. On a single-node machine the nodes can be emulated (e.g., -u 2), which checks the NUMA mode, but not its gains.
+bool CBenchmark::bench_numa()
+{
+	CNumaTopology topology(params.numa_nodes);
+	uint32_t no_nodes = topology.NoNodes();
+	uint32_t no_in_create = params.no_samples - params.no_appended;
+	string archive_name = (path(params.work_dir) / "bench_numa.agc").string();
+	path col_dir = path(params.work_dir) / "col_numa";
+	uint64_t bytes = 0;
+
+	for (uint32_t i = 0; i < no_in_create; ++i)
+		bytes += file_size(v_sample_files[i]);
+
+	vector<uint32_t> v_no_threads{ max(1u, params.no_threads / no_nodes) };
+	if (params.no_threads != v_no_threads.front())
+		v_no_threads.emplace_back(params.no_threads);
+
+	create_directories(col_dir);
+
+	for (auto no_threads : v_no_threads)
+		for (auto numa : { 0u, params.numa_nodes })
+		{
+			bool ok;
+			string extra = "\"no_threads\": " + to_string(no_threads) + ", \"numa\": " + to_string(numa) + ", \"no_nodes\": " + to_string(no_nodes);
+
+			double time = measure([&] {
+				CAGCCompressor agc_c;
+
+				if (!agc_c.Create(archive_name, params.pack_cardinality, params.kmer_length, v_sample_files.front(), params.segment_size,
+					params.min_match_length, false, false, 0, no_threads, 0.0))
+					return false;
+
+				agc_c.SetNuma(numa);
+
+				vector<pair<string, string>> v_sample_file_names;
+				for (uint32_t i = 0; i < no_in_create; ++i)
+					v_sample_file_names.emplace_back(v_sample_names[i], v_sample_files[i]);
+
+				bool r = agc_c.AddSampleFiles(v_sample_file_names, no_threads);
+				r &= agc_c.Close(no_threads);
+
+				return r;
+				}, ok);
+
+			if (!ok)
+				return false;
+
+			add_result("numa_create", time, bytes, extra + ", \"archive_size\": " + to_string(file_size(archive_name)));
+
+			time = measure([&] {
+				CAGCDecompressor agc_d(false);
+
+				if (!agc_d.Open(archive_name, true))
+					return false;
+
+				agc_d.SetNuma(numa);
+
+				bool r = agc_d.GetCollectionFiles(col_dir.string(), 80, no_threads, 0, false, false, 0);
+				r &= agc_d.Close();
+
+				return r;
+				}, ok);
+
+			if (!ok)
+				return false;
+
+			uint64_t out_bytes = 0;
+			for (auto& f : directory_iterator(col_dir))
+				out_bytes += f.file_size();
+
+			add_result("numa_getcol", time, out_bytes, extra);
+		}
+
+	error_code ec;
+	remove(archive_name, ec);
+	remove_all(col_dir, ec);
+
+	return true;
+}
+
+// *******************************************************************************************
+bool CBenchmark::Run()
+{
+	if (params.input_list_name.empty())
+	{
+		if (params.no_samples < 2)
+			params.no_samples = 2;
+		params.no_appended = min(params.no_appended, params.no_samples - 1);
+
+		cerr << "Generating synthetic collection\n";
+		gen_collection();
+	}
+	else if (!load_input_list())
+		return false;
+
+	bool r = bench_create();
+
+	if (r && params.no_appended)
+		r = bench_append();
+	else if (r)
+		copy_file(archive_create_name, archive_append_name, copy_options::overwrite_existing);
+
+	r = r && bench_getcol() && bench_getset() && bench_ctg_ranges() && bench_get_part();
+	r = r && bench_lz_diff() && bench_kmer() && bench_tuples();
+
+	if (r && params.numa_nodes)
+		r = bench_numa();
+
+	if (r)
+		store_results();
+	else
+		cerr << "Benchmark failed\n";
+
+	if (!params.keep_files)
+	{
+		error_code ec;
+
+		if (params.input_list_name.empty())
+			remove_all(params.work_dir, ec);
+		else
+		{
+			remove(archive_create_name, ec);
+			remove(archive_append_name, ec);
+			remove(path(params.work_dir) / "getset.fa", ec);
+			remove_all(path(params.work_dir) / "col", ec);
+		}
+	}
+
+	return r;
+}
+
+// *******************************************************************************************
+void usage(const CBenchParams& params)
+{
+	cerr << AGC_VERSION << endl;
+	cerr << "Usage: agc_bench [options]\n";
+	cerr << "Options:\n";
+	cerr << "   -a <int>       - no. of samples added in append (default: " << params.no_appended << ")\n";
+	cerr << "   -c <int>       - no. of contigs in synthetic genome (default: " << params.no_contigs << ")\n";
+	cerr << "   -d <float>     - divergence of synthetic genomes (default: " << params.divergence << ")\n";
+	cerr << "   -g <int>       - length of synthetic genome (default: " << params.genome_length << ")\n";
+	cerr << "   -i <file_name> - file with FASTA file names (instead of synthetic collection)\n";
+	cerr << "   -k             - keep working files (default: false)\n";
+	cerr << "   -n <int>       - no. of samples in synthetic collection (default: " << params.no_samples << ")\n";
+	cerr << "   -o <file_name> - output JSON file (default: output is sent to stdout)\n";
+	cerr << "   -q <int>       - no. of random contig range queries (default: " << params.no_queries << ")\n";
+	cerr << "   -r <int>       - no. of repetitions of kernel benchmarks (default: " << params.kernel_repeats << ")\n";
+	cerr << "   -s <int>       - random seed (default: " << params.seed << ")\n";
+	cerr << "   -t <int>       - no. of threads (default: " << params.no_threads << ")\n";
+	cerr << "   -u <int>       - NUMA scaling benchmark (0 - off, 1 - nodes of the system, >1 - emulated nodes) (default: " << params.numa_nodes << ")\n";
+	cerr << "   -w <path>      - working directory (default: " << params.work_dir << ")\n";
+}
+
+// *******************************************************************************************
+int main(int argc, char** argv)
+{
+	CBenchParams params;
+	ketopt_t o = KETOPT_INIT;
+	int c;
+
+	while ((c = ketopt(&o, argc, const_cast<const char**>(argv), 1, "a:c:d:g:hi:kn:o:q:r:s:t:u:w:", 0)) >= 0) {
+		if (c == 'a') {
+			params.no_appended = (uint32_t) max(0, atoi(o.arg));
+		} else if (c == 'c') {
+			params.no_contigs = (uint32_t) max(1, atoi(o.arg));
+		} else if (c == 'd') {
+			params.divergence = clamp(atof(o.arg), 0.0, 0.5);
+		} else if (c == 'g') {
+			params.genome_length = (uint64_t) max(1000ll, atoll(o.arg));
+		} else if (c == 'h') {
+			usage(params);
+			return 0;
+		} else if (c == 'i') {
+			params.input_list_name = o.arg;
+		} else if (c == 'k') {
+			params.keep_files = true;
+		} else if (c == 'n') {
+			params.no_samples = (uint32_t) max(2, atoi(o.arg));
+		} else if (c == 'o') {
+			params.output_name = o.arg;
+		} else if (c == 'q') {
+			params.no_queries = (uint32_t) max(0, atoi(o.arg));
+		} else if (c == 'r') {
+			params.kernel_repeats = (uint32_t) max(1, atoi(o.arg));
+		} else if (c == 's') {
+			params.seed = (uint32_t) atoi(o.arg);
+		} else if (c == 't') {
+			params.no_threads = (uint32_t) max(1, atoi(o.arg));
+		} else if (c == 'u') {
+			params.numa_nodes = (uint32_t) max(0, atoi(o.arg));
+		} else if (c == 'w') {
+			params.work_dir = o.arg;
+		}
+	}
+
+	CBenchmark bench(params);
+
+	return bench.Run() ? 0 : 1;
+}
+
+// EOF
@@ -0,0 +1,104 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <algorithm>
+#include "../common/defs.h"
+
+using namespace std;
+
+// *******************************************************************************************
+struct CBenchParams
+{
+	uint32_t no_samples = 20;
+	uint32_t no_appended = 5;
+	uint32_t no_contigs = 4;
+	uint64_t genome_length = 4'000'000;
+	double divergence = 0.005;
+	uint32_t no_threads = max<uint32_t>(1, thread::hardware_concurrency() / 2);
+	uint32_t no_queries = 1000;
+	uint32_t query_length = 10'000;
+	uint32_t kernel_repeats = 5;
+	uint32_t seed = 123;
+	uint32_t numa_nodes = 0;					// 0 - no NUMA scaling benchmark
+
+	uint32_t pack_cardinality = 50;
+	uint32_t kmer_length = 31;
+	uint32_t segment_size = 60'000;
+	uint32_t min_match_length = 20;
+
+	string work_dir = "agc_bench_tmp";
+	string output_name;
+	string input_list_name;
+	bool keep_files = false;
+};
+
+// *******************************************************************************************
+// Benchmark of the main operations (create, append, decompression) and of the kernels
+class CBenchmark
+{
+	struct result_t {
+		string name;
+		double time = 0;
+		uint64_t bytes = 0;
+		uint64_t peak_rss_kb = 0;
+		string extra;
+	};
+
+	CBenchParams params;
+	mt19937_64 mt;
+
+	vector<string> v_sample_files;
+	vector<string> v_sample_names;
+	uint64_t input_size = 0;
+	vector<result_t> v_results;
+
+	string archive_create_name;
+	string archive_append_name;
+
+	void gen_collection();
+	void mutate(const contig_t& src, contig_t& dest);
+	bool load_input_list();
+	bool load_fasta_seqs(const string& file_name, vector<pair<string, contig_t>>& v_seqs);
+
+	uint64_t peak_rss_kb();
+	void add_result(const string& name, double time, uint64_t bytes, const string& extra = "");
+	double measure(const function<bool()>& fun, bool& ok);
+
+	bool bench_create();
+	bool bench_append();
+	bool bench_getcol();
+	bool bench_getset();
+	bool bench_ctg_ranges();
+	bool bench_lz_diff();
+	bool bench_kmer();
+	bool bench_tuples();
+	bool bench_get_part();
+	bool bench_numa();
+
+	void store_results();
+
+public:
+	CBenchmark(const CBenchParams& _params);
+	~CBenchmark() = default;
+
+	bool Run();
+};
+
+// EOF
+#endif
@@ -37,7 +37,7 @@ CAGCBasic::CAGCBasic()
         collection_desc = static_pointer_cast<CCollection>(make_shared<CCollection_V1>());
     else if(archive_version < 3000)
         collection_desc = static_pointer_cast<CCollection>(make_shared<CCollection_V2>());
-    else if(archive_version < 4000)
+    else if(archive_version < 5000)
         collection_desc = static_pointer_cast<CCollection>(make_shared<CCollection_V3>());
 
     verbosity = 0;
@@ -93,7 +93,7 @@ bool CAGCBasic::load_file_type_info(const string& archive_name)
         collection_desc = static_pointer_cast<CCollection>(make_shared<CCollection_V1>());
     else if (archive_version < 3000)
         collection_desc = static_pointer_cast<CCollection>(make_shared<CCollection_V2>());
-    else if (archive_version < 4000)
+    else if (archive_version < 5000)
         collection_desc = static_pointer_cast<CCollection>(make_shared<CCollection_V3>());
 
     return true;
@@ -198,7 +198,7 @@ bool CAGCBasic::load_metadata_impl_v3()
 // *******************************************************************************************
 bool CAGCBasic::load_metadata()
 {    
-    if (archive_version >= 4000)
+    if (archive_version >= 5000)
     {
         archive_version = 0;        // Invalid archive
 
@@ -212,7 +212,7 @@ bool CAGCBasic::load_metadata()
         load_metadata_impl_v1();
     else if (archive_version < 3000)        // v2
         load_metadata_impl_v2();
-    else if (archive_version < 4000)        // v3
+    else if (archive_version < 5000)        // v3 and v4 (v3 with compact splitters)
         load_metadata_impl_v3();
 
     uint64_t tmp;
@@ -241,6 +241,26 @@ bool CAGCBasic::load_metadata()
     min_match_len = compression_params.min_match_len;
     segment_size = compression_params.segment_size;
 
+    // Optional trained dictionary for delta packs
+    zstd_delta_dict.reset();
+
+    auto delta_dict_id = in_archive->GetStreamId("delta-dict");
+
+    if (delta_dict_id >= 0)
+    {
+        vector<uint8_t> v_dict;
+
+        zstd_delta_dict = make_shared<CZSTDDict>(CSegment::delta_pack_compression_level);
+
+        if (!in_archive->GetPart(delta_dict_id, 0, v_dict, tmp) || !zstd_delta_dict->Load(v_dict))
+        {
+            in_archive->Close();
+            if (is_app_mode)
+                cerr << "Corrupted dictionary of delta packs\n";
+            return false;
+        }
+    }
+
     return true;
 }
 
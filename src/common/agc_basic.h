@@ -74,6 +74,8 @@ protected:
 
 	shared_ptr<CCollection> collection_desc;
 
+	shared_ptr<CZSTDDict> zstd_delta_dict;														// trained dictionary for delta packs (optional)
+
 	map<string, string> m_file_type_info;
 
 	compression_params_t compression_params;
@@ -172,7 +172,8 @@ int64_t CAGCDecompressorLibrary::GetContigLength(const string& sample_name, cons
 bool CAGCDecompressorLibrary::decompress_contig(contig_task_t& contig_desc, ZSTD_DCtx* zstd_ctx, contig_t& ctg, bool fast)
 {
 	name_range_t &contig_name_range = contig_desc.name_range;
-	vector<contig_t> v_segments_loc;
+	contig_t seg_ctg;
+	bool first_processed = false;
 
 	bool need_free_zstd = false;
 
@@ -219,7 +220,17 @@ bool CAGCDecompressorLibrary::decompress_contig(contig_task_t& contig_desc, ZSTD
 		}
 	}
 
-	v_segments_loc.reserve(contig_desc.segments.size());
+	ctg.clear();
+
+	// Segments are appended directly to the output contig, so for the whole contig its size is known in advance
+	if (from == 0 && to == 0x7fffffffffffffffu)
+	{
+		size_t req_size = 0;
+		for (auto& seg : contig_desc.segments)
+			req_size += seg.raw_length;
+
+		ctg.reserve(req_size);
+	}
 
 	for (auto seg : contig_desc.segments)
 	{
@@ -235,41 +246,29 @@ bool CAGCDecompressorLibrary::decompress_contig(contig_task_t& contig_desc, ZSTD
 			break;
 
 		if(!fast)
-			decompress_segment(seg.group_id, seg.in_group_id, ctg, zstd_ctx);
+			decompress_segment(seg.group_id, seg.in_group_id, seg_ctg, zstd_ctx, seg.raw_length);
 		else
-			decompress_segment_fast(seg.group_id, seg.in_group_id, ctg, zstd_ctx);
+			decompress_segment_fast(seg.group_id, seg.in_group_id, seg_ctg, zstd_ctx, seg.raw_length);
 
 		if (seg.is_rev_comp)
-			reverse_complement(ctg);
+			reverse_complement(seg_ctg);
 
-		v_segments_loc.emplace_back(move(ctg));
+		if (!first_processed)
+			ctg.insert(ctg.end(), seg_ctg.begin(), seg_ctg.end());
+		else if (seg_ctg.size() < compression_params.kmer_length)
+		{
+			if (is_app_mode)
+				cerr << "Corrupted archive!" << endl;
+		}
+		else
+			ctg.insert(ctg.end(), seg_ctg.begin() + compression_params.kmer_length, seg_ctg.end());
 
+		first_processed = true;
 		curr_pos += seg_len - kmer_length;
 	}
 
-	if (!v_segments_loc.empty())
+	if (first_processed)
 	{
-		size_t req_size = 0;
-		for (uint32_t j = 0; j < v_segments_loc.size(); ++j)
-			req_size += v_segments_loc[j].size();
-
-		ctg.clear();
-		ctg.reserve(req_size);
-		ctg.insert(ctg.end(), v_segments_loc.front().begin(), v_segments_loc.front().end());
-
-		for (uint32_t j = 1; j < v_segments_loc.size(); ++j)
-			if (v_segments_loc[j].size() < compression_params.kmer_length)
-			{
-				if (is_app_mode)
-					cerr << "Corrupted archive!" << endl;
-			}
-			else
-			{
-				ctg.insert(ctg.end(), v_segments_loc[j].begin() + compression_params.kmer_length, v_segments_loc[j].end());
-				v_segments_loc[j].clear();
-				v_segments_loc[j].shrink_to_fit();
-			}
-
 		if (ctg.size() > (uint64_t)to + 1)
 			ctg.resize((uint64_t)to + 1);
 
@@ -356,9 +355,9 @@ bool CAGCDecompressorLibrary::decompress_contig_streaming(contig_task_t& contig_
 			break;
 
 		if(!fast)
-			decompress_segment(seg.group_id, seg.in_group_id, ctg, zstd_ctx);
+			decompress_segment(seg.group_id, seg.in_group_id, ctg, zstd_ctx, seg.raw_length);
 		else
-			decompress_segment_fast(seg.group_id, seg.in_group_id, ctg, zstd_ctx);
+			decompress_segment_fast(seg.group_id, seg.in_group_id, ctg, zstd_ctx, seg.raw_length);
 
 		if (seg.is_rev_comp)
 			reverse_complement(ctg);
@@ -414,7 +413,7 @@ bool CAGCDecompressorLibrary::Open(const string& _archive_fn, const bool _prefet
 		if (!load_metadata())
 			return false;
 	}
-	else if (archive_version < 4000)
+	else if (archive_version < 5000)
 	{
 		if (!load_metadata() ||
 			!dynamic_pointer_cast<CCollection_V3>(collection_desc)->set_archives(in_archive, nullptr, 1, pack_cardinality, segment_size, kmer_length))
@@ -434,18 +433,19 @@ bool CAGCDecompressorLibrary::close_decompression()
 }
 
 // *******************************************************************************************
-bool CAGCDecompressorLibrary::decompress_segment(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx)
+bool CAGCDecompressorLibrary::decompress_segment(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t raw_length)
 {
 	CSegment segment(ss_base(archive_version, group_id), in_archive, nullptr, compression_params.pack_cardinality, compression_params.min_match_len, false, archive_version);
+	segment.set_zstd_dict(zstd_delta_dict);
 
 	if (group_id < no_raw_groups)
 		return segment.get_raw(in_group_id, ctg, zstd_ctx);
 	else
-		return segment.get(in_group_id, ctg, zstd_ctx);
+		return segment.get(in_group_id, ctg, zstd_ctx, raw_length);
 }
 
 // *******************************************************************************************
-bool CAGCDecompressorLibrary::decompress_segment_fast(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx)
+bool CAGCDecompressorLibrary::decompress_segment_fast(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t raw_length)
 {
 	shared_ptr<CSegment> segment;
 
@@ -469,6 +469,7 @@ bool CAGCDecompressorLibrary::decompress_segment_fast(const uint32_t group_id, c
 		else
 		{
 			segment = make_shared<CSegment>(ss_base(archive_version, group_id), in_archive, nullptr, compression_params.pack_cardinality, compression_params.min_match_len, false, archive_version, true);
+			segment->set_zstd_dict(zstd_delta_dict);
 			v_segment[group_id] = segment;
 		}
 	}
@@ -476,7 +477,7 @@ bool CAGCDecompressorLibrary::decompress_segment_fast(const uint32_t group_id, c
 	if (group_id < no_raw_groups)
 		return segment->get_raw_locked(in_group_id, ctg, zstd_ctx);
 	else
-		return segment->get_locked(in_group_id, ctg, zstd_ctx);
+		return segment->get_locked(in_group_id, ctg, zstd_ctx, raw_length);
 }
 
 // *******************************************************************************************
@@ -133,13 +133,14 @@ protected:
 		string sample_name;
 		string contig_name;
 		contig_t contig_data;
+		uint64_t seq_length = 0;			// no. of bases (used only for indexing of BGZF output)
 
 		sample_contig_data_t() = default;
 		sample_contig_data_t(const string &_sample_name, const string &_contig_name, const contig_t &_contig_data) :
 			sample_name(_sample_name), contig_name(_contig_name), contig_data(_contig_data) {}
 
-		sample_contig_data_t(const string &_sample_name, const string &_contig_name, contig_t &&_contig_data) :
-			sample_name(_sample_name), contig_name(_contig_name), contig_data(move(_contig_data)) {}
+		sample_contig_data_t(const string &_sample_name, const string &_contig_name, contig_t &&_contig_data, const uint64_t _seq_length = 0) :
+			sample_name(_sample_name), contig_name(_contig_name), contig_data(move(_contig_data)), seq_length(_seq_length) {}
 
 		sample_contig_data_t(const sample_contig_data_t&) = default;
 		sample_contig_data_t(sample_contig_data_t&&) = default;
@@ -168,8 +169,8 @@ protected:
 	map<uint32_t, shared_ptr<CSegment>> v_segment;
 
 	bool analyze_contig_query(const string& query, string& sample, name_range_t& name_range);
-	bool decompress_segment(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx);
-	bool decompress_segment_fast(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx);
+	bool decompress_segment(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t raw_length = 0);
+	bool decompress_segment_fast(const uint32_t group_id, const uint32_t in_group_id, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t raw_length = 0);
 
 	bool decompress_contig(contig_task_t& task, ZSTD_DCtx *zstd_ctx, contig_t& ctg, bool fast = false);
 	bool decompress_contig_streaming(contig_task_t& task, ZSTD_DCtx *zstd_ctx, CStreamWrapper& stream_wrapper, bool fast = false);
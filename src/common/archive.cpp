@@ -13,6 +13,18 @@
 
 #include <iostream>
 #include <algorithm>
+#include <filesystem>
+#include <atomic>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define AGC_HAVE_COPY_FILE_RANGE
+#endif
 
 #ifndef _WIN32
 #define my_fseek	fseek
@@ -51,19 +63,111 @@ bool CArchive::Open(const string &file_name)
 	if (input_mode)
 		f_in.Open(file_name, io_buffer_size);
 	else
+	{
+		// Journal of an interrupted compression into the file of the same name is not valid anymore
+		if (!file_name.empty())
+		{
+			error_code ec;
+			filesystem::remove(journal_file_name(file_name), ec);
+		}
+
 		f_out.Open(file_name);
+	}
 
 	if (!f_in.IsOpened() && !f_out.IsOpened())
 		return false;
 
+	archive_name = file_name;
+
 	if (input_mode)
-		deserialize();
+	{
+		// If there is a journal, the appending is in progress or was interrupted, so only the committed part is valid
+		size_t committed_size;
+		bool completed;
+
+		if (!read_journal(file_name, committed_size, completed))
+			committed_size = f_in.FileSize();
+
+		if (!deserialize(committed_size))
+		{
+			f_in.Close();
+			return false;
+		}
+	}
 
 	f_offset = 0;
 
 	return true;
 }
 
+// *******************************************************************************************
+bool CArchive::OpenForAppending(const string& file_name)
+{
+	lock_guard<mutex> lck(mtx);
+
+	if (input_mode || f_in.IsOpened() || f_out.IsOpened())
+		return false;
+
+	error_code ec;
+	size_t committed_size;
+	bool completed;
+
+	// Roll back the interrupted appending (completed appending is kept, only its journal was not removed)
+	if (read_journal(file_name, committed_size, completed) && !completed)
+	{
+		filesystem::resize_file(file_name, committed_size, ec);
+		if (ec)
+			return false;
+	}
+
+	filesystem::remove(journal_file_name(file_name), ec);
+
+	if (!f_in.Open(file_name, 1 << 20))
+		return false;
+
+	committed_size = f_in.FileSize();
+	bool r = deserialize(committed_size);
+	f_in.Close();
+
+	if (!r || !write_journal(file_name, committed_size))
+		return false;
+
+	if (!f_out.OpenForAppending(file_name))
+	{
+		filesystem::remove(journal_file_name(file_name), ec);
+		return false;
+	}
+
+	archive_name = file_name;
+	journal_name = journal_file_name(file_name);
+	appending_mode = true;
+	f_offset = committed_size;
+
+	return true;
+}
+
+// *******************************************************************************************
+// Commit the parts written so far without closing the archive: the footer is stored after them and the journal
+// is set to the new size. Further parts are written after this footer, so an interrupted compression is rolled
+// back to the last checkpoint.
+bool CArchive::Checkpoint()
+{
+	lock_guard<mutex> lck(mtx);
+
+	if (input_mode || !f_out.IsOpened() || archive_name.empty())
+		return false;
+
+	flush_out_buffers();
+	f_offset += serialize(true);
+
+	if (!f_out.Sync() || !write_journal(archive_name, f_offset))
+		return false;
+
+	journal_name = journal_file_name(archive_name);
+
+	return true;
+}
+
 // *******************************************************************************************
 bool CArchive::Close()
 {
@@ -74,6 +178,27 @@ bool CArchive::Close()
 
 	if (input_mode)
 		f_in.Close();
+	else if (appending_mode || !journal_name.empty())
+	{
+		flush_out_buffers();
+		size_t footer_size = serialize();
+
+		// Commit point - after marking the journal as completed the new footer is valid
+		bool r = f_out.Sync();
+		r &= write_journal(archive_name, f_offset + footer_size, true);
+		r &= f_out.Close();
+
+		if (r)
+		{
+			error_code ec;
+			filesystem::remove(journal_name, ec);
+		}
+
+		appending_mode = false;
+		journal_name.clear();
+
+		return r;
+	}
 	else
 	{
 		flush_out_buffers();
@@ -84,6 +209,54 @@ bool CArchive::Close()
 	return true;
 }
 
+// *******************************************************************************************
+string CArchive::journal_file_name(const string& file_name)
+{
+	return file_name + ".journal";
+}
+
+// *******************************************************************************************
+bool CArchive::read_journal(const string& file_name, size_t& committed_size, bool& completed)
+{
+	CInFile f;
+	error_code ec;
+
+	if (!f.Open(journal_file_name(file_name), 16))
+		return false;
+
+	if (f.FileSize() != 24)
+		return false;
+
+	committed_size = f.ReadUInt(8);
+	uint64_t state = f.ReadUInt(8);
+	uint64_t check = f.ReadUInt(8);
+
+	completed = state == 1;
+
+	auto file_size = filesystem::file_size(file_name, ec);
+
+	return !ec && state <= 1 && check == ~((uint64_t)committed_size ^ state) && committed_size <= file_size;
+}
+
+// *******************************************************************************************
+bool CArchive::write_journal(const string& file_name, const size_t committed_size, const bool completed)
+{
+	COutFile f;
+	uint64_t state = completed ? 1 : 0;
+
+	if (!f.Open(journal_file_name(file_name), 24))
+		return false;
+
+	f.WriteUInt(committed_size, 8);
+	f.WriteUInt(state, 8);
+	f.WriteUInt(~((uint64_t)committed_size ^ state), 8);
+
+	bool r = f.Sync();
+	r &= f.Close();
+
+	return r;
+}
+
 // *******************************************************************************************
 /*size_t CArchive::write_fixed(const uint64_t x)
 {
@@ -139,7 +312,9 @@ size_t CArchive::read(string& s)
 }
 
 // *******************************************************************************************
-bool CArchive::serialize()
+// Returns the no. of bytes written (with the footer size)
+// Footer of a checkpoint is superseded by the next one, so it is not accounted in the packed sizes of streams
+size_t CArchive::serialize(const bool checkpoint)
 {
 	size_t footer_size = 0;
 
@@ -160,29 +335,39 @@ bool CArchive::serialize()
 			footer_size += write(part.size);
 		}
 
-		stream.packed_size += footer_size - p;
+		if (!checkpoint)
+			stream.packed_size += footer_size - p;
 	}
 
 	write_fixed(footer_size);
 
-	return true;
+	return footer_size + 8;
 }
 
 // *******************************************************************************************
-bool CArchive::deserialize()
+bool CArchive::deserialize(const size_t file_size)
 {
 	size_t footer_size;
-	size_t file_size = f_in.FileSize();
+
+	if (file_size < 8)
+		return false;
 
 	f_in.Seek(file_size - 8ull);
 	read_fixed(footer_size);
 
-	f_in.Seek(file_size -(size_t)(8 + footer_size));
+	if (footer_size > file_size - 8)
+		return false;
+
+	footer_offset = file_size - (size_t)(8 + footer_size);
+	f_in.Seek(footer_offset);
 
 	// Read stream part offsets
 	size_t n_streams;
 	read(n_streams);
 
+	if (n_streams > footer_size)
+		return false;
+
 	v_streams.resize(n_streams, stream_t());
 
 	rm_streams.reserve(2 * n_streams);
@@ -196,17 +381,27 @@ bool CArchive::deserialize()
 		read(stream_second.raw_size);
 
 		stream_second.parts.resize(stream_second.cur_id);
+		stream_second.packed_size = 0;
+		stream_second.packed_data_size = 0;
+
 		for (size_t j = 0; j < stream_second.cur_id; ++j)
 		{
 			read(stream_second.parts[j].offset);
 			read(stream_second.parts[j].size);
+
+			stream_second.packed_data_size += stream_second.parts[j].size;
 		}
 
+		stream_second.packed_size = stream_second.packed_data_size;
+
 		stream_second.cur_id = 0;
 
 		if(!is_lazy_str(stream_second.stream_name))
 			rm_streams[stream_second.stream_name] = i;
 	}
+
+	if (f_in.GetPos() != file_size - 8)
+		return false;
 	
 	f_in.Seek(0);
 
@@ -281,7 +476,8 @@ bool CArchive::add_part(const int stream_id, const vector<uint8_t>& v_data, cons
 {
 	v_streams[stream_id].parts.push_back(part_t(f_offset, v_data.size()));
 
-	f_offset += write(metadata);
+	v_streams[stream_id].parts.back().meta_size = write(metadata);
+	f_offset += v_streams[stream_id].parts.back().meta_size;
 	f_out.Write(v_data.data(), v_data.size());
 
 	f_offset += v_data.size();
@@ -317,7 +513,8 @@ bool CArchive::AddPartComplete(const int stream_id, const int part_id, const vec
 	
 	v_streams[stream_id].parts[part_id] = part_t(f_offset, v_data.size());
 
-	f_offset += write(metadata);
+	v_streams[stream_id].parts[part_id].meta_size = write(metadata);
+	f_offset += v_streams[stream_id].parts[part_id].meta_size;
 	f_out.Write(v_data.data(), v_data.size());
 
 	f_offset += v_data.size();
@@ -338,6 +535,34 @@ bool CArchive::AddPartBuffered(const int stream_id, const vector<uint8_t>& v_dat
 	return true;
 }
 
+// *******************************************************************************************
+// Reserve a place for a buffered part (to keep the order of parts when they are prepared in parallel).
+// All reserved parts must be completed before the buffers are flushed.
+int CArchive::AddPartBufferedPrepare(const int stream_id)
+{
+	lock_guard<mutex> lck(mtx);
+
+	auto& v_buffer = m_buffer[stream_id];
+	v_buffer.emplace_back(vector<uint8_t>(), 0);
+
+	return static_cast<int>(v_buffer.size()) - 1;
+}
+
+// *******************************************************************************************
+bool CArchive::AddPartBufferedComplete(const int stream_id, const int buffer_id, vector<uint8_t>&& v_data, const uint64_t metadata)
+{
+	lock_guard<mutex> lck(mtx);
+
+	auto p = m_buffer.find(stream_id);
+
+	if (p == m_buffer.end() || buffer_id < 0 || buffer_id >= static_cast<int>(p->second.size()))
+		return false;
+
+	p->second[buffer_id] = make_pair(move(v_data), metadata);
+
+	return true;
+}
+
 // *******************************************************************************************
 bool CArchive::flush_out_buffers()
 {
@@ -358,6 +583,294 @@ bool CArchive::FlushOutBuffers()
 	return flush_out_buffers();
 }
 
+// *******************************************************************************************
+// Remove the stored parts of the stream except the first no_parts (buffered parts are not affected).
+// The data of removed parts stay in the file, but are no longer referenced.
+bool CArchive::TruncateStream(const int stream_id, const size_t no_parts)
+{
+	lock_guard<mutex> lck(mtx);
+
+	if (stream_id < 0 || stream_id >= static_cast<int>(v_streams.size()))
+		return false;
+
+	auto& stream = v_streams[stream_id];
+
+	for (size_t i = no_parts; i < stream.parts.size(); ++i)
+	{
+		stream.packed_size -= stream.parts[i].size + stream.parts[i].meta_size;
+		stream.packed_data_size -= stream.parts[i].size;
+	}
+
+	if (no_parts < stream.parts.size())
+		stream.parts.resize(no_parts);
+
+	return true;
+}
+
+// *******************************************************************************************
+// Copy ranges of parts of src archive (input mode) to the end of this archive (output mode).
+// Parts adjacent in the src file are copied as contiguous byte ranges (without decoding them),
+// so only the offsets of the parts must be recalculated.
+bool CArchive::CopyParts(CArchive& src, const vector<copy_desc_t>& v_desc, const uint32_t no_threads)
+{
+	scoped_lock lck(mtx, src.mtx);
+
+	if (input_mode || !src.input_mode || !f_out.IsOpened() || !src.f_in.IsOpened())
+		return false;
+
+	// The end of a part (metadata + data) is bounded by the beginning of the next part (or footer) in the file
+	vector<size_t> v_offsets;
+
+	for (auto& stream : src.v_streams)
+		for (auto& part : stream.parts)
+			v_offsets.emplace_back(part.offset);
+	v_offsets.emplace_back(src.footer_offset);
+
+	sort(v_offsets.begin(), v_offsets.end());
+
+	struct src_part_t {
+		size_t src_from;
+		size_t src_to;
+		size_t size;
+		int dest_stream_id;
+		part_t* dest_part;
+	};
+
+	vector<src_part_t> v_src_parts;
+
+	for (auto& desc : v_desc)
+	{
+		if (desc.src_stream_id < 0 || desc.src_stream_id >= static_cast<int>(src.v_streams.size()) ||
+			desc.dest_stream_id < 0 || desc.dest_stream_id >= static_cast<int>(v_streams.size()))
+			return false;
+
+		auto& src_stream = src.v_streams[desc.src_stream_id];
+
+		if (desc.first_part + desc.no_parts > src_stream.parts.size())
+			return false;
+
+		for (size_t i = desc.first_part; i < desc.first_part + desc.no_parts; ++i)
+		{
+			auto& part = src_stream.parts[i];
+			size_t next_offset = *upper_bound(v_offsets.begin(), v_offsets.end(), part.offset);
+
+			v_src_parts.push_back(src_part_t{ part.offset, next_offset, part.size, desc.dest_stream_id, nullptr });
+		}
+	}
+
+	// Register the parts in the destination streams
+	vector<size_t> v_first_dest_part;
+
+	for (auto& desc : v_desc)
+	{
+		auto& src_stream = src.v_streams[desc.src_stream_id];
+		auto& dest_stream = v_streams[desc.dest_stream_id];
+
+		v_first_dest_part.emplace_back(dest_stream.parts.size());
+
+		for (size_t i = desc.first_part; i < desc.first_part + desc.no_parts; ++i)
+		{
+			dest_stream.parts.push_back(part_t(0, src_stream.parts[i].size));
+			dest_stream.packed_size += src_stream.parts[i].size;
+			dest_stream.packed_data_size += src_stream.parts[i].size;
+		}
+	}
+
+	size_t idx = 0;
+
+	for (size_t i = 0; i < v_desc.size(); ++i)
+		for (size_t j = 0; j < v_desc[i].no_parts; ++j)
+			v_src_parts[idx++].dest_part = &v_streams[v_desc[i].dest_stream_id].parts[v_first_dest_part[i] + j];
+
+	sort(v_src_parts.begin(), v_src_parts.end(), [](const src_part_t& x, const src_part_t& y) {
+		return x.src_from < y.src_from;
+		});
+
+	// Sizes of metadata of parts are not stored in the footer, so they are decoded from the src file
+	// (the parts are visited in the file order, so the reads are served mostly from the buffer)
+	for (auto& part : v_src_parts)
+	{
+		uint64_t metadata;
+
+		src.f_in.Seek(part.src_from);
+		part.src_to = min(part.src_from + src.read(metadata) + part.size, part.src_to);
+
+		part.dest_part->meta_size = part.src_to > part.src_from + part.size ? part.src_to - part.src_from - part.size : 0;
+		v_streams[part.dest_stream_id].packed_size += part.dest_part->meta_size;
+	}
+
+	// Merge adjacent parts into ranges
+	vector<copy_range_t> v_ranges;
+	size_t dest_pos = f_offset;
+
+	for (auto& part : v_src_parts)
+	{
+		if (v_ranges.empty() || part.src_from > v_ranges.back().src_to)
+		{
+			if (!v_ranges.empty())
+				dest_pos += v_ranges.back().src_to - v_ranges.back().src_from;
+			v_ranges.emplace_back(part.src_from, part.src_to, dest_pos);
+		}
+		else
+			v_ranges.back().src_to = max(v_ranges.back().src_to, part.src_to);
+
+		part.dest_part->offset = v_ranges.back().dest_from + (part.src_from - v_ranges.back().src_from);
+	}
+
+	if (!v_ranges.empty())
+		dest_pos += v_ranges.back().src_to - v_ranges.back().src_from;
+
+	bool r;
+
+	if (!copy_ranges_direct(src.archive_name, v_ranges, no_threads, r))
+		r = copy_ranges_buffered(src.f_in, v_ranges);
+
+	f_offset = dest_pos;
+
+	return r;
+}
+
+// *******************************************************************************************
+// Copy by positioned reads and writes (or copy_file_range() inside the kernel) in many threads.
+// Returns false (without writing anything) if this is not possible, e.g., for stdout output.
+bool CArchive::copy_ranges_direct(const string& src_file_name, const vector<copy_range_t>& v_ranges, const uint32_t no_threads, bool& result)
+{
+	result = true;
+
+#ifndef _WIN32
+	if (v_ranges.empty())
+		return true;
+
+	int out_fd = f_out.Descriptor();
+	struct stat out_stat;
+
+	if (out_fd < 0 || fstat(out_fd, &out_stat) != 0 || !S_ISREG(out_stat.st_mode))
+		return false;
+
+	int in_fd = open(src_file_name.c_str(), O_RDONLY);
+
+	if (in_fd < 0)
+		return false;
+
+	if (!f_out.Flush())
+	{
+		close(in_fd);
+		result = false;
+		return true;
+	}
+
+	atomic<size_t> next_range{ 0 };
+	atomic<bool> ok{ true };
+#ifdef AGC_HAVE_COPY_FILE_RANGE
+	atomic<bool> use_copy_file_range{ true };
+#endif
+
+	auto worker = [&] {
+		const size_t buffer_size = 8 << 20;
+		vector<uint8_t> buffer;
+
+		while (ok)
+		{
+			size_t i = next_range.fetch_add(1);
+			if (i >= v_ranges.size())
+				break;
+
+			size_t in_pos = v_ranges[i].src_from;
+			size_t out_pos = v_ranges[i].dest_from;
+			size_t to_copy = v_ranges[i].src_to - v_ranges[i].src_from;
+
+#ifdef AGC_HAVE_COPY_FILE_RANGE
+			while (to_copy && use_copy_file_range)
+			{
+				loff_t off_in = (loff_t)in_pos;
+				loff_t off_out = (loff_t)out_pos;
+
+				auto n = copy_file_range(in_fd, &off_in, out_fd, &off_out, to_copy, 0);
+
+				if (n <= 0)
+				{
+					use_copy_file_range = false;		// e.g., not supported by the file system, so use pread/pwrite
+					break;
+				}
+
+				in_pos += n;
+				out_pos += n;
+				to_copy -= n;
+			}
+#endif
+
+			if (to_copy && buffer.empty())
+				buffer.resize(buffer_size);
+
+			while (to_copy)
+			{
+				auto n = pread(in_fd, buffer.data(), min(to_copy, buffer_size), (off_t)in_pos);
+
+				if (n <= 0 || pwrite(out_fd, buffer.data(), n, (off_t)out_pos) != n)
+				{
+					ok = false;
+					break;
+				}
+
+				in_pos += n;
+				out_pos += n;
+				to_copy -= n;
+			}
+		}
+		};
+
+	uint32_t no_workers = (uint32_t) min<size_t>(max<uint32_t>(no_threads, 1), v_ranges.size());
+	vector<thread> v_threads;
+
+	for (uint32_t i = 1; i < no_workers; ++i)
+		v_threads.emplace_back(worker);
+
+	worker();
+
+	for (auto& t : v_threads)
+		t.join();
+
+	close(in_fd);
+
+	auto& last = v_ranges.back();
+
+	result = f_out.Seek(last.dest_from + (last.src_to - last.src_from)) && ok;
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+// *******************************************************************************************
+bool CArchive::copy_ranges_buffered(CInFile& src_in, const vector<copy_range_t>& v_ranges)
+{
+	const size_t buffer_size = 8 << 20;
+	vector<uint8_t> buffer;
+
+	for (auto& range : v_ranges)
+	{
+		src_in.Seek(range.src_from);
+
+		for (size_t to_copy = range.src_to - range.src_from; to_copy;)
+		{
+			size_t n = min(to_copy, buffer_size);
+
+			buffer.resize(n);
+			if (src_in.Read(buffer.data(), n) != n)
+				return false;
+
+			f_out.Write(buffer.data(), n);
+			if (!f_out.Good())
+				return false;
+
+			to_copy -= n;
+		}
+	}
+
+	return true;
+}
+
 // *******************************************************************************************
 void CArchive::SetRawSize(const int stream_id, const size_t raw_size)
 {
@@ -532,6 +1045,42 @@ size_t CArchive::GetNoParts(const int stream_id)
 	return v_streams[stream_id].parts.size();
 }
 
+// *******************************************************************************************
+bool CArchive::GetPartInfo(const int stream_id, const int part_id, size_t& packed_size, uint64_t& metadata)
+{
+	lock_guard<mutex> lck(mtx);
+
+	if (stream_id < 0 || stream_id >= static_cast<int>(v_streams.size()))
+		return false;
+
+	auto& p = v_streams[stream_id];
+
+	if (part_id < 0 || (size_t)part_id >= p.parts.size())
+		return false;
+
+	packed_size = p.parts[part_id].size;
+	metadata = 0;
+
+	if (packed_size != 0)
+	{
+		f_in.Seek(p.parts[part_id].offset);
+		read(metadata);
+	}
+
+	return true;
+}
+
+// *******************************************************************************************
+string CArchive::GetStreamName(const int stream_id)
+{
+	lock_guard<mutex> lck(mtx);
+
+	if (stream_id < 0 || stream_id >= static_cast<int>(v_streams.size()))
+		return "";
+
+	return v_streams[stream_id].stream_name;
+}
+
 // *******************************************************************************************
 size_t CArchive::GetStreamPackedSize(const int stream_id)
 {
@@ -24,18 +24,33 @@
 
 using namespace std;
 
+// *******************************************************************************************
+// Archive is a set of streams of parts. The parts are stored one after another and the footer
+// (description of all streams) is at the end of the file followed by the footer size.
+// In appending mode the new parts and a new footer are written after the existing footer,
+// so the existing contents is never modified. The journal file (archive name + ".journal")
+// holding the size of the last committed archive exists until the new footer is stored,
+// so an interrupted appending is rolled back (and ignored by the readers). Just before the archive is closed
+// the journal is marked as completed, so an appending finished before the journal was removed is kept.
+// A checkpoint commits the parts written so far in the same way (with a provisional footer).
 class CArchive
 {
 	bool input_mode;
+	bool appending_mode = false;
 	CInFile f_in;
 	COutFile f_out;
 	size_t io_buffer_size;
 
 	size_t f_offset;
+	size_t footer_offset = 0;
+
+	string archive_name;
+	string journal_name;
 
 	struct part_t{
 		size_t offset;
 		size_t size;
+		size_t meta_size = 0;		// size of metadata accounted in packed size of the stream (not stored in the footer)
 
 		part_t() : offset(0), size(0)
 		{};
@@ -61,8 +76,24 @@ class CArchive
 
 	mutex mtx;
 
-	bool serialize();
-	bool deserialize();
+	size_t serialize(const bool checkpoint = false);
+	bool deserialize(const size_t file_size);
+
+	struct copy_range_t {
+		size_t src_from;
+		size_t src_to;
+		size_t dest_from;
+
+		copy_range_t(size_t _src_from, size_t _src_to, size_t _dest_from) : src_from(_src_from), src_to(_src_to), dest_from(_dest_from)
+		{};
+	};
+
+	bool copy_ranges_direct(const string& src_file_name, const vector<copy_range_t>& v_ranges, const uint32_t no_threads, bool& result);
+	bool copy_ranges_buffered(CInFile& src_in, const vector<copy_range_t>& v_ranges);
+
+	static string journal_file_name(const string& file_name);
+	static bool read_journal(const string& file_name, size_t& committed_size, bool& completed);
+	static bool write_journal(const string& file_name, const size_t committed_size, const bool completed = false);
 
 	// *******************************************************************************************
 	inline bool is_lazy_str(const string& str)
@@ -165,16 +196,26 @@ class CArchive
 	int register_stream(const string& stream_name);
 
 public:
+	struct copy_desc_t {
+		int src_stream_id;
+		int dest_stream_id;
+		size_t first_part;
+		size_t no_parts;
+	};
+
 	CArchive(const bool _input_mode, const size_t _io_buffer_size = 64 << 20, const string& _lazy_prefix = "");
 	~CArchive();
 
 	bool Open(const string &file_name);
+	bool OpenForAppending(const string& file_name);
+	bool Checkpoint();
 	bool Close();
 
 	int RegisterStream(const string &stream_name);
 	pair<int, int> RegisterStreams(const string &stream_name1, const string& stream_name2);
 	int GetStreamId(const string &stream_name);
 
+	string GetStreamName(const int stream_id);
 	size_t GetStreamPackedSize(const int stream_id);
 	size_t GetStreamPackedDataSize(const int stream_id);
 
@@ -182,9 +223,14 @@ public:
 	int AddPartPrepare(const int stream_id);
 	bool AddPartComplete(const int stream_id, const int part_id, const vector<uint8_t>& v_data, const uint64_t metadata = 0);
 	bool AddPartBuffered(const int stream_id, const vector<uint8_t>& v_data, const uint64_t metadata = 0);
+	int AddPartBufferedPrepare(const int stream_id);
+	bool AddPartBufferedComplete(const int stream_id, const int buffer_id, vector<uint8_t>&& v_data, const uint64_t metadata = 0);
 
 	bool FlushOutBuffers();
 
+	bool TruncateStream(const int stream_id, const size_t no_parts);
+	bool CopyParts(CArchive& src, const vector<copy_desc_t>& v_desc, const uint32_t no_threads = 1);
+
 	bool GetPart(const int stream_id, vector<uint8_t> &v_data, uint64_t &metadata);
 	bool GetPart(const int stream_id, const int part_id, vector<uint8_t>& v_data, uint64_t& metadata);
 
@@ -203,6 +249,7 @@ public:
 
 	size_t GetNoStreams();
 	size_t GetNoParts(const int stream_id);
+	bool GetPartInfo(const int stream_id, const int part_id, size_t& packed_size, uint64_t& metadata);
 };
 
 // EOF
@@ -9,17 +9,20 @@
 // *******************************************************************************************
 
 #include "collection_v3.h"
+#include "instrumentation.h"
 #include <cassert>
 #include <future>
 
 // *******************************************************************************************
+// In in-place mode out_archive is opened for appending to the file of in_archive, so its parts need not be copied
 bool CCollection_V3::set_archives(shared_ptr<CArchive> _in_archive, shared_ptr<CArchive> _out_archive,
-	uint32_t _no_threads, size_t _batch_size, uint32_t _segment_size, uint32_t _kmer_length)
+	uint32_t _no_threads, size_t _batch_size, uint32_t _segment_size, uint32_t _kmer_length, bool _in_place)
 {
 	lock_guard<mutex> lck(mtx);
 
 	in_archive = _in_archive;
 	out_archive = _out_archive;
+	in_place = _in_place;
 
 	batch_size = _batch_size;
 	segment_size = _segment_size;
@@ -34,6 +37,14 @@ bool CCollection_V3::set_archives(shared_ptr<CArchive> _in_archive, shared_ptr<C
 		return prepare_for_appending_copy();
 }
 
+// *******************************************************************************************
+void CCollection_V3::set_dict_training(bool _train_details_dicts)
+{
+	lock_guard<mutex> lck(mtx);
+
+	train_details_dicts = _train_details_dicts;
+}
+
 // *******************************************************************************************
 bool CCollection_V3::prepare_for_compression()
 {
@@ -56,24 +67,22 @@ bool CCollection_V3::prepare_for_appending_copy()
 	collection_details_id = out_archive->RegisterStream("collection-details");
 
 	load_batch_sample_names();
+	load_details_dicts(!in_place);
+
+	if (in_place)
+		return true;
 
 	// in and out ids for collection-* must be the same!
 
 	auto no_contig_batches = in_archive->GetNoParts(in_collection_contig_id);
 
 	// Transfer all but the last one batch from in to out archive
-	vector<uint8_t> data;
-	uint64_t meta;
+	if (no_contig_batches < 2)
+		return true;
 
-	for (size_t i = 0; i < no_contig_batches - 1; ++i)
-	{
-		in_archive->GetPart(in_collection_contig_id, i, data, meta);
-		out_archive->AddPart(collection_contig_id, data, meta);
-		in_archive->GetPart(in_collection_details_id, i, data, meta);
-		out_archive->AddPart(collection_details_id, data, meta);
-	}
-
-	return true;
+	return out_archive->CopyParts(*in_archive, {
+		CArchive::copy_desc_t{ in_collection_contig_id, collection_contig_id, 0, no_contig_batches - 1 },
+		CArchive::copy_desc_t{ in_collection_details_id, collection_details_id, 0, no_contig_batches - 1 } }, no_threads);
 }
 
 // *******************************************************************************************
@@ -85,6 +94,7 @@ bool CCollection_V3::prepare_for_appending_load_last_batch()
 	auto in_collection_details_id = in_archive->GetStreamId("collection-details");
 
 	auto no_contig_batches = in_archive->GetNoParts(in_collection_contig_id);
+	no_archived_contig_batches = no_contig_batches;
 
 	// Transfer all but the last one batch from in to out archive
 	vector<uint8_t> data;
@@ -94,7 +104,18 @@ bool CCollection_V3::prepare_for_appending_load_last_batch()
 	load_batch_contig_names(no_contig_batches - 1);
 	load_batch_contig_details(no_contig_batches - 1);
 
-	if (no_samples_in_last_batch == batch_size)
+	if (in_place)
+	{
+		// The last batch stays in the archive if complete or will be stored again (extended)
+		if (no_samples_in_last_batch == batch_size)
+			clear_batch_contig(no_contig_batches - 1);
+		else
+		{
+			out_archive->TruncateStream(collection_contig_id, no_contig_batches - 1);
+			out_archive->TruncateStream(collection_details_id, no_contig_batches - 1);
+		}
+	}
+	else if (no_samples_in_last_batch == batch_size)
 	{
 		in_archive->GetPart(in_collection_contig_id, no_contig_batches - 1, data, meta);
 		out_archive->AddPart(collection_contig_id, data, meta);
@@ -115,20 +136,22 @@ bool CCollection_V3::prepare_for_decompression()
 	collection_details_id = in_archive->GetStreamId("collection-details");
 
 	load_batch_sample_names();
+	load_details_dicts(false);
 
 	return true;
 }
 
 // *******************************************************************************************
-void CCollection_V3::complete_serialization()
+// Only the first no_samples samples are stored (at checkpoints the samples read ahead are not complete)
+void CCollection_V3::complete_serialization(const uint32_t no_samples)
 {
 	lock_guard<mutex> lck(mtx);
 
-	store_batch_sample_names();
+	store_batch_sample_names(no_samples);
 }
 
 // *******************************************************************************************
-void CCollection_V3::zstd_compress(ZSTD_CCtx*& cctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, int level)
+void CCollection_V3::zstd_compress(ZSTD_CCtx*& cctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, int level, const CZSTDDict* dict)
 {
 	if (cctx == nullptr)
 	{
@@ -136,32 +159,110 @@ void CCollection_V3::zstd_compress(ZSTD_CCtx*& cctx, vector<uint8_t>& v_input, v
 	}
 
 	v_output.resize(ZSTD_compressBound(v_input.size()));
-	auto c_size = ZSTD_compressCCtx(cctx, v_output.data(), v_output.size(), v_input.data(), v_input.size(), level);
+
+	size_t c_size;
+
+	if (dict && !dict->Empty())
+		c_size = dict->Compress(cctx, v_output.data(), v_output.size(), v_input.data(), v_input.size());
+	else
+		c_size = ZSTD_compressCCtx(cctx, v_output.data(), v_output.size(), v_input.data(), v_input.size(), level);
 
 	v_output.resize(c_size);
 }
 
 // *******************************************************************************************
-void CCollection_V3::zstd_decompress(ZSTD_DCtx*& dctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, size_t raw_size)
+void CCollection_V3::zstd_decompress(ZSTD_DCtx*& dctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, size_t raw_size, const CZSTDDict* dict)
 {
 	if (dctx == nullptr)
 		dctx = ZSTD_createDCtx();
 
 	v_output.resize(raw_size);
-	ZSTD_decompressDCtx(dctx, v_output.data(), v_output.size(), v_input.data(), v_input.size());
+	CZSTDDict::Decompress(dict, dctx, v_output.data(), v_output.size(), v_input.data(), v_input.size());
+}
+
+// *******************************************************************************************
+// Train dictionaries for the details streams using the samples from the first stored batch
+void CCollection_V3::build_details_dicts(uint32_t id_from, uint32_t id_to)
+{
+	array<vector<vector<uint8_t>>, 5> vv_samples;
+	array<size_t, 5> a_total_sizes{};
+
+	for (uint32_t i = id_from; i < id_to; ++i)
+	{
+		array<vector<uint8_t>, 5> v_data;
+
+		serialize_contig_details(v_data, i, i + 1);
+
+		for (int j = 0; j < 5; ++j)
+		{
+			a_total_sizes[j] += v_data[j].size();
+			vv_samples[j].emplace_back(move(v_data[j]));
+		}
+	}
+
+	auto dict_stream_id = out_archive->RegisterStream("collection-details-dict");
+
+	for (int j = 0; j < 5; ++j)
+	{
+		details_dicts[j] = make_shared<CZSTDDict>(details_compression_level);
+
+		if (!details_dicts[j]->Train(vv_samples[j], clamp<size_t>(a_total_sizes[j] / 8, 256, 16 << 10)))
+			details_dicts[j].reset();
+
+		// Empty part means no dictionary for a given stream
+		out_archive->AddPart(dict_stream_id, details_dicts[j] ? details_dicts[j]->Data() : vector<uint8_t>(), 0);
+	}
+
+	details_dicts_ready = true;
+}
+
+// *******************************************************************************************
+void CCollection_V3::load_details_dicts(bool copy_to_out_archive)
+{
+	auto in_dict_stream_id = in_archive->GetStreamId("collection-details-dict");
+
+	if (in_dict_stream_id < 0)
+		return;
+
+	int out_dict_stream_id = copy_to_out_archive ? out_archive->RegisterStream("collection-details-dict") : -1;
+
+	vector<uint8_t> data;
+	uint64_t meta;
+
+	for (int j = 0; j < 5; ++j)
+	{
+		if (!in_archive->GetPart(in_dict_stream_id, j, data, meta))
+			data.clear();
+
+		if (copy_to_out_archive)
+			out_archive->AddPart(out_dict_stream_id, data, meta);
+
+		details_dicts[j].reset();
+
+		if (!data.empty())
+		{
+			details_dicts[j] = make_shared<CZSTDDict>(details_compression_level);
+			if (!details_dicts[j]->Load(data))
+				details_dicts[j].reset();
+		}
+	}
+
+	details_dicts_ready = true;
 }
 
 // *******************************************************************************************
-void CCollection_V3::store_batch_sample_names()
+void CCollection_V3::store_batch_sample_names(const uint32_t no_samples)
 {
 	vector<uint8_t> v_data, v_tmp;
 
 	determine_collection_samples_id();
 
-	serialize_sample_names(v_tmp);
+	serialize_sample_names(v_tmp, no_samples);
 
 	zstd_compress(zstd_cctx_samples, v_tmp, v_data, 19);
 
+	// Sample names are stored as a single part, so in in-place mode the previous one is replaced
+	out_archive->TruncateStream(collection_samples_id, 0);
 	out_archive->AddPartBuffered(collection_samples_id, v_data, v_tmp.size());
 }
 
@@ -235,6 +336,9 @@ void CCollection_V3::store_batch_contig_details(uint32_t id_from, uint32_t id_to
 
 	determnine_collection_details_id();
 
+	if (train_details_dicts && !details_dicts_ready)
+		build_details_dicts(id_from, id_to);
+
 	serialize_contig_details(v_data, id_from, id_to);
 
 	if (no_threads >= 4)
@@ -243,7 +347,7 @@ void CCollection_V3::store_batch_contig_details(uint32_t id_from, uint32_t id_to
 		v_fut.reserve(5);
 
 		for (int i = 0; i < 5; ++i)
-			v_fut.emplace_back(async([&, i]() {zstd_compress(zstd_cctx_details[i], v_data[i], v_packed[i], 19); }));
+			v_fut.emplace_back(async([&, i]() {zstd_compress(zstd_cctx_details[i], v_data[i], v_packed[i], details_compression_level, details_dicts[i].get()); }));
 
 		for (int i = 0; i < 5; ++i)
 			v_fut[i].wait();
@@ -251,7 +355,7 @@ void CCollection_V3::store_batch_contig_details(uint32_t id_from, uint32_t id_to
 	else
 	{
 		for (int i = 0; i < 5; ++i)
-			zstd_compress(zstd_cctx_details[i], v_data[i], v_packed[i], 19);
+			zstd_compress(zstd_cctx_details[i], v_data[i], v_packed[i], details_compression_level, details_dicts[i].get());
 	}
 
 	for (int i = 0; i < 5; ++i)
@@ -303,7 +407,7 @@ void CCollection_V3::load_batch_contig_details(size_t id_batch)
 		v_fut.reserve(5);
 
 		for (int i = 0; i < 5; ++i)
-			v_fut.emplace_back(async([&, i]() {zstd_decompress(zstd_dctx_details[i], v_packed[i], v_data[i], a_sizes[i].first); }));
+			v_fut.emplace_back(async([&, i]() {zstd_decompress(zstd_dctx_details[i], v_packed[i], v_data[i], a_sizes[i].first, details_dicts[i].get()); }));
 
 		for (int i = 0; i < 5; ++i)
 			v_fut[i].wait();
@@ -311,7 +415,7 @@ void CCollection_V3::load_batch_contig_details(size_t id_batch)
 	else
 	{
 		for (int i = 0; i < 5; ++i)
-			zstd_decompress(zstd_dctx_details[i], v_packed[i], v_data[i], a_sizes[i].first);
+			zstd_decompress(zstd_dctx_details[i], v_packed[i], v_data[i], a_sizes[i].first, details_dicts[i].get());
 	}
 
 	deserialize_contig_details(v_data, id_batch * batch_size);
@@ -320,12 +424,14 @@ void CCollection_V3::load_batch_contig_details(size_t id_batch)
 }
 
 // *******************************************************************************************
-void CCollection_V3::serialize_sample_names(vector<uint8_t>& v_data)
+void CCollection_V3::serialize_sample_names(vector<uint8_t>& v_data, const uint32_t no_samples)
 {
-	append(v_data, (uint32_t) sample_desc.size());
+	uint32_t n = (uint32_t) min<size_t>(no_samples, sample_desc.size());
+
+	append(v_data, n);
 
-	for (auto& x: sample_desc)
-		append(v_data, x.name);
+	for (uint32_t i = 0; i < n; ++i)
+		append(v_data, sample_desc[i].name);
 }
 
 // *******************************************************************************************
@@ -681,6 +787,8 @@ void CCollection_V3::deserialize_contig_details(array<vector<uint8_t>, 5>& v_dat
 // *******************************************************************************************
 void CCollection_V3::store_contig_batch(uint32_t id_from, uint32_t id_to)
 {
+	AGC_INSTR_SCOPE(collection_store);
+
 	lock_guard<mutex> lck(mtx);
 
 	if (no_threads > 1)
@@ -704,6 +812,15 @@ void CCollection_V3::store_contig_batch(uint32_t id_from, uint32_t id_to)
 
 // *******************************************************************************************
 bool CCollection_V3::register_sample_contig(const string& sample_name, const string& contig_name)
+{
+	uint32_t sample_id, contig_id;
+
+	return register_sample_contig(sample_name, contig_name, sample_id, contig_id);
+}
+
+// *******************************************************************************************
+// Register contig and return its position in the collection
+bool CCollection_V3::register_sample_contig(const string& sample_name, const string& contig_name, uint32_t& sample_id, uint32_t& contig_id)
 {
 	string short_contig_name = extract_contig_name(contig_name);
 	string stored_sample_name = sample_name;
@@ -719,8 +836,7 @@ bool CCollection_V3::register_sample_contig(const string& sample_name, const str
 		if (q != sample_ids.end())
 			return false;		// sample of the same name was already registered (prior to previous sample_name)
 
-		uint32_t sample_id = (uint32_t)sample_ids.size();
-		sample_ids[stored_sample_name] = sample_id;
+		sample_ids[stored_sample_name] = (uint32_t)sample_ids.size();
 		sample_desc.emplace_back(stored_sample_name);
 
 		prev_sample_name = stored_sample_name;
@@ -728,6 +844,9 @@ bool CCollection_V3::register_sample_contig(const string& sample_name, const str
 
 	sample_desc.back().contigs.emplace_back(contig_desc_t(contig_name));
 
+	sample_id = (uint32_t)(sample_desc.size() - 1);
+	contig_id = (uint32_t)(sample_desc.back().contigs.size() - 1);
+
 	return true;
 }
 
@@ -804,6 +923,33 @@ void CCollection_V3::add_segments_placed(vector<segments_to_place_t>& segments_t
 	}
 }
 
+// *******************************************************************************************
+// Register complete description of a sample (e.g., taken from other archive)
+bool CCollection_V3::add_sample_desc(const string& sample_name, const vector<pair<string, vector<segment_desc_t>>>& sample_desc_)
+{
+	lock_guard<mutex> lck(mtx);
+
+	if (sample_ids.find(sample_name) != sample_ids.end())
+		return false;		// sample of the same name was already registered
+
+	uint32_t sample_id = (uint32_t)sample_ids.size();
+	sample_ids[sample_name] = sample_id;
+	sample_desc.emplace_back(sample_name);
+
+	auto& contigs = sample_desc.back().contigs;
+	contigs.reserve(sample_desc_.size());
+
+	for (auto& x : sample_desc_)
+	{
+		contigs.emplace_back(contig_desc_t(x.first));
+		contigs.back().segments = x.second;
+	}
+
+	prev_sample_name = sample_name;
+
+	return true;
+}
+
 // *******************************************************************************************
 bool CCollection_V3::get_reference_name(string& reference_name)
 {
@@ -916,6 +1062,61 @@ bool CCollection_V3::get_contig_desc(const string& sample_name, string& contig_n
 	return false;
 }
 
+// *******************************************************************************************
+// Segment list of a contig of a sample not stored yet or of a sample stored in the input archive (appending mode).
+// In the latter case the batch is loaded aside, so the batch being extended is not affected.
+bool CCollection_V3::get_contig_segments(const uint32_t sample_id, const uint32_t contig_id, vector<segment_desc_t>& contig_desc)
+{
+	lock_guard<mutex> lck(mtx);
+
+	contig_desc.clear();
+
+	if (sample_id >= sample_desc.size())
+		return false;
+
+	if (sample_desc[sample_id].contigs.empty())
+	{
+		size_t id_batch = sample_id / batch_size;
+
+		if (id_batch >= no_archived_contig_batches)
+			return false;		// Batch already stored in the output archive
+
+		auto saved_batch_id = unpacked_contig_data_batch_id;
+		auto saved_no_samples_in_last_batch = no_samples_in_last_batch;
+
+		if (aux_contig_data_batch_id >= 0)
+			clear_batch_contig(aux_contig_data_batch_id);
+
+		unpacked_contig_data_batch_id = -1;
+		load_batch_contig_names(id_batch);
+		load_batch_contig_details(id_batch);
+
+		aux_contig_data_batch_id = (int)id_batch;
+		unpacked_contig_data_batch_id = saved_batch_id;
+		no_samples_in_last_batch = saved_no_samples_in_last_batch;
+	}
+
+	if (contig_id >= sample_desc[sample_id].contigs.size())
+		return false;
+
+	contig_desc = sample_desc[sample_id].contigs[contig_id].segments;
+
+	return true;
+}
+
+// *******************************************************************************************
+bool CCollection_V3::set_contig_segments(const uint32_t sample_id, const uint32_t contig_id, const vector<segment_desc_t>& contig_desc)
+{
+	lock_guard<mutex> lck(mtx);
+
+	if (sample_id >= sample_desc.size() || contig_id >= sample_desc[sample_id].contigs.size())
+		return false;
+
+	sample_desc[sample_id].contigs[contig_id].segments = contig_desc;
+
+	return true;
+}
+
 // *******************************************************************************************
 bool CCollection_V3::is_contig_desc(const string& sample_name, const string& contig_name)
 {
@@ -13,6 +13,7 @@
 
 #include "collection.h"
 #include "archive.h"
+#include "zstd_dict.h"
 
 class CCollection_V3 : public CCollection
 {
@@ -91,10 +92,18 @@ class CCollection_V3 : public CCollection
 	ZSTD_DCtx* zstd_dctx_contigs = nullptr;
 	array<ZSTD_DCtx*, 5> zstd_dctx_details = { nullptr, nullptr, nullptr, nullptr, nullptr };
 
+	const int details_compression_level = 19;			// zstd level of the details streams and of their dictionaries
+	array<shared_ptr<CZSTDDict>, 5> details_dicts;
+	bool train_details_dicts = false;
+	bool details_dicts_ready = false;
+	bool in_place = false;
+
 	unordered_map<string, uint32_t, MurMurStringsHash> sample_ids;
 	vector<sample_desc_t> sample_desc;
 
 	int unpacked_contig_data_batch_id = -1;
+	int aux_contig_data_batch_id = -1;
+	size_t no_archived_contig_batches = 0;
 
 	uint32_t no_threads;
 
@@ -115,7 +124,7 @@ class CCollection_V3 : public CCollection
 	shared_ptr<CArchive> out_archive;
 	vector<int> v_in_group_ids;
 
-	void store_batch_sample_names();
+	void store_batch_sample_names(const uint32_t no_samples);
 	void store_batch_contig_names(uint32_t id_from, uint32_t id_to);
 	void store_batch_contig_details(uint32_t id_from, uint32_t id_to);
 
@@ -124,7 +133,7 @@ class CCollection_V3 : public CCollection
 	void load_batch_contig_details(size_t id_batch);
 	void clear_batch_contig(size_t id_batch);
 
-	void serialize_sample_names(vector<uint8_t> &v_data);
+	void serialize_sample_names(vector<uint8_t> &v_data, const uint32_t no_samples);
 	void serialize_contig_names(vector<uint8_t>& v_data, uint32_t id_from, uint32_t id_to);
 	void serialize_contig_details(array<vector<uint8_t>, 5>& v_data, uint32_t id_from, uint32_t id_to);
 
@@ -136,8 +145,11 @@ class CCollection_V3 : public CCollection
 	bool prepare_for_appending_copy();
 	bool prepare_for_decompression();
 
-	void zstd_compress(ZSTD_CCtx*& cctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, int level);
-	void zstd_decompress(ZSTD_DCtx*& dctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, size_t raw_size);
+	void zstd_compress(ZSTD_CCtx*& cctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, int level, const CZSTDDict* dict = nullptr);
+	void zstd_decompress(ZSTD_DCtx*& dctx, vector<uint8_t>& v_input, vector<uint8_t>& v_output, size_t raw_size, const CZSTDDict* dict = nullptr);
+
+	void build_details_dicts(uint32_t id_from, uint32_t id_to);
+	void load_details_dicts(bool copy_to_out_archive);
 
 	// Just check
 	int get_in_group_id(int pos)
@@ -236,23 +248,28 @@ public:
 	};
 
 	bool set_archives(shared_ptr<CArchive> _in_archive, shared_ptr<CArchive> _out_archive,
-		uint32_t _no_threads, size_t _batch_size, uint32_t _segment_size, uint32_t _kmer_length);
+		uint32_t _no_threads, size_t _batch_size, uint32_t _segment_size, uint32_t _kmer_length, bool _in_place = false);
+	void set_dict_training(bool _train_details_dicts);
 
-	void complete_serialization();
+	void complete_serialization(const uint32_t no_samples = ~0u);
 
 	bool prepare_for_appending_load_last_batch();
 
 	virtual bool register_sample_contig(const string& sample_name, const string& contig_name);
+	bool register_sample_contig(const string& sample_name, const string& contig_name, uint32_t& sample_id, uint32_t& contig_id);
 	
 	void reset_prev_sample_name();
 	virtual void add_segment_placed(const string &sample_name, const string& contig_name, const uint32_t place, const uint32_t group_id, const uint32_t in_group_id, const bool is_rev_comp, const uint32_t raw_length);
 	void add_segments_placed(vector<segments_to_place_t>& segments_to_place);
+	bool add_sample_desc(const string& sample_name, const vector<pair<string, vector<segment_desc_t>>>& sample_desc_);
 	virtual bool get_reference_name(string& reference_name);
 	virtual bool get_samples_list(vector<string>& v_samples, bool sorted = true);
 	virtual bool get_contig_list_in_sample(const string& sample_name, vector<string>& v_contig_names);
 	virtual bool get_sample_desc(const string& sample_name, vector<pair<string, vector<segment_desc_t>>>& sample_desc_);
 	virtual bool get_contig_desc(const string& sample_name, string& contig_name, vector<segment_desc_t>& contig_desc);
 	virtual bool is_contig_desc(const string& sample_name, const string& contig_name);
+	bool get_contig_segments(const uint32_t sample_id, const uint32_t contig_id, vector<segment_desc_t>& contig_desc);
+	bool set_contig_segments(const uint32_t sample_id, const uint32_t contig_id, const vector<segment_desc_t>& contig_desc);
 	virtual vector<string> get_samples_for_contig(const string& contig_name);
 	virtual size_t get_no_samples();
 	virtual int32_t get_no_contigs(const string& sample_name);
@@ -25,8 +25,9 @@ const uint32_t AGC_VER_MINOR = 2;
 const uint32_t AGC_VER_BUGFIX = 2;
 const string AGC_VER_BUILD = "20260326.1"s;
 
-const uint32_t AGC_FILE_MAJOR = 3;
+const uint32_t AGC_FILE_MAJOR = 4;					// since 4: splitters and map of segments in compact forms (refused by AGC 3.x)
 const uint32_t AGC_FILE_MINOR = 0;
+const uint32_t AGC_FILE_MINOR_BINARY_LZ = 1;		// deltas stored in binary token format (CLZDiff_V3)
 
 const std::string AGC_VERSION = std::string("AGC (Assembled Genomes Compressor) v. ") + 
 	to_string(AGC_VER_MAJOR) + "." + to_string(AGC_VER_MINOR) + "." + to_string(AGC_VER_BUGFIX) +
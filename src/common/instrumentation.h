@@ -0,0 +1,337 @@
+#ifndef _INSTRUMENTATION_H
+#define _INSTRUMENTATION_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cinttypes>
+
+using namespace std;
+
+// Hot-path instrumentation of the compressor.
+// Compiled in only if AGC_INSTRUMENTATION is defined (make INSTRUMENTATION=true),
+// otherwise AGC_INSTR_* macros expand to nothing.
+
+// *******************************************************************************************
+enum class instr_phase_t : uint32_t {
+	read_input, queue_wait, preprocess, contig_scan, segment_assignment, candidate_estimate, new_splitters,
+	barrier_wait, store_tail_wait, registration, store_segments, segment_encoding, zstd_packing, collection_store, checkpoint, finalization,
+	no_phases
+};
+
+// *******************************************************************************************
+enum class instr_counter_t : uint32_t {
+	contigs, dup_contigs, bases, segments, estimates, zstd_packs, zstd_raw_bytes, zstd_packed_bytes, barrier_arrivals, store_tasks, split_chunks,
+	no_counters
+};
+
+// *******************************************************************************************
+// Per-phase times are "self" times, i.e., time of nested scopes is excluded
+class CInstrumentation
+{
+public:
+	static constexpr uint32_t no_phases = (uint32_t) instr_phase_t::no_phases;
+	static constexpr uint32_t no_counters = (uint32_t) instr_counter_t::no_counters;
+	static constexpr uint32_t max_threads = 256;
+
+private:
+	struct alignas(64) thread_slot_t {
+		array<atomic<uint64_t>, no_phases> time_ns{};
+		array<atomic<uint64_t>, no_phases> calls{};
+		array<atomic<uint64_t>, no_counters> counters{};
+	};
+
+	array<thread_slot_t, max_threads> slots;
+	atomic<uint32_t> no_slots{ 0 };
+	chrono::steady_clock::time_point start_time{ chrono::steady_clock::now() };
+
+	// *******************************************************************************************
+	thread_slot_t& slot()
+	{
+		thread_local uint32_t slot_id = min(no_slots.fetch_add(1, memory_order_relaxed), max_threads - 1);
+
+		return slots[slot_id];
+	}
+
+	// *******************************************************************************************
+	uint32_t get_no_slots() const
+	{
+		return min(no_slots.load(), max_threads);
+	}
+
+	// *******************************************************************************************
+	bool is_slot_used(const thread_slot_t& s) const
+	{
+		for (auto& x : s.calls)
+			if (x.load(memory_order_relaxed))
+				return true;
+		for (auto& x : s.counters)
+			if (x.load(memory_order_relaxed))
+				return true;
+
+		return false;
+	}
+
+	// *******************************************************************************************
+	double wall_time() const
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+	}
+
+	CInstrumentation() = default;
+
+public:
+	CInstrumentation(const CInstrumentation&) = delete;
+	CInstrumentation& operator=(const CInstrumentation&) = delete;
+
+	// *******************************************************************************************
+	static CInstrumentation& Instance()
+	{
+		static CInstrumentation instr;
+
+		return instr;
+	}
+
+	// *******************************************************************************************
+	static const char* PhaseName(const instr_phase_t phase)
+	{
+		static const char* names[] = {
+			"read_input", "queue_wait", "preprocess", "contig_scan", "segment_assignment", "candidate_estimate", "new_splitters",
+			"barrier_wait", "store_tail_wait", "registration", "store_segments", "segment_encoding", "zstd_packing", "collection_store", "checkpoint", "finalization" };
+
+		return names[(uint32_t)phase];
+	}
+
+	// *******************************************************************************************
+	static const char* CounterName(const instr_counter_t counter)
+	{
+		static const char* names[] = {
+			"contigs", "dup_contigs", "bases", "segments", "estimates", "zstd_packs", "zstd_raw_bytes", "zstd_packed_bytes", "barrier_arrivals", "store_tasks", "split_chunks" };
+
+		return names[(uint32_t)counter];
+	}
+
+	// *******************************************************************************************
+	// Must be called when no instrumented code is running
+	void Reset()
+	{
+		for (auto& s : slots)
+		{
+			for (auto& x : s.time_ns)
+				x = 0;
+			for (auto& x : s.calls)
+				x = 0;
+			for (auto& x : s.counters)
+				x = 0;
+		}
+
+		start_time = chrono::steady_clock::now();
+	}
+
+	// *******************************************************************************************
+	void AddTime(const instr_phase_t phase, const uint64_t time_ns)
+	{
+		auto& s = slot();
+
+		s.time_ns[(uint32_t)phase].fetch_add(time_ns, memory_order_relaxed);
+		s.calls[(uint32_t)phase].fetch_add(1, memory_order_relaxed);
+	}
+
+	// *******************************************************************************************
+	void Count(const instr_counter_t counter, const uint64_t val = 1)
+	{
+		slot().counters[(uint32_t)counter].fetch_add(val, memory_order_relaxed);
+	}
+
+	// *******************************************************************************************
+	void Print(ostream& out) const
+	{
+		vector<const thread_slot_t*> v_used;
+
+		for (uint32_t i = 0; i < get_no_slots(); ++i)
+			if (is_slot_used(slots[i]))
+				v_used.emplace_back(&slots[i]);
+
+		double wall = wall_time();
+		double total_all = 0;
+
+		for (auto s : v_used)
+			for (auto& x : s->time_ns)
+				total_all += x.load() / 1e9;
+
+		ostringstream oss;
+
+		oss << "*** Instrumentation (wall time: " << fixed << setprecision(3) << wall << " s; threads: " << v_used.size() << ")\n";
+		oss << left << setw(20) << "phase" << right << setw(12) << "total [s]" << setw(12) << "max/thr [s]" << setw(12) << "calls" << setw(9) << "share" << "\n";
+
+		for (uint32_t i = 0; i < no_phases; ++i)
+		{
+			double total = 0;
+			double max_thr = 0;
+			uint64_t calls = 0;
+
+			for (auto s : v_used)
+			{
+				double t = s->time_ns[i].load() / 1e9;
+				total += t;
+				max_thr = max(max_thr, t);
+				calls += s->calls[i].load();
+			}
+
+			if (!calls)
+				continue;
+
+			oss << left << setw(20) << PhaseName((instr_phase_t)i) << right << setprecision(3)
+				<< setw(12) << total << setw(12) << max_thr << setw(12) << calls
+				<< setw(8) << setprecision(1) << (total_all > 0 ? 100.0 * total / total_all : 0.0) << "%\n";
+		}
+
+		for (uint32_t i = 0; i < no_counters; ++i)
+		{
+			uint64_t val = 0;
+
+			for (auto s : v_used)
+				val += s->counters[i].load();
+
+			oss << left << setw(20) << CounterName((instr_counter_t)i) << right << setw(24) << val << "\n";
+		}
+
+		out << oss.str();
+	}
+
+	// *******************************************************************************************
+	bool StoreJSON(const string& file_name) const
+	{
+		vector<const thread_slot_t*> v_used;
+
+		for (uint32_t i = 0; i < get_no_slots(); ++i)
+			if (is_slot_used(slots[i]))
+				v_used.emplace_back(&slots[i]);
+
+		ofstream ofs(file_name);
+		if (!ofs)
+			return false;
+
+		ostringstream oss;
+
+		oss << fixed << setprecision(6);
+		oss << "{\n";
+		oss << "  \"wall_time\": " << wall_time() << ",\n";
+		oss << "  \"no_threads\": " << v_used.size() << ",\n";
+		oss << "  \"phases\": [\n";
+
+		for (uint32_t i = 0; i < no_phases; ++i)
+		{
+			double total = 0;
+			uint64_t calls = 0;
+			string per_thread;
+
+			for (auto s : v_used)
+			{
+				double t = s->time_ns[i].load() / 1e9;
+				total += t;
+				calls += s->calls[i].load();
+
+				ostringstream oss_t;
+				oss_t << fixed << setprecision(6) << t;
+				per_thread += (per_thread.empty() ? "" : ", ") + oss_t.str();
+			}
+
+			oss << "    {\"name\": \"" << PhaseName((instr_phase_t)i) << "\", \"total_time\": " << total << ", \"calls\": " << calls
+				<< ", \"per_thread\": [" << per_thread << "]}" << (i + 1 < no_phases ? "," : "") << "\n";
+		}
+
+		oss << "  ],\n";
+		oss << "  \"counters\": {\n";
+
+		for (uint32_t i = 0; i < no_counters; ++i)
+		{
+			uint64_t val = 0;
+
+			for (auto s : v_used)
+				val += s->counters[i].load();
+
+			oss << "    \"" << CounterName((instr_counter_t)i) << "\": " << val << (i + 1 < no_counters ? "," : "") << "\n";
+		}
+
+		oss << "  }\n";
+		oss << "}\n";
+
+		ofs << oss.str();
+
+		return (bool) ofs;
+	}
+};
+
+// *******************************************************************************************
+// Scoped timer, the time of nested scopes (in the same thread) is not accounted to the enclosing one
+class CInstrScope
+{
+	instr_phase_t phase;
+	CInstrScope* parent;
+	uint64_t nested_ns = 0;
+	chrono::steady_clock::time_point t_start;
+
+	// *******************************************************************************************
+	static CInstrScope*& current()
+	{
+		thread_local CInstrScope* p = nullptr;
+
+		return p;
+	}
+
+public:
+	CInstrScope(const CInstrScope&) = delete;
+	CInstrScope& operator=(const CInstrScope&) = delete;
+
+	// *******************************************************************************************
+	explicit CInstrScope(const instr_phase_t _phase) : phase(_phase), parent(current()), t_start(chrono::steady_clock::now())
+	{
+		current() = this;
+	}
+
+	// *******************************************************************************************
+	~CInstrScope()
+	{
+		uint64_t elapsed = (uint64_t) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - t_start).count();
+
+		current() = parent;
+		if (parent)
+			parent->nested_ns += elapsed;
+
+		CInstrumentation::Instance().AddTime(phase, elapsed - min(elapsed, nested_ns));
+	}
+};
+
+#define AGC_INSTR_CONCAT_IMPL(x, y)		x##y
+#define AGC_INSTR_CONCAT(x, y)			AGC_INSTR_CONCAT_IMPL(x, y)
+
+#ifdef AGC_INSTRUMENTATION
+#define AGC_INSTR_SCOPE(phase)			CInstrScope AGC_INSTR_CONCAT(agc_instr_scope_, __LINE__)(instr_phase_t::phase)
+#define AGC_INSTR_SCOPE_AS(phase_val)	CInstrScope AGC_INSTR_CONCAT(agc_instr_scope_, __LINE__)(phase_val)
+#define AGC_INSTR_COUNT(counter, val)	CInstrumentation::Instance().Count(instr_counter_t::counter, val)
+#else
+#define AGC_INSTR_SCOPE(phase)
+#define AGC_INSTR_SCOPE_AS(phase_val)
+#define AGC_INSTR_COUNT(counter, val)
+#endif
+
+// EOF
+#endif
@@ -31,6 +31,10 @@ using namespace std;
 #include <io.h>
 #endif
 
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 // *******************************************************************************************
 // Buffered input file
 class CInFile
@@ -188,26 +192,32 @@ public:
 	}
 		
 	// *******************************************************************************************
-	void Read(uint8_t *ptr, size_t size)
+	// Returns the no. of bytes read (less than size at the end of file or on a read error)
+	size_t Read(uint8_t *ptr, size_t size)
 	{
 		if (before_buffer_bytes + buffer_pos + size > file_size)
 			size = file_size - (before_buffer_bytes + buffer_pos);
 
 		size_t to_read = size;
 
-		while (buffer_pos + to_read > BUFFER_SIZE)
+		while (buffer_pos + to_read > buffer_filled)
 		{
-			memcpy(ptr, buffer + buffer_pos, BUFFER_SIZE - buffer_pos);
-			ptr += BUFFER_SIZE - buffer_pos;
-			to_read -= BUFFER_SIZE - buffer_pos;
+			memcpy(ptr, buffer + buffer_pos, buffer_filled - buffer_pos);
+			ptr += buffer_filled - buffer_pos;
+			to_read -= buffer_filled - buffer_pos;
 
 			before_buffer_bytes += buffer_filled;
 			buffer_filled = fread(buffer, 1, BUFFER_SIZE, f);
 			buffer_pos = 0;
+
+			if (buffer_filled == 0)
+				return size - to_read;
 		}
 
 		memcpy(ptr, buffer + buffer_pos, to_read);
 		buffer_pos += to_read;
+
+		return size;
 	}
 
 	// *******************************************************************************************
@@ -304,6 +314,87 @@ public:
 		return true;
 	}
 
+	// *******************************************************************************************
+	// Open existing file and set the position at its end (the current contents is not modified)
+	bool OpenForAppending(const string& file_name, const size_t _BUFFER_SIZE = 8 << 20)
+	{
+		if (f)
+			return false;
+
+		use_stdout = false;
+
+		f = fopen(file_name.c_str(), "r+b");
+		if (!f)
+			return false;
+
+		my_fseek(f, 0, SEEK_END);
+
+		BUFFER_SIZE = _BUFFER_SIZE;
+		buffer = new uint8_t[BUFFER_SIZE];
+		buffer_pos = 0;
+		success = true;
+
+		return true;
+	}
+
+	// *******************************************************************************************
+	// Write the buffered data (e.g., before direct writes to the file)
+	bool Flush()
+	{
+		if (!f)
+			return false;
+
+		if (buffer_pos)
+		{
+			success &= fwrite(buffer, 1, buffer_pos, f) == buffer_pos;
+			buffer_pos = 0;
+		}
+
+		success &= fflush(f) == 0;
+
+		return success;
+	}
+
+	// *******************************************************************************************
+	// Descriptor for direct (positioned) writes, -1 for stdout
+	int Descriptor() const
+	{
+		if (!f || use_stdout)
+			return -1;
+
+#ifndef _WIN32
+		return fileno(f);
+#else
+		return _fileno(f);
+#endif
+	}
+
+	// *******************************************************************************************
+	// Continue buffered writing from given position (e.g., after direct writes to the file)
+	bool Seek(const size_t pos)
+	{
+		if (!Flush())
+			return false;
+
+		return my_fseek(f, pos, SEEK_SET) == 0;
+	}
+
+	// *******************************************************************************************
+	// Write the buffered data and force the OS to store them on the disk
+	bool Sync()
+	{
+		if (!Flush())
+			return false;
+
+#ifndef _WIN32
+		success &= fsync(fileno(f)) == 0;
+#else
+		success &= _commit(_fileno(f)) == 0;
+#endif
+
+		return success;
+	}
+
 	// *******************************************************************************************
 	bool Close()
 	{
@@ -316,10 +407,8 @@ public:
 		fflush(f);
 
 		if (f && !use_stdout)
-		{
 			fclose(f);
-			f = nullptr;
-		}
+		f = nullptr;
 		if (buffer)
 		{
 			delete[] buffer;
@@ -335,6 +424,13 @@ public:
 		return f != nullptr;
 	}
 
+	// *******************************************************************************************
+	// No write error so far
+	bool Good() const
+	{
+		return success;
+	}
+
 	// *******************************************************************************************
 	void Put(const uint8_t c)
 	{
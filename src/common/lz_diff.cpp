@@ -19,9 +19,6 @@ CLZDiffBase::CLZDiffBase(const uint32_t _min_match_len)
 	key_len = min_match_len - hashing_step + 1u;
 	key_mask = ~0ull >> (64 - 2 * key_len);
 	short_ht_ver = false;
-	ht_mask = 0;
-	ht_size = 0;
-	index_ready = false;
 }
 
 // *******************************************************************************************
@@ -32,7 +29,7 @@ CLZDiffBase::~CLZDiffBase()
 // *******************************************************************************************
 bool CLZDiffBase::SetMinMatchLen(const uint32_t _min_match_len)
 {
-	if (!reference.empty() || index_ready)
+	if (!reference.empty() || lz_index)
 		return false;
 
 	min_match_len = _min_match_len;
@@ -78,9 +75,10 @@ void CLZDiffBase::prepare_gen(const contig_t& _reference)
 }
 
 // *******************************************************************************************
-void CLZDiffBase::prepare_index()
+shared_ptr<const CLZDiffBase::lz_index_t> CLZDiffBase::build_index() const
 {
-	ht_size = 0;
+	auto idx = make_shared<lz_index_t>();
+	uint64_t ht_size = 0;
 
 	uint32_t no_prev_valid = 0;
 
@@ -124,25 +122,41 @@ void CLZDiffBase::prepare_index()
 	if (ht_size < 8)
 		ht_size = 8;
 
-	ht_mask = ht_size - 1;
+	idx->ht_size = ht_size;
+	idx->ht_mask = ht_size - 1;
+
+	idx->ht_tags.assign(ht_size + max_no_tries, 0);
 
 	if (short_ht_ver)
 	{
-		ht16.resize(ht_size, empty_key16);
-		make_index16();
+		idx->ht16.resize(ht_size, empty_key16);
+		make_index16(*idx);
 	}
 	else
 	{
-		ht32.resize(ht_size, empty_key32);
-		make_index32();
+		idx->ht32.resize(ht_size, empty_key32);
+		make_index32(*idx);
 	}
 
-	index_ready = true;
+	return idx;
+}
+
+// *******************************************************************************************
+shared_ptr<const CLZDiffBase::lz_index_t> CLZDiffBase::get_index() const
+{
+	lock_guard<mutex> lck(mtx_index);
+
+	if (!lz_index)
+		lz_index = build_index();
+
+	return lz_index;
 }
 
 // *******************************************************************************************
 void CLZDiffBase::Prepare(const contig_t& _reference)
 {
+	ReleaseIndex();
+
 	short_ht_ver = _reference.size() / hashing_step < 65535;
 
 	prepare_gen(_reference);
@@ -151,13 +165,34 @@ void CLZDiffBase::Prepare(const contig_t& _reference)
 // *******************************************************************************************
 void CLZDiffBase::AssureIndex()
 {
-	if (!index_ready)
-		prepare_index();
+	get_index();
+}
+
+// *******************************************************************************************
+// Users that already took the index keep it until they finish
+void CLZDiffBase::ReleaseIndex()
+{
+	lock_guard<mutex> lck(mtx_index);
+
+	lz_index.reset();
+}
+
+// *******************************************************************************************
+size_t CLZDiffBase::IndexMemoryUsage() const
+{
+	lock_guard<mutex> lck(mtx_index);
+
+	if (!lz_index)
+		return 0;
+
+	return lz_index->ht16.capacity() * sizeof(uint16_t) + lz_index->ht32.capacity() * sizeof(uint32_t) + lz_index->ht_tags.capacity();
 }
 
 // *******************************************************************************************
 void CLZDiffBase::GetCodingCostVector(const contig_t& text, vector<uint32_t>& v_costs, const bool prefix_costs) const
 {
+	auto idx = get_index();
+
 	v_costs.clear();
 	v_costs.reserve(text.size());
 
@@ -222,7 +257,7 @@ void CLZDiffBase::GetCodingCostVector(const contig_t& text, vector<uint32_t>& v_
 			continue;
 		}
 
-		uint64_t ht_pos = mmh(x) & ht_mask;
+		uint64_t h = mmh(x);
 
 		uint32_t len_bck = 0;
 		uint32_t len_fwd = 0;
@@ -230,8 +265,8 @@ void CLZDiffBase::GetCodingCostVector(const contig_t& text, vector<uint32_t>& v_
 		uint32_t max_len = text_size - i;
 
 		if (short_ht_ver ?
-			!find_best_match16((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
-			!find_best_match32((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
+			!find_best_match16(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
+			!find_best_match32(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
 		{
 			v_costs.emplace_back(1);
 			++i;
@@ -284,7 +319,7 @@ void CLZDiffBase::GetCodingCostVector(const contig_t& text, vector<uint32_t>& v_
 }
 
 // *******************************************************************************************
-bool CLZDiffBase::find_best_match16(uint32_t ht_pos, const uint8_t* s, const uint32_t max_len, const uint32_t no_prev_literals,
+bool CLZDiffBase::find_best_match16(const lz_index_t& idx, const uint64_t h, const uint8_t* s, const uint32_t max_len, const uint32_t no_prev_literals,
 	uint32_t& ref_pos, uint32_t& len_bck, uint32_t& len_fwd) const
 {
 	len_fwd = 0;
@@ -293,23 +328,20 @@ bool CLZDiffBase::find_best_match16(uint32_t ht_pos, const uint8_t* s, const uin
 	uint32_t min_to_update = min_match_len;
 
 	const uint8_t* ref_ptr = reference.data();
+	const uint64_t ht_pos0 = h & idx.ht_mask;
 
-	for (uint32_t i = 0; i < max_no_tries; ++i)
+	for (uint64_t cand = candidate_slots(idx, ht_pos0, hash_tag(h)); cand; cand &= cand - 1)
 	{
-		if (ht16[ht_pos] == empty_key16)
-			break;
+		uint64_t ht_pos = (ht_pos0 + ctz64(cand)) & idx.ht_mask;
 
-		uint32_t h_pos = ((uint32_t) ht16[ht_pos]) * hashing_step;
+		uint32_t h_pos = ((uint32_t) idx.ht16[ht_pos]) * hashing_step;
 		const uint8_t* p = ref_ptr + h_pos;
 
 		uint32_t f_len = compare_fwd((uint8_t*)s, (uint8_t*)p, max_len);
 
 		if (f_len >= key_len)
 		{
-			uint32_t b_len = 0;
-			for (; b_len < min(no_prev_literals, h_pos); ++b_len)
-				if (*(s - b_len - 1) != *(p - b_len - 1))
-					break;
+			uint32_t b_len = compare_bck(s, p, min(no_prev_literals, h_pos));
 
 			if (b_len + f_len > min_to_update)
 			{
@@ -320,15 +352,13 @@ bool CLZDiffBase::find_best_match16(uint32_t ht_pos, const uint8_t* s, const uin
 				min_to_update = b_len + f_len;
 			}
 		}
-
-		ht_pos = (uint32_t)((ht_pos + 1u) & ht_mask);
 	}
 
 	return len_bck + len_fwd >= min_match_len;
 }
 
 // *******************************************************************************************
-bool CLZDiffBase::find_best_match32(uint32_t ht_pos, const uint8_t* s, const uint32_t max_len, const uint32_t no_prev_literals,
+bool CLZDiffBase::find_best_match32(const lz_index_t& idx, const uint64_t h, const uint8_t* s, const uint32_t max_len, const uint32_t no_prev_literals,
 	uint32_t& ref_pos, uint32_t& len_bck, uint32_t& len_fwd) const
 {
 	len_fwd = 0;
@@ -337,23 +367,20 @@ bool CLZDiffBase::find_best_match32(uint32_t ht_pos, const uint8_t* s, const uin
 	uint32_t min_to_update = min_match_len;
 
 	const uint8_t* ref_ptr = reference.data();
+	const uint64_t ht_pos0 = h & idx.ht_mask;
 
-	for (uint32_t i = 0; i < max_no_tries; ++i)
+	for (uint64_t cand = candidate_slots(idx, ht_pos0, hash_tag(h)); cand; cand &= cand - 1)
 	{
-		if (ht32[ht_pos] == empty_key32)
-			break;
+		uint64_t ht_pos = (ht_pos0 + ctz64(cand)) & idx.ht_mask;
 
-		uint32_t h_pos = ht32[ht_pos] * hashing_step;
+		uint32_t h_pos = idx.ht32[ht_pos] * hashing_step;
 		const uint8_t* p = ref_ptr + h_pos;
 
 		uint32_t f_len = compare_fwd((uint8_t*)s, (uint8_t*)p, max_len);
 
 		if (f_len >= key_len)
 		{
-			uint32_t b_len = 0;
-			for (; b_len < min(no_prev_literals, h_pos); ++b_len)
-				if (*(s - b_len - 1) != *(p - b_len - 1))
-					break;
+			uint32_t b_len = compare_bck(s, p, min(no_prev_literals, h_pos));
 
 			if (b_len + f_len > min_to_update)
 			{
@@ -364,15 +391,13 @@ bool CLZDiffBase::find_best_match32(uint32_t ht_pos, const uint8_t* s, const uin
 				min_to_update = b_len + f_len;
 			}
 		}
-
-		ht_pos = (uint32_t) ((ht_pos + 1u) & ht_mask);
 	}
 
 	return len_bck + len_fwd >= min_match_len;
 }
 
 // *******************************************************************************************
-void CLZDiffBase::make_index16()
+void CLZDiffBase::make_index16(lz_index_t& idx) const
 {
 	uint32_t ref_size = (uint32_t)reference.size();
 	MurMur64Hash mmh;
@@ -388,19 +413,23 @@ void CLZDiffBase::make_index16()
 		uint64_t x = get_code(ptr);
 		if (x == ~0ull)
 			continue;
-		uint64_t pos = mmh(x) & ht_mask;
+		uint64_t h = mmh(x);
+		uint64_t pos = h & idx.ht_mask;
 
 		for (uint32_t j = 0; j < max_no_tries; ++j)
-			if (ht16[(pos + j) & ht_mask] == empty_key16)
+			if (idx.ht16[(pos + j) & idx.ht_mask] == empty_key16)
 			{
-				ht16[(pos + j) & ht_mask] = i / hashing_step;
+				idx.ht16[(pos + j) & idx.ht_mask] = i / hashing_step;
+				idx.ht_tags[(pos + j) & idx.ht_mask] = hash_tag(h);
 				break;
 			}
 	}
+
+	finish_tags(idx);
 }
 
 // *******************************************************************************************
-void CLZDiffBase::make_index32()
+void CLZDiffBase::make_index32(lz_index_t& idx) const
 {
 	uint32_t ref_size = (uint32_t)reference.size();
 	MurMur64Hash mmh;
@@ -416,15 +445,26 @@ void CLZDiffBase::make_index32()
 		uint64_t x = get_code(ptr);
 		if (x == ~0ull)
 			continue;
-		uint64_t pos = mmh(x) & ht_mask;
+		uint64_t h = mmh(x);
+		uint64_t pos = h & idx.ht_mask;
 
 		for (uint32_t j = 0; j < max_no_tries; ++j)
-			if (ht32[(pos + j) & ht_mask] == empty_key32)
+			if (idx.ht32[(pos + j) & idx.ht_mask] == empty_key32)
 			{
-				ht32[(pos + j) & ht_mask] = i / hashing_step;
+				idx.ht32[(pos + j) & idx.ht_mask] = i / hashing_step;
+				idx.ht_tags[(pos + j) & idx.ht_mask] = hash_tag(h);
 				break;
 			}
 	}
+
+	finish_tags(idx);
+}
+
+// *******************************************************************************************
+void CLZDiffBase::finish_tags(lz_index_t& idx) const
+{
+	for (uint64_t i = 0; i < max_no_tries; ++i)
+		idx.ht_tags[idx.ht_size + i] = idx.ht_tags[i & idx.ht_mask];
 }
 
 // *******************************************************************************************
@@ -476,8 +516,7 @@ void CLZDiff_V1::decode_match(contig_t::const_iterator& p, uint32_t& ref_pos, ui
 // *******************************************************************************************
 void CLZDiff_V1::Encode(const contig_t& text, contig_t& encoded)
 {
-	if (!index_ready)
-		prepare_index();
+	auto idx = get_index();
 
 	uint32_t text_size = (uint32_t)text.size();
 
@@ -532,7 +571,7 @@ void CLZDiff_V1::Encode(const contig_t& text, contig_t& encoded)
 			continue;
 		}
 
-		uint64_t ht_pos = mmh(x) & ht_mask;
+		uint64_t h = mmh(x);
 
 		uint32_t len_bck = 0;
 		uint32_t len_fwd = 0;
@@ -540,8 +579,8 @@ void CLZDiff_V1::Encode(const contig_t& text, contig_t& encoded)
 		uint32_t max_len = text_size - i;
 
 		if (short_ht_ver ?
-			!find_best_match16((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
-			!find_best_match32((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
+			!find_best_match16(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
+			!find_best_match32(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
 		{
 			encode_literal(*text_ptr, encoded);
 
@@ -594,13 +633,16 @@ size_t CLZDiff_V1::Estimate(const contig_t& text, uint32_t bound)
 }
 
 // *******************************************************************************************
-void CLZDiff_V1::Decode(const contig_t& reference, const contig_t& encoded, contig_t& decoded)
+void CLZDiff_V1::Decode(const contig_t& reference, const uint8_t* _encoded, const size_t encoded_size, contig_t& decoded, const size_t size_hint)
 {
 	uint8_t c;
 	uint32_t ref_pos, len;
 	uint32_t pred_pos = 0;
 
+	const contig_t encoded(_encoded, _encoded + encoded_size);
+
 	decoded.clear();
+	decoded.reserve(size_hint);
 
 	for (auto p = encoded.begin(); p != encoded.end(); )
 	{
@@ -643,7 +685,7 @@ void CLZDiff_V2::encode_match(const uint32_t ref_pos, const uint32_t len, const
 }
 
 // *******************************************************************************************
-void CLZDiff_V2::decode_match(contig_t::const_iterator& p, uint32_t& ref_pos, uint32_t& len, uint32_t& pred_pos)
+void CLZDiff_V2::decode_match(const uint8_t*& p, uint32_t& ref_pos, uint32_t& len, uint32_t& pred_pos)
 {
 	int64_t raw_pos;
 	int64_t raw_len;
@@ -668,8 +710,7 @@ void CLZDiff_V2::decode_match(contig_t::const_iterator& p, uint32_t& ref_pos, ui
 // *******************************************************************************************
 void CLZDiff_V2::Encode(const contig_t& text, contig_t& encoded)
 {
-	if (!index_ready)
-		prepare_index();
+	auto idx = get_index();
 
 	uint32_t text_size = (uint32_t)text.size();
 
@@ -731,7 +772,7 @@ void CLZDiff_V2::Encode(const contig_t& text, contig_t& encoded)
 			continue;
 		}
 
-		uint64_t ht_pos = mmh(x) & ht_mask;
+		uint64_t h = mmh(x);
 
 		uint32_t len_bck = 0;
 		uint32_t len_fwd = 0;
@@ -739,8 +780,8 @@ void CLZDiff_V2::Encode(const contig_t& text, contig_t& encoded)
 		uint32_t max_len = text_size - i;
 
 		if (short_ht_ver ?
-			!find_best_match16((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
-			!find_best_match32((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
+			!find_best_match16(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
+			!find_best_match32(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
 		{
 			encode_literal(*text_ptr, encoded);
 
@@ -798,22 +839,25 @@ void CLZDiff_V2::Encode(const contig_t& text, contig_t& encoded)
 }
 
 // *******************************************************************************************
-void CLZDiff_V2::Decode(const contig_t& reference, const contig_t& encoded, contig_t& decoded)
+void CLZDiff_V2::Decode(const contig_t& reference, const uint8_t* encoded, const size_t encoded_size, contig_t& decoded, const size_t size_hint)
 {
 	uint8_t c;
 	uint32_t ref_pos, len;
 	uint32_t pred_pos = 0;
 
+	const uint8_t* ref_ptr = reference.data();
+
 	decoded.clear();
+	decoded.reserve(size_hint ? size_hint : reference.size());
 
-	for (auto p = encoded.begin(); p != encoded.end(); )
+	for (auto p = encoded, p_end = encoded + encoded_size; p != p_end; )
 	{
 		if (is_literal(p))
 		{
 			decode_literal(p, c);
 
 			if (c == '!')
-				c = reference[pred_pos];
+				c = ref_ptr[pred_pos];
 			decoded.emplace_back(c);
 			++pred_pos;
 		}
@@ -829,7 +873,7 @@ void CLZDiff_V2::Decode(const contig_t& reference, const contig_t& encoded, cont
 			if (len == ~0u)
 				len = reference.size() - ref_pos;
 
-			decoded.insert(decoded.end(), reference.begin() + ref_pos, reference.begin() + ref_pos + len);
+			decoded.insert(decoded.end(), ref_ptr + ref_pos, ref_ptr + ref_pos + len);
 			pred_pos = ref_pos + len;
 		}
 	}
@@ -838,8 +882,7 @@ void CLZDiff_V2::Decode(const contig_t& reference, const contig_t& encoded, cont
 // *******************************************************************************************
 size_t CLZDiff_V2::Estimate(const contig_t& text, uint32_t bound)
 {
-	if (!index_ready)
-		prepare_index();
+	auto idx = get_index();
 
 	uint32_t text_size = (uint32_t)text.size();
 
@@ -902,7 +945,7 @@ size_t CLZDiff_V2::Estimate(const contig_t& text, uint32_t bound)
 			continue;
 		}
 
-		uint64_t ht_pos = mmh(x) & ht_mask;
+		uint64_t h = mmh(x);
 
 		uint32_t len_bck = 0;
 		uint32_t len_fwd = 0;
@@ -910,8 +953,8 @@ size_t CLZDiff_V2::Estimate(const contig_t& text, uint32_t bound)
 		uint32_t max_len = text_size - i;
 
 		if (short_ht_ver ?
-			!find_best_match16((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
-			!find_best_match32((uint32_t)ht_pos, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
+			!find_best_match16(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd) :
+			!find_best_match32(*idx, h, text_ptr, max_len, no_prev_literals, match_pos, len_bck, len_fwd))
 		{
 			++est_cost;
 
@@ -945,4 +988,133 @@ size_t CLZDiff_V2::Estimate(const contig_t& text, uint32_t bound)
 	return est_cost;
 }
 
-// EOL
\ No newline at end of file
+// *******************************************************************************************
+//
+// *******************************************************************************************
+void CLZDiff_V3::Encode(const contig_t& text, contig_t& encoded)
+{
+	contig_t text_encoded;
+
+	CLZDiff_V2::Encode(text, text_encoded);
+	transcode(text_encoded, encoded);
+}
+
+// *******************************************************************************************
+// Convert V2 (text) tokens into binary ones
+void CLZDiff_V3::transcode(const contig_t& text_encoded, contig_t& encoded)
+{
+	uint8_t c;
+	uint32_t ref_pos, len;
+	uint32_t pred_pos = 0;
+
+	encoded.clear();
+	encoded.reserve(text_encoded.size());
+
+	for (auto p = text_encoded.data(), p_end = text_encoded.data() + text_encoded.size(); p != p_end; )
+	{
+		if (is_literal(p))
+		{
+			decode_literal(p, c);
+
+			encoded.emplace_back(c == '!' ? tok_literal_same : c);
+			++pred_pos;
+		}
+		else if (is_Nrun(p))
+		{
+			decode_Nrun(p, len);
+
+			encoded.emplace_back(tok_Nrun);
+			append_varint(encoded, len - min_Nrun_len);
+		}
+		else
+		{
+			decode_match(p, ref_pos, len, pred_pos);
+
+			if (ref_pos == pred_pos)
+			{
+				if (len == ~0u)
+					encoded.emplace_back(tok_match_pred_end);
+				else if (len - min_match_len < (uint32_t) (tok_match_pred - tok_match_short))
+					encoded.emplace_back((uint8_t) (tok_match_short + (len - min_match_len)));
+				else
+				{
+					encoded.emplace_back(tok_match_pred);
+					append_varint(encoded, len - min_match_len);
+				}
+			}
+			else
+			{
+				encoded.emplace_back(len == ~0u ? tok_match_end : tok_match);
+				append_varint(encoded, zigzag_encode((int64_t)ref_pos - (int64_t)pred_pos));
+				if (len != ~0u)
+					append_varint(encoded, len - min_match_len);
+			}
+
+			pred_pos = ref_pos + len;
+		}
+	}
+}
+
+// *******************************************************************************************
+void CLZDiff_V3::Decode(const contig_t& reference, const uint8_t* encoded, const size_t encoded_size, contig_t& decoded, const size_t size_hint)
+{
+	uint32_t ref_pos, len;
+	uint32_t pred_pos = 0;
+
+	const uint8_t* ref_ptr = reference.data();
+
+	decoded.clear();
+	decoded.reserve(size_hint ? size_hint : reference.size());
+
+	for (auto p = encoded, p_end = encoded + encoded_size; p != p_end; )
+	{
+		uint8_t t = *p++;
+
+		if (t <= tok_literal_max)
+		{
+			decoded.emplace_back(t);
+			++pred_pos;
+			continue;
+		}
+		else if (t == tok_literal_same)
+		{
+			decoded.emplace_back(ref_ptr[pred_pos]);
+			++pred_pos;
+			continue;
+		}
+		else if (t == tok_Nrun)
+		{
+			decoded.insert(decoded.end(), (size_t)(read_varint(p) + min_Nrun_len), N_code);
+			continue;
+		}
+		else if (t < tok_match_pred)
+		{
+			ref_pos = pred_pos;
+			len = min_match_len + (t - tok_match_short);
+		}
+		else if (t == tok_match_pred)
+		{
+			ref_pos = pred_pos;
+			len = min_match_len + (uint32_t)read_varint(p);
+		}
+		else if (t == tok_match_pred_end)
+		{
+			ref_pos = pred_pos;
+			len = (uint32_t)reference.size() - ref_pos;
+		}
+		else
+		{
+			ref_pos = (uint32_t)((int64_t)pred_pos + zigzag_decode(read_varint(p)));
+
+			if (t == tok_match)
+				len = min_match_len + (uint32_t)read_varint(p);
+			else
+				len = (uint32_t)reference.size() - ref_pos;
+		}
+
+		decoded.insert(decoded.end(), ref_ptr + ref_pos, ref_ptr + ref_pos + len);
+		pred_pos = ref_pos + len;
+	}
+}
+
+// EOL
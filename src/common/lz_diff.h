@@ -14,6 +14,9 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <cstring>
+#include <memory>
+#include <mutex>
 #include "../common/utils.h"
 
 #include <refresh/string_operations/lib/string_operations.h>
@@ -22,6 +25,10 @@ using namespace std;
 
 #define USE_SPARSE_HT
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 // *******************************************************************************************
 class CLZDiffBase
 {
@@ -41,19 +48,91 @@ protected:
 	const uint32_t hashing_step = 1;
 #endif
 
+	// Hash index of the reference. It is immutable once built, so readers use it without locking
+	// and it can be released (e.g., to save memory) at any time and rebuilt on demand.
+	struct lz_index_t
+	{
+		vector<uint32_t> ht32;
+		vector<uint16_t> ht16;
+		vector<uint8_t> ht_tags;		// 8-bit hash tag per slot (0 - empty), first max_no_tries tags repeated after the last slot
+		uint64_t ht_size = 0;
+		uint64_t ht_mask = 0;
+	};
+
 	contig_t reference;
-	vector<uint32_t> ht32;
-	vector<uint16_t> ht16;
-	uint64_t ht_size;
-	uint64_t ht_mask;
+	mutable mutex mtx_index;
+	mutable shared_ptr<const lz_index_t> lz_index;
 	uint32_t key_len;
 	uint64_t key_mask;
 	uint32_t min_match_len;
 	bool short_ht_ver;
-	bool index_ready;
 
-	void make_index16();
-	void make_index32();
+	void make_index16(lz_index_t& idx) const;
+	void make_index32(lz_index_t& idx) const;
+	void finish_tags(lz_index_t& idx) const;
+
+	static uint8_t hash_tag(const uint64_t h)
+	{
+		uint8_t t = (uint8_t)(h >> 56);
+
+		return t ? t : 1;
+	}
+
+	static uint32_t ctz64(const uint64_t x)
+	{
+#ifdef _MSC_VER
+		unsigned long r;
+		_BitScanForward64(&r, x);
+		return (uint32_t)r;
+#else
+		return (uint32_t)__builtin_ctzll(x);
+#endif
+	}
+
+	static uint32_t clz64(const uint64_t x)
+	{
+#ifdef _MSC_VER
+		unsigned long r;
+		_BitScanReverse64(&r, x);
+		return 63u - (uint32_t)r;
+#else
+		return (uint32_t)__builtin_clzll(x);
+#endif
+	}
+
+	// Gathers the highest bits of 8 bytes into 8 lowest bits
+	static uint64_t byte_mask(const uint64_t x)
+	{
+		return ((x & 0x8080808080808080ull) * 0x0002040810204081ull) >> 56;
+	}
+
+	// Bit mask of slots (starting from ht_pos) of the same tag that are before the first empty slot.
+	// Slots of different tag cannot contain a k-mer of the same code, so they need not be checked.
+	uint64_t candidate_slots(const lz_index_t& idx, const uint64_t ht_pos, const uint8_t tag) const
+	{
+		const uint64_t lo7 = 0x7f7f7f7f7f7f7f7full;
+		const uint64_t tag_pattern = 0x0101010101010101ull * tag;
+		const uint8_t* p = idx.ht_tags.data() + ht_pos;
+
+		uint64_t empty_mask = 0;
+		uint64_t tag_mask = 0;
+
+		for (uint32_t i = 0; i < max_no_tries; i += 8, p += 8)
+		{
+			uint64_t w;
+			memcpy(&w, p, 8);
+
+			uint64_t x = w ^ tag_pattern;
+
+			empty_mask |= byte_mask(~(((w & lo7) + lo7) | w | lo7)) << i;
+			tag_mask |= byte_mask(~(((x & lo7) + lo7) | x | lo7)) << i;
+
+			if (empty_mask)
+				return tag_mask & ((empty_mask & (~empty_mask + 1)) - 1);
+		}
+
+		return tag_mask;
+	}
 
 	uint64_t get_code(const uint8_t* s) const
 	{
@@ -190,17 +269,20 @@ protected:
 		return 10;
 	}
 
-	bool is_literal(const contig_t::const_iterator& p) const
+	template<typename Iter>
+	bool is_literal(const Iter& p) const
 	{
 		return (*p >= 'A' && *p <= 'A' + 20) || (*p == '!');
 	}
 
-	bool is_Nrun(const contig_t::const_iterator& p) const
+	template<typename Iter>
+	bool is_Nrun(const Iter& p) const
 	{
 		return *p == N_run_starter_code;
 	}
 
-	void decode_literal(contig_t::const_iterator& p, uint8_t &c) const
+	template<typename Iter>
+	void decode_literal(Iter& p, uint8_t &c) const
 	{
 		if (*p == '!')
 		{
@@ -211,7 +293,8 @@ protected:
 			c = *p++ - 'A';
 	}
 
-	void decode_Nrun(contig_t::const_iterator& p, uint32_t& len) const
+	template<typename Iter>
+	void decode_Nrun(Iter& p, uint32_t& len) const
 	{
 		int64_t raw_len;
 
@@ -222,9 +305,9 @@ protected:
 		len = (uint32_t)(raw_len + min_Nrun_len);
 	}
 
-	bool find_best_match16(uint32_t ht_pos, const uint8_t *s, const uint32_t max_len, const uint32_t no_prev_literals,
+	bool find_best_match16(const lz_index_t& idx, const uint64_t h, const uint8_t *s, const uint32_t max_len, const uint32_t no_prev_literals,
 		uint32_t& ref_pos, uint32_t& len_bck, uint32_t& len_fwd) const;
-	bool find_best_match32(uint32_t ht_pos, const uint8_t *s, const uint32_t max_len, const uint32_t no_prev_literals,
+	bool find_best_match32(const lz_index_t& idx, const uint64_t h, const uint8_t *s, const uint32_t max_len, const uint32_t no_prev_literals,
 		uint32_t& ref_pos, uint32_t& len_bck, uint32_t& len_fwd) const;
 	inline void append_int(contig_t& text, int64_t x) const
 	{
@@ -261,7 +344,8 @@ protected:
 		text.insert(text.end(), p, tmp + 16);
 	}
 
-	void read_int(contig_t::const_iterator& p, int64_t &x) const
+	template<typename Iter>
+	void read_int(Iter& p, int64_t &x) const
 	{
 		bool is_neg = false;
 		x = 0;
@@ -279,6 +363,28 @@ protected:
 			x = -x;
 	}
 
+	// Length of the common part of the texts preceding p and q (at most max_len symbols)
+	uint32_t compare_bck(const uint8_t* p, const uint8_t* q, const uint32_t max_len) const
+	{
+		uint32_t len = 0;
+
+		for (; len + 8 <= max_len; len += 8)
+		{
+			uint64_t x, y;
+			memcpy(&x, p - len - 8, 8);
+			memcpy(&y, q - len - 8, 8);
+
+			if (x != y)
+				return len + clz64(x ^ y) / 8;
+		}
+
+		for (; len < max_len; ++len)
+			if (*(p - len - 1) != *(q - len - 1))
+				break;
+
+		return len;
+	}
+
 	uint32_t compare_fwd(uint8_t* p, uint8_t* q, uint32_t max_len) const
 	{
 		return (uint32_t)refresh::matching_length(p, q, max_len);
@@ -332,7 +438,8 @@ protected:
 	}
 
 	void prepare_gen(const contig_t& _reference);
-	void prepare_index();
+	shared_ptr<const lz_index_t> build_index() const;
+	shared_ptr<const lz_index_t> get_index() const;
 
 public:
 	CLZDiffBase(const uint32_t _min_match_len = 18);
@@ -342,11 +449,19 @@ public:
 	void Prepare(const contig_t& _reference);
 
 	virtual void Encode(const contig_t& text, contig_t&encoded) = 0;
-	virtual void Decode(const contig_t& reference, const contig_t& encoded, contig_t& decoded) = 0;
+	// size_hint is the expected length of decoded sequence (0 - unknown)
+	virtual void Decode(const contig_t& reference, const uint8_t* encoded, const size_t encoded_size, contig_t& decoded, const size_t size_hint = 0) = 0;
+
+	void Decode(const contig_t& reference, const contig_t& encoded, contig_t& decoded)
+	{
+		Decode(reference, encoded.data(), encoded.size(), decoded);
+	}
 
 	virtual size_t Estimate(const contig_t& text, uint32_t bound = 0) = 0;
 
 	void AssureIndex();
+	void ReleaseIndex();
+	size_t IndexMemoryUsage() const;
 
 	void GetReference(contig_t& s);
 	void GetCodingCostVector(const contig_t& text, vector<uint32_t> &v_costs, const bool prefix_costs) const;
@@ -365,8 +480,10 @@ public:
 
 	virtual ~CLZDiff_V1() {};
 
+	using CLZDiffBase::Decode;
+
 	virtual void Encode(const contig_t& text, contig_t& encoded);
-	virtual void Decode(const contig_t& reference, const contig_t& encoded, contig_t& decoded);
+	virtual void Decode(const contig_t& reference, const uint8_t* encoded, const size_t encoded_size, contig_t& decoded, const size_t size_hint = 0);
 
 	virtual size_t Estimate(const contig_t& text, uint32_t bound = 0);
 };
@@ -374,8 +491,9 @@ public:
 // *******************************************************************************************
 class CLZDiff_V2 : public CLZDiffBase
 {
+protected:
 	void encode_match(const uint32_t ref_pos, const uint32_t len, const uint32_t pred_pos, contig_t& encoded);
-	void decode_match(contig_t::const_iterator& p, uint32_t& ref_pos, uint32_t& len, uint32_t& pred_pos);
+	void decode_match(const uint8_t*& p, uint32_t& ref_pos, uint32_t& len, uint32_t& pred_pos);
 
 	uint32_t int_len(int x) const
 	{
@@ -429,11 +547,60 @@ public:
 
 	virtual ~CLZDiff_V2() {};
 
+	using CLZDiffBase::Decode;
+
 	virtual void Encode(const contig_t& text, contig_t& encoded);
-	virtual void Decode(const contig_t& reference, const contig_t& encoded, contig_t& decoded);
+	virtual void Decode(const contig_t& reference, const uint8_t* encoded, const size_t encoded_size, contig_t& decoded, const size_t size_hint = 0);
 
 	virtual size_t Estimate(const contig_t& text, uint32_t bound = ~0u);
 };
 
+// *******************************************************************************************
+// Binary token format. The sequence is parsed exactly as in V2, but the tokens are stored as single bytes
+// followed by varints instead of decimal numbers. Byte 0xff is never produced as it separates deltas in packs.
+class CLZDiff_V3 : public CLZDiff_V2
+{
+	static constexpr uint8_t tok_literal_max = 0x1e;		// literals are stored as symbol codes
+	static constexpr uint8_t tok_literal_same = 0x1f;		// literal equal to the reference symbol at predicted position
+	static constexpr uint8_t tok_Nrun = 0x20;				// varint(len - min_Nrun_len)
+	static constexpr uint8_t tok_match_short = 0x40;		// match at predicted position, len - min_match_len stored in token
+	static constexpr uint8_t tok_match_pred = 0xbe;			// match at predicted position, varint(len - min_match_len)
+	static constexpr uint8_t tok_match_pred_end = 0xbf;		// match at predicted position to the end of reference
+	static constexpr uint8_t tok_match = 0xc0;				// varint(zigzag(ref_pos - pred_pos)), varint(len - min_match_len)
+	static constexpr uint8_t tok_match_end = 0xc1;			// varint(zigzag(ref_pos - pred_pos)), match to the end of reference
+
+	// 6 bits in each continuation byte (0x80-0xbf) and 7 bits in the last byte (0x00-0x7f)
+	void append_varint(contig_t& encoded, uint64_t x) const
+	{
+		for (; x >= 0x80; x >>= 6)
+			encoded.emplace_back((uint8_t)(0x80 | (x & 0x3f)));
+		encoded.emplace_back((uint8_t)x);
+	}
+
+	uint64_t read_varint(const uint8_t*& p) const
+	{
+		uint64_t x = 0;
+		uint32_t shift = 0;
+
+		for (; *p & 0x80; ++p, shift += 6)
+			x |= (uint64_t)(*p & 0x3f) << shift;
+
+		return x | ((uint64_t)*p++ << shift);
+	}
+
+	void transcode(const contig_t& text_encoded, contig_t& encoded);
+
+public:
+	CLZDiff_V3(const uint32_t _min_match_len = 18) : CLZDiff_V2(_min_match_len)
+	{}
+
+	virtual ~CLZDiff_V3() {};
+
+	using CLZDiffBase::Decode;
+
+	virtual void Encode(const contig_t& text, contig_t& encoded);
+	virtual void Decode(const contig_t& reference, const uint8_t* encoded, const size_t encoded_size, contig_t& decoded, const size_t size_hint = 0);
+};
+
 // EOF
 #endif
\ No newline at end of file
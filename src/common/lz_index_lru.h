@@ -0,0 +1,142 @@
+#ifndef _LZ_INDEX_LRU_H
+#define _LZ_INDEX_LRU_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <cinttypes>
+#include "../common/lz_diff.h"
+#include "../common/memory_governor.h"
+
+using namespace std;
+
+// *******************************************************************************************
+// Memory budget for hash indexes of LZ-diff references shared by all segments.
+// The least recently used indexes are released when the budget is exceeded; they are rebuilt on demand
+// from the reference (kept in memory), so no archive access or zstd decompression is necessary.
+class CLZIndexLRU
+{
+	mutex mtx;
+	size_t budget = 0;						// 0 - unlimited
+	size_t used = 0;
+
+	list<pair<CLZDiffBase*, size_t>> lru;	// most recently used first
+	unordered_map<CLZDiffBase*, list<pair<CLZDiffBase*, size_t>>::iterator> m_items;
+
+	shared_ptr<CMemoryGovernor> mem_governor;
+
+	// *******************************************************************************************
+	void report()
+	{
+		if (mem_governor)
+			mem_governor->SetUsage(mem_class_t::lz_indexes, used);
+	}
+
+	// *******************************************************************************************
+	void evict(const CLZDiffBase* keep)
+	{
+		while (budget && used > budget && !lru.empty() && lru.back().first != keep)
+		{
+			auto& item = lru.back();
+
+			item.first->ReleaseIndex();
+			used -= item.second;
+			m_items.erase(item.first);
+			lru.pop_back();
+		}
+
+		report();
+	}
+
+public:
+	CLZIndexLRU(const size_t _budget = 0) : budget(_budget)
+	{}
+
+	CLZIndexLRU(const CLZIndexLRU&) = delete;
+	CLZIndexLRU& operator=(const CLZIndexLRU&) = delete;
+
+	// *******************************************************************************************
+	void SetBudget(const size_t _budget)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		budget = _budget;
+		evict(nullptr);
+	}
+
+	// *******************************************************************************************
+	void SetMemoryGovernor(shared_ptr<CMemoryGovernor> _mem_governor)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		mem_governor = _mem_governor;
+		report();
+	}
+
+	// *******************************************************************************************
+	// Mark the index as just used (mem - its current size in bytes)
+	void Touch(CLZDiffBase* lz_diff, const size_t mem)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		auto p = m_items.find(lz_diff);
+
+		if (p != m_items.end())
+		{
+			used -= p->second->second;
+			lru.erase(p->second);
+		}
+
+		if (mem == 0)
+		{
+			if (p != m_items.end())
+				m_items.erase(p);
+			report();
+			return;
+		}
+
+		lru.emplace_front(lz_diff, mem);
+		m_items[lz_diff] = lru.begin();
+		used += mem;
+
+		evict(lz_diff);
+	}
+
+	// *******************************************************************************************
+	void Remove(const CLZDiffBase* lz_diff)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		auto p = m_items.find(const_cast<CLZDiffBase*>(lz_diff));
+
+		if (p == m_items.end())
+			return;
+
+		used -= p->second->second;
+		lru.erase(p->second);
+		m_items.erase(p);
+
+		report();
+	}
+
+	// *******************************************************************************************
+	size_t Used()
+	{
+		lock_guard<mutex> lck(mtx);
+
+		return used;
+	}
+};
+
+// EOF
+#endif
@@ -0,0 +1,213 @@
+#ifndef _MEMORY_GOVERNOR_H
+#define _MEMORY_GOVERNOR_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cinttypes>
+#include <ostream>
+#include <iomanip>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// *******************************************************************************************
+enum class mem_class_t : uint32_t {
+	input_contigs, contigs_in_work, segment_parts, lz_indexes, pack_queue,
+	no_classes
+};
+
+// *******************************************************************************************
+// Accounting of the main memory consumers of the compressor (queues and buffers) against a common budget.
+// Consumers only report their usage (no allocations are made here). The budget is enforced by backpressure:
+// the input reader waits (before queuing a contig) as long as the budget would be exceeded and queued contigs
+// are still to be taken by workers; other memory is released only after synchronization, so it cannot be waited for.
+// Budgets of the bounded structures (queues, LZ index LRU) are derived from the global one.
+class CMemoryGovernor
+{
+	static constexpr uint32_t no_classes = (uint32_t)mem_class_t::no_classes;
+
+	size_t budget;													// 0 - unlimited (accounting only)
+
+	array<atomic<int64_t>, no_classes> a_used{};
+	array<atomic<int64_t>, no_classes> a_peak{};
+	atomic<int64_t> total{ 0 };
+	atomic<int64_t> total_peak{ 0 };
+
+	mutex mtx;
+	condition_variable cv;
+	atomic<uint32_t> no_waiting{ 0 };
+
+	// *******************************************************************************************
+	static void update_max(atomic<int64_t>& x, const int64_t val)
+	{
+		int64_t cur = x.load(memory_order_relaxed);
+
+		while (cur < val && !x.compare_exchange_weak(cur, val, memory_order_relaxed))
+			;
+	}
+
+	// *******************************************************************************************
+	void notify()
+	{
+		if (!no_waiting.load())
+			return;
+
+		{
+			lock_guard<mutex> lck(mtx);		// no lost wake-up of the reader that has just checked the condition
+		}
+		cv.notify_all();
+	}
+
+public:
+	// *******************************************************************************************
+	CMemoryGovernor(const size_t _budget = 0) : budget(_budget)
+	{}
+
+	CMemoryGovernor(const CMemoryGovernor&) = delete;
+	CMemoryGovernor& operator=(const CMemoryGovernor&) = delete;
+
+	// *******************************************************************************************
+	size_t Budget() const
+	{
+		return budget;
+	}
+
+	// *******************************************************************************************
+	// Budget for a structure taking given fraction of the global budget, but not more than default_val (0 - unlimited)
+	size_t Share(const double frac, const size_t default_val) const
+	{
+		if (!budget)
+			return default_val;
+
+		size_t share = max<size_t>(1, (size_t)(budget * frac));
+
+		return default_val ? min(default_val, share) : share;
+	}
+
+	// *******************************************************************************************
+	void Add(const mem_class_t mem_class, const size_t size)
+	{
+		auto& used = a_used[(uint32_t)mem_class];
+
+		update_max(a_peak[(uint32_t)mem_class], used.fetch_add((int64_t)size, memory_order_relaxed) + (int64_t)size);
+		update_max(total_peak, total.fetch_add((int64_t)size, memory_order_relaxed) + (int64_t)size);
+	}
+
+	// *******************************************************************************************
+	void Release(const mem_class_t mem_class, const size_t size)
+	{
+		a_used[(uint32_t)mem_class].fetch_sub((int64_t)size, memory_order_relaxed);
+		total.fetch_sub((int64_t)size, memory_order_relaxed);
+
+		notify();
+	}
+
+	// *******************************************************************************************
+	void ReleaseAll(const mem_class_t mem_class)
+	{
+		total.fetch_sub(a_used[(uint32_t)mem_class].exchange(0), memory_order_relaxed);
+
+		notify();
+	}
+
+	// *******************************************************************************************
+	// For consumers tracking their usage by themselves
+	void SetUsage(const mem_class_t mem_class, const size_t size)
+	{
+		int64_t delta = (int64_t)size - a_used[(uint32_t)mem_class].exchange((int64_t)size, memory_order_relaxed);
+
+		update_max(a_peak[(uint32_t)mem_class], (int64_t)size);
+		update_max(total_peak, total.fetch_add(delta, memory_order_relaxed) + delta);
+
+		if (delta < 0)
+			notify();
+	}
+
+	// *******************************************************************************************
+	// Backpressure for the input reader: wait until size bytes fit in the budget or no queued contigs remain
+	void WaitForRoom(const size_t size)
+	{
+		if (!budget)
+			return;
+
+		auto fits = [&] {
+			return total.load() + (int64_t)size <= (int64_t)budget || a_used[(uint32_t)mem_class_t::input_contigs].load() <= 0;
+			};
+
+		if (fits())
+			return;
+
+		unique_lock<mutex> lck(mtx);
+		++no_waiting;
+		cv.wait(lck, fits);
+		--no_waiting;
+	}
+
+	// *******************************************************************************************
+	size_t Peak() const
+	{
+		return (size_t)max<int64_t>(0, total_peak.load());
+	}
+
+	// *******************************************************************************************
+	// Peak resident set size of the process (0 if unknown)
+	static size_t PeakRSS()
+	{
+#ifndef _WIN32
+		struct rusage usage;
+
+		if (getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+#ifdef __APPLE__
+		return (size_t)usage.ru_maxrss;
+#else
+		return (size_t)usage.ru_maxrss * 1024;
+#endif
+#else
+		return 0;
+#endif
+	}
+
+	// *******************************************************************************************
+	void Print(ostream& out) const
+	{
+		static const char* names[] = { "input contigs", "contigs in work", "segment parts", "LZ indexes", "pack queue" };
+
+		auto mb = [](const int64_t x) { return (double)max<int64_t>(0, x) / (1 << 20); };
+
+		out << "*** Memory (peak) ***" << endl;
+		out << fixed << setprecision(1);
+
+		for (uint32_t i = 0; i < no_classes; ++i)
+			out << left << setw(23) << names[i] << right << ": " << mb(a_peak[i].load()) << " MB" << endl;
+
+		out << left << setw(23) << "Tracked total" << right << ": " << mb(total_peak.load()) << " MB";
+		if (budget)
+			out << " (budget: " << mb((int64_t)budget) << " MB)";
+		out << endl;
+
+		if (auto rss = PeakRSS(); rss)
+			out << left << setw(23) << "Process" << right << ": " << mb((int64_t)rss) << " MB" << endl;
+
+		out << defaultfloat;
+	}
+};
+
+// EOF
+#endif
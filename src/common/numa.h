@@ -0,0 +1,195 @@
+#ifndef _NUMA_H
+#define _NUMA_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <cinttypes>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+// *******************************************************************************************
+// NUMA topology used to pin worker threads to nodes (no external library is necessary).
+//
+// Nodes and their CPUs are read from /sys/devices/system/node (Linux). Memory is not bound explicitly: the kernel places
+// pages on the node of the thread that touches them first, so structures allocated and filled by pinned threads are node-local.
+// For testing on single-node machines the CPUs available to the process can be split into a given no. of emulated nodes
+// (if there are more nodes than CPUs, the nodes share CPUs).
+// On other systems (or if the topology cannot be read) there is a single node and threads are not pinned.
+class CNumaTopology
+{
+	vector<vector<uint32_t>> vv_cpus;			// CPUs of nodes (only nodes with CPUs available to the process)
+
+	// *******************************************************************************************
+	// List in the kernel format, e.g., "0-3,8-11"
+	static bool parse_cpu_list(const string& str, vector<uint32_t>& v_cpus)
+	{
+		v_cpus.clear();
+
+		size_t pos = 0;
+
+		while (pos < str.size())
+		{
+			size_t end = str.find(',', pos);
+			if (end == string::npos)
+				end = str.size();
+
+			string range = str.substr(pos, end - pos);
+			pos = end + 1;
+
+			if (range.empty())
+				continue;
+
+			auto dash = range.find('-');
+			uint32_t from, to;
+
+			try
+			{
+				from = (uint32_t)stoul(range.substr(0, dash));
+				to = (dash == string::npos) ? from : (uint32_t)stoul(range.substr(dash + 1));
+			}
+			catch (...)
+			{
+				return false;
+			}
+
+			for (uint32_t i = from; i <= to; ++i)
+				v_cpus.emplace_back(i);
+		}
+
+		return true;
+	}
+
+	// *******************************************************************************************
+	static vector<uint32_t> available_cpus()
+	{
+		vector<uint32_t> v_cpus;
+
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		if (sched_getaffinity(0, sizeof(set), &set) == 0)
+			for (uint32_t i = 0; i < CPU_SETSIZE; ++i)
+				if (CPU_ISSET(i, &set))
+					v_cpus.emplace_back(i);
+#endif
+
+		if (v_cpus.empty())
+			for (uint32_t i = 0; i < max(1u, thread::hardware_concurrency()); ++i)
+				v_cpus.emplace_back(i);
+
+		return v_cpus;
+	}
+
+	// *******************************************************************************************
+	void read_system_nodes(const vector<uint32_t>& v_available)
+	{
+#ifdef __linux__
+		const uint32_t max_nodes = 1024;
+		vector<uint32_t> v_cpus;
+
+		for (uint32_t i = 0; i < max_nodes; ++i)
+		{
+			ifstream ifs("/sys/devices/system/node/node" + to_string(i) + "/cpulist");
+
+			if (!ifs)
+				continue;
+
+			string line;
+			getline(ifs, line);
+
+			if (!parse_cpu_list(line, v_cpus))
+				continue;
+
+			v_cpus.erase(remove_if(v_cpus.begin(), v_cpus.end(), [&](const uint32_t x) {
+				return !binary_search(v_available.begin(), v_available.end(), x);
+				}), v_cpus.end());
+
+			if (!v_cpus.empty())
+				vv_cpus.emplace_back(move(v_cpus));
+		}
+#endif
+	}
+
+public:
+	// *******************************************************************************************
+	// no_nodes: 1 - nodes of the system, >1 - emulated nodes (available CPUs split evenly)
+	CNumaTopology(const uint32_t no_nodes = 1)
+	{
+		auto v_available = available_cpus();
+
+		if (no_nodes > 1)
+		{
+			size_t n_cpus = v_available.size();
+
+			for (uint32_t i = 0; i < no_nodes; ++i)
+				if (no_nodes <= n_cpus)
+					vv_cpus.emplace_back(v_available.begin() + n_cpus * i / no_nodes, v_available.begin() + n_cpus * (i + 1) / no_nodes);
+				else
+					vv_cpus.emplace_back(1, v_available[i % n_cpus]);
+		}
+		else
+			read_system_nodes(v_available);
+
+		if (vv_cpus.empty())
+			vv_cpus.emplace_back(move(v_available));
+	}
+
+	// *******************************************************************************************
+	uint32_t NoNodes() const
+	{
+		return (uint32_t)vv_cpus.size();
+	}
+
+	// *******************************************************************************************
+	uint32_t NoCpus(const uint32_t node) const
+	{
+		return (uint32_t)vv_cpus[node].size();
+	}
+
+	// *******************************************************************************************
+	// Workers are split into contiguous blocks of (almost) equal sizes, one per node
+	uint32_t NodeOfWorker(const uint32_t worker_id, const uint32_t no_workers) const
+	{
+		return (uint32_t)((uint64_t)worker_id * vv_cpus.size() / max(no_workers, 1u));
+	}
+
+	// *******************************************************************************************
+	// Pin the calling thread to CPUs of the node
+	bool Pin(const uint32_t node) const
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		for (auto x : vv_cpus[node % vv_cpus.size()])
+			if (x < CPU_SETSIZE)
+				CPU_SET(x, &set);
+
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+};
+
+// EOF
+#endif
@@ -0,0 +1,116 @@
+#ifndef _PACK_COMPRESSOR_H
+#define _PACK_COMPRESSOR_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <zstd/lib/zstd.h>
+#include "../common/queue.h"
+#include "../common/memory_governor.h"
+
+using namespace std;
+
+// *******************************************************************************************
+// Background stage compressing packs of segments (and references) by its own threads.
+// Callers enqueue jobs (owning immutable data to compress) and do not wait for zstd.
+// The total size of data waiting for compression is bounded, so Add() blocks if the stage is too slow.
+class CPackCompressor
+{
+public:
+	using job_t = function<void(ZSTD_CCtx*)>;
+
+private:
+	CBoundedQueue<pair<job_t, size_t>> q_jobs;
+	vector<thread> v_threads;
+	shared_ptr<CMemoryGovernor> mem_governor;
+
+	mutex mtx;
+	condition_variable cv_done;
+	uint64_t no_pending = 0;
+
+	// *******************************************************************************************
+	void worker()
+	{
+		ZSTD_CCtx* zstd_cctx = ZSTD_createCCtx();
+		pair<job_t, size_t> job;
+
+		while (q_jobs.Pop(job))
+		{
+			job.first(zstd_cctx);
+			job.first = nullptr;
+
+			if (mem_governor)
+				mem_governor->Release(mem_class_t::pack_queue, job.second);
+
+			lock_guard<mutex> lck(mtx);
+			if (--no_pending == 0)
+				cv_done.notify_all();
+		}
+
+		ZSTD_freeCCtx(zstd_cctx);
+	}
+
+public:
+	// *******************************************************************************************
+	CPackCompressor(const uint32_t no_threads, const size_t max_queue_bytes = 256ull << 20, shared_ptr<CMemoryGovernor> _mem_governor = nullptr) :
+		q_jobs(1, max_queue_bytes),
+		mem_governor(_mem_governor)
+	{
+		v_threads.reserve(no_threads);
+
+		for (uint32_t i = 0; i < no_threads; ++i)
+			v_threads.emplace_back([this] { worker(); });
+	}
+
+	CPackCompressor(const CPackCompressor&) = delete;
+	CPackCompressor& operator=(const CPackCompressor&) = delete;
+
+	// *******************************************************************************************
+	~CPackCompressor()
+	{
+		q_jobs.MarkCompleted();
+
+		for (auto& t : v_threads)
+			t.join();
+	}
+
+	// *******************************************************************************************
+	// size - no. of bytes to compress (cost of the job in the queue)
+	void Add(job_t&& job, const size_t size)
+	{
+		{
+			lock_guard<mutex> lck(mtx);
+			++no_pending;
+		}
+
+		if (mem_governor)
+			mem_governor->Add(mem_class_t::pack_queue, size);
+
+		q_jobs.Emplace(make_pair(move(job), size), size);
+	}
+
+	// *******************************************************************************************
+	// Wait until all enqueued jobs are completed
+	void Wait()
+	{
+		unique_lock<mutex> lck(mtx);
+
+		cv_done.wait(lck, [this] { return no_pending == 0; });
+	}
+};
+
+// EOF
+#endif
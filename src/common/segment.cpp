@@ -10,9 +10,65 @@
 
 #include "segment.h"
 
+// *******************************************************************************************
+void CSegment::set_zstd_dict(shared_ptr<CZSTDDict> _zstd_dict)
+{
+    lock_guard<mutex> lck(mtx);
+
+    zstd_dict = _zstd_dict;
+}
+
+// *******************************************************************************************
+void CSegment::set_lz_index_lru(shared_ptr<CLZIndexLRU> _lz_index_lru)
+{
+    lock_guard<mutex> lck(mtx);
+
+    lz_index_lru = _lz_index_lru;
+}
+
+// *******************************************************************************************
+// Packs are compressed by the background stage (out_archive buffers must be flushed after its Wait())
+void CSegment::set_pack_compressor(shared_ptr<CPackCompressor> _pack_compressor)
+{
+    lock_guard<mutex> lck(mtx);
+
+    pack_compressor = _pack_compressor;
+}
+
+// *******************************************************************************************
+// Index of the reference is built lazily (and may be released by LRU) so it is registered after each use
+void CSegment::touch_index()
+{
+    if (lz_index_lru)
+        lz_index_lru->Touch(lz_diff.get(), lz_diff->IndexMemoryUsage());
+}
+
+// *******************************************************************************************
+// Delta-coded sequences not stored in the archive yet (joined as in a pack), e.g., as a sample for dictionary training
+bool CSegment::get_pending_pack(contig_t& pack)
+{
+    lock_guard<mutex> lck(mtx);
+
+    pack.clear();
+
+    if (ref_size == 0 || v_lzp.empty())
+        return false;
+
+    for (auto& x : v_lzp)
+    {
+        pack.insert(pack.end(), x.begin(), x.end());
+        pack.push_back(contig_separator);
+    }
+
+    return true;
+}
+
 // *******************************************************************************************
 uint32_t CSegment::add_raw(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx)
 {
+    AGC_INSTR_SCOPE(segment_encoding);
+    AGC_INSTR_COUNT(segments, 1);
+
     lock_guard<mutex> lck(mtx);
 
     if (internal_state == internal_state_t::packed)
@@ -20,7 +76,7 @@ uint32_t CSegment::add_raw(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* z
 
     if (v_raw.size() == contigs_in_pack)
     {
-        store_in_archive(v_raw, zstd_cctx);
+        store_in_archive(v_raw, zstd_cctx, false);
         v_raw.clear();
     }
 
@@ -33,6 +89,9 @@ uint32_t CSegment::add_raw(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* z
 // *******************************************************************************************
 uint32_t CSegment::add(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx)
 {
+    AGC_INSTR_SCOPE(segment_encoding);
+    AGC_INSTR_COUNT(segments, 1);
+
     lock_guard<mutex> lck(mtx);
 
     if (internal_state == internal_state_t::packed)
@@ -48,31 +107,80 @@ uint32_t CSegment::add(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_
     }
     else
     {
-        if (v_lzp.size() == contigs_in_pack)
-        {
-            store_in_archive(v_lzp, zstd_cctx);
-            v_lzp.clear();
-        }
-
         contig_t delta;
 
         lz_diff->Encode(s, delta);
+        touch_index();
+
+        return add_delta(s.size(), delta, zstd_cctx);
+    }
+
+    ++no_seqs;
+
+    return no_seqs - 1u;
+}
+
+// *******************************************************************************************
+// Delta-code the sequence without adding it to the segment (possible only if the reference is known).
+// The index of the reference is shared and immutable, so many sequences can be coded in parallel.
+bool CSegment::encode(const contig_t& s, contig_t& delta, ZSTD_DCtx* zstd_dctx)
+{
+    AGC_INSTR_SCOPE(segment_encoding);
+
+    {
+        lock_guard<mutex> lck(mtx);
+
+        if (internal_state == internal_state_t::packed)
+            unpack(zstd_dctx);
+
+        if (no_seqs == 0)
+            return false;
+    }
+
+    lz_diff->Encode(s, delta);
+    touch_index();
+
+    return true;
+}
+
+// *******************************************************************************************
+// Add the sequence delta-coded by encode()
+uint32_t CSegment::add_encoded(const contig_t& s, contig_t& delta, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx)
+{
+    AGC_INSTR_COUNT(segments, 1);
+
+    lock_guard<mutex> lck(mtx);
+
+    if (internal_state == internal_state_t::packed)
+        unpack(zstd_dctx);
+
+    return add_delta(s.size(), delta, zstd_cctx);
+}
+
+// *******************************************************************************************
+// Must be called under the lock
+uint32_t CSegment::add_delta(const size_t seq_len, contig_t& delta, ZSTD_CCtx* zstd_cctx)
+{
+    if (v_lzp.size() == contigs_in_pack)
+    {
+        store_in_archive(v_lzp, zstd_cctx, true);
+        v_lzp.clear();
+    }
 
 #ifdef IMPROVED_LZ_ENCODING
-        if (delta.empty())       // same sequence as reference
-            return 0;
+    if (delta.empty())       // same sequence as reference
+        return 0;
 #endif
 
-        auto p = find(v_lzp.begin(), v_lzp.end(), delta);
-        
-        if (p != v_lzp.end())
-            return no_seqs - distance(p, v_lzp.end());
+    auto p = find(v_lzp.begin(), v_lzp.end(), delta);
 
-        seq_size += s.size() + 1;
-        packed_size += delta.size() + 1;
+    if (p != v_lzp.end())
+        return no_seqs - distance(p, v_lzp.end());
 
-        v_lzp.emplace_back(move(delta));
-    }
+    seq_size += seq_len + 1;
+    packed_size += delta.size() + 1;
+
+    v_lzp.emplace_back(move(delta));
 
     ++no_seqs;
 
@@ -82,6 +190,9 @@ uint32_t CSegment::add(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_
 // *******************************************************************************************
 uint64_t CSegment::estimate(const contig_t& s, uint32_t bound, ZSTD_DCtx* zstd_dctx)
 {
+    AGC_INSTR_SCOPE(candidate_estimate);
+    AGC_INSTR_COUNT(estimates, 1);
+
     if (ref_size == 0)
         return 0;
 
@@ -90,11 +201,13 @@ uint64_t CSegment::estimate(const contig_t& s, uint32_t bound, ZSTD_DCtx* zstd_d
 
         if (internal_state == internal_state_t::packed)
             unpack(zstd_dctx);
-
-        lz_diff->AssureIndex();
     }
 
-    return lz_diff->Estimate(s, bound);
+    // Index is shared and immutable, so it is built (if necessary) and used without the segment lock
+    auto r = lz_diff->Estimate(s, bound);
+    touch_index();
+
+    return r;
 }
 
 // *******************************************************************************************
@@ -104,15 +217,14 @@ void CSegment::get_coding_cost(const contig_t& s, vector<uint32_t>& v_costs, con
         return;
 
     {
-        //    lock_guard<mutex> lck(mtx);
         lock_guard<mutex> lck(mtx);
 
         if (internal_state == internal_state_t::packed)
             unpack(zstd_dctx);
-        lz_diff->AssureIndex();
     }
 
     lz_diff->GetCodingCostVector(s, v_costs, prefix_costs);
+    touch_index();
 }
 
 // *******************************************************************************************
@@ -124,26 +236,117 @@ size_t CSegment::get_ref_size() const
 // *******************************************************************************************
 void CSegment::finish(ZSTD_CCtx* zstd_ctx)
 {
+    // Not modified last pack (when appending) is just transferred
+    if (lazy_delta_part_id >= 0 && !in_place)
+    {
+        in_archive->GetPart(in_name + ss_delta_ext(archive_version), lazy_delta_part_id, packed_delta, raw_delta_size);
+        lazy_delta_part_id = -1;
+    }
+
+    // The open pack is already in the archive (stored at a checkpoint or reopened in place) and no sequences were added since then
+    if (open_part_id >= 0 && no_seqs == open_part_no_seqs)
+    {
+        v_lzp.clear();
+        v_raw.clear();
+        open_part_id = -1;
+    }
+
     if (!v_lzp.empty())
-        store_in_archive(v_lzp, zstd_ctx);
+        store_in_archive(v_lzp, zstd_ctx, true);
     if (!v_raw.empty())
-        store_in_archive(v_raw, zstd_ctx);
+        store_in_archive(v_raw, zstd_ctx, false);
     if (!packed_delta.empty())
         store_compressed_delta_in_archive();
 }
 
+// *******************************************************************************************
+// Store the open pack, so the archive is complete at a checkpoint. The pack remains open (its part is replaced
+// when the pack is stored again). Must be called when the buffers of the archive are flushed.
+void CSegment::store_checkpoint(ZSTD_CCtx* zstd_ctx)
+{
+    lock_guard<mutex> lck(mtx);
+
+    // Not modified group (when appending in place) is already complete in the archive
+    if (internal_state == internal_state_t::packed)
+        return;
+
+    auto& v_open = v_lzp.empty() ? v_raw : v_lzp;
+
+    if (v_open.empty())
+        return;
+
+    // The open pack is already in the archive and no sequences were added since then
+    if (open_part_id >= 0 && no_seqs == open_part_no_seqs)
+        return;
+
+    store_in_archive(v_open, zstd_ctx, &v_open == &v_lzp);
+
+    // The part is buffered, so it will be the next part of the stream
+    open_part_id = (int)out_archive->GetNoParts(stream_id_delta);
+    open_part_no_seqs = no_seqs;
+}
+
+// *******************************************************************************************
+// Unpack the reference part of the group (stored uncompressed or zstd-compressed, possibly as tuples)
+void CSegment::unpack_ref(vector<uint8_t>& zstd_ref_seq, const uint64_t ref_seq_size, contig_t& ref, ZSTD_DCtx* zstd_ctx)
+{
+    if (ref_seq_size == 0)
+        ref = move(zstd_ref_seq);       // No compression
+    else if (zstd_ref_seq.back() == 0)
+    {
+        ref.resize(ref_seq_size);
+        ZSTD_decompressDCtx(zstd_ctx, ref.data(), ref.size(), zstd_ref_seq.data(), zstd_ref_seq.size() - 1u);
+    }
+    else
+    {
+        vector<uint8_t> v_tuples;
+        v_tuples.resize(ref_seq_size + 1);
+
+        auto output_size = ZSTD_decompressDCtx(zstd_ctx, v_tuples.data(), v_tuples.size(), zstd_ref_seq.data(), zstd_ref_seq.size() - 1u);
+
+        v_tuples.resize(output_size);
+        ref.clear();
+        tuples2bytes(v_tuples, ref);
+    }
+}
+
+// *******************************************************************************************
+// Unpack a part with a pack of (delta-coded or raw) sequences
+void CSegment::unpack_pack(vector<uint8_t>& zstd_pack, const uint64_t pack_size, contig_t& pack, ZSTD_DCtx* zstd_ctx)
+{
+    if (pack_size == 0)
+        pack = move(zstd_pack);
+    else
+    {
+        pack.resize(pack_size);
+        CZSTDDict::Decompress(zstd_dict.get(), zstd_ctx, pack.data(), pack.size(), zstd_pack.data(), zstd_pack.size());
+    }
+}
+
+// *******************************************************************************************
+// Positions where the sequences of the pack start (and the position after the end of the pack)
+void CSegment::find_separators(const contig_t& pack, vector<uint32_t>& sep_pos) const
+{
+    sep_pos.clear();
+    sep_pos.emplace_back(0);
+
+    if (contigs_in_pack == 1)
+        sep_pos.emplace_back((uint32_t) pack.size());
+    else
+        for (uint32_t i = 0; i < (uint32_t) pack.size(); ++i)
+            if (pack[i] == contig_separator)
+                sep_pos.emplace_back(i + 1);
+}
+
 // *******************************************************************************************
 bool CSegment::get_raw(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx)
 {
     // Retrive pack of raw contigs
-//    vector<uint8_t> pack_raw_seq;
-
     int part_id = id_seq / contigs_in_pack;
-    int seq_in_part_id = id_seq % contigs_in_pack;
+    uint32_t seq_in_part_id = id_seq % contigs_in_pack;
 
-    uint8_t* pack_raw_seq = nullptr;
     contig_t buf;
-    size_t pack_raw_seq_size = 0;
+    contig_t* pack_raw_seq = &buf;
 
     vector<uint8_t> zstd_raw_seq;
     uint64_t raw_seq_size;
@@ -151,19 +354,7 @@ bool CSegment::get_raw(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx
     if (!fast)
     {
         tie(stream_id_delta, ignore) = in_archive->GetPart(name + ss_delta_ext(archive_version), part_id, zstd_raw_seq, raw_seq_size);
-
-        if (raw_seq_size == 0)
-        {
-            pack_raw_seq = zstd_raw_seq.data();
-            pack_raw_seq_size = zstd_raw_seq.size();
-        }
-        else
-        {
-            buf.resize(raw_seq_size);
-            ZSTD_decompressDCtx(zstd_ctx, buf.data(), buf.size(), zstd_raw_seq.data(), zstd_raw_seq.size());
-            pack_raw_seq = buf.data();
-            pack_raw_seq_size = buf.size();
-        }
+        unpack_pack(zstd_raw_seq, raw_seq_size, buf, zstd_ctx);
     }
     else
     {
@@ -177,50 +368,28 @@ bool CSegment::get_raw(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx
                 pf_packed_raw_seq.erase(pf_packed_raw_seq.begin());
 
             tie(p_raw, ignore) = pf_packed_raw_seq.insert(make_pair(part_id, vector<uint8_t>()));
-
-            if (raw_seq_size == 0)
-                p_raw->second = move(zstd_raw_seq);
-            else
-            {
-                p_raw->second.resize(raw_seq_size);
-                ZSTD_decompressDCtx(zstd_ctx, p_raw->second.data(), p_raw->second.size(), zstd_raw_seq.data(), zstd_raw_seq.size());
-            }
+            unpack_pack(zstd_raw_seq, raw_seq_size, p_raw->second, zstd_ctx);
         }
 
-        pack_raw_seq = p_raw->second.data();
-        pack_raw_seq_size = p_raw->second.size();
+        pack_raw_seq = &p_raw->second;
     }
 
-    // Retrive the requested delta-coded contig
-    uint32_t b_pos = 0;
-    uint32_t e_pos = 0;
-    int cnt = 0;
+    // Retrive the requested contig
+    vector<uint32_t> sep_pos;
+    find_separators(*pack_raw_seq, sep_pos);
 
-    for (uint32_t i = 0; i < pack_raw_seq_size; ++i)
-    {
-        if (pack_raw_seq[i] == contig_separator)
-        {
-            ++cnt;
-            if (cnt == seq_in_part_id)
-                b_pos = i + 1;
-            else if (cnt == seq_in_part_id + 1)
-            {
-                e_pos = i;
-                break;
-            }
-        }
-    }
+    if (seq_in_part_id + 1 >= sep_pos.size())
+        return false;
 
-    ctg.assign(pack_raw_seq + b_pos, pack_raw_seq + e_pos);
+    ctg.assign(pack_raw_seq->begin() + sep_pos[seq_in_part_id], pack_raw_seq->begin() + (sep_pos[seq_in_part_id + 1] - 1));
 
     return true;
 }
 
 // *******************************************************************************************
-bool CSegment::get(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx)
+bool CSegment::get(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t size_hint)
 {
     // Retrive reference contig
-//    contig_t ref_seq;
     vector<uint8_t> zstd_ref_seq;
 
     vector<uint8_t> zstd_delta_seq;
@@ -250,27 +419,7 @@ bool CSegment::get(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx)
     }
 
     if (ref_seq.empty())
-    {
-        if (ref_seq_size == 0)
-            ref_seq = move(zstd_ref_seq);       // No compression
-        else
-        {
-            ref_seq.resize(ref_seq_size);
-
-            if (zstd_ref_seq.back() == 0)
-                ZSTD_decompressDCtx(zstd_ctx, ref_seq.data(), ref_seq.size(), zstd_ref_seq.data(), zstd_ref_seq.size() - 1u);
-            else
-            {
-                vector<uint8_t> v_tuples;
-                v_tuples.resize(ref_seq_size + 1);
-
-                auto output_size = ZSTD_decompressDCtx(zstd_ctx, v_tuples.data(), v_tuples.size(), zstd_ref_seq.data(), zstd_ref_seq.size() - 1u);
-
-                v_tuples.resize(output_size);
-                tuples2bytes(v_tuples, ref_seq);
-            }
-        }
-    }
+        unpack_ref(zstd_ref_seq, ref_seq_size, ref_seq, zstd_ctx);
 
     if (id_seq == 0)
     {
@@ -286,108 +435,40 @@ bool CSegment::get(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx)
         return true;
     }
 
-    uint8_t* pack_delta_seq;
-    bool need_deallocate_pack_delta_seq = false;
-    auto p_delta = pf_packed_delta_seq.begin();
+    // Retrive pack of delta-coded contigs
+    contig_t buf;
+    vector<uint32_t> buf_sep_pos;
+    contig_t* pack_delta_seq = &buf;
+    vector<uint32_t>* sep_pos = &buf_sep_pos;
 
     if (!fast)
     {
-        if (delta_seq_size == 0)
-        {
-            pack_delta_seq = zstd_delta_seq.data();
-            delta_seq_size = zstd_delta_seq.size();
-        }
-        else
-        {
-            pack_delta_seq = new uint8_t[delta_seq_size];
-            need_deallocate_pack_delta_seq = true;
-            ZSTD_decompressDCtx(zstd_ctx, pack_delta_seq, delta_seq_size, zstd_delta_seq.data(), zstd_delta_seq.size());
-        }
+        unpack_pack(zstd_delta_seq, delta_seq_size, buf, zstd_ctx);
+        find_separators(buf, buf_sep_pos);
     }
     else
     {
-        p_delta = pf_packed_delta_seq.find(part_id);
+        auto p_delta = pf_packed_delta_seq.find(part_id);
 
         if (p_delta == pf_packed_delta_seq.end())
         {
             tie(p_delta, ignore) = pf_packed_delta_seq.insert(make_pair(part_id, make_pair(vector<uint8_t>(), vector<uint32_t>())));
 
-            if (delta_seq_size == 0)
-                p_delta->second.first = zstd_delta_seq;
-            else
-            {
-                p_delta->second.first.resize(delta_seq_size);
-                ZSTD_decompressDCtx(zstd_ctx, p_delta->second.first.data(), delta_seq_size, zstd_delta_seq.data(), zstd_delta_seq.size());
-            }
-
-            auto& sep_pos = p_delta->second.second;
-
-            pack_delta_seq = p_delta->second.first.data();
-            delta_seq_size = p_delta->second.first.size();
-
-            if (contigs_in_pack == 1)
-            {
-                sep_pos.emplace_back(0);
-                sep_pos.emplace_back(delta_seq_size);
-            }
-            else
-            {
-                sep_pos.emplace_back(0);
-
-                for (uint32_t i = 0; i < delta_seq_size; ++i)
-                    if (pack_delta_seq[i] == contig_separator)
-                        sep_pos.emplace_back(i + 1);
-            }
+            unpack_pack(zstd_delta_seq, delta_seq_size, p_delta->second.first, zstd_ctx);
+            find_separators(p_delta->second.first, p_delta->second.second);
         }
-        else
-        {
-            pack_delta_seq = p_delta->second.first.data();
-            delta_seq_size = p_delta->second.first.size();
-        }
-    }
-
-    // Retrive pack of delta-coded contigs
-    contig_t delta_seq;
-    int seq_in_part_id = (id_seq - 1) % contigs_in_pack;
-
-    if (!fast)
-    {
-        if (contigs_in_pack > 1)
-        {
-            // Retrive the requested delta-coded contig
-            uint32_t b_pos = 0;
-            uint32_t e_pos = 0;
-            int cnt = 0;
 
-            for (uint32_t i = 0; i < delta_seq_size; ++i)
-            {
-                if (pack_delta_seq[i] == contig_separator)
-                {
-                    ++cnt;
-                    if (cnt == seq_in_part_id)
-                        b_pos = i + 1;
-                    else if (cnt == seq_in_part_id + 1)
-                    {
-                        e_pos = i;
-                        break;
-                    }
-                }
-            }
-
-            delta_seq.assign(pack_delta_seq + b_pos, pack_delta_seq + e_pos);
-        }
-        else
-            delta_seq.assign(pack_delta_seq, pack_delta_seq + delta_seq_size - 1);
+        pack_delta_seq = &p_delta->second.first;
+        sep_pos = &p_delta->second.second;
     }
-    else
-        delta_seq.assign(pack_delta_seq + p_delta->second.second[seq_in_part_id], pack_delta_seq + p_delta->second.second[seq_in_part_id + 1] - 1);
 
-    // LZ decode delta-encoded contig
-    ctg.clear();
-    lz_diff->Decode(ref_seq, delta_seq, ctg);
+    uint32_t seq_in_part_id = (id_seq - 1) % contigs_in_pack;
+
+    if (seq_in_part_id + 1 >= sep_pos->size())
+        return false;
 
-    if (need_deallocate_pack_delta_seq)
-        delete[] pack_delta_seq;
+    // LZ decode delta-encoded contig directly from the pack
+    lz_diff->Decode(ref_seq, pack_delta_seq->data() + (*sep_pos)[seq_in_part_id], (*sep_pos)[seq_in_part_id + 1] - 1 - (*sep_pos)[seq_in_part_id], ctg, size_hint);
 
     if (!fast)
     {
@@ -407,24 +488,156 @@ bool CSegment::get_raw_locked(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* z
 }
 
 // *******************************************************************************************
-bool CSegment::get_locked(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx)
+bool CSegment::get_locked(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t size_hint)
 {
     lock_guard<mutex> lck(mtx);
 
-    return get(id_seq, ctg, zstd_ctx);
+    return get(id_seq, ctg, zstd_ctx, size_hint);
+}
+
+// *******************************************************************************************
+// Retrive and unpack reference sequence of the group
+bool CSegment::load_ref(contig_t& ref, ZSTD_DCtx* zstd_ctx)
+{
+    vector<uint8_t> zstd_ref_seq;
+    uint64_t ref_seq_size = 0;
+    bool ok;
+
+    tie(stream_id_ref, ok) = in_archive->GetPart(name + ss_ref_ext(archive_version), 0, zstd_ref_seq, ref_seq_size);
+
+    if (!ok)
+        return false;
+
+    unpack_ref(zstd_ref_seq, ref_seq_size, ref, zstd_ctx);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Retrive and unpack a pack of (delta-coded or raw) sequences and determine where the sequences start
+bool CSegment::load_pack(const int part_id, contig_t& pack, vector<uint32_t>& sep_pos, ZSTD_DCtx* zstd_ctx)
+{
+    vector<uint8_t> zstd_pack;
+    uint64_t pack_size = 0;
+    bool ok;
+
+    tie(stream_id_delta, ok) = in_archive->GetPart(name + ss_delta_ext(archive_version), part_id, zstd_pack, pack_size);
+
+    if (!ok)
+        return false;
+
+    unpack_pack(zstd_pack, pack_size, pack, zstd_ctx);
+    find_separators(pack, sep_pos);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Retrive many raw sequences of the group in a single pass (each pack is read and decompressed once)
+// v_req must be sorted by sequence id
+bool CSegment::get_raw_multi(const vector<pair<uint32_t, contig_t*>>& v_req, ZSTD_DCtx* zstd_ctx)
+{
+    contig_t pack;
+    vector<uint32_t> sep_pos;
+    int cur_part_id = -1;
+    const pair<uint32_t, contig_t*>* prev_req = nullptr;
+
+    for (auto& req : v_req)
+    {
+        if (prev_req && prev_req->first == req.first)
+        {
+            *req.second = *prev_req->second;
+            continue;
+        }
+
+        int part_id = req.first / contigs_in_pack;
+        uint32_t seq_in_part_id = req.first % contigs_in_pack;
+
+        if (part_id != cur_part_id)
+        {
+            if (!load_pack(part_id, pack, sep_pos, zstd_ctx))
+                return false;
+            cur_part_id = part_id;
+        }
+
+        if (seq_in_part_id + 1 >= sep_pos.size())
+            return false;
+
+        req.second->assign(pack.begin() + sep_pos[seq_in_part_id], pack.begin() + (sep_pos[seq_in_part_id + 1] - 1));
+        prev_req = &req;
+    }
+
+    return true;
+}
+
+// *******************************************************************************************
+// Retrive many sequences of the group in a single pass (reference is unpacked once and each delta pack is read and decompressed once)
+// v_req must be sorted by sequence id
+bool CSegment::get_multi(const vector<pair<uint32_t, contig_t*>>& v_req, ZSTD_DCtx* zstd_ctx)
+{
+    contig_t ref, pack;
+    vector<uint32_t> sep_pos;
+    int cur_part_id = -1;
+    const pair<uint32_t, contig_t*>* prev_req = nullptr;
+
+    if (v_req.empty())
+        return true;
+
+    if (!load_ref(ref, zstd_ctx))
+        return false;
+
+    for (auto& req : v_req)
+    {
+        if (prev_req && prev_req->first == req.first)
+        {
+            *req.second = *prev_req->second;
+            continue;
+        }
+
+        prev_req = &req;
+
+        if (req.first == 0)
+        {
+            *req.second = ref;
+            continue;
+        }
+
+        int part_id = (req.first - 1) / contigs_in_pack;
+        uint32_t seq_in_part_id = (req.first - 1) % contigs_in_pack;
+
+        if (part_id != cur_part_id)
+        {
+            if (!load_pack(part_id, pack, sep_pos, zstd_ctx))
+                return false;
+            cur_part_id = part_id;
+        }
+
+        if (seq_in_part_id + 1 >= sep_pos.size())
+            return false;
+
+        // LZ decode delta-encoded contig directly from the pack
+        lz_diff->Decode(ref, pack.data() + sep_pos[seq_in_part_id], sep_pos[seq_in_part_id + 1] - 1 - sep_pos[seq_in_part_id], *req.second);
+    }
+
+    return true;
 }
 
 // *******************************************************************************************
-void CSegment::appending_init()
+// All parts except the last delta pack must be already in out_archive (copied in bulk or, in in-place mode, the same file).
+// The reference and the last delta pack are loaded on the first use.
+// _in_name is the name of the group in in_archive if it differs (merging archives).
+void CSegment::appending_init(const bool _in_place, const string& _in_name)
 {
     if (internal_state != internal_state_t::none)
         return;
 
-    // Retrive reference contig
-    contig_t ref_seq;
-    
-    int in_stream_id_ref = in_archive->GetStreamId(name + ss_ref_ext(archive_version));
-    int in_stream_id_delta = in_archive->GetStreamId(name + ss_delta_ext(archive_version));
+    in_place = _in_place;
+
+    if (!_in_name.empty())
+        in_name = _in_name;
+
+    int in_stream_id_ref = in_archive->GetStreamId(in_name + ss_ref_ext(archive_version));
+    int in_stream_id_delta = in_archive->GetStreamId(in_name + ss_delta_ext(archive_version));
 
     int out_stream_id_ref = -1;
     int out_stream_id_delta = -1;
@@ -434,34 +647,15 @@ void CSegment::appending_init()
     if(in_stream_id_delta >= 0)
         out_stream_id_delta = out_archive->RegisterStream(name + ss_delta_ext(archive_version));
 
-    // Copy of all parts except last one
-    if (in_stream_id_ref >= 0)
-    {
-        in_archive->GetPart(in_stream_id_ref, packed_ref_seq, raw_ref_seq_size);
-        out_archive->AddPart(out_stream_id_ref, packed_ref_seq, raw_ref_seq_size);
-        ref_transferred = true;
-        no_seqs = 1;
-    }
-    else
-    {
-        packed_ref_seq.clear();
-        no_seqs = 0;
-    }
+    packed_ref_seq.clear();
+    lazy_ref = in_stream_id_ref >= 0;
+    no_seqs = lazy_ref ? 1 : 0;
 
-    if (in_stream_id_delta >= 0)
+    uint32_t no_parts = in_stream_id_delta >= 0 ? (uint32_t)in_archive->GetNoParts(in_stream_id_delta) : 0;
+    if (no_parts)
     {
-        vector<uint8_t> tmp_data;
-        uint64_t tmp_meta;
-
-        uint32_t no_parts = (uint32_t) in_archive->GetNoParts(in_stream_id_delta);
-        for (uint32_t i = 0; i + 1 < no_parts; ++i)
-        {
-            in_archive->GetPart(in_stream_id_delta, tmp_data, tmp_meta);
-            out_archive->AddPart(out_stream_id_delta, tmp_data, tmp_meta);
-            no_seqs += contigs_in_pack;
-        }
-
-        in_archive->GetPart(in_stream_id_delta, packed_delta, raw_delta_size);
+        no_seqs += (no_parts - 1) * contigs_in_pack;
+        lazy_delta_part_id = (int)no_parts - 1;
     }
 
     internal_state = internal_state_t::packed;
@@ -497,6 +691,22 @@ void CSegment::unpack(ZSTD_DCtx* zstd_ctx)
 {
     bool empty_ctx = zstd_ctx == nullptr;
 
+    if (lazy_ref)
+    {
+        in_archive->GetPart(in_name + ss_ref_ext(archive_version), 0, packed_ref_seq, raw_ref_seq_size);
+        lazy_ref = false;
+    }
+
+    if (lazy_delta_part_id >= 0)
+    {
+        in_archive->GetPart(in_name + ss_delta_ext(archive_version), lazy_delta_part_id, packed_delta, raw_delta_size);
+
+        // In place, the last pack stays in the archive until it is stored again (extended by new contigs)
+        if (in_place)
+            open_part_id = lazy_delta_part_id;
+        lazy_delta_part_id = -1;
+    }
+
     if (!packed_ref_seq.empty())
     {
         contig_t ref_seq;
@@ -541,7 +751,7 @@ void CSegment::unpack(ZSTD_DCtx* zstd_ctx)
                 zstd_ctx = ZSTD_createDCtx();
 
             delta_seq.resize(raw_delta_size);
-            ZSTD_decompressDCtx(zstd_ctx, delta_seq.data(), delta_seq.size(), packed_delta.data(), packed_delta.size());
+            CZSTDDict::Decompress(zstd_dict.get(), zstd_ctx, delta_seq.data(), delta_seq.size(), packed_delta.data(), packed_delta.size());
         }
 
         packed_delta.clear();
@@ -566,6 +776,9 @@ void CSegment::unpack(ZSTD_DCtx* zstd_ctx)
 
         no_seqs += (uint32_t) v_lzp.size();
 
+        if (open_part_id >= 0)
+            open_part_no_seqs = no_seqs;
+
         if (ref_size == 0)          // There is no reference sequence so the deltas are in fact raw sequences
             swap(v_raw, v_lzp);
     }
@@ -576,4 +789,162 @@ void CSegment::unpack(ZSTD_DCtx* zstd_ctx)
     internal_state = internal_state_t::normal;
 }
 
+// *******************************************************************************************
+// Number of leading full packs in which all sequences are used (such packs can be copied byte-for-byte)
+// first_id is the id of the first sequence in the delta stream (0 for raw groups, 1 for LZ groups)
+uint32_t CSegment::no_unchanged_packs(const vector<bool>& v_used, const uint32_t first_id, const uint32_t contigs_in_pack, const uint32_t no_packs)
+{
+    uint32_t no_unchanged = 0;
+
+    // The last pack can be not full, so it is never counted
+    for (; no_unchanged + 1 < no_packs; ++no_unchanged)
+    {
+        size_t id_from = first_id + (size_t) no_unchanged * contigs_in_pack;
+        size_t id_to = id_from + contigs_in_pack;
+
+        if (id_to > v_used.size() || find(v_used.begin() + id_from, v_used.begin() + id_to, false) != v_used.begin() + id_to)
+            break;
+    }
+
+    return no_unchanged;
+}
+
+// *******************************************************************************************
+// Store in out_archive only the used sequences of the group from src (a segment of in_archive).
+// The reference and the first no_copied_packs packs must be already copied, the remaining packs are
+// decompressed and the used sequences are repacked (without re-encoding).
+// v_new_ids maps old sequence ids to the new ones (~0u for removed sequences).
+bool CSegment::subset(CSegment& src, const vector<bool>& v_used, const bool raw_group, const uint32_t no_copied_packs, vector<uint32_t>& v_new_ids, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx)
+{
+    const uint32_t first_id = raw_group ? 0 : 1;
+
+    int in_stream_id_delta = src.in_archive->GetStreamId(src.name + ss_delta_ext(archive_version));
+    uint32_t no_parts = in_stream_id_delta >= 0 ? (uint32_t) src.in_archive->GetNoParts(in_stream_id_delta) : 0;
+
+    v_new_ids.assign(v_used.size(), ~0u);
+
+    uint32_t new_id = 0;
+    for (; new_id < min<size_t>(v_used.size(), first_id + (size_t) no_copied_packs * contigs_in_pack); ++new_id)
+        v_new_ids[new_id] = new_id;
+
+    contig_t pack;
+    vector<uint32_t> sep_pos;
+    vector<contig_t> v_seqs;
+
+    for (uint32_t part_id = no_copied_packs; part_id < no_parts; ++part_id)
+    {
+        size_t id = first_id + (size_t) part_id * contigs_in_pack;
+
+        if (id >= v_used.size())
+            break;
+
+        if (!src.load_pack(part_id, pack, sep_pos, zstd_dctx))
+            return false;
+
+        for (size_t k = 0; k + 1 < sep_pos.size(); ++k, ++id)
+        {
+            if (id >= v_used.size() || !v_used[id])
+                continue;
+
+            v_new_ids[id] = new_id++;
+            v_seqs.emplace_back(pack.begin() + sep_pos[k], pack.begin() + (sep_pos[k + 1] - 1));
+
+            if (v_seqs.size() == contigs_in_pack)
+            {
+                store_in_archive(v_seqs, zstd_cctx, !raw_group);
+                v_seqs.clear();
+            }
+        }
+    }
+
+    if (!v_seqs.empty())
+        store_in_archive(v_seqs, zstd_cctx, !raw_group);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Add the used sequences of the group from src (a segment of another archive) to this group (prepared by appending_init).
+// Raw sequences are repacked. Delta-coded sequences are repacked as they are if both groups have the same reference
+// (stored as the same bytes), otherwise they are decoded and delta-coded against the reference of this group.
+// v_new_ids maps sequence ids of src to the ids in this group (~0u for not used sequences).
+bool CSegment::merge(CSegment& src, const vector<bool>& v_used, const bool raw_group, vector<uint32_t>& v_new_ids, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx)
+{
+    const uint32_t first_id = raw_group ? 0 : 1;
+
+    v_new_ids.assign(v_used.size(), ~0u);
+
+    if (v_used.empty())
+        return true;
+
+    int in_stream_id_delta = src.in_archive->GetStreamId(src.name + ss_delta_ext(archive_version));
+    uint32_t no_parts = in_stream_id_delta >= 0 ? (uint32_t) src.in_archive->GetNoParts(in_stream_id_delta) : 0;
+
+    contig_t ref, pack, seq, ctg;
+    vector<uint32_t> sep_pos;
+    bool same_ref = false;
+
+    if (raw_group)
+        v_new_ids[0] = 0;                   // the empty sequence present in all raw groups
+    else
+    {
+        vector<uint8_t> v_src_ref, v_ref;
+        uint64_t src_ref_metadata = 0;
+        uint64_t ref_metadata = 0;
+
+        same_ref = src.in_archive->GetPart(src.name + ss_ref_ext(archive_version), 0, v_src_ref, src_ref_metadata).second &&
+            in_archive->GetPart(in_name + ss_ref_ext(archive_version), 0, v_ref, ref_metadata).second &&
+            src_ref_metadata == ref_metadata && v_src_ref == v_ref;
+
+        if (same_ref)
+            v_new_ids[0] = 0;
+        else
+        {
+            if (!src.load_ref(ref, zstd_dctx))
+                return false;
+
+            if (v_used[0])
+                v_new_ids[0] = add(ref, zstd_cctx, zstd_dctx);
+        }
+    }
+
+    for (uint32_t part_id = 0; part_id < no_parts; ++part_id)
+    {
+        size_t id = first_id + (size_t) part_id * contigs_in_pack;
+
+        if (id >= v_used.size())
+            break;
+
+        if (!src.load_pack(part_id, pack, sep_pos, zstd_dctx))
+            return false;
+
+        for (size_t k = 0; k + 1 < sep_pos.size() && id < v_used.size(); ++k, ++id)
+        {
+            if (!v_used[id] || v_new_ids[id] != ~0u)
+                continue;
+
+            seq.assign(pack.begin() + sep_pos[k], pack.begin() + (sep_pos[k + 1] - 1));
+
+            if (raw_group)
+                v_new_ids[id] = add_raw(seq, zstd_cctx, zstd_dctx);
+            else if (same_ref)
+            {
+                lock_guard<mutex> lck(mtx);
+
+                if (internal_state == internal_state_t::packed)
+                    unpack(zstd_dctx);
+
+                v_new_ids[id] = add_delta(0, seq, zstd_cctx);         // length of the sequence is not known without decoding (only for statistics)
+            }
+            else
+            {
+                src.lz_diff->Decode(ref, seq.data(), seq.size(), ctg);
+                v_new_ids[id] = add(ctg, zstd_cctx, zstd_dctx);
+            }
+        }
+    }
+
+    return true;
+}
+
 // EOF
@@ -21,6 +21,10 @@
 #include "../common/lz_diff.h"
 #include "../common/archive.h"
 #include "../common/defs.h"
+#include "../common/instrumentation.h"
+#include "../common/zstd_dict.h"
+#include "../common/lz_index_lru.h"
+#include "../common/pack_compressor.h"
 
 using namespace std;
 
@@ -30,7 +34,13 @@ class CSegment
 
     const uint8_t contig_separator = 0xffu;
 
+public:
+    static constexpr int delta_pack_compression_level = 17;
+
+private:
+
     string name;
+    string in_name;                 // name of the group in in_archive when appending (can differ when archives are merged)
     shared_ptr<CArchive> in_archive;
     shared_ptr<CArchive> out_archive;
     uint32_t contigs_in_pack;
@@ -48,9 +58,16 @@ class CSegment
     packed_block_t packed_delta;
     uint64_t raw_ref_seq_size = 0;
     uint64_t raw_delta_size = 0;
-    bool ref_transferred = false;
+    bool in_place = false;
+    bool lazy_ref = false;
+    int lazy_delta_part_id = -1;
+    int open_part_id = -1;          // part of the delta stream holding the open pack (stored at the last checkpoint or reopened in place)
+    uint64_t open_part_no_seqs = 0; // no. of sequences when the open pack was stored (it is not stored again if unchanged)
 
     unique_ptr<CLZDiffBase> lz_diff;
+    shared_ptr<CZSTDDict> zstd_dict;
+    shared_ptr<CLZIndexLRU> lz_index_lru;
+    shared_ptr<CPackCompressor> pack_compressor;
 
     uint32_t no_seqs;
     vector<contig_t> v_lzp;
@@ -69,8 +86,9 @@ private:
     uint64_t packed_size;
     mutex mtx;
 
+public:
     // *******************************************************************************************
-    void bytes2tuples(const vector<uint8_t>& v_bytes, vector<uint8_t>& v_tuples)
+    static void bytes2tuples(const vector<uint8_t>& v_bytes, vector<uint8_t>& v_tuples)
     {
         uint8_t me = 0;
         
@@ -91,7 +109,7 @@ private:
     }
 
     // *******************************************************************************************
-    void tuples2bytes(const vector<uint8_t>& v_tuples, vector<uint8_t>& v_bytes)
+    static void tuples2bytes(const vector<uint8_t>& v_tuples, vector<uint8_t>& v_bytes)
     {
         uint8_t marker = v_tuples.back();
         uint8_t no_bytes = marker >> 4;
@@ -110,9 +128,10 @@ private:
             v_bytes.assign(v_tuples.begin(), v_tuples.begin() + v_tuples.size() - 1u);        
     }
 
+private:
     // *******************************************************************************************
     template<unsigned NO_BYTES, unsigned MULT>
-    void bytes2tuples_impl(const vector<uint8_t>& v_bytes, vector<uint8_t>& v_tuples)
+    static void bytes2tuples_impl(const vector<uint8_t>& v_bytes, vector<uint8_t>& v_tuples)
     {
         v_tuples.reserve((v_bytes.size() - NO_BYTES - 1u) / NO_BYTES + 1);
 
@@ -139,7 +158,7 @@ private:
 
     // *******************************************************************************************
     template<unsigned NO_BYTES, unsigned MULT>
-    void tuples2bytes_impl(const vector<uint8_t>& v_tuples, vector<uint8_t>& v_bytes, const uint32_t output_size)
+    static void tuples2bytes_impl(const vector<uint8_t>& v_tuples, vector<uint8_t>& v_bytes, const uint32_t output_size)
     {
         uint32_t i, j;
 
@@ -169,58 +188,9 @@ private:
     }
 
     // *******************************************************************************************
-    void add_to_archive(const int stream_id, const contig_t& data, const int compression_level, ZSTD_CCtx* zstd_ctx)
+    // References are stored as tuples if they are not too repetitive
+    static bool prefer_tuples(const contig_t& data)
     {
-        size_t a_size = ZSTD_compressBound(data.size());
-        uint8_t *packed = new uint8_t[a_size+1u];
-        uint32_t packed_size = (uint32_t) ZSTD_compressCCtx(zstd_ctx, (void *) packed, a_size, data.data(), data.size(), compression_level);
-        packed[packed_size] = 0;      // ZSTD compression marker - plain (0)
-
-        if(packed_size + 1u < (uint32_t) data.size())
-        {
-            vector<uint8_t> v_packed(packed, packed + packed_size + 1);
-            out_archive->AddPartBuffered(stream_id, v_packed, data.size());
-        }
-        else
-        {
-            out_archive->AddPartBuffered(stream_id, data, 0);
-        }
-
-        delete[] packed;
-    }
-
-    // *******************************************************************************************
-    void add_to_archive_tuples(const int stream_id, const contig_t& data, const int compression_level, ZSTD_CCtx* zstd_ctx)
-    {
-        vector<uint8_t> v_tuples;
-
-        bytes2tuples(data, v_tuples);
-
-        size_t a_size = ZSTD_compressBound(v_tuples.size());
-        uint8_t *packed = new uint8_t[a_size+1u];
-        uint32_t packed_size = (uint32_t) ZSTD_compressCCtx(zstd_ctx, (void *) packed, a_size, v_tuples.data(), v_tuples.size(), compression_level);
-        packed[packed_size] = 1;      // ZSTD compression marker - tuples (1)
-
-        if(packed_size + 1u < (uint32_t) data.size())
-        {
-            vector<uint8_t> v_packed(packed, packed + packed_size + 1);
-            out_archive->AddPartBuffered(stream_id, v_packed, data.size());
-        }
-        else
-        {
-            out_archive->AddPartBuffered(stream_id, data, 0);
-        }
-
-        delete[] packed;
-    }
-
-    // *******************************************************************************************
-    void store_in_archive(const contig_t& data, ZSTD_CCtx* zstd_ctx)
-    { 
-        string stream_name = name + ss_ref_ext(archive_version);
-
-        stream_id_ref = out_archive->RegisterStream(stream_name);
-
         double best_frac = 0.0;
         double frac_limit = 0.5;
 
@@ -248,15 +218,103 @@ private:
             }
         }
 
-        if (best_frac < 0.5)
-            add_to_archive_tuples(stream_id_ref, data, 13, zstd_ctx);
+        return best_frac < 0.5;
+    }
+
+    // *******************************************************************************************
+    // Compress reference or pack of sequences; returns metadata of the part (0 if data are stored as they are)
+    static uint64_t pack_data(const contig_t& data, const bool is_ref, const CZSTDDict* dict, ZSTD_CCtx* zstd_ctx, vector<uint8_t>& v_packed)
+    {
+        AGC_INSTR_SCOPE(zstd_packing);
+
+        bool tuples = is_ref && prefer_tuples(data);
+        int compression_level = is_ref ? (tuples ? 13 : 19) : delta_pack_compression_level;
+
+        vector<uint8_t> v_tuples;
+        const vector<uint8_t>* src = &data;
+
+        if (tuples)
+        {
+            bytes2tuples(data, v_tuples);
+            src = &v_tuples;
+        }
+
+        size_t a_size = ZSTD_compressBound(src->size());
+        uint32_t packed_size;
+
+        v_packed.resize(a_size + 1u);
+
+        if (dict)
+            packed_size = (uint32_t) dict->Compress(zstd_ctx, (void*) v_packed.data(), a_size, src->data(), src->size());
         else
-            add_to_archive(stream_id_ref, data, 19, zstd_ctx);
+            packed_size = (uint32_t) ZSTD_compressCCtx(zstd_ctx, (void *) v_packed.data(), a_size, src->data(), src->size(), compression_level);
+        v_packed[packed_size] = tuples ? 1 : 0;      // ZSTD compression marker - tuples (1) or plain (0)
+
+        AGC_INSTR_COUNT(zstd_packs, 1);
+        AGC_INSTR_COUNT(zstd_raw_bytes, data.size());
+        AGC_INSTR_COUNT(zstd_packed_bytes, packed_size + 1u);
+
+        if(packed_size + 1u < (uint32_t) data.size())
+        {
+            v_packed.resize(packed_size + 1u);
+            return data.size();
+        }
+
+        v_packed.assign(data.begin(), data.end());
+
+        return 0;
     }
 
     // *******************************************************************************************
-    void store_in_archive(const vector<contig_t>& v_data, ZSTD_CCtx* zstd_ctx)
+    // If the pack compressor is set, the place of the part is reserved and the data are compressed in the background
+    void add_to_archive(const int stream_id, contig_t&& data, const bool is_ref, ZSTD_CCtx* zstd_ctx, const bool use_dict = false)
     {
+        shared_ptr<CZSTDDict> dict = (use_dict && zstd_dict && !zstd_dict->Empty()) ? zstd_dict : nullptr;
+
+        if (!pack_compressor)
+        {
+            vector<uint8_t> v_packed;
+            uint64_t metadata = pack_data(data, is_ref, dict.get(), zstd_ctx, v_packed);
+
+            out_archive->AddPartBuffered(stream_id, v_packed, metadata);
+
+            return;
+        }
+
+        int buffer_id = out_archive->AddPartBufferedPrepare(stream_id);
+        size_t size = data.size();
+
+        pack_compressor->Add([archive = out_archive, stream_id, buffer_id, is_ref, dict, data = move(data)](ZSTD_CCtx* cctx) {
+            vector<uint8_t> v_packed;
+            uint64_t metadata = pack_data(data, is_ref, dict.get(), cctx, v_packed);
+
+            archive->AddPartBufferedComplete(stream_id, buffer_id, move(v_packed), metadata);
+            }, size);
+    }
+
+    // *******************************************************************************************
+    uint32_t add_delta(const size_t seq_len, contig_t& delta, ZSTD_CCtx* zstd_cctx);
+
+    // *******************************************************************************************
+    void store_in_archive(const contig_t& data, ZSTD_CCtx* zstd_ctx)
+    { 
+        string stream_name = name + ss_ref_ext(archive_version);
+
+        stream_id_ref = out_archive->RegisterStream(stream_name);
+
+        add_to_archive(stream_id_ref, contig_t(data), true, zstd_ctx);
+    }
+
+    // *******************************************************************************************
+    void store_in_archive(const vector<contig_t>& v_data, ZSTD_CCtx* zstd_ctx, const bool use_dict)
+    {
+        // The open pack already present in the archive is replaced
+        if (open_part_id >= 0)
+        {
+            out_archive->TruncateStream(stream_id_delta, open_part_id);
+            open_part_id = -1;
+        }
+
         contig_t pack;
 
         size_t res_size = v_data.size();
@@ -276,7 +334,7 @@ private:
         if (stream_id_delta < 0)
             stream_id_delta = out_archive->RegisterStream(name + ss_delta_ext(archive_version));
 
-        add_to_archive(stream_id_delta, pack, 17, zstd_ctx);
+        add_to_archive(stream_id_delta, move(pack), false, zstd_ctx, use_dict);
     }
 
     // *******************************************************************************************
@@ -292,12 +350,20 @@ private:
     }
 
     void unpack(ZSTD_DCtx* zstd_ctx);
+    void touch_index();
+
+    void unpack_ref(vector<uint8_t>& zstd_ref_seq, const uint64_t ref_seq_size, contig_t& ref, ZSTD_DCtx* zstd_ctx);
+    void unpack_pack(vector<uint8_t>& zstd_pack, const uint64_t pack_size, contig_t& pack, ZSTD_DCtx* zstd_ctx);
+    void find_separators(const contig_t& pack, vector<uint32_t>& sep_pos) const;
+
+    bool load_ref(contig_t& ref, ZSTD_DCtx* zstd_ctx);
+    bool load_pack(const int part_id, contig_t& pack, vector<uint32_t>& sep_pos, ZSTD_DCtx* zstd_ctx);
 
 public:
     // *******************************************************************************************
     CSegment(const string &_name, shared_ptr<CArchive> _in_archive, shared_ptr<CArchive> _out_archive,
         const uint32_t _contigs_in_pack, const uint32_t _min_match_len, const bool _concatenated_genomes, uint32_t _archive_version, bool fast = false) :
-        name(_name), in_archive(_in_archive), out_archive(_out_archive), 
+        name(_name), in_name(_name), in_archive(_in_archive), out_archive(_out_archive), 
         contigs_in_pack(_contigs_in_pack), min_match_len(_min_match_len), concatenated_genomes(_concatenated_genomes), archive_version(_archive_version), fast(fast),
         no_seqs(0), ref_size(0), seq_size(0), packed_size(0)
     {
@@ -307,35 +373,54 @@ public:
 
         if (_archive_version < 2000)
             lz_diff = make_unique<CLZDiff_V1>();
-        else
+        else if (_archive_version < 3000 || _archive_version % 1000 < AGC_FILE_MINOR_BINARY_LZ)
             lz_diff = make_unique<CLZDiff_V2>();
+        else
+            lz_diff = make_unique<CLZDiff_V3>();
 
         lz_diff->SetMinMatchLen(min_match_len);
     };
 
     ~CSegment()
     {
+        if (lz_index_lru)
+            lz_index_lru->Remove(lz_diff.get());
     }
 
+    void set_zstd_dict(shared_ptr<CZSTDDict> _zstd_dict);
+    void set_lz_index_lru(shared_ptr<CLZIndexLRU> _lz_index_lru);
+    void set_pack_compressor(shared_ptr<CPackCompressor> _pack_compressor);
+    bool get_pending_pack(contig_t& pack);
+
     uint32_t add_raw(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx);
     uint32_t add(const contig_t& s, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx);
+    bool encode(const contig_t& s, contig_t& delta, ZSTD_DCtx* zstd_dctx);
+    uint32_t add_encoded(const contig_t& s, contig_t& delta, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx);
     uint64_t estimate(const contig_t& s, uint32_t bound, ZSTD_DCtx* zstd_dctx);
 
     void get_coding_cost(const contig_t& s, vector<uint32_t> &v_costs, const bool prefix_costs, ZSTD_DCtx* zstd_dctx);
 
     void finish(ZSTD_CCtx* zstd_ctx);
+    void store_checkpoint(ZSTD_CCtx* zstd_ctx);
     bool get_raw(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx);
-    bool get(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx);
+    bool get(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t size_hint = 0);
 
     bool get_raw_locked(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx);
-    bool get_locked(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx);
+    bool get_locked(const uint32_t id_seq, contig_t& ctg, ZSTD_DCtx* zstd_ctx, const uint32_t size_hint = 0);
+
+    bool get_raw_multi(const vector<pair<uint32_t, contig_t*>>& v_req, ZSTD_DCtx* zstd_ctx);
+    bool get_multi(const vector<pair<uint32_t, contig_t*>>& v_req, ZSTD_DCtx* zstd_ctx);
 
     void clear();
     uint64_t get_no_seqs();
 
     size_t get_ref_size() const;
 
-    void appending_init();
+    void appending_init(const bool _in_place = false, const string& _in_name = "");
+
+    static uint32_t no_unchanged_packs(const vector<bool>& v_used, const uint32_t first_id, const uint32_t contigs_in_pack, const uint32_t no_packs);
+    bool subset(CSegment& src, const vector<bool>& v_used, const bool raw_group, const uint32_t no_copied_packs, vector<uint32_t>& v_new_ids, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx);
+    bool merge(CSegment& src, const vector<bool>& v_used, const bool raw_group, vector<uint32_t>& v_new_ids, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx);
 };
 
 // EOF
@@ -0,0 +1,157 @@
+#ifndef _ZSTD_DICT_H
+#define _ZSTD_DICT_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <cinttypes>
+#include <zstd/lib/zstd.h>
+#include <zstd/lib/zdict.h>
+
+using namespace std;
+
+// *******************************************************************************************
+// Trained zstd dictionary with prepared (digested) compression and decompression objects.
+// Frames compressed with the dictionary carry its id, so parts compressed before the dictionary
+// was available (or without it) are still decompressed without it.
+class CZSTDDict
+{
+	vector<uint8_t> dict;
+	ZSTD_CDict* cdict = nullptr;
+	ZSTD_DDict* ddict = nullptr;
+	uint32_t dict_id = 0;
+	int compression_level;
+
+	static constexpr size_t min_dict_size = 256;
+
+	// *******************************************************************************************
+	void release()
+	{
+		if (cdict)
+			ZSTD_freeCDict(cdict);
+		if (ddict)
+			ZSTD_freeDDict(ddict);
+
+		cdict = nullptr;
+		ddict = nullptr;
+		dict_id = 0;
+	}
+
+	// *******************************************************************************************
+	bool prepare()
+	{
+		dict_id = ZDICT_getDictID(dict.data(), dict.size());
+
+		if (dict_id == 0)
+		{
+			dict.clear();
+			return false;
+		}
+
+		cdict = ZSTD_createCDict(dict.data(), dict.size(), compression_level);
+		ddict = ZSTD_createDDict(dict.data(), dict.size());
+
+		if (!cdict || !ddict)
+		{
+			release();
+			dict.clear();
+			return false;
+		}
+
+		return true;
+	}
+
+public:
+	CZSTDDict(const int _compression_level) : compression_level(_compression_level)
+	{}
+
+	CZSTDDict(const CZSTDDict&) = delete;
+	CZSTDDict& operator=(const CZSTDDict&) = delete;
+
+	~CZSTDDict()
+	{
+		release();
+	}
+
+	// *******************************************************************************************
+	bool Train(const vector<vector<uint8_t>>& v_samples, const size_t max_dict_size)
+	{
+		vector<uint8_t> v_concat;
+		vector<size_t> v_sizes;
+
+		for (auto& x : v_samples)
+			if (!x.empty())
+			{
+				v_concat.insert(v_concat.end(), x.begin(), x.end());
+				v_sizes.emplace_back(x.size());
+			}
+
+		release();
+
+		if (v_sizes.size() < 8 || max_dict_size < min_dict_size)
+			return false;
+
+		dict.resize(max_dict_size);
+
+		auto dict_size = ZDICT_trainFromBuffer(dict.data(), dict.size(), v_concat.data(), v_sizes.data(), (unsigned) v_sizes.size());
+
+		if (ZDICT_isError(dict_size))
+		{
+			dict.clear();
+			return false;
+		}
+
+		dict.resize(dict_size);
+		dict.shrink_to_fit();
+
+		return prepare();
+	}
+
+	// *******************************************************************************************
+	bool Load(const vector<uint8_t>& _dict)
+	{
+		release();
+		dict = _dict;
+
+		return prepare();
+	}
+
+	// *******************************************************************************************
+	bool Empty() const
+	{
+		return dict_id == 0;
+	}
+
+	// *******************************************************************************************
+	const vector<uint8_t>& Data() const
+	{
+		return dict;
+	}
+
+	// *******************************************************************************************
+	size_t Compress(ZSTD_CCtx* cctx, void* dst, const size_t dst_capacity, const void* src, const size_t src_size) const
+	{
+		return ZSTD_compress_usingCDict(cctx, dst, dst_capacity, src, src_size, cdict);
+	}
+
+	// *******************************************************************************************
+	// Dictionary is used only if the frame was compressed with it (dict may be nullptr)
+	static size_t Decompress(const CZSTDDict* dict, ZSTD_DCtx* dctx, void* dst, const size_t dst_capacity, const void* src, const size_t src_size)
+	{
+		if (dict != nullptr && dict->dict_id != 0 && ZSTD_getDictID_fromFrame(src, src_size) == dict->dict_id)
+			return ZSTD_decompress_usingDDict(dctx, dst, dst_capacity, src, src_size, dict->ddict);
+
+		return ZSTD_decompressDCtx(dctx, dst, dst_capacity, src, src_size);
+	}
+};
+
+// EOF
+#endif
@@ -50,6 +50,9 @@ CAGCCompressor::CAGCCompressor() : CAGCBasic()
     adaptive_compression = false;
     segment_size = 0;
 
+    lz_index_lru->SetMemoryGovernor(mem_governor);
+    buffered_seg_part.set_memory_governor(mem_governor);
+
     m_file_type_info["producer"] = "agc";
     m_file_type_info["producer_version_major"] = to_string(AGC_VER_MAJOR);
     m_file_type_info["producer_version_minor"] = to_string(AGC_VER_MINOR);
@@ -166,20 +169,30 @@ void CAGCCompressor::store_metadata_impl_v2(uint32_t no_threads)
 }
 
 // *******************************************************************************************
-void CAGCCompressor::store_metadata_impl_v3(uint32_t no_threads)
+// At checkpoints only the contigs of processed samples are stored (the input reader registers contigs ahead)
+void CAGCCompressor::store_metadata_impl_v3(uint32_t no_threads, const bool checkpoint)
 {
-    // Nothing to do here
+    // Collection is stored in batches, only the index of contig hashes remains
+    if (!contig_hash_index)
+        return;
+
+    vector<uint8_t> v_data;
+    auto no_entries = contig_hash_index->Serialize(v_data, checkpoint ? processed_samples : ~0u);
+
+    auto contig_hashes_id = out_archive->RegisterStream("contig-hashes");
+    out_archive->TruncateStream(contig_hashes_id, 0);
+    out_archive->AddPart(contig_hashes_id, v_data, no_entries);
 }
 
 // *******************************************************************************************
-void CAGCCompressor::store_metadata(uint32_t no_threads)
+void CAGCCompressor::store_metadata(uint32_t no_threads, const bool checkpoint)
 {
     if (archive_version < 2000)
         store_metadata_impl_v1(no_threads);
     else if (archive_version < 3000)
         store_metadata_impl_v2(no_threads);
     else
-        store_metadata_impl_v3(no_threads);
+        store_metadata_impl_v3(no_threads, checkpoint);
 
     uint64_t total_size_ref = 0;
     uint64_t total_size_delta = 0;
@@ -213,7 +226,9 @@ void CAGCCompressor::store_metadata(uint32_t no_threads)
     if(archive_version >= 2000)
         append(v_params, compression_params.segment_size);
 
+    // Metadata streams consist of single parts, so in in-place appending mode the previous parts are replaced
     auto compression_params_id = out_archive->RegisterStream("params");
+    out_archive->TruncateStream(compression_params_id, 0);
     out_archive->AddPart(compression_params_id, v_params);
 
     vector<uint8_t> v_tmp;
@@ -222,12 +237,25 @@ void CAGCCompressor::store_metadata(uint32_t no_threads)
         v_hs_splitters.emplace_back(x);
     sort(v_hs_splitters.begin(), v_hs_splitters.end());
 
-    for (auto x : v_hs_splitters)
-        append64(v_tmp, x);
-    auto splitters_id = out_archive->RegisterStream("splitters");
-    out_archive->AddPart(splitters_id, v_tmp, hs_splitters.size());
-    v_hs_splitters.clear();
-    v_hs_splitters.shrink_to_fit();
+    // Since archive version 4 splitters and segment splitters are stored in compact forms (Elias-Fano and columnar).
+    // Archives of older versions keep the legacy streams (also when appended), so AGC 3.x can still extend them.
+    bool compact_splitters = archive_version >= 4000 && CSplittersCodec::EncodeSplitters(v_hs_splitters, kmer_length, v_tmp);
+
+    if (compact_splitters)
+    {
+        auto splitters_id = out_archive->RegisterStream("splitters-ef");
+        out_archive->TruncateStream(splitters_id, 0);
+        out_archive->AddPart(splitters_id, v_tmp, hs_splitters.size());
+    }
+    else
+    {
+        v_tmp.clear();
+        for (auto x : v_hs_splitters)
+            append64(v_tmp, x);
+        auto splitters_id = out_archive->RegisterStream("splitters");
+        out_archive->TruncateStream(splitters_id, 0);
+        out_archive->AddPart(splitters_id, v_tmp, hs_splitters.size());
+    }
 
     uint32_t no_segments_one_side = 0;
     vector<pair<pair<uint64_t, uint64_t>, uint32_t>> v_map_segments;
@@ -241,17 +269,32 @@ void CAGCCompressor::store_metadata(uint32_t no_threads)
     }
     sort(v_map_segments.begin(), v_map_segments.end());
 
-    v_tmp.clear();
-    for (auto& x : v_map_segments)
+    if (compact_splitters)
+    {
+        CSplittersCodec::EncodeSegmentMap(v_map_segments, v_hs_splitters, v_tmp, no_threads);
+
+        auto map_segments_id = out_archive->RegisterStream("segment-splitters-col");
+        out_archive->TruncateStream(map_segments_id, 0);
+        out_archive->AddPart(map_segments_id, v_tmp, map_segments.size());
+    }
+    else
     {
-        append64(v_tmp, x.first.first);
-        append64(v_tmp, x.first.second);
-        append(v_tmp, x.second);
+        v_tmp.clear();
+        for (auto& x : v_map_segments)
+        {
+            append64(v_tmp, x.first.first);
+            append64(v_tmp, x.first.second);
+            append(v_tmp, x.second);
+        }
+        auto map_segments_id = out_archive->RegisterStream("segment-splitters");
+        out_archive->TruncateStream(map_segments_id, 0);
+        out_archive->AddPart(map_segments_id, v_tmp, map_segments.size());
     }
-    auto map_segments_id = out_archive->RegisterStream("segment-splitters");
-    out_archive->AddPart(map_segments_id, v_tmp, map_segments.size());
 
-    if (verbosity > 0 && is_app_mode)
+    v_hs_splitters.clear();
+    v_hs_splitters.shrink_to_fit();
+
+    if (verbosity > 0 && is_app_mode && !checkpoint)
     {
         cerr << endl;
         cerr << "*** Component sizes ***" << endl;
@@ -260,8 +303,12 @@ void CAGCCompressor::store_metadata(uint32_t no_threads)
         cerr << "Raw sequences          : " << total_size_raw << endl;
         cerr << "Delta sequences        : " << total_size_delta - total_size_raw << endl;
         cerr << "Params                 : " << out_archive->GetStreamPackedSize(out_archive->GetStreamId("params")) << endl;
-        cerr << "Splitters              : " << out_archive->GetStreamPackedSize(out_archive->GetStreamId("splitters")) << endl;
-        cerr << "Segment splitters      : " << out_archive->GetStreamPackedSize(out_archive->GetStreamId("segment-splitters")) << endl;
+        cerr << "Splitters              : " << out_archive->GetStreamPackedSize(out_archive->GetStreamId("splitters")) +
+            out_archive->GetStreamPackedSize(out_archive->GetStreamId("splitters-ef")) << endl;
+        cerr << "Segment splitters      : " << out_archive->GetStreamPackedSize(out_archive->GetStreamId("segment-splitters")) +
+            out_archive->GetStreamPackedSize(out_archive->GetStreamId("segment-splitters-col")) << endl;
+        if (contig_hash_index)
+            cerr << "Contig hashes          : " << out_archive->GetStreamPackedSize(out_archive->GetStreamId("contig-hashes")) << endl;
 
         if(archive_version < 2000)
             cerr << "Collection desc.       : " << 
@@ -280,6 +327,8 @@ void CAGCCompressor::store_metadata(uint32_t no_threads)
         cerr << "No. segments           : " << no_segments << endl;
         cerr << "No. one-side segments  : " << no_segments_one_side << endl;
         cerr << "No. only ref. segments : " << no_only_ref_segments << endl;
+        if (contig_hash_index)
+            cerr << "No. duplicated contigs : " << contig_hash_index->GetNoDuplicates() << endl;
     }
 }
 
@@ -296,17 +345,25 @@ void CAGCCompressor::store_file_type_info()
 
     auto s_id = out_archive->RegisterStream("file_type_info");
 
+    out_archive->TruncateStream(s_id, 0);
     out_archive->AddPart(s_id, v_data, m_file_type_info.size());
 }
 
 // *******************************************************************************************
-void CAGCCompressor::appending_init()
+bool CAGCCompressor::appending_init(const uint32_t no_threads)
 {
     no_segments = 0;
+    vector<CArchive::copy_desc_t> v_copy_desc;
 
     if(archive_version >= 3000)
         dynamic_pointer_cast<CCollection_V3>(collection_desc)->prepare_for_appending_load_last_batch();
 
+    if (zstd_delta_dict && !in_place_appending)
+    {
+        auto dict_stream_id = out_archive->RegisterStream("delta-dict");
+        out_archive->AddPart(dict_stream_id, zstd_delta_dict->Data(), 0);
+    }
+
     while (true)
     {
         auto ref_stream_id = in_archive->GetStreamId(ss_ref_name(archive_version, no_segments));
@@ -316,11 +373,32 @@ void CAGCCompressor::appending_init()
             break;
 
         v_segments.emplace_back(make_shared<CSegment>(ss_base(archive_version, no_segments), in_archive, out_archive, pack_cardinality, min_match_len, concatenated_genomes, archive_version));
-        v_segments.back()->appending_init();
+        v_segments.back()->set_zstd_dict(zstd_delta_dict);
+        v_segments.back()->set_lz_index_lru(lz_index_lru);
+        v_segments.back()->set_pack_compressor(pack_compressor);
+        v_segments.back()->appending_init(in_place_appending);
+
+        // Reference and all delta packs except the last one are copied in bulk
+        if (!in_place_appending)
+        {
+            if (ref_stream_id >= 0)
+                v_copy_desc.push_back(CArchive::copy_desc_t{ ref_stream_id, out_archive->GetStreamId(ss_ref_name(archive_version, no_segments)), 0, 1 });
+
+            size_t no_delta_parts = in_archive->GetNoParts(delta_stream_id);
+            if (no_delta_parts > 1)
+                v_copy_desc.push_back(CArchive::copy_desc_t{ delta_stream_id, out_archive->GetStreamId(ss_delta_name(archive_version, no_segments)), 0, no_delta_parts - 1 });
+        }
 
         ++no_segments;
     }
 
+    if (!v_copy_desc.empty() && !out_archive->CopyParts(*in_archive, v_copy_desc, no_threads))
+    {
+        if (is_app_mode)
+            cerr << "Cannot copy archive data\n";
+        return false;
+    }
+
     auto vss = v_segments.size();
     if (!is_power_2(vss))
     {
@@ -330,53 +408,153 @@ void CAGCCompressor::appending_init()
         v_segments.resize(vss);
     }
 
-    auto splitters_stream_id = in_archive->GetStreamId("splitters");
+    if (!load_splitters_from_archive(no_threads))
+    {
+        if (is_app_mode)
+            cerr << "Corrupted splitters in the archive\n";
+        return false;
+    }
+
+    if (!load_contig_hash_index())
+    {
+        if (is_app_mode)
+            cerr << "Corrupted contig hashes in the archive\n";
+        return false;
+    }
+
+    buffered_seg_part.resize(no_segments);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Load splitters and the map of segment splitters (pairs of splitters terminating each group) from in_archive.
+bool CAGCCompressor::load_splitters_from_archive(const uint32_t no_threads)
+{
+    vector<uint64_t> v_splitters;
+    vector<pair<pair<uint64_t, uint64_t>, uint32_t>> v_map_segments;
+
+    if (!read_splitters(*in_archive, v_splitters, v_map_segments, no_threads))
+        return false;
+
+    build_splitter_structures(v_splitters, v_map_segments, no_threads);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Compact streams (archive version 4+) are preferred; legacy streams of raw values are read otherwise.
+// Compact streams in archives of older versions (not known to the readers of these versions) are ignored.
+bool CAGCCompressor::read_splitters(CArchive& archive, vector<uint64_t>& v_splitters, vector<pair<pair<uint64_t, uint64_t>, uint32_t>>& v_map_segments, const uint32_t no_threads)
+{
     vector<uint8_t> v_tmp;
-    uint64_t no_splitters;
-    uint64_t x1, x2;
-    uint32_t x3;
+    uint64_t no_splitters = 0;
+    uint64_t no_stored_segment_maps = 0;
 
-    in_archive->GetPart(splitters_stream_id, v_tmp, no_splitters);
+    v_splitters.clear();
+    v_map_segments.clear();
 
-    auto p = v_tmp.begin();
+    auto splitters_id = archive_version >= 4000 ? archive.GetStreamId("splitters-ef") : -1;
 
-    hs_splitters.clear();
-    for (uint32_t i = 0; i < no_splitters; ++i)
+    if (splitters_id >= 0)
     {
-        read64(p, x1);
-        hs_splitters.insert(x1);
+        if (!archive.GetPart(splitters_id, v_tmp, no_splitters) ||
+            !CSplittersCodec::DecodeSplitters(v_tmp, kmer_length, v_splitters) || v_splitters.size() != no_splitters)
+            return false;
     }
+    else
+    {
+        archive.GetPart(archive.GetStreamId("splitters"), v_tmp, no_splitters);
 
-    bloom_splitters.resize((uint64_t) (no_splitters / 0.25));
-    bloom_splitters.insert(hs_splitters.begin(), hs_splitters.end());
+        no_splitters = min<uint64_t>(no_splitters, v_tmp.size() / 8);
+        v_splitters.resize(no_splitters);
 
-    auto map_segments_id = in_archive->GetStreamId("segment-splitters");
-    uint64_t no_stored_segment_maps;
-    in_archive->GetPart(map_segments_id, v_tmp, no_stored_segment_maps);
+        auto p = v_tmp.begin();
+        for (auto& x : v_splitters)
+            read64(p, x);
+    }
 
-    p = v_tmp.begin();
-    map_segments[make_pair(~0ull, ~0ull)] = 0;
+    auto map_segments_id = archive_version >= 4000 ? archive.GetStreamId("segment-splitters-col") : -1;
 
-    for (uint32_t i = 0; i < no_stored_segment_maps; ++i)
+    if (map_segments_id >= 0)
+    {
+        if (!archive.GetPart(map_segments_id, v_tmp, no_stored_segment_maps) ||
+            !CSplittersCodec::DecodeSegmentMap(v_tmp, v_splitters, v_map_segments, no_threads) || v_map_segments.size() != no_stored_segment_maps)
+            return false;
+    }
+    else
     {
-        read64(p, x1);
-        read64(p, x2);
-        read(p, x3);
+        archive.GetPart(archive.GetStreamId("segment-splitters"), v_tmp, no_stored_segment_maps);
 
-        map_segments[make_pair(x1, x2)] = x3;
+        no_stored_segment_maps = min<uint64_t>(no_stored_segment_maps, v_tmp.size() / 20);
+        v_map_segments.resize(no_stored_segment_maps);
 
-        if (x1 != ~0ull && x2 != ~0ull)
+        auto p = v_tmp.begin();
+        for (auto& x : v_map_segments)
         {
-            map_segments_terminators[x1].emplace_back(x2);
-            if (x1 != x2)
-                map_segments_terminators[x2].emplace_back(x1);
+            read64(p, x.first.first);
+            read64(p, x.first.second);
+            read(p, x.second);
         }
     }
 
-    buffered_seg_part.resize(no_segments);
+    return true;
+}
+
+// *******************************************************************************************
+// The structures are independent, so they are built concurrently (splitter set and bloom filter by many threads)
+void CAGCCompressor::build_splitter_structures(const vector<uint64_t>& v_splitters, const vector<pair<pair<uint64_t, uint64_t>, uint32_t>>& v_map_segments, const uint32_t no_threads)
+{
+    auto fut_map_segments = async(launch::async, [&] {
+        map_segments.reserve(v_map_segments.size() + 1);
+        map_segments[make_pair(~0ull, ~0ull)] = 0;
+
+        for (auto& x : v_map_segments)
+            map_segments[x.first] = x.second;
+    });
 
-    for (auto& term : map_segments_terminators)
-        sort(term.second.begin(), term.second.end());
+    // All (splitter, neighbour) pairs are sorted at once, so the terminator lists are built already sorted
+    auto fut_terminators = async(launch::async, [&] {
+        vector<pair<uint64_t, uint64_t>> v_terminators;
+        v_terminators.reserve(2 * v_map_segments.size());
+
+        for (auto& x : v_map_segments)
+            if (x.first.first != ~0ull && x.first.second != ~0ull)
+            {
+                v_terminators.emplace_back(x.first.first, x.first.second);
+                if (x.first.first != x.first.second)
+                    v_terminators.emplace_back(x.first.second, x.first.first);
+            }
+
+        sort(v_terminators.begin(), v_terminators.end());
+
+        size_t no_distinct = 0;
+        for (size_t i = 0; i < v_terminators.size(); ++i)
+            no_distinct += i == 0 || v_terminators[i].first != v_terminators[i - 1].first;
+
+        map_segments_terminators.reserve(no_distinct);
+
+        for (size_t i = 0; i < v_terminators.size(); )
+        {
+            size_t j;
+            for (j = i + 1; j < v_terminators.size() && v_terminators[j].first == v_terminators[i].first; ++j)
+                ;
+
+            auto& term = map_segments_terminators[v_terminators[i].first];
+            term.reserve(term.size() + j - i);
+            for (; i < j; ++i)
+                term.emplace_back(v_terminators[i].second);
+        }
+    });
+
+    hs_splitters.clear();
+    hs_splitters.insert_parallel(v_splitters, no_threads);
+
+    bloom_splitters.resize((uint64_t) (v_splitters.size() / 0.25));
+    bloom_splitters.insert_parallel(v_splitters, no_threads);
+
+    fut_map_segments.wait();
+    fut_terminators.wait();
 }
 
 // *******************************************************************************************
@@ -447,7 +625,8 @@ bool CAGCCompressor::determine_splitters(const string& reference_file_name, cons
     if (verbosity > 0 && is_app_mode)
         cerr << "Gathering reference k-mers\n";
 
-    q_contigs_data = make_unique<CBoundedQueue<contig_t>>(1, contig_part_size * no_threads * 3);
+    // Parts of the reference queued for k-mer collection are charged to input contigs (and limited by the memory budget)
+    q_contigs_data = make_unique<CBoundedQueue<contig_t>>(1, mem_governor->Share(1.0 / 16, contig_part_size * no_threads * 3));
     vector<thread> v_threads;
 
     start_kmer_collecting_threads(v_threads, no_threads, v_candidate_kmers, v_candidate_kmers_offset);
@@ -465,6 +644,7 @@ bool CAGCCompressor::determine_splitters(const string& reference_file_name, cons
 
             start_pos += part.size() - (kmer_length - 1);
             auto cost = part.size();
+            mem_governor->Add(mem_class_t::input_contigs, cost);
             q_contigs_data->Emplace(move(part), cost);
         }
     }
@@ -513,7 +693,7 @@ bool CAGCCompressor::determine_splitters(const string& reference_file_name, cons
     }
 
     // Determine splitters
-    pq_contigs_raw = make_unique<CBoundedPQueue<contig_t>>(1, 4ull << 30);
+    pq_contigs_raw = make_unique<CBoundedPQueue<contig_t>>(1, mem_governor->Share(0.5, 4ull << 30));
 
     vv_splitters.resize(no_threads);
     vv_fallback_minimizers.resize(no_threads);
@@ -533,7 +713,9 @@ bool CAGCCompressor::determine_splitters(const string& reference_file_name, cons
 
     pq_contigs_raw.release();
 
-    if (!adaptive_compression)
+    if (adaptive_compression)
+        build_reference_kmer_set();
+    else
     {
         v_candidate_kmers.clear();
         v_candidate_kmers.shrink_to_fit();
@@ -579,7 +761,8 @@ bool CAGCCompressor::count_kmers(vector<pair<string, vector<uint8_t>>>& v_contig
     if (verbosity > 0 && is_app_mode)
         cerr << "Gathering reference k-mers\n";
 
-    q_contigs_data = make_unique<CBoundedQueue<contig_t>>(1, contig_part_size * no_threads * 3);
+    // Parts of the reference queued for k-mer collection are charged to input contigs (and limited by the memory budget)
+    q_contigs_data = make_unique<CBoundedQueue<contig_t>>(1, mem_governor->Share(1.0 / 16, contig_part_size * no_threads * 3));
     vector<thread> v_threads;
 
     start_kmer_collecting_threads(v_threads, no_threads, v_candidate_kmers, v_candidate_kmers_offset);
@@ -597,6 +780,7 @@ bool CAGCCompressor::count_kmers(vector<pair<string, vector<uint8_t>>>& v_contig
 
             start_pos += part.size() - (kmer_length - 1);
             auto cost = part.size();
+            mem_governor->Add(mem_class_t::input_contigs, cost);
             q_contigs_data->Emplace(move(part), cost);
         }
     }
@@ -629,14 +813,44 @@ bool CAGCCompressor::count_kmers(vector<pair<string, vector<uint8_t>>>& v_contig
     if (verbosity > 1 && is_app_mode)
         cerr << "No. of singletons: " << v_candidate_kmers.size() - v_candidate_kmers_offset << endl;
 
+    build_reference_kmer_set();
+
     return true;
 }
 
 // *******************************************************************************************
-void CAGCCompressor::enumerate_kmers(contig_t& ctg, vector<uint64_t>& vec)
+// In adaptive mode only membership of k-mers in the reference genome is checked later, so sorted vectors
+// of singletons and duplicated k-mers are replaced by a compact set.
+// K-mer codes are aligned to the highest bits, so they are stored in the set shifted to the lowest bits.
+void CAGCCompressor::build_reference_kmer_set()
 {
-    CKmer kmer(kmer_length, kmer_mode_t::canonical);
+    const uint32_t shift = 64 - 2 * kmer_length;
+    auto is_filler = [&](const uint64_t x) {return x == ~0ull && kmer_length < 32; };
+    auto align = [shift](uint64_t& x) {x >>= shift; };
+
+    v_candidate_kmers.erase(remove_if(v_candidate_kmers.begin() + v_candidate_kmers_offset, v_candidate_kmers.end(), is_filler), v_candidate_kmers.end());
+    v_duplicated_kmers.erase(remove_if(v_duplicated_kmers.begin(), v_duplicated_kmers.end(), is_filler), v_duplicated_kmers.end());
+
+    for_each(v_candidate_kmers.begin() + v_candidate_kmers_offset, v_candidate_kmers.end(), align);
+    for_each(v_duplicated_kmers.begin(), v_duplicated_kmers.end(), align);
+
+    ref_kmers.assign(v_candidate_kmers.begin() + v_candidate_kmers_offset, v_candidate_kmers.end(),
+        v_duplicated_kmers.begin(), v_duplicated_kmers.end(), 2 * kmer_length);
+
+    v_candidate_kmers.clear();
+    v_candidate_kmers.shrink_to_fit();
+    v_candidate_kmers_offset = 0;
+
+    v_duplicated_kmers.clear();
+    v_duplicated_kmers.shrink_to_fit();
+
+    if (verbosity > 1 && is_app_mode)
+        cerr << "No. of reference k-mers: " << ref_kmers.size() << " (" << ref_kmers.memory_usage() << " bytes)" << endl;
+}
 
+// *******************************************************************************************
+void CAGCCompressor::enumerate_kmers(contig_t& ctg, vector<uint64_t>& vec)
+{
     vec.clear();
 
     if (ctg.size() < kmer_length)
@@ -644,20 +858,9 @@ void CAGCCompressor::enumerate_kmers(contig_t& ctg, vector<uint64_t>& vec)
 
     vec.reserve(ctg.size() + 1 - kmer_length);
 
-    kmer.Reset();
-
-    for (auto x : ctg)
-    {
-        if (x > 3)
-            kmer.Reset();
-        else
-        {
-            kmer.insert(x);
-
-            if (kmer.is_full())
-                vec.emplace_back(kmer.data());
-        }
-    }
+    for_each_kmer(ctg, kmer_length, [&](uint64_t, uint64_t kmer_dir, uint64_t kmer_rc) {
+        vec.emplace_back(min(kmer_dir, kmer_rc));
+        });
 }
 
 // *******************************************************************************************
@@ -714,8 +917,6 @@ void CAGCCompressor::start_kmer_collecting_threads(vector<thread> &v_threads, co
     for (uint32_t i = 0; i < n_t; ++i)
         v_threads.emplace_back([&, extra_items] {
 
-        CKmer kmer(kmer_length, kmer_mode_t::canonical);
-
         uint64_t curr_part_id = 0;
         uint64_t j = contig_part_size;
         uint64_t part_start_pos = extra_items;
@@ -727,32 +928,21 @@ void CAGCCompressor::start_kmer_collecting_threads(vector<thread> &v_threads, co
             if (!q_contigs_data->Pop(task))
                 continue;
 
-            kmer.Reset();
-
-            for (auto x : task)
-            {
-                if (x > 3)
-                    kmer.Reset();
-                else
+            for_each_kmer(task, kmer_length, [&](uint64_t, uint64_t kmer_dir, uint64_t kmer_rc) {
+                if (j == contig_part_size)
                 {
-                    kmer.insert(x);
+                    curr_part_id = atomic_fetch_add(&a_part_id, 1);
+                    part_start_pos = extra_items + curr_part_id * contig_part_size;
+                    j = 0;
 
-                    if (kmer.is_full())
-                    {
-                        if (j == contig_part_size)
-                        {
-                            curr_part_id = atomic_fetch_add(&a_part_id, 1);
-                            part_start_pos = extra_items + curr_part_id * contig_part_size;
-                            j = 0;
+                    if (part_start_pos + contig_part_size >= v_kmers.size() && is_app_mode)
+                        cerr << "Problem with v_kmers\n";
+                }
 
-                            if (part_start_pos + contig_part_size >= v_kmers.size() && is_app_mode)
-                                cerr << "Problem with v_kmers\n";
-                        }
+                v_kmers[part_start_pos + j++] = min(kmer_dir, kmer_rc);
+                });
 
-                        v_kmers[part_start_pos + j++] = kmer.data();
-                    }
-                }
-            }
+            mem_governor->Release(mem_class_t::input_contigs, task.size());
         }
 
         });
@@ -761,57 +951,40 @@ void CAGCCompressor::start_kmer_collecting_threads(vector<thread> &v_threads, co
 // *******************************************************************************************
 void CAGCCompressor::find_splitters_in_contig(contig_t& ctg, const vector<uint64_t>::iterator v_begin, const vector<uint64_t>::iterator v_end, vector<uint64_t>& v_splitters, vector<array<uint64_t, 4>> &v_fallbacks)
 {
-    // Initialization to large value to add 1st candidate k-mer
-    uint64_t current_len = segment_size;
+    // 1st candidate k-mer can be at any position
+    uint64_t next_cand_pos = 0;
+    uint64_t next_kmer_pos = 0;         // k-mers overlapping the last splitter are skipped
     vector<uint64_t> v_recent_kmers;
-    CKmer kmer(kmer_length, kmer_mode_t::canonical);
 
     uint64_t prev_splitter = ~0ull;
     vector<pair<uint64_t, bool>> fallback_kmers_in_segment;
 
-    MurMur64Hash mmh;
-
-    kmer.Reset();
+    for_each_kmer(ctg, kmer_length, [&](uint64_t pos, uint64_t kmer_dir, uint64_t kmer_rc) {
+        if (pos < next_kmer_pos)
+            return;
 
-    for (auto x : ctg)
-    {
-        if (x > 3)
-            kmer.Reset();
-        else
-        {
-            kmer.insert(x);
-
-            if (kmer.is_full())
-            {
-                v_recent_kmers.emplace_back(kmer.data());
+        uint64_t d = min(kmer_dir, kmer_rc);
 
-                if (fallback_filter(kmer.data()) && kmer.data_dir() != kmer.data_rc())           // for symmetric kmers orientation in contig is unclear
-                    fallback_kmers_in_segment.emplace_back(kmer.data(), kmer.is_dir_oriented());
+        v_recent_kmers.emplace_back(d);
 
-                if (current_len >= segment_size)
-                {
-                    uint64_t d = kmer.data();
+        if (fallback_filter(d) && kmer_dir != kmer_rc)           // for symmetric kmers orientation in contig is unclear
+            fallback_kmers_in_segment.emplace_back(d, kmer_dir <= kmer_rc);
 
-                    if (binary_search(v_begin, v_end, d))
-                    {
-                        v_splitters.emplace_back(d);
+        if (pos >= next_cand_pos && binary_search(v_begin, v_end, d))
+        {
+            v_splitters.emplace_back(d);
 
-                        for (auto& x : fallback_kmers_in_segment)
-                            v_fallbacks.emplace_back(array<uint64_t, 4>{prev_splitter, d, x.first, (uint64_t)x.second});
+            for (auto& x : fallback_kmers_in_segment)
+                v_fallbacks.emplace_back(array<uint64_t, 4>{prev_splitter, d, x.first, (uint64_t)x.second});
 
-                        fallback_kmers_in_segment.clear();
-                        prev_splitter = d;
+            fallback_kmers_in_segment.clear();
+            prev_splitter = d;
 
-                        current_len = 0;
-                        kmer.Reset();
-                        v_recent_kmers.clear();
-                    }
-                }
-            }
+            next_cand_pos = pos + segment_size;
+            next_kmer_pos = pos + kmer_length;
+            v_recent_kmers.clear();
         }
-
-        ++current_len;
-    }
+        });
 
     // Try add the rightmost candidate k-mer
     for (auto p = v_recent_kmers.rbegin(); p != v_recent_kmers.rend(); ++p)
@@ -906,6 +1079,8 @@ void CAGCCompressor::start_finalizing_threads(vector<thread>& v_threads, const u
 // *******************************************************************************************
 void CAGCCompressor::preprocess_raw_contig(contig_t& ctg)
 {
+    AGC_INSTR_SCOPE(preprocess);
+
     size_t len = ctg.size();
     size_t in_pos = 0;
     size_t out_pos = 0;
@@ -953,10 +1128,15 @@ void CAGCCompressor::preprocess_raw_contig(contig_t& ctg)
 // *******************************************************************************************
 void CAGCCompressor::register_segments(uint32_t n_t)
 {
+    AGC_INSTR_SCOPE(registration);
+
     buffered_seg_part.sort_known(n_t);          
 
     uint32_t no_new = buffered_seg_part.process_new();
 
+    if (raw_clusterer)
+        no_new += buffered_seg_part.cluster_segments(0, *raw_clusterer, n_t, [this](contig_t& s) { reverse_complement(s); });
+
     for (uint32_t i = 0; i < no_new; ++i)
         out_archive->RegisterStreams(ss_ref_name(archive_version, no_segments + i), ss_delta_name(archive_version, no_segments + i));
 
@@ -967,12 +1147,17 @@ void CAGCCompressor::register_segments(uint32_t n_t)
 
     buffered_seg_part.distribute_segments(0, 0, no_raw_groups);
 
-    buffered_seg_part.restart_read_vec();
+    // Only groups with a reference (created in earlier registrations) can be delta-coded in chunks
+    buffered_seg_part.restart_read_vec(n_t, [this](const int32_t group_id) {
+        return group_id >= (int32_t)no_raw_groups && v_segments[group_id] != nullptr;
+        });
 }
 
 // *******************************************************************************************
-void CAGCCompressor::store_segments(ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx)
+void CAGCCompressor::store_segments(ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx, const uint32_t node)
 {
+    AGC_INSTR_SCOPE(store_segments);
+
     string sample_name;
     string contig_name;
     contig_t seg_data;
@@ -985,70 +1170,147 @@ void CAGCCompressor::store_segments(ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx)
 
     vector<segments_to_place_t> buffered_coll_insertions;
 
-    int no_parts = buffered_seg_part.get_no_parts();
+    CBufferedSegPart::store_task_t task;
 
-    while (true)
+    while (buffered_seg_part.get_store_task(task, node))
     {
-        int block_group_id = buffered_seg_part.get_vec_id();
+        int group_id = task.group_id;
         int in_group_id;
+        CBufferedSegPart::split_group_t* split_group = nullptr;
+        uint32_t part_id = 0;
 
-        if (block_group_id < 0)
-            break;
+        AGC_INSTR_COUNT(store_tasks, 1);
 
-        for (int group_id = block_group_id; group_id > block_group_id - CBufferedSegPart::part_id_step; --group_id)
+        // Chunk of a large group: delta-code its segments; the thread completing the last chunk adds all of them
+        if (task.last)
         {
-            if (!buffered_seg_part.is_empty_part(group_id))
-                while (buffered_seg_part.get_part(group_id, kmer1, kmer2, sample_name, contig_name, seg_data, is_rev_comp, seg_part_no))
-                {
-                    if (v_segments[group_id] == nullptr)
-                    {
-                        v_segments[group_id] = make_shared<CSegment>(ss_base(archive_version, group_id), nullptr, out_archive, pack_cardinality, min_match_len, concatenated_genomes, archive_version);
+            AGC_INSTR_COUNT(split_chunks, 1);
 
-                        seg_map_mtx.lock();
+            split_group = &buffered_seg_part.get_split_group(group_id);
 
-                        auto p = map_segments.find(make_pair(kmer1, kmer2));
-                        if (p == map_segments.end())
-                            map_segments[make_pair(kmer1, kmer2)] = group_id;
-                        else if (p->second > group_id)
-                            p->second = group_id;
+            for (uint32_t i = task.first; i < task.last; ++i)
+                split_group->v_encoded[i] = (uint8_t) v_segments[group_id]->encode(buffered_seg_part.peek_part_data(group_id, i), split_group->v_deltas[i], zstd_dctx);
 
-                        if (kmer1 != ~0ull && kmer2 != ~0ull)
-                        {
-                            map_segments_terminators[kmer1].push_back(kmer2);
-                            sort(map_segments_terminators[kmer1].begin(), map_segments_terminators[kmer1].end());
+            if (split_group->no_pending_chunks.fetch_sub(1) != 1)
+                continue;
+        }
 
-                            if (kmer1 != kmer2)
-                            {
-                                map_segments_terminators[kmer2].push_back(kmer1);
-                                sort(map_segments_terminators[kmer2].begin(), map_segments_terminators[kmer2].end());
-                            }
-                        }
+        if (!buffered_seg_part.is_empty_part(group_id))
+            while (buffered_seg_part.get_part(group_id, kmer1, kmer2, sample_name, contig_name, seg_data, is_rev_comp, seg_part_no))
+            {
+                if (v_segments[group_id] == nullptr)
+                {
+                    v_segments[group_id] = make_shared<CSegment>(ss_base(archive_version, group_id), nullptr, out_archive, pack_cardinality, min_match_len, concatenated_genomes, archive_version);
+                    v_segments[group_id]->set_zstd_dict(zstd_delta_dict);
+                    v_segments[group_id]->set_lz_index_lru(lz_index_lru);
+                    v_segments[group_id]->set_pack_compressor(pack_compressor);
 
-                        seg_map_mtx.unlock();
-                    }
+                    seg_map_mtx.lock();
 
-                    if (group_id < (int)no_raw_groups)
-                    {
-                        in_group_id = v_segments[group_id]->add_raw(seg_data, zstd_cctx, zstd_dctx);
-                    }
-                    else
-                        in_group_id = v_segments[group_id]->add(seg_data, zstd_cctx, zstd_dctx);
+                    auto p = map_segments.find(make_pair(kmer1, kmer2));
+                    if (p == map_segments.end())
+                        map_segments[make_pair(kmer1, kmer2)] = group_id;
+                    else if (p->second > group_id)
+                        p->second = group_id;
 
-                    //                    collection_desc->add_segment_placed(sample_name, contig_name, seg_part_no, group_id, in_group_id, is_rev_comp, (uint32_t)seg_data.size());
-                    if (buffered_coll_insertions.size() == max_buff_size)
+                    if (kmer1 != ~0ull && kmer2 != ~0ull)
                     {
-                        collection_desc->add_segments_placed(buffered_coll_insertions);
-                        buffered_coll_insertions.clear();
+                        map_segments_terminators[kmer1].push_back(kmer2);
+                        sort(map_segments_terminators[kmer1].begin(), map_segments_terminators[kmer1].end());
+
+                        if (kmer1 != kmer2)
+                        {
+                            map_segments_terminators[kmer2].push_back(kmer1);
+                            sort(map_segments_terminators[kmer2].begin(), map_segments_terminators[kmer2].end());
+                        }
                     }
 
-                    buffered_coll_insertions.emplace_back(sample_name, contig_name, seg_part_no, group_id, in_group_id, is_rev_comp, (uint32_t)seg_data.size());
+                    seg_map_mtx.unlock();
                 }
-        }
+
+                if (group_id < (int)no_raw_groups)
+                {
+                    in_group_id = v_segments[group_id]->add_raw(seg_data, zstd_cctx, zstd_dctx);
+                }
+                else if (split_group && split_group->v_encoded[part_id])
+                    in_group_id = v_segments[group_id]->add_encoded(seg_data, split_group->v_deltas[part_id], zstd_cctx, zstd_dctx);
+                else
+                    in_group_id = v_segments[group_id]->add(seg_data, zstd_cctx, zstd_dctx);
+
+                ++part_id;
+
+                //                    collection_desc->add_segment_placed(sample_name, contig_name, seg_part_no, group_id, in_group_id, is_rev_comp, (uint32_t)seg_data.size());
+                if (buffered_coll_insertions.size() == max_buff_size)
+                {
+                    collection_desc->add_segments_placed(buffered_coll_insertions);
+                    buffered_coll_insertions.clear();
+                }
+
+                buffered_coll_insertions.emplace_back(sample_name, contig_name, seg_part_no, group_id, in_group_id, is_rev_comp, (uint32_t)seg_data.size());
+            }
     }
 
     collection_desc->add_segments_placed(buffered_coll_insertions);
 }
 
+// *******************************************************************************************
+// Packs of segments and references are compressed by additional threads (about 1/4 of the workers),
+// so the workers filling packs (also under the segment locks) do not run zstd
+void CAGCCompressor::start_pack_compressor(const uint32_t no_threads)
+{
+    if (no_threads > 1)
+        pack_compressor = make_shared<CPackCompressor>(max(1u, no_threads / 4), mem_governor->Share(1.0 / 8, 256ull << 20), mem_governor);
+    else
+        pack_compressor.reset();
+}
+
+// *******************************************************************************************
+// Parts of the archive are buffered in the order of adding, so all pending packs must be compressed first
+void CAGCCompressor::flush_out_buffers()
+{
+    if (pack_compressor)
+        pack_compressor->Wait();
+
+    out_archive->FlushOutBuffers();
+}
+
+// *******************************************************************************************
+// Train zstd dictionary for delta packs using the delta-coded sequences waiting for packing
+void CAGCCompressor::train_delta_dict()
+{
+    vector<contig_t> v_samples;
+    contig_t pack;
+    size_t total_size = 0;
+
+    for (uint32_t i = no_raw_groups; i < no_segments && total_size < max_delta_dict_training_size; ++i)
+        if (v_segments[i] != nullptr && v_segments[i]->get_pending_pack(pack))
+        {
+            total_size += pack.size();
+            v_samples.emplace_back(move(pack));
+        }
+
+    auto dict = make_shared<CZSTDDict>(CSegment::delta_pack_compression_level);
+
+    if (!dict->Train(v_samples, clamp<size_t>(total_size / 32, 1 << 10, max_delta_dict_size)))
+    {
+        // Too little data so far - try again later
+        dict_next_training = processed_samples + dict_training_samples;
+        return;
+    }
+
+    auto dict_stream_id = out_archive->RegisterStream("delta-dict");
+    out_archive->AddPart(dict_stream_id, dict->Data(), 0);
+
+    zstd_delta_dict = dict;
+
+    for (auto& seg : v_segments)
+        if (seg != nullptr)
+            seg->set_zstd_dict(zstd_delta_dict);
+
+    if (verbosity > 1 && is_app_mode)
+        cerr << "Dictionary for delta packs trained (size: " << dict->Data().size() << " B; samples: " << v_samples.size() << ")\n";
+}
+
 // *******************************************************************************************
 void CAGCCompressor::prepare_compressing_stuctures(const uint32_t n_t)
 {
@@ -1088,24 +1350,124 @@ void CAGCCompressor::compressing_stage2_job(uint32_t thread_id, uint32_t n_t)
 
 }
 
+// *******************************************************************************************
+// Register contig in the collection; is_duplicate is set if an identical contig was indexed before, so it must not be compressed
+bool CAGCCompressor::register_contig(const string& sample_name, const string& contig_name, const contig_t& contig, bool& is_duplicate)
+{
+    is_duplicate = false;
+
+    if (!contig_hash_index || !contig_hash_index->IsIndexable(contig))
+        return collection_desc->register_sample_contig(sample_name, contig_name);
+
+    uint32_t sample_id, contig_id;
+
+    if (!dynamic_pointer_cast<CCollection_V3>(collection_desc)->register_sample_contig(sample_name, contig_name, sample_id, contig_id))
+        return false;
+
+    is_duplicate = contig_hash_index->FindOrInsert(CContigHashIndex::Hash(contig), CContigHashIndex::contig_pos_t{ sample_id, contig_id }, no_dedup_rounds);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Copy segment lists of source contigs to their duplicates read in the current synchronization round.
+// Must be called after the round is registered (segments are placed), but before the batch of samples is stored.
+void CAGCCompressor::resolve_contig_aliases()
+{
+    if (!contig_hash_index)
+        return;
+
+    auto collection_desc_v3 = dynamic_pointer_cast<CCollection_V3>(collection_desc);
+
+    bool ok = contig_hash_index->Resolve(no_resolved_dedup_rounds++,
+        [&](const CContigHashIndex::contig_pos_t& pos, vector<segment_desc_t>& v_segments) {
+            return collection_desc_v3->get_contig_segments(pos.sample_id, pos.contig_id, v_segments); },
+        [&](const CContigHashIndex::contig_pos_t& pos, const vector<segment_desc_t>& v_segments) {
+            collection_desc_v3->set_contig_segments(pos.sample_id, pos.contig_id, v_segments); });
+
+    if (!ok && is_app_mode)
+        cerr << "Error: Cannot find the source of a duplicated contig!\n";
+}
+
+// *******************************************************************************************
+// Index of contig hashes is absent in archives created by older versions (deduplication then starts from scratch)
+bool CAGCCompressor::load_contig_hash_index()
+{
+    if (archive_version < 3000)
+        return true;
+
+    contig_hash_index = make_unique<CContigHashIndex>(1000, mem_governor->Share(1.0 / 16, 256ull << 20));
+
+    auto contig_hashes_id = in_archive->GetStreamId("contig-hashes");
+
+    if (contig_hashes_id < 0)
+        return true;
+
+    vector<uint8_t> v_data;
+    uint64_t no_entries;
+
+    return in_archive->GetPart(contig_hashes_id, v_data, no_entries) && contig_hash_index->Deserialize(v_data) && contig_hash_index->GetSize() == no_entries;
+}
+
+// *******************************************************************************************
+// In NUMA mode the first worker of each node copies the splitter structures (so the copy is allocated on its node)
+void CAGCCompressor::replicate_splitters(const uint32_t thread_id)
+{
+    uint32_t node = v_worker_nodes[thread_id];
+
+    if (thread_id > 0 && v_worker_nodes[thread_id - 1] == node)
+        return;
+
+    v_hs_splitters_node[node] = make_unique<hash_set_t>(hs_splitters);
+    v_bloom_splitters_node[node] = make_unique<bloom_set_t>(bloom_splitters);
+}
+
 // *******************************************************************************************
 // Start compressing threads
 void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_barrier &bar, const uint32_t n_t)
 {
     v_threads.clear();
 
+    v_worker_nodes.assign(n_t, 0);
+
+    if (numa_topology)
+    {
+        for (uint32_t i = 0; i < n_t; ++i)
+            v_worker_nodes[i] = numa_topology->NodeOfWorker(i, n_t);
+
+        v_hs_splitters_node.clear();
+        v_hs_splitters_node.resize(numa_topology->NoNodes());
+        v_bloom_splitters_node.clear();
+        v_bloom_splitters_node.resize(numa_topology->NoNodes());
+    }
+
+    buffered_seg_part.set_no_nodes(numa_topology ? numa_topology->NoNodes() : 1);
+
     for (uint32_t i = 0; i < n_t; ++i)
     {
         v_threads.emplace_back([&, i, n_t]() {
+            uint32_t thread_id = i;
+
+            if (numa_topology)
+            {
+                numa_topology->Pin(v_worker_nodes[thread_id]);
+                replicate_splitters(thread_id);
+                bar.arrive_and_wait();
+            }
+
             auto zstd_cctx = ZSTD_createCCtx();
             auto zstd_dctx = ZSTD_createDCtx();
-            uint32_t thread_id = i;
 
             while(true)
             {
                 task_t task;
+                CBoundedPQueue<task_t>::result_t q_res;
+
+                {
+                    AGC_INSTR_SCOPE(queue_wait);
+                    q_res = pq_contigs_desc_working->PopLarge(task);
+                }
 
-                auto q_res = pq_contigs_desc_working->PopLarge(task);
                 if (q_res == CBoundedPQueue<task_t>::result_t::empty)
                     continue;
                 else if (q_res == CBoundedPQueue<task_t>::result_t::completed)
@@ -1129,9 +1491,9 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
 
                     bar.arrive_and_wait();
 
-                    store_segments(zstd_cctx, zstd_dctx);
+                    store_segments(zstd_cctx, zstd_dctx, v_worker_nodes[thread_id]);
 
-                    bar.arrive_and_wait();
+                    bar.arrive_and_wait(instr_phase_t::store_tail_wait);
 
                     if (thread_id == 0)
                     {
@@ -1139,6 +1501,8 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
 
                         if (n_t == 1)
                         {
+                            resolve_contig_aliases();
+
                             if (!concatenated_genomes)
                                 ++processed_samples;
                             else
@@ -1150,10 +1514,15 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
                                     processed_samples = (uint32_t) max_ps;
                             }
 
+                            dict_training_pending = dict_training_samples && zstd_delta_dict == nullptr && processed_samples >= dict_next_training;
+
                             if (archive_version >= 3000 && processed_samples % pack_cardinality == 0)
+                            {
                                 dynamic_pointer_cast<CCollection_V3>(collection_desc)->store_contig_batch(processed_samples - pack_cardinality, processed_samples);
+                                checkpoint_pending = checkpoint_samples && processed_samples >= last_checkpoint_samples + checkpoint_samples;
+                            }
 
-                            out_archive->FlushOutBuffers();
+                            flush_out_buffers();
                         }
 
                         // !!! ???
@@ -1162,6 +1531,8 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
                     }
                     else if (thread_id == 1)
                     {
+                        resolve_contig_aliases();
+
                         if (!concatenated_genomes)
                             ++processed_samples;
                         else
@@ -1173,14 +1544,44 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
                                 processed_samples = (uint32_t) max_ps;
                         }
 
+                        dict_training_pending = dict_training_samples && zstd_delta_dict == nullptr && processed_samples >= dict_next_training;
+
                         if (archive_version >= 3000 && processed_samples % pack_cardinality == 0)
+                        {
                             dynamic_pointer_cast<CCollection_V3>(collection_desc)->store_contig_batch(processed_samples - pack_cardinality, processed_samples);
+                            checkpoint_pending = checkpoint_samples && processed_samples >= last_checkpoint_samples + checkpoint_samples;
+                        }
 
-                        out_archive->FlushOutBuffers();
+                        flush_out_buffers();
                     }
 
                     bar.arrive_and_wait();
 
+                    // Dictionary is trained when all workers wait and the output buffers are flushed,
+                    // so the pending packs do not change and the place of the dictionary in the archive is deterministic
+                    if (dict_training_pending)
+                    {
+                        if (thread_id == 0)
+                            train_delta_dict();
+
+                        bar.arrive_and_wait();
+
+                        if (thread_id == 0)
+                            dict_training_pending = false;
+                    }
+
+                    // Checkpoint is stored when all workers wait, so the state of the compression is consistent
+                    if (checkpoint_pending)
+                    {
+                        if (thread_id == 0)
+                            store_checkpoint(n_t, zstd_cctx);
+
+                        bar.arrive_and_wait();
+
+                        if (thread_id == 0)
+                            checkpoint_pending = false;
+                    }
+
                     continue;
                 }
 
@@ -1233,11 +1634,21 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
 
                     bar.arrive_and_wait();
 
+                    if (numa_topology)
+                    {
+                        replicate_splitters(thread_id);
+                        bar.arrive_and_wait();
+                    }
+
                     continue;
                 }
 
                 if (get<0>(task) == contig_processing_stage_t::all_contigs)
                 {
+                    // Hard contigs are accounted as in work since they were taken from the input queue
+                    mem_governor->Release(mem_class_t::input_contigs, get<3>(task).size());
+                    mem_governor->Add(mem_class_t::contigs_in_work, get<3>(task).size());
+
                     preprocess_raw_contig(get<3>(task));
                 }
 
@@ -1245,6 +1656,8 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
 
                 if (compress_contig(get<0>(task), get<1>(task), get<2>(task), get<3>(task), zstd_cctx, zstd_dctx, thread_id, bar))
                 {
+                    mem_governor->Release(mem_class_t::contigs_in_work, ctg_size);
+
                     auto old_pb = processed_bases.fetch_add(ctg_size);
                     auto new_pb = old_pb + ctg_size;
 
@@ -1275,6 +1688,8 @@ void CAGCCompressor::start_compressing_threads(vector<thread>& v_threads, my_bar
 pair_segment_desc_t CAGCCompressor::add_segment(const string& sample_name, const string& contig_name, uint32_t seg_part_no,
     contig_t &&segment, CKmer kmer_front, CKmer kmer_back, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx, uint32_t thread_id, my_barrier& bar)
 {
+    AGC_INSTR_SCOPE(segment_assignment);
+
     pair<uint64_t, uint64_t> pk, pk2(~0ull, ~0ull);
     contig_t segment_rc;
     contig_t segment2, segment2_rc;
@@ -1819,39 +2234,29 @@ pair<pair<uint64_t, uint64_t>, bool> CAGCCompressor::find_cand_segment_using_fal
     if (!zstd_dctx_for_fallback)
         zstd_dctx_for_fallback = ZSTD_createDCtx();
 
-    CKmer kmer(kmer_length, kmer_mode_t::canonical);
-
     map<pair<uint64_t, uint64_t>, vector<uint64_t>> cand_seg_counts;
 
-    kmer.Reset();
+    for_each_kmer(segment, kmer_length, [&](uint64_t, uint64_t kmer_dir, uint64_t kmer_rc) {
+        uint64_t d = min(kmer_dir, kmer_rc);
 
-    for (auto x : segment)
-    {
-        if (x > 3)
-            kmer.Reset();
-        else
-        {
-            kmer.insert(x);
+        if (!fallback_filter(d))
+            return;
 
-            if (kmer.is_full() && fallback_filter(kmer.data()))
-            {
-                auto p = map_fallback_minimizers.find(kmer.data());
+        auto p = map_fallback_minimizers.find(d);
 
-                if (p != map_fallback_minimizers.end())
+        if (p != map_fallback_minimizers.end())
+        {
+            for (auto y : p->second)
+            {
+                if (y.first != ~0ull && y.second != ~0ull)           // !!! TODO: consider to relax
                 {
-                    for (auto y : p->second)
-                    {
-                        if (y.first != ~0ull && y.second != ~0ull)           // !!! TODO: consider to relax
-                        {
-                            if (!kmer.is_dir_oriented())
-                                swap(y.first, y.second);
-                            cand_seg_counts[y].emplace_back(kmer.data());
-                        }
-                    }
+                    if (kmer_dir > kmer_rc)
+                        swap(y.first, y.second);
+                    cand_seg_counts[y].emplace_back(d);
                 }
             }
         }
-    }
+        });
 
     vector<pair<uint64_t, pair<uint64_t, uint64_t>>> pruned_cand_seg_counts;
 
@@ -1965,75 +2370,80 @@ pair<pair<uint64_t, uint64_t>, bool> CAGCCompressor::find_cand_segment_using_fal
 // *******************************************************************************************
 void CAGCCompressor::add_fallback_mapping(uint64_t splitter1, uint64_t splitter2, const contig_t& segment)
 {
-    CKmer kmer(kmer_length, kmer_mode_t::canonical);
-    MurMur64Hash mmh;
-
     auto splitter_dir = make_pair(splitter1, splitter2);
     auto splitter_rev = make_pair(splitter2, splitter1);
 
-    kmer.Reset();
+    for_each_kmer(segment, kmer_length, [&](uint64_t, uint64_t kmer_dir, uint64_t kmer_rc) {
+        uint64_t d = min(kmer_dir, kmer_rc);
 
-    for (auto x : segment)
-    {
-        if (x > 3)
-            kmer.Reset();
-        else
+        if (fallback_filter(d))
         {
-            kmer.insert(x);
+            auto& mfm_kd = map_fallback_minimizers[d];
+            auto to_add = kmer_dir <= kmer_rc ? splitter_dir : splitter_rev;
 
-            if (kmer.is_full() && fallback_filter(kmer.data()))
-            {
-                auto& mfm_kd = map_fallback_minimizers[kmer.data()];
-                auto to_add = kmer.is_dir_oriented() ? splitter_dir : splitter_rev;
-
-                if (count(mfm_kd.begin(), mfm_kd.end(), to_add) == 0)
-                    mfm_kd.emplace_back(to_add);
-            }
+            if (count(mfm_kd.begin(), mfm_kd.end(), to_add) == 0)
+                mfm_kd.emplace_back(to_add);
         }
-    }
+        });
 }
 
 // *******************************************************************************************
 bool CAGCCompressor::compress_contig(contig_processing_stage_t contig_processing_stage, string sample_name, string id, contig_t& contig, 
     ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx, uint32_t thread_id, my_barrier& bar)
 {
-    CKmer kmer(kmer_length, kmer_mode_t::canonical);
+    AGC_INSTR_SCOPE(contig_scan);
 
-    uint64_t pos = 0;
     uint64_t split_pos = 0;
     CKmer split_kmer(kmer_length, kmer_mode_t::canonical);
     uint32_t seg_part_no = 0;
 
-    for (auto x : contig)
-    {
-        if (x >> 2)         // x > 3
-            kmer.Reset();
-        else
+    // In NUMA mode the replicas of splitter structures of the node of the thread are used
+    auto& hs = numa_topology ? *v_hs_splitters_node[v_worker_nodes[thread_id]] : hs_splitters;
+    auto& bloom = numa_topology ? *v_bloom_splitters_node[v_worker_nodes[thread_id]] : bloom_splitters;
+
+    // K-mers of a block of positions are computed first, so the bloom filter can be probed in a batch (with prefetching)
+    dispatch_kmer_length(kmer_length, [&](auto k_tag) {
+        CKmerScanner<decltype(k_tag)::value> scanner(contig, kmer_length);
+        uint64_t a_kmers[scan_block_size];
+        uint64_t a_pos[scan_block_size];
+        uint64_t a_hashes[scan_block_size];
+        uint64_t next_kmer_pos = 0;         // k-mers overlapping the last splitter are skipped
+
+        while (!scanner.Done())
         {
-            kmer.insert_canonical(x);           // a bit faster than insert()
+            uint32_t n = scanner.NextBlock(scan_block_size, a_kmers, a_pos);
 
-            if (kmer.is_full())
+            for (uint32_t i = 0; i < n; ++i)
             {
-                uint64_t d = kmer.data_canonical();     // a bit faster than data()
-                if (bloom_splitters.check(d) && hs_splitters.check(d))
-                {
-                    auto seg_id = add_segment(sample_name, id, seg_part_no,
-                        move(get_part(contig, split_pos, pos + 1 - split_pos)), split_kmer, kmer, zstd_cctx, zstd_dctx, thread_id, bar);
+                a_hashes[i] = bloom.hash(a_kmers[i]);
+                bloom.prefetch(a_hashes[i]);
+            }
 
-                    ++seg_part_no;
+            for (uint32_t i = 0; i < n; ++i)
+            {
+                if (a_pos[i] < next_kmer_pos || !bloom.check_hashed(a_hashes[i]) || !hs.check(a_kmers[i]))
+                    continue;
 
-                    if (seg_id.contains_second)
-                        ++seg_part_no;
+                uint64_t pos = a_pos[i];
+                CKmer kmer(kmer_length, kmer_mode_t::canonical);
 
-                    split_pos = pos + 1 - kmer_length;
-                    split_kmer = kmer;
-                    kmer.Reset();
-                }
+                for (uint64_t j = pos + 1 - kmer_length; j <= pos; ++j)
+                    kmer.insert_canonical(contig[j]);
+
+                auto seg_id = add_segment(sample_name, id, seg_part_no,
+                    move(get_part(contig, split_pos, pos + 1 - split_pos)), split_kmer, kmer, zstd_cctx, zstd_dctx, thread_id, bar);
+
+                ++seg_part_no;
+
+                if (seg_id.contains_second)
+                    ++seg_part_no;
+
+                split_pos = pos + 1 - kmer_length;
+                split_kmer = kmer;
+                next_kmer_pos = pos + kmer_length;
             }
         }
-
-        ++pos;
-    }
+        });
 
     if (adaptive_compression && contig_processing_stage == contig_processing_stage_t::all_contigs && split_kmer == CKmer(kmer_length, kmer_mode_t::canonical))
     {
@@ -2053,28 +2463,18 @@ bool CAGCCompressor::compress_contig(contig_processing_stage_t contig_processing
 // *******************************************************************************************
 void CAGCCompressor::find_new_splitters(contig_t& ctg, uint32_t thread_id)
 {
+    AGC_INSTR_SCOPE(new_splitters);
+
     vector<uint64_t> v_contig_kmers;
-    vector<uint64_t> v_tmp;
 
     enumerate_kmers(ctg, v_contig_kmers);
     sort(v_contig_kmers.begin(), v_contig_kmers.end());
     remove_non_singletons(v_contig_kmers, 0);
 
-    v_tmp.resize(v_contig_kmers.size());
-
-    // Exclude k-mers in reference genome - singletons
-    auto p_end = set_difference(v_contig_kmers.begin(), v_contig_kmers.end(),
-        v_candidate_kmers.begin() + v_candidate_kmers_offset, v_candidate_kmers.end(),
-        v_tmp.begin());
-
-    v_tmp.erase(p_end, v_tmp.end());
-
-    // Exclude k-mers in reference genome - duplicated
-    p_end = set_difference(v_tmp.begin(), v_tmp.end(),
-        v_duplicated_kmers.begin(), v_duplicated_kmers.end(),
-        v_contig_kmers.begin());
-
-    v_contig_kmers.erase(p_end, v_contig_kmers.end());
+    // Exclude k-mers in reference genome (singletons and duplicated)
+    v_contig_kmers.erase(remove_if(v_contig_kmers.begin(), v_contig_kmers.end(), [&](const uint64_t x) {
+        return ref_kmers.check(x >> (64 - 2 * kmer_length));
+        }), v_contig_kmers.end());
 
     add_fallback_kmers(v_contig_kmers.begin(), v_contig_kmers.end());
 
@@ -2090,27 +2490,64 @@ contig_t CAGCCompressor::get_part(const contig_t& contig, uint64_t pos, uint64_t
         return contig_t(contig.begin() + pos, contig.end());
 }
 
+// *******************************************************************************************
+// Store the state of the compression at the boundary of sample batches, so the archive is valid (up to the processed
+// samples) if the compression is interrupted later and can be resumed by in-place appending. Workers must be idle.
+void CAGCCompressor::store_checkpoint(const uint32_t no_threads, ZSTD_CCtx* zstd_cctx)
+{
+    AGC_INSTR_SCOPE(checkpoint);
+
+    // Parts of open packs stored at the previous checkpoint are replaced, so pending packs must be stored first
+    flush_out_buffers();
+
+    for (uint32_t i = 0; i < no_segments; ++i)
+        v_segments[i]->store_checkpoint(zstd_cctx);
+
+    flush_out_buffers();
+
+    store_metadata(no_threads, true);
+    dynamic_pointer_cast<CCollection_V3>(collection_desc)->complete_serialization(processed_samples);
+    store_file_type_info();
+
+    if (!out_archive->Checkpoint())
+    {
+        if (is_app_mode)
+            cerr << "Cannot store checkpoint in " << out_archive_name << endl;
+    }
+    else if (verbosity > 0 && is_app_mode)
+        cerr << "Checkpoint after " << processed_samples << " samples\n";
+
+    last_checkpoint_samples = processed_samples;
+}
+
 // *******************************************************************************************
 bool CAGCCompressor::close_compression(const uint32_t no_threads)
 {
     if (working_mode != working_mode_t::compression && working_mode != working_mode_t::appending)
         return false;
 
+    AGC_INSTR_SCOPE(finalization);
+
     vector<thread> v_threads;
 
     start_finalizing_threads(v_threads, no_threads);
     join_threads(v_threads);
 
-    out_archive->FlushOutBuffers();
+    flush_out_buffers();
+    pack_compressor.reset();
 
     store_metadata(no_threads);
 
+    if (is_app_mode && (verbosity > 0 || mem_governor->Budget()))
+        mem_governor->Print(cerr);
+
     if(archive_version >= 3000)
         dynamic_pointer_cast<CCollection_V3>(collection_desc)->complete_serialization();
 
     store_file_type_info();
 
-    return true;
+    // In in-place appending mode closing the archive commits the new data
+    return out_archive->Close();
 }
 
 // *******************************************************************************************
@@ -2118,11 +2555,22 @@ bool CAGCCompressor::close_compression(const uint32_t no_threads)
 bool CAGCCompressor::AddSampleFiles(vector<pair<string, string>> _v_sample_file_name, const uint32_t no_threads)
 {
     if (_v_sample_file_name.empty())
+    {
+        // The last incomplete batch of samples loaded from the input archive must be stored again
+        if (archive_version >= 3000 && in_archive != nullptr)
+        {
+            auto no_samples = (uint32_t) dynamic_pointer_cast<CCollection_V3>(collection_desc)->get_no_samples();
+
+            if (no_samples % pack_cardinality != 0)
+                dynamic_pointer_cast<CCollection_V3>(collection_desc)->store_contig_batch(no_samples / pack_cardinality * pack_cardinality, no_samples);
+        }
+
         return true;
+    }
 
     processed_bases = 0;
 
-    size_t queue_capacity = max(2ull << 30, no_threads * (192ull << 20));
+    size_t queue_capacity = mem_governor->Share(0.5, max(2ull << 30, no_threads * (192ull << 20)));
 
     pq_contigs_desc = make_shared<CBoundedPQueue<task_t>>(1, queue_capacity);
     pq_contigs_desc_aux = make_shared<CBoundedPQueue<task_t>>(1, ~0ull);
@@ -2152,10 +2600,41 @@ bool CAGCCompressor::AddSampleFiles(vector<pair<string, string>> _v_sample_file_
     else
         processed_samples = 0;
 
+    last_checkpoint_samples = processed_samples;
+    dict_next_training = processed_samples + dict_training_samples;
+
     if (concatenated_genomes)
         cnt_contigs_in_sample = processed_samples % pack_cardinality;
 
     size_t num_empty_input = 0; 
+
+    auto read_contig = [&] {
+        AGC_INSTR_SCOPE(read_input);
+
+        if (!gio.ReadContigRaw(id, contig))
+            return false;
+
+        AGC_INSTR_COUNT(contigs, 1);
+        AGC_INSTR_COUNT(bases, contig.size());
+
+        return true;
+        };
+
+    // Duplicates of already indexed contigs are not compressed (their segment lists are copied at registration)
+    bool is_duplicate = false;
+
+    auto enqueue_contig = [&](const string& sample_name) {
+        if (!is_duplicate)
+        {
+            auto cost = contig.size();
+            mem_governor->WaitForRoom(cost);
+            mem_governor->Add(mem_class_t::input_contigs, cost);
+            pq_contigs_desc->Emplace(make_tuple(contig_processing_stage_t::all_contigs, sample_name, id, move(contig)), sample_priority, cost);
+        }
+
+        AGC_INSTR_COUNT(dup_contigs, is_duplicate ? 1 : 0);
+        contig.clear();
+        };
     
     for(auto sf : _v_sample_file_name)
     {
@@ -2175,23 +2654,22 @@ bool CAGCCompressor::AddSampleFiles(vector<pair<string, string>> _v_sample_file_
         bool any_contigs_read = false;
         bool any_contigs_added = false;
         
-        while (gio.ReadContigRaw(id, contig))
+        while (read_contig())
         {
             if (concatenated_genomes)
             {
-                if (!collection_desc->register_sample_contig("", id))
+                if (!register_contig("", id, contig, is_duplicate))
                     cerr << "Error: Pair sample_name:contig_name " << id << ":" << id << " is already in the archive!\n";
                 else
                 {
-                    auto cost = contig.size();
-                    pq_contigs_desc->Emplace(make_tuple(contig_processing_stage_t::all_contigs, "", id, move(contig)), sample_priority, cost);
-                    contig.clear();
+                    enqueue_contig("");
 
                     if (++cnt_contigs_in_sample >= max_no_contigs_before_synchronization)
                     {
                         // Send synchronization tokens
                         pq_contigs_desc->EmplaceManyNoCost(make_tuple(
                             adaptive_compression ? contig_processing_stage_t::new_splitters : contig_processing_stage_t::registration, "", "", contig_t()), sample_priority, no_workers);
+                        ++no_dedup_rounds;
 
                         cnt_contigs_in_sample = 0;
                         --sample_priority;
@@ -2202,11 +2680,9 @@ bool CAGCCompressor::AddSampleFiles(vector<pair<string, string>> _v_sample_file_
             }
             else
             {
-                if (collection_desc->register_sample_contig(sf.first, id))
+                if (register_contig(sf.first, id, contig, is_duplicate))
                 {
-                    auto cost = contig.size();
-                    pq_contigs_desc->Emplace(make_tuple(contig_processing_stage_t::all_contigs, sf.first, id, move(contig)), sample_priority, cost);
-                    contig.clear();
+                    enqueue_contig(sf.first);
                     any_contigs_added = true;
                 }
                 else
@@ -2231,6 +2707,7 @@ bool CAGCCompressor::AddSampleFiles(vector<pair<string, string>> _v_sample_file_
             pq_contigs_desc->EmplaceManyNoCost(make_tuple(
                 adaptive_compression ? contig_processing_stage_t::new_splitters : contig_processing_stage_t::registration,
                 "", "", contig_t()), sample_priority, no_workers);
+            ++no_dedup_rounds;
 
             --sample_priority;
         }
@@ -2243,6 +2720,7 @@ bool CAGCCompressor::AddSampleFiles(vector<pair<string, string>> _v_sample_file_
         // Send synchronization tokens
         pq_contigs_desc->EmplaceManyNoCost(make_tuple(
             adaptive_compression ? contig_processing_stage_t::new_splitters : contig_processing_stage_t::registration, "", "", contig_t()), sample_priority, no_workers);
+        ++no_dedup_rounds;
 
         cnt_contigs_in_sample = 0;
         --sample_priority;
@@ -2258,7 +2736,7 @@ bool CAGCCompressor::AddSampleFiles(vector<pair<string, string>> _v_sample_file_
     if (archive_version >= 3000 && processed_samples % pack_cardinality != 0)
         dynamic_pointer_cast<CCollection_V3>(collection_desc)->store_contig_batch((processed_samples / pack_cardinality) * pack_cardinality, processed_samples);
 
-    out_archive->FlushOutBuffers();
+    flush_out_buffers();
 
     pq_contigs_desc.reset();
     pq_contigs_desc_aux.reset();
@@ -2276,6 +2754,10 @@ bool CAGCCompressor::Create(const string& _file_name, const uint32_t _pack_cardi
     if (working_mode != working_mode_t::none)
         return false;
 
+#ifdef AGC_INSTRUMENTATION
+    CInstrumentation::Instance().Reset();
+#endif
+
     pack_cardinality = _pack_cardinality;
     kmer_length = _kmer_length;
     min_match_len = _min_match_len;
@@ -2285,6 +2767,7 @@ bool CAGCCompressor::Create(const string& _file_name, const uint32_t _pack_cardi
     verbosity = _verbosity;
     fallback_frac = _fallback_frac;
     fallback_filter.reset(fallback_frac);
+    out_archive_name = _file_name;
     
     if (!determine_splitters(reference_file_name, _segment_size, no_threads))
     {
@@ -2301,13 +2784,19 @@ bool CAGCCompressor::Create(const string& _file_name, const uint32_t _pack_cardi
     
     working_mode = working_mode_t::compression;
 
-    if (archive_version >= 3000 && archive_version < 4000)
+    if (archive_version >= 3000 && archive_version < 5000)
+    {
         dynamic_pointer_cast<CCollection_V3>(collection_desc)->set_archives(nullptr, out_archive, no_threads, pack_cardinality, segment_size, kmer_length);
+        dynamic_pointer_cast<CCollection_V3>(collection_desc)->set_dict_training(dict_training_samples > 0);
+        contig_hash_index = make_unique<CContigHashIndex>(1000, mem_governor->Share(1.0 / 16, 256ull << 20));
+    }
 
     no_samples_in_archive = 0;
 
     map_segments[std::make_pair(~0ull, ~0ull)] = 0;
 
+    start_pack_compressor(no_threads);
+
     v_segments.resize(no_raw_groups);
 
     for (no_segments = 0; no_segments < no_raw_groups; ++no_segments)
@@ -2317,6 +2806,7 @@ bool CAGCCompressor::Create(const string& _file_name, const uint32_t _pack_cardi
         out_archive->RegisterStream(ss_delta_name(archive_version, no_segments));
 
         v_segments[no_segments] = make_shared<CSegment>(ss_base(archive_version, no_segments), nullptr, out_archive, pack_cardinality, min_match_len, concatenated_genomes, archive_version);
+        v_segments[no_segments]->set_pack_compressor(pack_compressor);
         v_segments[no_segments]->add_raw(empty_ctg, nullptr, nullptr);		// To ensure that raw (special) segments are present in the archive
     }
 
@@ -2327,15 +2817,21 @@ bool CAGCCompressor::Create(const string& _file_name, const uint32_t _pack_cardi
 }
 
 // *******************************************************************************************
+// In in-place mode (_out_archive_fn is ignored) only new parts and a new footer are appended to the input archive
 bool CAGCCompressor::Append(const string& _in_archive_fn, const string& _out_archive_fn, const uint32_t _verbosity, const bool _prefetch_archive, const bool _concatenated_genomes, const bool _adaptive_compression,
-    const uint32_t no_threads, double _fallback_frac)
+    const uint32_t no_threads, double _fallback_frac, const bool _in_place)
 {
     if (working_mode != working_mode_t::none)
         return false;
 
+#ifdef AGC_INSTRUMENTATION
+    CInstrumentation::Instance().Reset();
+#endif
+
+    in_place_appending = _in_place;
     in_archive_name = _in_archive_fn;
-    out_archive_name = _out_archive_fn;
-    prefetch_archive = _prefetch_archive;
+    out_archive_name = in_place_appending ? _in_archive_fn : _out_archive_fn;
+    prefetch_archive = _prefetch_archive && !in_place_appending;            // only small part of the archive is read in in-place mode
     concatenated_genomes = _concatenated_genomes;
     adaptive_compression = _adaptive_compression;
     fallback_frac = _fallback_frac;
@@ -2352,21 +2848,44 @@ bool CAGCCompressor::Append(const string& _in_archive_fn, const string& _out_arc
         return false;
     working_mode = working_mode_t::appending;
 
+    if (in_place_appending && archive_version < 3000)
+    {
+        if (is_app_mode)
+            cerr << "In-place appending is supported only for archives in version 3.0 or newer\n";
+        working_mode = working_mode_t::none;
+        return false;
+    }
+
+    // Readers of older formats cannot decode the dictionary-compressed streams
+    if (dict_training_samples && archive_version < 4000)
+    {
+        if (is_app_mode)
+            cerr << "Dictionaries are supported only for archives in version 4.0 or newer\n";
+        working_mode = working_mode_t::none;
+        return false;
+    }
+
     out_archive = make_shared<CArchive>(false, 32 << 20);
 
-    if (!out_archive->Open(out_archive_name))
+    if (!(in_place_appending ? out_archive->OpenForAppending(out_archive_name) : out_archive->Open(out_archive_name)))
         return false;
 
-    // !!! TODO (future): Add moving part of archive to the new one
-    if (archive_version >= 3000 && archive_version < 4000)
-        dynamic_pointer_cast<CCollection_V3>(collection_desc)->set_archives(in_archive, out_archive, no_threads, pack_cardinality, segment_size, kmer_length);
+    if (archive_version >= 3000 && archive_version < 5000)
+    {
+        if (!dynamic_pointer_cast<CCollection_V3>(collection_desc)->set_archives(in_archive, out_archive, no_threads, pack_cardinality, segment_size, kmer_length, in_place_appending))
+            return false;
+        dynamic_pointer_cast<CCollection_V3>(collection_desc)->set_dict_training(dict_training_samples > 0);
+    }
 
     no_samples_in_archive = collection_desc->get_no_samples();
 
     if (adaptive_compression)
         build_candidate_kmers_from_archive(no_threads);
 
-    appending_init();
+    start_pack_compressor(no_threads);
+
+    if (!appending_init(no_threads))
+        return false;
 
     working_mode = working_mode_t::appending;
 
@@ -2374,27 +2893,847 @@ bool CAGCCompressor::Append(const string& _in_archive_fn, const string& _out_arc
 }
 
 // *******************************************************************************************
-void CAGCCompressor::AddCmdLine(const string& cmd_line)
+// Store in a new archive only the selected samples (all except the listed ones if exclude is set).
+// Splitters are reused and groups not used by the selected samples are removed. Reference sequences are
+// copied as they are (delta-coded sequences are relative to them), delta packs are copied byte-for-byte
+// as long as no sequence is removed from them or from preceding packs, the other packs are repacked.
+bool CAGCCompressor::Subset(const string& _in_archive_fn, const string& _out_archive_fn, const vector<string>& v_sample_names, const bool exclude, const uint32_t _verbosity, const uint32_t no_threads)
 {
-    if (working_mode != working_mode_t::compression && working_mode != working_mode_t::appending)
-        return;
+    if (working_mode != working_mode_t::none)
+        return false;
 
-    collection_desc->add_cmd_line(cmd_line);
-}
+    in_archive_name = _in_archive_fn;
+    out_archive_name = _out_archive_fn;
+    prefetch_archive = false;
+    verbosity = _verbosity;
 
-// *******************************************************************************************
-bool CAGCCompressor::Close(const uint32_t no_threads)
-{
-    bool r = true;
+    if (!load_file_type_info(in_archive_name))
+        return false;
 
-    if (working_mode == working_mode_t::none)
-        r = false;
-    else if (working_mode == working_mode_t::compression)
-        r = close_compression(no_threads);
-    else if (working_mode == working_mode_t::appending)
-        r = close_compression(no_threads);
+    if (!load_metadata())
+        return false;
 
-    working_mode = working_mode_t::none;
+    if (archive_version < 3000)
+    {
+        if (is_app_mode)
+            cerr << "Subsetting is supported only for archives in version 3.0 or newer\n";
+        return false;
+    }
+
+    auto in_collection = dynamic_pointer_cast<CCollection_V3>(collection_desc);
+    if (!in_collection->set_archives(in_archive, nullptr, no_threads, pack_cardinality, segment_size, kmer_length))
+        return false;
+
+    // Selected samples (in the archive order)
+    vector<string> v_all_samples;
+    vector<string> v_samples;
+    in_collection->get_samples_list(v_all_samples, false);
+
+    unordered_set<string> s_names(v_sample_names.begin(), v_sample_names.end());
+    unordered_set<string> s_all_samples(v_all_samples.begin(), v_all_samples.end());
+
+    for (auto& x : s_names)
+        if (!s_all_samples.count(x))
+        {
+            if (is_app_mode)
+                cerr << "No sample " << x << " in the archive\n";
+            return false;
+        }
+
+    for (auto& x : v_all_samples)
+        if ((bool) s_names.count(x) != exclude)
+            v_samples.emplace_back(x);
+
+    if (v_samples.empty())
+    {
+        if (is_app_mode)
+            cerr << "No samples selected\n";
+        return false;
+    }
+
+    uint32_t no_in_groups = 0;
+    while (in_archive->GetStreamId(ss_ref_name(archive_version, no_in_groups)) >= 0 || in_archive->GetStreamId(ss_delta_name(archive_version, no_in_groups)) >= 0)
+        ++no_in_groups;
+
+    // Determine sequences used by the selected samples
+    vector<vector<bool>> vv_used(no_in_groups);
+    vector<pair<string, vector<segment_desc_t>>> sample_desc;
+
+    for (auto& sample_name : v_samples)
+    {
+        in_collection->get_sample_desc(sample_name, sample_desc);
+
+        for (auto& contig : sample_desc)
+            for (auto& seg : contig.second)
+            {
+                if (seg.group_id >= no_in_groups)
+                {
+                    if (is_app_mode)
+                        cerr << "Corrupted archive (no group " << seg.group_id << ")\n";
+                    return false;
+                }
+
+                auto& v_used = vv_used[seg.group_id];
+                if (seg.in_group_id >= v_used.size())
+                    v_used.resize(seg.in_group_id + 1, false);
+                v_used[seg.in_group_id] = true;
+            }
+    }
+
+    // Raw groups are always kept, other groups only if used. The first sequence of a group
+    // (the reference or the empty sequence in raw groups) is always kept.
+    vector<uint32_t> v_group_map(no_in_groups, ~0u);
+    no_segments = 0;
+
+    for (uint32_t i = 0; i < no_in_groups; ++i)
+        if (i < no_raw_groups || !vv_used[i].empty())
+        {
+            v_group_map[i] = no_segments++;
+
+            if (vv_used[i].empty())
+                vv_used[i].resize(1);
+            vv_used[i][0] = true;
+        }
+
+    out_archive = make_shared<CArchive>(false, 32 << 20);
+
+    if (!out_archive->Open(out_archive_name))
+    {
+        if (is_app_mode)
+            cerr << "Cannot open output archive " << out_archive_name << endl;
+        return false;
+    }
+
+    auto out_collection = make_shared<CCollection_V3>();
+    if (!out_collection->set_archives(nullptr, out_archive, no_threads, pack_cardinality, segment_size, kmer_length))
+        return false;
+
+    if (zstd_delta_dict)
+    {
+        auto dict_stream_id = out_archive->RegisterStream("delta-dict");
+        out_archive->AddPart(dict_stream_id, zstd_delta_dict->Data(), 0);
+    }
+
+    // References and unchanged delta packs are copied in bulk
+    vector<CArchive::copy_desc_t> v_copy_desc;
+    vector<uint32_t> v_no_copied_packs(no_in_groups, 0);
+
+    for (uint32_t i = 0; i < no_in_groups; ++i)
+    {
+        if (v_group_map[i] == ~0u)
+            continue;
+
+        auto in_ref_stream_id = in_archive->GetStreamId(ss_ref_name(archive_version, i));
+        auto in_delta_stream_id = in_archive->GetStreamId(ss_delta_name(archive_version, i));
+
+        if (in_ref_stream_id >= 0)
+            v_copy_desc.push_back(CArchive::copy_desc_t{ in_ref_stream_id, out_archive->RegisterStream(ss_ref_name(archive_version, v_group_map[i])), 0, 1 });
+
+        if (in_delta_stream_id >= 0)
+        {
+            auto out_delta_stream_id = out_archive->RegisterStream(ss_delta_name(archive_version, v_group_map[i]));
+
+            v_no_copied_packs[i] = CSegment::no_unchanged_packs(vv_used[i], i < no_raw_groups ? 0 : 1, pack_cardinality, (uint32_t) in_archive->GetNoParts(in_delta_stream_id));
+
+            if (v_no_copied_packs[i])
+                v_copy_desc.push_back(CArchive::copy_desc_t{ in_delta_stream_id, out_delta_stream_id, 0, v_no_copied_packs[i] });
+        }
+    }
+
+    if (!v_copy_desc.empty() && !out_archive->CopyParts(*in_archive, v_copy_desc, no_threads))
+    {
+        if (is_app_mode)
+            cerr << "Cannot copy archive data\n";
+        return false;
+    }
+
+    // Remaining packs are repacked in parallel (in chunks of groups to limit the size of buffered parts)
+    vector<vector<uint32_t>> vv_new_ids(no_in_groups);
+    const uint32_t chunk_size = 1024;
+    atomic<bool> repack_ok = true;
+
+    for (uint32_t chunk_begin = 0; chunk_begin < no_in_groups; chunk_begin += chunk_size)
+    {
+        uint32_t chunk_end = min(chunk_begin + chunk_size, no_in_groups);
+        atomic<uint32_t> next_group = chunk_begin;
+
+        vector<thread> v_threads;
+        v_threads.reserve(no_threads);
+
+        for (uint32_t j = 0; j < no_threads; ++j)
+            v_threads.emplace_back([&] {
+                ZSTD_CCtx* zstd_cctx = ZSTD_createCCtx();
+                ZSTD_DCtx* zstd_dctx = ZSTD_createDCtx();
+
+                for (uint32_t i = next_group++; i < chunk_end; i = next_group++)
+                {
+                    if (v_group_map[i] == ~0u)
+                        continue;
+
+                    CSegment src_segment(ss_base(archive_version, i), in_archive, nullptr, pack_cardinality, min_match_len, false, archive_version);
+                    CSegment dest_segment(ss_base(archive_version, v_group_map[i]), nullptr, out_archive, pack_cardinality, min_match_len, false, archive_version);
+
+                    src_segment.set_zstd_dict(zstd_delta_dict);
+                    dest_segment.set_zstd_dict(zstd_delta_dict);
+
+                    if (!dest_segment.subset(src_segment, vv_used[i], i < no_raw_groups, v_no_copied_packs[i], vv_new_ids[i], zstd_cctx, zstd_dctx))
+                        repack_ok = false;
+                }
+
+                ZSTD_freeCCtx(zstd_cctx);
+                ZSTD_freeDCtx(zstd_dctx);
+            });
+
+        join_threads(v_threads);
+
+        out_archive->FlushOutBuffers();
+    }
+
+    if (!repack_ok)
+    {
+        if (is_app_mode)
+            cerr << "Cannot read archive data\n";
+        return false;
+    }
+
+    // Collection description with renumbered groups and sequences
+    for (size_t i = 0; i < v_samples.size(); ++i)
+    {
+        in_collection->get_sample_desc(v_samples[i], sample_desc);
+
+        for (auto& contig : sample_desc)
+            for (auto& seg : contig.second)
+            {
+                seg.in_group_id = vv_new_ids[seg.group_id][seg.in_group_id];
+                seg.group_id = v_group_map[seg.group_id];
+            }
+
+        out_collection->add_sample_desc(v_samples[i], sample_desc);
+
+        if ((i + 1) % pack_cardinality == 0)
+            out_collection->store_contig_batch((uint32_t) (i + 1 - pack_cardinality), (uint32_t) (i + 1));
+    }
+
+    if (v_samples.size() % pack_cardinality)
+        out_collection->store_contig_batch((uint32_t) (v_samples.size() / pack_cardinality * pack_cardinality), (uint32_t) v_samples.size());
+
+    out_collection->complete_serialization();
+
+    // Splitters are kept, segment splitters of the removed groups are dropped
+    if (!load_splitters_from_archive(no_threads))
+    {
+        if (is_app_mode)
+            cerr << "Corrupted splitters in the archive\n";
+        return false;
+    }
+
+    for (auto p = map_segments.begin(); p != map_segments.end(); )
+        if (p->second < 0 || (uint32_t) p->second >= no_in_groups || v_group_map[p->second] == ~0u)
+            p = map_segments.erase(p);
+        else
+        {
+            p->second = (int32_t) v_group_map[p->second];
+            ++p;
+        }
+
+    if (verbosity > 0 && is_app_mode)
+        cerr << "Samples: " << v_samples.size() << " of " << v_all_samples.size() << ", groups: " << no_segments << " of " << no_in_groups << endl;
+
+    store_metadata(no_threads);
+    store_file_type_info();
+
+    in_archive->Close();
+
+    return out_archive->Close();
+}
+
+// *******************************************************************************************
+// Merge archives (e.g., shards of a collection compressed independently, possibly on different machines) into a new archive.
+// Groups are unified by their splitter pairs. Groups of the first archive are copied as they are, groups of the other archives
+// with new splitter pairs are copied as new groups, and sequences of the remaining groups are added to the groups of the same
+// splitter pairs (repacked, and delta-coded again only if the references of the groups differ).
+// Samples present in many archives (e.g., the reference of shards appended to a common base archive) are stored once.
+bool CAGCCompressor::Merge(const vector<string>& v_in_archive_fns, const string& _out_archive_fn, const uint32_t _verbosity, const uint32_t no_threads)
+{
+    if (working_mode != working_mode_t::none || v_in_archive_fns.empty())
+        return false;
+
+    out_archive_name = _out_archive_fn;
+    prefetch_archive = false;
+    verbosity = _verbosity;
+
+    struct merge_input_t {
+        shared_ptr<CArchive> archive;
+        shared_ptr<CCollection_V3> collection;
+        uint32_t no_groups = 0;
+        vector<pair<pair<uint64_t, uint64_t>, uint32_t>> v_map_segments;
+        vector<string> v_samples;                   // samples taken from the archive
+        vector<uint32_t> v_sample_map;              // sample id -> sample id in the merged archive (~0u if not taken)
+        vector<vector<bool>> vv_used;               // sequences used by the taken samples
+        vector<uint32_t> v_group_map;               // group id -> group id in the merged archive
+        vector<vector<uint32_t>> vv_new_ids;        // sequence ids in the merged archive (empty for groups copied as they are)
+    };
+
+    vector<merge_input_t> v_inputs(v_in_archive_fns.size());
+    vector<uint64_t> v_splitters;
+    vector<uint64_t> v_all_splitters;
+
+    compression_params_t first_params{};
+    uint32_t first_archive_version = 0;
+    shared_ptr<CZSTDDict> first_delta_dict;
+    map<string, string> first_file_type_info;
+
+    for (size_t j = 0; j < v_inputs.size(); ++j)
+    {
+        auto& input = v_inputs[j];
+        in_archive_name = v_in_archive_fns[j];
+
+        if (!load_file_type_info(in_archive_name))
+            return false;
+
+        if (!load_metadata())
+            return false;
+
+        if (archive_version < 3000)
+        {
+            if (is_app_mode)
+                cerr << "Merging is supported only for archives in version 3.0 or newer\n";
+            return false;
+        }
+
+        if (j == 0)
+        {
+            first_params = compression_params;
+            first_archive_version = archive_version;
+            first_delta_dict = zstd_delta_dict;
+            first_file_type_info = m_file_type_info;
+        }
+        else if (archive_version != first_archive_version || compression_params.kmer_length != first_params.kmer_length ||
+            compression_params.min_match_len != first_params.min_match_len || compression_params.pack_cardinality != first_params.pack_cardinality ||
+            compression_params.segment_size != first_params.segment_size)
+        {
+            if (is_app_mode)
+                cerr << "Archive " << in_archive_name << " was created with other parameters than " << v_in_archive_fns.front() << endl;
+            return false;
+        }
+        else if ((zstd_delta_dict == nullptr) != (first_delta_dict == nullptr) || (zstd_delta_dict && zstd_delta_dict->Data() != first_delta_dict->Data()))
+        {
+            if (is_app_mode)
+                cerr << "Archive " << in_archive_name << " uses other dictionary of delta packs than " << v_in_archive_fns.front() << endl;
+            return false;
+        }
+
+        input.archive = in_archive;
+        input.collection = dynamic_pointer_cast<CCollection_V3>(collection_desc);
+
+        if (!input.collection->set_archives(in_archive, nullptr, no_threads, pack_cardinality, segment_size, kmer_length))
+            return false;
+
+        while (in_archive->GetStreamId(ss_ref_name(archive_version, input.no_groups)) >= 0 || in_archive->GetStreamId(ss_delta_name(archive_version, input.no_groups)) >= 0)
+            ++input.no_groups;
+
+        if (input.no_groups < no_raw_groups || !read_splitters(*in_archive, v_splitters, input.v_map_segments, no_threads))
+        {
+            if (is_app_mode)
+                cerr << "Corrupted archive " << in_archive_name << endl;
+            return false;
+        }
+
+        v_all_splitters.insert(v_all_splitters.end(), v_splitters.begin(), v_splitters.end());
+        sort(v_all_splitters.begin(), v_all_splitters.end());
+        v_all_splitters.erase(unique(v_all_splitters.begin(), v_all_splitters.end()), v_all_splitters.end());
+    }
+
+    zstd_delta_dict = first_delta_dict;
+
+    // Samples of the same name must have the same contigs (names and lengths are compared); they are taken from the first archive
+    auto sample_signature = [&](const vector<pair<string, vector<segment_desc_t>>>& desc) {
+        uint64_t h = desc.size();
+
+        for (auto& contig : desc)
+        {
+            uint64_t len = 0;
+            for (auto& seg : contig.second)
+                len += seg.raw_length;
+            if (!contig.second.empty())
+                len -= (contig.second.size() - 1) * kmer_length;
+
+            h = (h * 0x9e3779b97f4a7c15ull) ^ hash<string>{}(contig.first);
+            h = (h * 0x9e3779b97f4a7c15ull) ^ len;
+        }
+
+        return h;
+    };
+
+    unordered_map<string, uint64_t> m_sample_signatures;
+    vector<pair<string, vector<segment_desc_t>>> sample_desc;
+    uint32_t no_samples = 0;
+    uint32_t no_repeated_samples = 0;
+
+    for (size_t j = 0; j < v_inputs.size(); ++j)
+    {
+        auto& input = v_inputs[j];
+        vector<string> v_all_samples;
+
+        input.collection->get_samples_list(v_all_samples, false);
+        input.v_sample_map.assign(v_all_samples.size(), ~0u);
+        input.vv_used.resize(input.no_groups);
+
+        for (size_t i = 0; i < v_all_samples.size(); ++i)
+        {
+            input.collection->get_sample_desc(v_all_samples[i], sample_desc);
+
+            uint64_t signature = sample_signature(sample_desc);
+            auto p = m_sample_signatures.find(v_all_samples[i]);
+
+            if (p != m_sample_signatures.end())
+            {
+                if (p->second != signature)
+                {
+                    if (is_app_mode)
+                        cerr << "Sample " << v_all_samples[i] << " differs in archives " << v_in_archive_fns.front() << " and " << v_in_archive_fns[j] << endl;
+                    return false;
+                }
+
+                ++no_repeated_samples;
+                continue;
+            }
+
+            m_sample_signatures.emplace(v_all_samples[i], signature);
+            input.v_samples.emplace_back(v_all_samples[i]);
+            input.v_sample_map[i] = no_samples++;
+
+            for (auto& contig : sample_desc)
+                for (auto& seg : contig.second)
+                {
+                    if (seg.group_id >= input.no_groups)
+                    {
+                        if (is_app_mode)
+                            cerr << "Corrupted archive " << v_in_archive_fns[j] << " (no group " << seg.group_id << ")\n";
+                        return false;
+                    }
+
+                    auto& v_used = input.vv_used[seg.group_id];
+                    if (seg.in_group_id >= v_used.size())
+                        v_used.resize(seg.in_group_id + 1, false);
+                    v_used[seg.in_group_id] = true;
+                }
+        }
+    }
+
+    // Groups are unified by splitter pairs. Merged group: (archive, group) it is copied from and (archive, group) pairs added to it.
+    vector<pair<uint32_t, uint32_t>> v_owners;
+    vector<vector<pair<uint32_t, uint32_t>>> vv_contributors;
+
+    map_segments.clear();
+    map_segments[make_pair(~0ull, ~0ull)] = 0;
+
+    for (uint32_t j = 0; j < (uint32_t) v_inputs.size(); ++j)
+    {
+        auto& input = v_inputs[j];
+
+        input.v_group_map.assign(input.no_groups, ~0u);
+        input.vv_new_ids.resize(input.no_groups);
+
+        if (j == 0)
+        {
+            for (uint32_t g = 0; g < input.no_groups; ++g)
+            {
+                input.v_group_map[g] = g;
+                v_owners.emplace_back(j, g);
+                vv_contributors.emplace_back();
+            }
+
+            for (auto& x : input.v_map_segments)
+                map_segments[x.first] = x.second;
+
+            continue;
+        }
+
+        vector<vector<pair<uint64_t, uint64_t>>> vv_keys(input.no_groups);
+        for (auto& x : input.v_map_segments)
+            if (x.second < input.no_groups)
+                vv_keys[x.second].emplace_back(x.first);
+
+        for (uint32_t g = 0; g < input.no_groups; ++g)
+        {
+            if (input.vv_used[g].empty())
+                continue;
+
+            uint32_t target = ~0u;
+
+            if (g < no_raw_groups)
+                target = g;
+            else
+                for (auto& key : vv_keys[g])
+                    if (auto p = map_segments.find(key); p != map_segments.end())
+                    {
+                        target = (uint32_t) p->second;
+                        break;
+                    }
+
+            if (target == ~0u)
+            {
+                target = (uint32_t) v_owners.size();
+                v_owners.emplace_back(j, g);
+                vv_contributors.emplace_back();
+            }
+            else
+                vv_contributors[target].emplace_back(j, g);
+
+            for (auto& key : vv_keys[g])
+                map_segments.emplace(key, (int32_t) target);
+
+            input.v_group_map[g] = target;
+        }
+
+        input.v_map_segments.clear();
+        input.v_map_segments.shrink_to_fit();
+    }
+
+    no_segments = (uint32_t) v_owners.size();
+
+    out_archive = make_shared<CArchive>(false, 32 << 20);
+
+    if (!out_archive->Open(out_archive_name))
+    {
+        if (is_app_mode)
+            cerr << "Cannot open output archive " << out_archive_name << endl;
+        return false;
+    }
+
+    auto out_collection = make_shared<CCollection_V3>();
+    if (!out_collection->set_archives(nullptr, out_archive, no_threads, pack_cardinality, segment_size, kmer_length))
+        return false;
+
+    if (zstd_delta_dict)
+    {
+        auto dict_stream_id = out_archive->RegisterStream("delta-dict");
+        out_archive->AddPart(dict_stream_id, zstd_delta_dict->Data(), 0);
+    }
+
+    // Groups are copied in bulk, except the last delta packs of groups extended by sequences from other archives
+    vector<vector<CArchive::copy_desc_t>> vv_copy_desc(v_inputs.size());
+    vector<uint32_t> v_targets;
+
+    for (uint32_t i = 0; i < no_segments; ++i)
+    {
+        auto [j, g] = v_owners[i];
+        auto& src_archive = v_inputs[j].archive;
+
+        auto in_ref_stream_id = src_archive->GetStreamId(ss_ref_name(archive_version, g));
+        auto in_delta_stream_id = src_archive->GetStreamId(ss_delta_name(archive_version, g));
+        size_t no_delta_parts = in_delta_stream_id >= 0 ? src_archive->GetNoParts(in_delta_stream_id) : 0;
+
+        if (!vv_contributors[i].empty())
+        {
+            v_targets.emplace_back(i);
+            if (no_delta_parts)
+                --no_delta_parts;
+        }
+
+        if (in_ref_stream_id >= 0)
+            vv_copy_desc[j].push_back(CArchive::copy_desc_t{ in_ref_stream_id, out_archive->RegisterStream(ss_ref_name(archive_version, i)), 0, 1 });
+
+        if (in_delta_stream_id >= 0)
+        {
+            auto out_delta_stream_id = out_archive->RegisterStream(ss_delta_name(archive_version, i));
+
+            if (no_delta_parts)
+                vv_copy_desc[j].push_back(CArchive::copy_desc_t{ in_delta_stream_id, out_delta_stream_id, 0, no_delta_parts });
+        }
+    }
+
+    for (size_t j = 0; j < v_inputs.size(); ++j)
+        if (!vv_copy_desc[j].empty() && !out_archive->CopyParts(*v_inputs[j].archive, vv_copy_desc[j], no_threads))
+        {
+            if (is_app_mode)
+                cerr << "Cannot copy archive data\n";
+            return false;
+        }
+
+    vv_copy_desc.clear();
+
+    // Sequences are added to the extended groups in parallel (in chunks of groups to limit the size of buffered parts)
+    const size_t chunk_size = 1024;
+    atomic<bool> merge_ok = true;
+
+    for (size_t chunk_begin = 0; chunk_begin < v_targets.size(); chunk_begin += chunk_size)
+    {
+        size_t chunk_end = min(chunk_begin + chunk_size, v_targets.size());
+        atomic<size_t> next_target = chunk_begin;
+
+        vector<thread> v_threads;
+        v_threads.reserve(no_threads);
+
+        for (uint32_t t = 0; t < no_threads; ++t)
+            v_threads.emplace_back([&] {
+                ZSTD_CCtx* zstd_cctx = ZSTD_createCCtx();
+                ZSTD_DCtx* zstd_dctx = ZSTD_createDCtx();
+
+                for (size_t k = next_target++; k < chunk_end; k = next_target++)
+                {
+                    uint32_t i = v_targets[k];
+                    auto [owner_id, owner_group_id] = v_owners[i];
+
+                    CSegment dest_segment(ss_base(archive_version, i), v_inputs[owner_id].archive, out_archive, pack_cardinality, min_match_len, false, archive_version);
+                    dest_segment.set_zstd_dict(zstd_delta_dict);
+                    dest_segment.appending_init(false, ss_base(archive_version, owner_group_id));
+
+                    for (auto [j, g] : vv_contributors[i])
+                    {
+                        CSegment src_segment(ss_base(archive_version, g), v_inputs[j].archive, nullptr, pack_cardinality, min_match_len, false, archive_version);
+                        src_segment.set_zstd_dict(zstd_delta_dict);
+
+                        if (!dest_segment.merge(src_segment, v_inputs[j].vv_used[g], i < no_raw_groups, v_inputs[j].vv_new_ids[g], zstd_cctx, zstd_dctx))
+                            merge_ok = false;
+                    }
+
+                    dest_segment.finish(zstd_cctx);
+                }
+
+                ZSTD_freeCCtx(zstd_cctx);
+                ZSTD_freeDCtx(zstd_dctx);
+            });
+
+        join_threads(v_threads);
+
+        out_archive->FlushOutBuffers();
+    }
+
+    if (!merge_ok)
+    {
+        if (is_app_mode)
+            cerr << "Cannot read archive data\n";
+        return false;
+    }
+
+    // Collection description with renumbered groups and sequences
+    uint32_t no_stored_samples = 0;
+
+    for (auto& input : v_inputs)
+    {
+        for (auto& sample_name : input.v_samples)
+        {
+            input.collection->get_sample_desc(sample_name, sample_desc);
+
+            for (auto& contig : sample_desc)
+                for (auto& seg : contig.second)
+                {
+                    if (!input.vv_new_ids[seg.group_id].empty())
+                        seg.in_group_id = input.vv_new_ids[seg.group_id][seg.in_group_id];
+                    seg.group_id = input.v_group_map[seg.group_id];
+                }
+
+            out_collection->add_sample_desc(sample_name, sample_desc);
+
+            if (++no_stored_samples % pack_cardinality == 0)
+                out_collection->store_contig_batch(no_stored_samples - pack_cardinality, no_stored_samples);
+        }
+
+        input.vv_used.clear();
+        input.vv_new_ids.clear();
+    }
+
+    if (no_stored_samples % pack_cardinality)
+        out_collection->store_contig_batch(no_stored_samples / pack_cardinality * pack_cardinality, no_stored_samples);
+
+    out_collection->complete_serialization();
+
+    // Indexes of contig hashes are joined (positions of contigs are remapped)
+    contig_hash_index = make_unique<CContigHashIndex>(1000, mem_governor->Share(1.0 / 16, 256ull << 20));
+
+    for (size_t j = 0; j < v_inputs.size(); ++j)
+    {
+        auto contig_hashes_id = v_inputs[j].archive->GetStreamId("contig-hashes");
+
+        if (contig_hashes_id < 0)
+            continue;
+
+        vector<uint8_t> v_data;
+        uint64_t no_entries;
+
+        if (!v_inputs[j].archive->GetPart(contig_hashes_id, v_data, no_entries) || !contig_hash_index->Import(v_data, v_inputs[j].v_sample_map))
+        {
+            if (is_app_mode)
+                cerr << "Corrupted contig hashes in the archive " << v_in_archive_fns[j] << endl;
+            return false;
+        }
+    }
+
+    // Splitters of all archives are kept
+    hs_splitters.clear();
+    hs_splitters.insert_parallel(v_all_splitters, no_threads);
+
+    if (verbosity > 0 && is_app_mode)
+        cerr << "Archives: " << v_inputs.size() << ", samples: " << no_samples << " (repeated: " << no_repeated_samples << "), groups: " << no_segments <<
+            " (extended: " << v_targets.size() << ")" << endl;
+
+    store_metadata(no_threads);
+
+    m_file_type_info = first_file_type_info;
+    store_file_type_info();
+
+    for (auto& input : v_inputs)
+        input.archive->Close();
+
+    return out_archive->Close();
+}
+
+// *******************************************************************************************
+void CAGCCompressor::AddCmdLine(const string& cmd_line)
+{
+    if (working_mode != working_mode_t::compression && working_mode != working_mode_t::appending)
+        return;
+
+    collection_desc->add_cmd_line(cmd_line);
+}
+
+// *******************************************************************************************
+void CAGCCompressor::SetInstrumentationReport(const string& file_name)
+{
+    instr_report_name = file_name;
+}
+
+// *******************************************************************************************
+// Must be called before Create, as the delta coder version is recorded in the archive version
+bool CAGCCompressor::SetLZDiffVersion(const uint32_t lz_diff_version)
+{
+    if (working_mode != working_mode_t::none)
+        return false;
+
+    uint32_t file_minor;
+
+    if (lz_diff_version == 2)
+        file_minor = AGC_FILE_MINOR;
+    else if (lz_diff_version == 3)
+        file_minor = AGC_FILE_MINOR_BINARY_LZ;
+    else
+        return false;
+
+    archive_version = AGC_FILE_MAJOR * 1000 + file_minor;
+    m_file_type_info["file_version_minor"] = to_string(file_minor);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Hash indexes of segment references are released (LRU) when they take more than max_mb MB
+// (0 - no limit, or a quarter of the global memory budget if it is set)
+void CAGCCompressor::SetLZIndexMemory(const uint32_t max_mb)
+{
+    lz_index_memory = max_mb;
+
+    lz_index_lru->SetBudget(max_mb ? (size_t) max_mb << 20 : mem_governor->Share(0.25, 0));
+}
+
+// *******************************************************************************************
+// Global memory budget (in MB; 0 - no limit) for queues and buffers of the compressor.
+// Must be called before Create or Append, as the sizes of queues are derived from it.
+bool CAGCCompressor::SetMaxMemory(const uint32_t max_mb)
+{
+    if (working_mode != working_mode_t::none)
+        return false;
+
+    mem_governor = make_shared<CMemoryGovernor>((size_t) max_mb << 20);
+
+    lz_index_lru->SetMemoryGovernor(mem_governor);
+    buffered_seg_part.set_memory_governor(mem_governor);
+    SetLZIndexMemory(lz_index_memory);
+
+    return true;
+}
+
+// *******************************************************************************************
+// Dictionaries are trained after given no. of samples (if not present in the input archive).
+// Must be set before Create() or Append(), so appending to archives older than version 4.0 can be rejected.
+bool CAGCCompressor::SetDictTraining(const uint32_t no_samples)
+{
+    if (working_mode != working_mode_t::none)
+        return false;
+
+    dict_training_samples = no_samples;
+
+    return true;
+}
+
+// *******************************************************************************************
+// Checkpoints are stored at the boundaries of sample batches after at least no_samples samples (0 - no checkpoints).
+// They need an archive file in version 3 or newer, so are not possible for output to stdout, concatenated genomes
+// and appending to a new archive (the parts of the input archive are transferred only at the end).
+bool CAGCCompressor::SetCheckpoints(const uint32_t no_samples)
+{
+    if (working_mode != working_mode_t::compression && working_mode != working_mode_t::appending)
+        return false;
+
+    if (no_samples && (out_archive_name.empty() || archive_version < 3000 || concatenated_genomes ||
+        (working_mode == working_mode_t::appending && !in_place_appending)))
+        return false;
+
+    checkpoint_samples = no_samples;
+
+    return true;
+}
+
+// *******************************************************************************************
+// Segments without splitters of a synchronization round are clustered by similarity (MinHash sketches) and clusters
+// are delta-coded in new groups instead of storing the segments in raw groups. The archive format is unchanged.
+void CAGCCompressor::SetRawClustering(const bool enable)
+{
+    if (enable)
+        raw_clusterer = make_unique<CRawSegmentClusterer>();
+    else
+        raw_clusterer.reset();
+}
+
+// *******************************************************************************************
+// NUMA mode (0 - disabled, 1 - nodes of the system, >1 - emulated nodes): workers are pinned to nodes (in contiguous blocks),
+// each node uses its own replicas of the splitter structures and groups are stored preferably by threads of their home nodes
+void CAGCCompressor::SetNuma(const uint32_t no_nodes)
+{
+    if (no_nodes)
+        numa_topology = make_shared<CNumaTopology>(no_nodes);
+    else
+        numa_topology.reset();
+
+    if (numa_topology && verbosity > 0 && is_app_mode)
+        cerr << "NUMA nodes: " << numa_topology->NoNodes() << endl;
+}
+
+// *******************************************************************************************
+// Samples present in the archive (e.g., to skip them when the compression is resumed)
+bool CAGCCompressor::ListSamples(vector<string>& v_sample_names)
+{
+    if (working_mode != working_mode_t::compression && working_mode != working_mode_t::appending)
+        return false;
+
+    return collection_desc->get_samples_list(v_sample_names, false);
+}
+
+// *******************************************************************************************
+bool CAGCCompressor::Close(const uint32_t no_threads)
+{
+    bool r = true;
+
+    if (working_mode == working_mode_t::none)
+        r = false;
+    else if (working_mode == working_mode_t::compression)
+        r = close_compression(no_threads);
+    else if (working_mode == working_mode_t::appending)
+        r = close_compression(no_threads);
+
+    working_mode = working_mode_t::none;
+
+#ifdef AGC_INSTRUMENTATION
+    if (verbosity > 1 && is_app_mode)
+        CInstrumentation::Instance().Print(cerr);
+
+    if (!instr_report_name.empty() && !CInstrumentation::Instance().StoreJSON(instr_report_name) && is_app_mode)
+        cerr << "Cannot store instrumentation report: " << instr_report_name << endl;
+#else
+    if (!instr_report_name.empty() && is_app_mode)
+        cerr << "Warning: instrumentation report not available (agc built without INSTRUMENTATION=true)\n";
+#endif
 
     return r;
 }
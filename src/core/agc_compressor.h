@@ -15,6 +15,13 @@
 #include "../core/genome_io.h"
 #include "../core/hs.h"
 #include "../core/kmer.h"
+#include "../core/kmer_scanner.h"
+#include "../core/kmer_set.h"
+#include "../core/splitters_codec.h"
+#include "../core/contig_hash_index.h"
+#include "../core/raw_clusterer.h"
+#include "../common/memory_governor.h"
+#include "../common/numa.h"
 #include "../common/utils.h"
 #include "../core/utils_adv.h"
 
@@ -232,6 +239,13 @@ private:
 			l_seg_part.emplace_back(move(seg_part));
 		}
 
+		void take_pending(vector<seg_part_t>& v_seg_part)
+		{
+			v_seg_part.assign(make_move_iterator(l_seg_part.begin() + min(virt_begin, l_seg_part.size())), make_move_iterator(l_seg_part.end()));
+			l_seg_part.clear();
+			virt_begin = 0;
+		}
+
 		void sort()
 		{
 			std::sort(l_seg_part.begin(), l_seg_part.end());
@@ -293,17 +307,67 @@ private:
 		{
 			return (uint32_t)l_seg_part.size();
 		}
+
+		uint32_t no_pending()
+		{
+			return (uint32_t)(l_seg_part.size() - min(virt_begin, l_seg_part.size()));
+		}
+
+		uint64_t pending_bytes()
+		{
+			uint64_t r = 0;
+
+			for (size_t i = virt_begin; i < l_seg_part.size(); ++i)
+				r += l_seg_part[i].seg_data.size();
+
+			return r;
+		}
+
+		const contig_t& peek_data(const uint32_t i)
+		{
+			return l_seg_part[virt_begin + i].seg_data;
+		}
+	};
+
+public:
+	// *******************************************************************************************
+	// Task of storing segments: the whole group (first == last == 0) or a chunk of segments of a large group
+	struct store_task_t {
+		int32_t group_id;
+		uint32_t first;
+		uint32_t last;
+	};
+
+	// *******************************************************************************************
+	// Deltas of a large group coded in chunks (in parallel); they are added to the group when the last chunk is done
+	struct split_group_t {
+		atomic<uint32_t> no_pending_chunks{ 0 };
+		vector<contig_t> v_deltas;
+		vector<uint8_t> v_encoded;
 	};
 
+private:
 	vector<list_seg_part_t> vl_seg_part;
 
 	set<kk_seg_part_t> s_seg_part;
 	mutex mtx;
 
-	atomic<int32_t> a_v_part_id;
+	vector<store_task_t> v_store_tasks;
+	map<int32_t, split_group_t> m_split_groups;
+	atomic<size_t> a_store_task_id;
+
+	// NUMA mode: tasks of a group are stored in the range of its home node (group_id % no_nodes), so the state of a group
+	// (segment, LZ index) is usually touched by threads of a single node; idle threads steal tasks of other nodes
+	uint32_t no_nodes = 1;
+	vector<size_t> v_node_task_end;
+	unique_ptr<atomic<size_t>[]> a_node_task_ids;
+
+	static constexpr uint64_t seg_part_overhead = 256;			// estimated cost of storing a segment (besides its bytes)
+	static constexpr uint32_t min_segments_in_chunk = 4;
+
+	shared_ptr<CMemoryGovernor> mem_governor;
 
 public:
-	static const int32_t part_id_step = 1;
 
 	CBufferedSegPart(uint32_t no_raw_groups)
 	{
@@ -317,14 +381,32 @@ public:
 		vl_seg_part.resize(no_groups);
 	}
 
+	void set_memory_governor(shared_ptr<CMemoryGovernor> _mem_governor)
+	{
+		mem_governor = _mem_governor;
+	}
+
+	void set_no_nodes(const uint32_t _no_nodes)
+	{
+		no_nodes = max(_no_nodes, 1u);
+		v_node_task_end.assign(no_nodes, 0);
+		a_node_task_ids = make_unique<atomic<size_t>[]>(no_nodes);
+	}
+
 	void add_known(uint32_t group_id, uint64_t kmer1, uint64_t kmer2, const string& sample_name, const string& contig_name, contig_t&& seg_data, bool is_rev_comp, uint32_t seg_part_no)
 	{
+		if (mem_governor)
+			mem_governor->Add(mem_class_t::segment_parts, seg_data.size() + seg_part_overhead);
+
 		// !!! TODO: use move() here?
 		vl_seg_part[group_id].emplace(kmer1, kmer2, sample_name, contig_name, seg_data, is_rev_comp, seg_part_no);		// internal mutex
 	}
 
 	void add_new(uint64_t kmer1, uint64_t kmer2, const string& sample_name, const string& contig_name, contig_t& seg_data, bool is_rev_comp, uint32_t seg_part_no)
 	{
+		if (mem_governor)
+			mem_governor->Add(mem_class_t::segment_parts, seg_data.size() + seg_part_overhead);
+
 		lock_guard<mutex> lck(mtx);
 		// !!! TODO: use move() here?
 		s_seg_part.emplace(kmer1, kmer2, sample_name, contig_name, seg_data, is_rev_comp, seg_part_no);
@@ -414,6 +496,58 @@ public:
 		return no_new;
 	}
 
+	// Segments of group src_id (raw segments) are clustered by similarity. They are moved to groups of clusters from earlier
+	// rounds or to new groups (clusters of at least 2 segments), so they are delta-coded against the representative (added
+	// first to a new group, so it becomes the reference). Segments similar to reverse complement of the representative
+	// are reversed. Remaining segments stay in src_id. Returns no. of new groups.
+	template<typename REV_COMP>
+	uint32_t cluster_segments(uint32_t src_id, CRawSegmentClusterer& clusterer, const uint32_t no_threads, REV_COMP&& rev_comp)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		vector<seg_part_t> v_parts;
+		vl_seg_part[src_id].take_pending(v_parts);
+
+		vector<const contig_t*> v_seqs;
+		v_seqs.reserve(v_parts.size());
+		for (auto& x : v_parts)
+			v_seqs.emplace_back(&x.seg_data);
+
+		const uint32_t first_group_id = (uint32_t)vl_seg_part.size();
+		auto v_clusters = clusterer.Cluster(v_seqs, first_group_id, no_threads);
+
+		uint32_t no_new = 0;
+		for (auto& cluster : v_clusters)
+			no_new += cluster.group_id >= first_group_id;
+
+		vl_seg_part.resize(first_group_id + no_new);
+
+		vector<bool> v_moved(v_parts.size(), false);
+
+		for (auto& cluster : v_clusters)
+		{
+			for (auto& m : cluster.v_members)
+			{
+				auto& x = v_parts[m.id];
+
+				if (m.rev_comp)
+				{
+					rev_comp(x.seg_data);
+					x.is_rev_comp = !x.is_rev_comp;
+				}
+
+				vl_seg_part[cluster.group_id].append_no_lock(x);
+				v_moved[m.id] = true;
+			}
+		}
+
+		for (size_t i = 0; i < v_parts.size(); ++i)
+			if (!v_moved[i])
+				vl_seg_part[src_id].append_no_lock(v_parts[i]);
+
+		return no_new;
+	}
+
 	void distribute_segments(uint32_t src_id, uint32_t dest_id_from, uint32_t dest_id_to)
 	{
 		uint32_t no_in_src = vl_seg_part[src_id].size();
@@ -500,23 +634,140 @@ public:
 			v_fut.emplace_back(async(job));
 
 		s_seg_part.clear();
+		m_split_groups.clear();
+		v_store_tasks.clear();
 		job();
 
 		for (auto& f : v_fut)
 			f.wait();
+
+		if (mem_governor)
+			mem_governor->ReleaseAll(mem_class_t::segment_parts);
 	}
 
-	void restart_read_vec()
+	// Groups are handed out by decreasing no. of buffered bytes (longest processing time first), so a large group
+	// taken at the end does not keep other threads waiting at the barrier after storing.
+	// Large groups with known reference (splittable) are split into chunks, which are delta-coded in parallel.
+	template<typename SPLITTABLE>
+	void restart_read_vec(const uint32_t no_threads, SPLITTABLE&& splittable)
 	{
 		lock_guard<mutex> lck(mtx);
 
-		a_v_part_id = (int32_t)vl_seg_part.size() - 1;
+		vector<pair<uint64_t, store_task_t>> v_tasks;
+		uint64_t total_bytes = 0;
+
+		for (int32_t i = 0; i < (int32_t)vl_seg_part.size(); ++i)
+			if (!vl_seg_part[i].empty())
+			{
+				uint64_t bytes = vl_seg_part[i].pending_bytes() + seg_part_overhead * vl_seg_part[i].no_pending();
+
+				v_tasks.emplace_back(bytes, store_task_t{ i, 0, 0 });
+				total_bytes += bytes;
+			}
+
+		m_split_groups.clear();
+
+		const uint64_t chunk_bytes = max<uint64_t>(total_bytes / (4 * max(no_threads, 1u)), 1);
+		const size_t no_groups = v_tasks.size();
+
+		for (size_t i = 0; i < no_groups; ++i)
+		{
+			auto [bytes, task] = v_tasks[i];
+			uint32_t n = vl_seg_part[task.group_id].no_pending();
+
+			if (no_threads < 2 || bytes <= 2 * chunk_bytes || n < 2 * min_segments_in_chunk || !splittable(task.group_id))
+				continue;
+
+			uint32_t no_chunks = (uint32_t)min<uint64_t>((bytes + chunk_bytes - 1) / chunk_bytes, n / min_segments_in_chunk);
+
+			auto& sg = m_split_groups[task.group_id];
+			sg.no_pending_chunks = no_chunks;
+			sg.v_deltas.assign(n, contig_t());
+			sg.v_encoded.assign(n, 0);
+
+			for (uint32_t j = 0; j < no_chunks; ++j)
+			{
+				uint32_t first = (uint32_t)((uint64_t)n * j / no_chunks);
+				uint32_t last = (uint32_t)((uint64_t)n * (j + 1) / no_chunks);
+				store_task_t chunk{ task.group_id, first, last };
+
+				if (j == 0)
+					v_tasks[i] = make_pair(bytes / no_chunks, chunk);
+				else
+					v_tasks.emplace_back(bytes / no_chunks, chunk);
+			}
+		}
+
+		sort(v_tasks.begin(), v_tasks.end(), [](const auto& x, const auto& y) {
+			if (x.first != y.first)
+				return x.first > y.first;
+			if (x.second.group_id != y.second.group_id)
+				return x.second.group_id > y.second.group_id;
+			return x.second.first < y.second.first;
+			});
+
+		v_store_tasks.clear();
+		v_store_tasks.reserve(v_tasks.size());
+
+		if (no_nodes == 1)
+			for (auto& x : v_tasks)
+				v_store_tasks.emplace_back(x.second);
+		else
+			for (uint32_t node = 0; node < no_nodes; ++node)
+			{
+				a_node_task_ids[node] = v_store_tasks.size();
+
+				for (auto& x : v_tasks)
+					if ((uint32_t)x.second.group_id % no_nodes == node)
+						v_store_tasks.emplace_back(x.second);
+
+				v_node_task_end[node] = v_store_tasks.size();
+			}
+
+		a_store_task_id = 0;
+	}
+
+	bool get_store_task(store_task_t& task, const uint32_t node = 0)
+	{
+		if (no_nodes > 1)
+		{
+			for (uint32_t i = 0; i < no_nodes; ++i)
+			{
+				uint32_t n = (node + i) % no_nodes;
+
+				if (a_node_task_ids[n].load(memory_order_relaxed) >= v_node_task_end[n])
+					continue;
+
+				size_t id = a_node_task_ids[n].fetch_add(1);
+
+				if (id < v_node_task_end[n])
+				{
+					task = v_store_tasks[id];
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		size_t id = a_store_task_id.fetch_add(1);
+
+		if (id >= v_store_tasks.size())
+			return false;
+
+		task = v_store_tasks[id];
+
+		return true;
+	}
+
+	split_group_t& get_split_group(const int32_t group_id)
+	{
+		return m_split_groups.find(group_id)->second;
 	}
 
-	int get_vec_id()
+	const contig_t& peek_part_data(const int32_t group_id, const uint32_t i)
 	{
-//		return a_v_part_id.fetch_sub(1);
-		return a_v_part_id.fetch_sub(part_id_step);
+		return vl_seg_part[group_id].peek_data(i);
 	}
 
 	int get_no_parts()
@@ -609,22 +860,47 @@ class CAGCCompressor : public CAGCBasic
 	shared_mutex seg_vec_mtx;
 
 	string out_archive_name;
+	string instr_report_name;
+
+	const size_t max_delta_dict_size = 112640;
+	const size_t max_delta_dict_training_size = 16 << 20;
+	uint32_t dict_training_samples = 0;															// 0 - no dictionary training
+	shared_ptr<CMemoryGovernor> mem_governor = make_shared<CMemoryGovernor>();					// accounting of memory of queues and buffers
+	shared_ptr<CLZIndexLRU> lz_index_lru = make_shared<CLZIndexLRU>();							// memory budget for LZ-diff hash indexes
+	uint32_t lz_index_memory = 0;
+	shared_ptr<CPackCompressor> pack_compressor;												// background compression of packs (nullptr - by workers)
+	unique_ptr<CContigHashIndex> contig_hash_index;											// whole-contig deduplication (nullptr - disabled)
+	unique_ptr<CRawSegmentClusterer> raw_clusterer;												// delta-coding of similar raw segments (nullptr - disabled)
+	uint32_t no_dedup_rounds = 0;																// synchronization rounds issued by the input reader
+	uint32_t no_resolved_dedup_rounds = 0;
+	uint32_t dict_next_training = 0;															// value of processed_samples triggering dictionary training
+	bool dict_training_pending = false;
 	size_t no_samples_in_archive;
+	uint32_t checkpoint_samples = 0;															// min. no. of samples between checkpoints (0 - no checkpoints)
+	uint32_t last_checkpoint_samples = 0;
+	bool checkpoint_pending = false;
 
 	vector<string> v_file_names;
 
 	bool concatenated_genomes;
 	bool adaptive_compression;
+	bool in_place_appending = false;															// new parts are appended to the input archive file
 
 	shared_ptr<CArchive> out_archive;															// internal mutexes
 
 	vector<uint64_t> v_candidate_kmers;
 	vector<uint64_t> v_duplicated_kmers;
 	uint64_t v_candidate_kmers_offset = 0;
+	CKmerSet ref_kmers;																			// only reads after init - no need to lock
 
 	hash_set_t hs_splitters{ ~0ull, 16ull, 0.4, equal_to<uint64_t>{}, MurMur64Hash{} };			// only reads after init - no need to lock
 	bloom_set_t bloom_splitters;
 
+	shared_ptr<CNumaTopology> numa_topology;													// NUMA mode (nullptr - disabled)
+	vector<uint32_t> v_worker_nodes;
+	vector<unique_ptr<hash_set_t>> v_hs_splitters_node;											// read-only replicas of splitter structures per node
+	vector<unique_ptr<bloom_set_t>> v_bloom_splitters_node;
+
 	unordered_map<pair<uint64_t, uint64_t>, int32_t, MurMurPair64Hash> map_segments;			// shared_mutex (seg_map_mtx)
 	unordered_map<uint64_t, vector<uint64_t>, MurMur64Hash> map_segments_terminators;			// shared_mutex (seg_map_mtx)
 	vector<shared_ptr<CSegment>> v_segments;													// shared_mutex to vector (seg_vec_mtx) + internal mutexes in stored objects
@@ -639,6 +915,7 @@ class CAGCCompressor : public CAGCBasic
 	atomic<uint32_t> id_segment = 0;
 
 	const size_t contig_part_size = 512 << 10;
+	static constexpr uint32_t scan_block_size = 64;												// no. of positions for batched splitter queries
 
 	CBufferedSegPart buffered_seg_part{ no_raw_groups };
 
@@ -672,7 +949,13 @@ class CAGCCompressor : public CAGCBasic
 	pair_segment_desc_t add_segment(const string &sample_name, const string &contig_name, uint32_t seg_part_no,
 		contig_t &&segment, CKmer kmer_front, CKmer kmer_back, ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx, uint32_t thread_id, my_barrier& bar);
 	void register_segments(uint32_t n_t);
-	void store_segments(ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx);
+	void store_segments(ZSTD_CCtx* zstd_cctx, ZSTD_DCtx* zstd_dctx, const uint32_t node = 0);
+	void replicate_splitters(const uint32_t thread_id);
+	bool register_contig(const string& sample_name, const string& contig_name, const contig_t& contig, bool& is_duplicate);
+	void resolve_contig_aliases();
+	bool load_contig_hash_index();
+	void start_pack_compressor(const uint32_t no_threads);
+	void flush_out_buffers();
 
 	pair<pair<uint64_t, uint64_t>, bool> find_cand_segment_with_one_splitter(CKmer kmer, contig_t& segment_dir, contig_t& segment_rc, ZSTD_DCtx* zstd_dctx, my_barrier& bar);
 	pair<uint64_t, uint32_t> find_cand_segment_with_missing_middle_splitter(CKmer kmer_front, CKmer kmer_back, contig_t& segment_dir, contig_t& segment_rc, ZSTD_DCtx* zstd_dctx, my_barrier& bar);
@@ -730,20 +1013,26 @@ class CAGCCompressor : public CAGCBasic
 
 	void store_metadata_impl_v1(uint32_t no_threads);
 	void store_metadata_impl_v2(uint32_t no_threads);
-	void store_metadata_impl_v3(uint32_t no_threads);
-
-	void store_metadata(uint32_t no_threads);
-	void appending_init();
+	void store_metadata_impl_v3(uint32_t no_threads, const bool checkpoint);
+
+	void store_metadata(uint32_t no_threads, const bool checkpoint = false);
+	void store_checkpoint(const uint32_t no_threads, ZSTD_CCtx* zstd_cctx);
+	bool appending_init(const uint32_t no_threads);
+	bool load_splitters_from_archive(const uint32_t no_threads);
+	bool read_splitters(CArchive& archive, vector<uint64_t>& v_splitters, vector<pair<pair<uint64_t, uint64_t>, uint32_t>>& v_map_segments, const uint32_t no_threads);
+	void build_splitter_structures(const vector<uint64_t>& v_splitters, const vector<pair<pair<uint64_t, uint64_t>, uint32_t>>& v_map_segments, const uint32_t no_threads);
 	bool determine_splitters(const string& reference_file_name, const size_t segment_size, const uint32_t no_threads);
 	bool count_kmers(vector<pair<string, vector<uint8_t>>>& v_contig_data, const uint32_t no_threads);
 
 	void remove_non_singletons(vector<uint64_t>& vec, size_t virtual_begin);
 	void remove_non_singletons(vector<uint64_t>& vec, vector<uint64_t>& v_duplicated, size_t virtual_begin);
+	void build_reference_kmer_set();
 
 	void enumerate_kmers(contig_t& ctg, vector<uint64_t> &vec);
 	void find_splitters_in_contig(contig_t& ctg, const vector<uint64_t>::iterator v_begin, const vector<uint64_t>::iterator v_end, vector<uint64_t>& v_splitters, vector<array<uint64_t, 4>>&v_fallbacks);
 
 	void store_file_type_info();
+	void train_delta_dict();
 
 	void build_candidate_kmers_from_archive(const uint32_t n_t);
 
@@ -754,9 +1043,21 @@ public:
 	bool Create(const string& _file_name, const uint32_t _pack_cardinality, const uint32_t _kmer_length, const string& reference_file_name, const uint32_t _segment_size,
 		const uint32_t _min_match_len, const bool _concatenated_genomes, const bool _adaptive_compression, const uint32_t _verbosity, const uint32_t _no_threads, double _fallback_frac);
 	bool Append(const string& _in_archive_fn, const string& _out_archive_fn, const uint32_t _verbosity, const bool _prefetch_archive, const bool _concatenated_genomes, const bool _adaptive_compression,
-		const uint32_t no_threads, double _fallback_frac);
+		const uint32_t no_threads, double _fallback_frac, const bool _in_place = false);
+	bool Subset(const string& _in_archive_fn, const string& _out_archive_fn, const vector<string>& v_sample_names, const bool exclude, const uint32_t _verbosity, const uint32_t no_threads);
+	bool Merge(const vector<string>& v_in_archive_fns, const string& _out_archive_fn, const uint32_t _verbosity, const uint32_t no_threads);
 
 	void AddCmdLine(const string& cmd_line);
+	void SetInstrumentationReport(const string& file_name);
+	bool SetDictTraining(const uint32_t no_samples);
+	bool SetLZDiffVersion(const uint32_t lz_diff_version);
+	void SetLZIndexMemory(const uint32_t max_mb);
+	bool SetMaxMemory(const uint32_t max_mb);
+	bool SetCheckpoints(const uint32_t no_samples);
+	void SetRawClustering(const bool enable);
+	void SetNuma(const uint32_t no_nodes);
+
+	bool ListSamples(vector<string>& v_sample_names);
 
 	bool Close(const uint32_t no_threads = 1);
 
@@ -12,6 +12,7 @@
 #include "genome_io.h"
 #include <filesystem>
 #include <chrono>
+#include <sstream>
 
 using namespace std::filesystem;
 
@@ -36,18 +37,61 @@ void CAGCDecompressor::gzip_contig(contig_t& ctg, contig_t& working_space, refre
 
 	swap(ctg, working_space);
 }
+
+// *******************************************************************************************
+// Contig (already converted to text) is compressed with its header line into BGZF blocks
+void CAGCDecompressor::bgzf_contig(const string& contig_name, contig_t& ctg, contig_t& working_space, CBgzfCompressor& bgzf_compressor)
+{
+	working_space.clear();
+	working_space.reserve(contig_name.size() + 2 + ctg.size());
+
+	working_space.emplace_back('>');
+	working_space.insert(working_space.end(), contig_name.begin(), contig_name.end());
+	working_space.emplace_back('\n');
+	working_space.insert(working_space.end(), ctg.begin(), ctg.end());
+
+	bgzf_compressor.Compress(working_space.data(), working_space.size(), ctg);
+}
+
+// *******************************************************************************************
+// BGZF output of getcol and getset: contigs are compressed by the decompression threads in blocks of at most 64 KiB
+// and the .fai and .gzi indexes are saved next to the output files (the compression level is given by gzip_level)
+void CAGCDecompressor::SetBgzf(const bool enable)
+{
+	bgzf_mode = enable;
+}
  
 // *******************************************************************************************
-void CAGCDecompressor::start_decompressing_threads(vector<thread>& v_threads, const uint32_t n_t, uint32_t gzip_level, uint32_t line_len, bool fast)
+// NUMA mode (0 - disabled, 1 - nodes of the system, >1 - emulated nodes): worker threads are pinned to nodes (in contiguous blocks),
+// so their working buffers are node-local
+void CAGCDecompressor::SetNuma(const uint32_t no_nodes)
+{
+	if (no_nodes)
+		numa_topology = make_shared<CNumaTopology>(no_nodes);
+	else
+		numa_topology.reset();
+}
+
+// *******************************************************************************************
+void CAGCDecompressor::pin_worker(const uint32_t worker_id, const uint32_t no_workers)
+{
+	if (numa_topology)
+		numa_topology->Pin(numa_topology->NodeOfWorker(worker_id, no_workers));
+}
+
+// *******************************************************************************************
+void CAGCDecompressor::start_decompressing_threads(vector<thread>& v_threads, const uint32_t n_t, uint32_t gzip_level, uint32_t line_len, bool fast, bool bgzf)
 {
 	for (uint32_t i = 0; i < n_t; ++i)
-		v_threads.emplace_back([&, i, gzip_level, line_len, fast] {
+		v_threads.emplace_back([&, i, n_t, gzip_level, line_len, fast, bgzf] {
+		pin_worker(i, n_t);
 
 		auto zstd_ctx = ZSTD_createDCtx();
 
 		contig_t ctg, working_space;
 		contig_task_t contig_desc;
 		refresh::gz_in_memory gzip_compressor(gzip_level);
+		CBgzfCompressor bgzf_compressor(gzip_level);
 
 		while (!q_contig_tasks->IsCompleted())
 		{
@@ -59,17 +103,21 @@ void CAGCDecompressor::start_decompressing_threads(vector<thread>& v_threads, co
 			if (!decompress_contig(contig_desc, zstd_ctx, ctg, fast))
 				continue;
 
+			uint64_t seq_length = ctg.size();
+
 			if(line_len == 0)
 				CNumAlphaConverter::convert_to_alpha(ctg);
 			else
 				CNumAlphaConverter::convert_and_split_into_lines(ctg, working_space, line_len);
 
-			if (gzip_level)
-				gzip_contig(ctg, working_space, gzip_compressor);
-
 			name_range_t contig_name_range = contig_desc.name_range;
 
-			pq_contigs_to_save->Emplace(priority, sample_contig_data_t{ contig_desc.sample_name, contig_name_range.str(), move(ctg) });
+			if (bgzf)
+				bgzf_contig(contig_name_range.str(), ctg, working_space, bgzf_compressor);
+			else if (gzip_level)
+				gzip_contig(ctg, working_space, gzip_compressor);
+
+			pq_contigs_to_save->Emplace(priority, sample_contig_data_t{ contig_desc.sample_name, contig_name_range.str(), move(ctg), seq_length });
 			ctg.clear();
 		}
 
@@ -79,6 +127,105 @@ void CAGCDecompressor::start_decompressing_threads(vector<thread>& v_threads, co
 		});
 }
 
+// *******************************************************************************************
+// Decode all requested sequences group by group - each group is owned by a single thread (a job of a pool worker)
+void CAGCDecompressor::decompress_groups(window_state_t& ws, ZSTD_DCtx* zstd_ctx)
+{
+	while (true)
+	{
+		size_t task_id = ws.next_task_id.fetch_add(1);
+		if (task_id >= ws.v_group_tasks.size())
+			break;
+
+		auto& group_task = ws.v_group_tasks[task_id];
+
+		sort(group_task.v_req.begin(), group_task.v_req.end(), [](const auto& x, const auto& y) {return x.first < y.first; });
+
+		CSegment segment(ss_base(archive_version, group_task.group_id), in_archive, nullptr, compression_params.pack_cardinality, compression_params.min_match_len, false, archive_version);
+		segment.set_zstd_dict(zstd_delta_dict);
+
+		bool r;
+		if (group_task.group_id < no_raw_groups)
+			r = segment.get_raw_multi(group_task.v_req, zstd_ctx);
+		else
+			r = segment.get_multi(group_task.v_req, zstd_ctx);
+
+		if (!r)
+			ws.all_ok = false;
+
+		group_task.v_req.clear();
+		group_task.v_req.shrink_to_fit();
+	}
+}
+
+// *******************************************************************************************
+// Join decoded segments into contigs, convert them to the output format and pass them to the saving thread (a job of a pool worker)
+void CAGCDecompressor::assemble_contigs(window_state_t& ws, contig_t& ctg, contig_t& working_space, refresh::gz_in_memory& gzip_compressor, CBgzfCompressor& bgzf_compressor,
+	uint32_t gzip_level, uint32_t line_len, bool bgzf)
+{
+	while (true)
+	{
+		size_t contig_id = ws.next_contig_id.fetch_add(1);
+		if (contig_id >= ws.v_contigs.size())
+			break;
+
+		auto& contig = ws.v_contigs[contig_id];
+
+		if (!assemble_contig(contig, ctg) && is_app_mode)
+			cerr << "Corrupted archive!" << endl;
+
+		uint64_t seq_length = ctg.size();
+
+		if (line_len == 0)
+			CNumAlphaConverter::convert_to_alpha(ctg);
+		else
+			CNumAlphaConverter::convert_and_split_into_lines(ctg, working_space, line_len);
+
+		if (bgzf)
+			bgzf_contig(contig.contig_name, ctg, working_space, bgzf_compressor);
+		else if (gzip_level)
+			gzip_contig(ctg, working_space, gzip_compressor);
+
+		ws.queued_bytes += ctg.size();
+
+		pq_contigs_to_save->Emplace(ws.first_priority + contig_id, sample_contig_data_t{ contig.sample_name, contig.contig_name, move(ctg), seq_length });
+		ctg.clear();
+	}
+}
+
+// *******************************************************************************************
+bool CAGCDecompressor::assemble_contig(window_contig_t& contig, contig_t& ctg)
+{
+	bool res = true;
+	size_t req_size = 0;
+
+	for (auto& x : contig.v_seg_data)
+		req_size += x.size();
+
+	ctg.clear();
+	ctg.reserve(req_size);
+
+	for (size_t j = 0; j < contig.v_seg_data.size(); ++j)
+	{
+		auto& seg_data = contig.v_seg_data[j];
+
+		if (contig.segments[j].is_rev_comp)
+			reverse_complement(seg_data);
+
+		if (j == 0)
+			ctg.insert(ctg.end(), seg_data.begin(), seg_data.end());
+		else if (seg_data.size() < compression_params.kmer_length)
+			res = false;
+		else
+			ctg.insert(ctg.end(), seg_data.begin() + compression_params.kmer_length, seg_data.end());
+
+		seg_data.clear();
+		seg_data.shrink_to_fit();
+	}
+
+	return res;
+}
+
 // *******************************************************************************************
 // Assign archive from already opened one
 bool CAGCDecompressor::AssignArchive(const CAGCBasic& agc_basic)
@@ -128,11 +275,12 @@ bool CAGCDecompressor::GetCollectionFiles(const string& _path, const uint32_t _l
 	if (no_ref && !v_samples.empty())
 		v_samples.erase(v_samples.begin());
 
-	q_contig_tasks = make_unique<CBoundedQueue<contig_task_t>>(1, 1);
-	pq_contigs_to_save = make_unique<CPriorityQueue<sample_contig_data_t>>(no_threads);
+	uint32_t level = (bgzf_mode && !gzip_level) ? default_bgzf_level : gzip_level;
 
-	vector<contig_task_t> v_tasks;
-	vector<thread> v_threads;
+	window_state_t ws;
+	bool save_ok = true;
+
+	pq_contigs_to_save = make_unique<CPriorityQueue<sample_contig_data_t>>(1);
 
 	// Saving thread
 	thread gio_thread([&] {
@@ -142,9 +290,22 @@ bool CAGCDecompressor::GetCollectionFiles(const string& _path, const uint32_t _l
 		string prev_sample_name;
 		bool is_gio_opened = false;
 		size_t file_id = 0;
+		string cur_file_name = "stdout";
 
 		string eol = "";
 
+		// Contigs of a file that cannot be written are dropped (the queue must be emptied anyway)
+		auto close_file = [&] {
+			if (gio.NoDuplicatedIndexNames())
+				cerr << eol << "Warning: " << gio.NoDuplicatedIndexNames() << " contig names repeated in " << cur_file_name << " are not indexed in .fai" << endl;
+			if (!gio.Close())
+			{
+				cerr << eol << "Cannot write file: " << cur_file_name << endl;
+				save_ok = false;
+			}
+			is_gio_opened = false;
+			};
+
 		while (!pq_contigs_to_save->IsCompleted())
 		{
 			if (!pq_contigs_to_save->Pop(ctg))
@@ -152,94 +313,185 @@ bool CAGCDecompressor::GetCollectionFiles(const string& _path, const uint32_t _l
 
 			if (ctg.sample_name != prev_sample_name)
 			{
-				if (is_gio_opened)
-					gio.Close();
+				if (is_gio_opened && !_path.empty())
+					close_file();
 
 				prev_sample_name = ctg.sample_name;
 				path cur_path = _path;
-				cur_path.append(prev_sample_name + ".fa" + (gzip_level ? ".gz" : ""));
+				cur_path.append(prev_sample_name + ".fa" + (level ? ".gz" : ""));
 //				cur_path.append(prev_sample_name + (gzip_level ? ".gz" : ""));
 
 				if (_path.empty())
-					gio.Open("", true);
+				{
+					// Stdout is opened once (in BGZF mode it is a single BGZF stream)
+					if (global_id == 0)
+						is_gio_opened = gio.Open("", true, bgzf_mode);
+				}
 				else
 				{
-					gio.Open(cur_path.string(), true);
+					cur_file_name = cur_path.string();
+					is_gio_opened = gio.Open(cur_file_name, true, bgzf_mode);
 					if (verbosity > 0)
 					{
-						cerr << eol << cur_path.string() << "  (" << ++file_id << " of " << v_samples.size() << ")";
+						cerr << eol << cur_file_name << "  (" << ++file_id << " of " << v_samples.size() << ")";
 						eol = "\n";
 					}
 				}
 
-				is_gio_opened = true;
+				if (!is_gio_opened && save_ok)
+				{
+					cerr << eol << "Cannot open destination file: " << cur_file_name << endl;
+					save_ok = false;
+				}
 			}
 
 			++global_id;
 
-			gio.SaveContigDirectly(ctg.contig_name, ctg.contig_data, gzip_level);
+			if (is_gio_opened && !(bgzf_mode ?
+				gio.SaveContigBgzf(ctg.contig_name, ctg.contig_data, ctg.seq_length, _line_length) :
+				gio.SaveContigDirectly(ctg.contig_name, ctg.contig_data, gzip_level)))
+				save_ok = false;
+
+			ws.queued_bytes -= ctg.contig_data.size();
 		}
 
 		if (is_gio_opened)
 		{
-			gio.Close();
+			close_file();
 			if (verbosity > 0)
 				cerr << endl;
 		}
 		});
 
-	v_threads.clear();
+	// Group-major decompression: samples are processed in windows of bounded raw size by a single pool of workers.
+	// Within a window each group is decoded by a single thread (reference is unpacked once per group)
+	// and then the contigs are assembled from the decoded segments and passed to the saving thread.
+	// Decoding of a window starts when the assembled contigs waiting for the saving thread take at most 1/4 of the window size,
+	// so the decoded and the queued data take together at most about 1.25 of the window size.
+	uint64_t window_size = fast ? group_major_window_size_fast : group_major_window_size;
+	size_t i_sample = 0;
+	bool res = true;
+
+	unordered_map<uint32_t, uint32_t> m_group_pos;
+	sample_desc_t sample_desc;
+
+	CBarrier bar(no_threads + 1);
+	vector<thread> v_threads;
+
 	v_threads.reserve(no_threads);
 
-	uint32_t global_i = 0;
-	uint32_t prev_no_contigs = no_threads;
+	for (uint32_t i = 0; i < no_threads; ++i)
+		v_threads.emplace_back([&, i] {
+		pin_worker(i, no_threads);
 
-	q_contig_tasks->Restart(1);
+		auto zstd_ctx = ZSTD_createDCtx();
 
-	start_decompressing_threads(v_threads, no_threads, gzip_level, _line_length, fast);
+		contig_t ctg, working_space;
+		refresh::gz_in_memory gzip_compressor(level);
+		CBgzfCompressor bgzf_compressor(level);
 
-	sample_desc_t sample_desc;
+		while (true)
+		{
+			bar.arrive_and_wait();		// window is ready
+			if (ws.completed)
+				break;
 
-	bool res = true;
+			decompress_groups(ws, zstd_ctx);
+
+			bar.arrive_and_wait();		// all groups are decoded
+
+			if (ws.all_ok)
+				assemble_contigs(ws, ctg, working_space, gzip_compressor, bgzf_compressor, level, _line_length, bgzf_mode);
+
+			bar.arrive_and_wait();		// all contigs are assembled
+		}
+
+		ZSTD_freeDCtx(zstd_ctx);
+			});
 
-	for (const auto& s : v_samples)
+	while (res && i_sample < v_samples.size())
 	{
-		if (!collection_desc->get_sample_desc(s, sample_desc))
+		uint64_t cur_window_size = 0;
+
+		ws.first_priority += ws.v_contigs.size();
+		ws.v_contigs.clear();
+
+		for (bool first = true; i_sample < v_samples.size() && (first || cur_window_size < window_size); ++i_sample, first = false)
 		{
-			cerr << "There is no sample " << s << endl;
+			if (!collection_desc->get_sample_desc(v_samples[i_sample], sample_desc))
+			{
+				cerr << "There is no sample " << v_samples[i_sample] << endl;
 
-			res = false;
-			break;
+				res = false;
+				break;
+			}
+
+			for (auto& x : sample_desc)
+			{
+				for (auto& seg : x.second)
+					cur_window_size += seg.raw_length;
+
+				ws.v_contigs.emplace_back(v_samples[i_sample], x.first, move(x.second));
+			}
 		}
 
-		v_tasks.clear();
-		v_tasks.shrink_to_fit();
-		v_tasks.reserve(sample_desc.size());
+		if (!res)
+			break;
 
-		for (uint32_t i = 0; i < sample_desc.size(); ++i, ++global_i)
-			v_tasks.emplace_back(global_i, s, sample_desc[i].first, sample_desc[i].second);
+		ws.v_group_tasks.clear();
+		m_group_pos.clear();
+
+		for (auto& ctg : ws.v_contigs)
+			for (size_t j = 0; j < ctg.segments.size(); ++j)
+			{
+				auto& seg = ctg.segments[j];
+				auto p = m_group_pos.find(seg.group_id);
+
+				if (p == m_group_pos.end())
+				{
+					p = m_group_pos.emplace(seg.group_id, (uint32_t) ws.v_group_tasks.size()).first;
+					ws.v_group_tasks.emplace_back(seg.group_id);
+				}
+
+				auto& group_task = ws.v_group_tasks[p->second];
+				group_task.v_req.emplace_back(seg.in_group_id, &ctg.v_seg_data[j]);
+				group_task.cost += seg.raw_length;
+			}
+
+		// The largest groups go first to balance the threads
+		sort(ws.v_group_tasks.begin(), ws.v_group_tasks.end(), [](const auto& x, const auto& y) {return x.cost > y.cost; });
 
-		sort(v_tasks.begin(), v_tasks.end(), [](auto& x, auto& y) {return x.segments.size() > y.segments.size(); });
+		ws.next_task_id = 0;
+		ws.next_contig_id = 0;
 
-		while (pq_contigs_to_save->GetSize() > 3 * prev_no_contigs || q_contig_tasks->GetSize().first > 3 * no_threads)
+		// Wait until the saving thread (almost) completes the previous window
+		while (ws.queued_bytes > window_size / 4)
 			this_thread::sleep_for(std::chrono::microseconds(25));
 
-		prev_no_contigs = sample_desc.size();
+		bar.arrive_and_wait();
+		bar.arrive_and_wait();
 
-		for (auto& task : v_tasks)
-			q_contig_tasks->Push(task, 0);
+		if (!ws.all_ok)
+		{
+			cerr << "Corrupted archive!" << endl;
+			res = false;
+		}
+
+		bar.arrive_and_wait();
 	}
 
-	q_contig_tasks->MarkCompleted();
+	ws.completed = true;
+	bar.arrive_and_wait();
 
 	join_threads(v_threads);
 
+	pq_contigs_to_save->MarkCompleted();
+
 	gio_thread.join();
 
-	q_contig_tasks.release();
-	pq_contigs_to_save.release();
+	pq_contigs_to_save.reset();
 
-	return res;
+	return res && save_ok;
 }
 
 // *******************************************************************************************
@@ -270,21 +522,30 @@ bool CAGCDecompressor::GetSampleFile(const string& _file_name, const vector<stri
 	vector<contig_task_t> v_tasks;
 	vector<thread> v_threads;
 
+	uint32_t level = (bgzf_mode && !gzip_level) ? default_bgzf_level : gzip_level;
+
 	string eol = "";
 
+	bool save_ok = true;
+
 	// Saving thread
 	thread gio_thread([&] {
 		CGenomeIO gio;
 		sample_contig_data_t ctg;
 
-		gio.Open(_file_name, true);
+		bool is_gio_opened = gio.Open(_file_name, true, bgzf_mode);
+		save_ok = is_gio_opened;
 
+		// Contigs are dropped if the file cannot be written (the queue must be emptied anyway)
 		while (!pq_contigs_to_save->IsCompleted())
 		{
 			if (!pq_contigs_to_save->Pop(ctg))
 				break;
 
-			gio.SaveContigDirectly(ctg.contig_name, ctg.contig_data, gzip_level);
+			if (is_gio_opened && !(bgzf_mode ?
+				gio.SaveContigBgzf(ctg.contig_name, ctg.contig_data, ctg.seq_length, _line_length) :
+				gio.SaveContigDirectly(ctg.contig_name, ctg.contig_data, gzip_level)))
+				save_ok = false;
 
 			if (!_file_name.empty() && verbosity > 0)
 			{
@@ -293,7 +554,11 @@ bool CAGCDecompressor::GetSampleFile(const string& _file_name, const vector<stri
 			}
 		}
 
-		gio.Close();
+		if (gio.NoDuplicatedIndexNames())
+			cerr << eol << "Warning: " << gio.NoDuplicatedIndexNames() << " contig names repeated in " << _file_name << " are not indexed in .fai" << endl;
+
+		if (is_gio_opened && !gio.Close())
+			save_ok = false;
 		});
 
 	v_threads.clear();
@@ -314,7 +579,7 @@ bool CAGCDecompressor::GetSampleFile(const string& _file_name, const vector<stri
 
 		q_contig_tasks->Restart(1);
 
-		start_decompressing_threads(v_threads, no_threads, gzip_level, _line_length);
+		start_decompressing_threads(v_threads, no_threads, level, _line_length, false, bgzf_mode);
 
 		for (auto& task : v_tasks)
 			q_contig_tasks->Push(task, 0);
@@ -333,7 +598,10 @@ bool CAGCDecompressor::GetSampleFile(const string& _file_name, const vector<stri
 	q_contig_tasks.release();
 	pq_contigs_to_save.release();
 
-	return true;
+	if (!save_ok)
+		cerr << "Cannot write file: " << (_file_name.empty() ? "stdout" : _file_name) << endl;
+
+	return save_ok;
 }
 
 // *******************************************************************************************
@@ -662,4 +930,373 @@ bool CAGCDecompressor::GetContigForStreaming(const string& _file_name, const vec
 	return true;
 }
 
+// *******************************************************************************************
+string CAGCDecompressor::json_str(const string& s)
+{
+	string r = "\"";
+
+	for (auto c : s)
+	{
+		if (c == '"' || c == '\\')
+		{
+			r.push_back('\\');
+			r.push_back(c);
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", (unsigned)c);
+			r.append(buf);
+		}
+		else
+			r.push_back(c);
+	}
+
+	r.push_back('"');
+
+	return r;
+}
+
+// *******************************************************************************************
+// Collect statistics of the archive (per-stream-class sizes, groups, samples) as JSON
+bool CAGCDecompressor::GetArchiveStats(string& json_stats, const string& timed_sample, const uint32_t no_threads)
+{
+	if (working_mode != working_mode_t::decompression)
+		return false;
+
+	struct stream_class_t {
+		size_t no_streams = 0;
+		size_t no_parts = 0;
+		uint64_t packed_size = 0;
+		uint64_t raw_size = 0;
+	};
+
+	struct group_stats_t {
+		uint32_t no_seqs = 0;
+		uint64_t no_occurrences = 0;
+		uint64_t ref_raw_size = 0;
+		uint64_t packed_size = 0;
+		vector<uint64_t> v_pack_raw_size;
+	};
+
+	struct sample_stats_t {
+		string name;
+		size_t no_contigs = 0;
+		size_t no_segments = 0;
+		uint64_t length = 0;
+		uint64_t est_decode_bytes = 0;
+	};
+
+	map<string, stream_class_t> m_stream_classes;
+	vector<group_stats_t> v_groups;
+	vector<sample_stats_t> v_sample_stats;
+	vector<string> v_samples;
+	sample_desc_t sample_desc;
+
+	collection_desc->get_samples_list(v_samples, false);
+
+	v_groups.resize(no_raw_groups);
+
+	// Segment descriptions of all samples
+	for (auto& s : v_samples)
+	{
+		if (!collection_desc->get_sample_desc(s, sample_desc))
+			return false;
+
+		sample_stats_t sample_stats;
+		sample_stats.name = s;
+		sample_stats.no_contigs = sample_desc.size();
+
+		for (auto& ctg : sample_desc)
+		{
+			for (auto& seg : ctg.second)
+			{
+				if (seg.group_id >= v_groups.size())
+					v_groups.resize(seg.group_id + 1);
+
+				auto& group = v_groups[seg.group_id];
+				group.no_seqs = max(group.no_seqs, seg.in_group_id + 1);
+				++group.no_occurrences;
+
+				sample_stats.length += seg.raw_length;
+			}
+
+			sample_stats.no_segments += ctg.second.size();
+			if (!ctg.second.empty())
+				sample_stats.length -= (ctg.second.size() - 1) * kmer_length;
+		}
+
+		v_sample_stats.emplace_back(sample_stats);
+	}
+
+	// Group streams
+	auto part_raw_size = [](size_t packed_size, uint64_t metadata) {return metadata ? metadata : (uint64_t)packed_size; };
+	vector<bool> v_group_stream(in_archive->GetNoStreams(), false);
+	size_t no_lz_groups = 0;
+	size_t no_references = 0;
+	uint64_t no_deltas = 0;
+	uint64_t no_raw_seqs = 0;
+
+	for (uint32_t group_id = 0; group_id < v_groups.size(); ++group_id)
+	{
+		auto& group = v_groups[group_id];
+		int ref_id = in_archive->GetStreamId(ss_ref_name(archive_version, group_id));
+		int delta_id = in_archive->GetStreamId(ss_delta_name(archive_version, group_id));
+		size_t packed_size;
+		uint64_t metadata;
+
+		if (ref_id >= 0)
+		{
+			auto& sc = m_stream_classes["group-ref"];
+			++sc.no_streams;
+			sc.no_parts += in_archive->GetNoParts(ref_id);
+			sc.packed_size += in_archive->GetStreamPackedSize(ref_id);
+			group.packed_size += in_archive->GetStreamPackedSize(ref_id);
+
+			if (in_archive->GetPartInfo(ref_id, 0, packed_size, metadata))
+			{
+				group.ref_raw_size = part_raw_size(packed_size, metadata);
+				sc.raw_size += group.ref_raw_size;
+			}
+
+			v_group_stream[ref_id] = true;
+			++no_references;
+		}
+
+		if (delta_id >= 0)
+		{
+			auto& sc = m_stream_classes[group_id < no_raw_groups ? "raw-group" : "group-delta"];
+			size_t no_parts = in_archive->GetNoParts(delta_id);
+
+			++sc.no_streams;
+			sc.no_parts += no_parts;
+			sc.packed_size += in_archive->GetStreamPackedSize(delta_id);
+			group.packed_size += in_archive->GetStreamPackedSize(delta_id);
+
+			group.v_pack_raw_size.resize(no_parts, 0);
+			for (size_t i = 0; i < no_parts; ++i)
+				if (in_archive->GetPartInfo(delta_id, (int)i, packed_size, metadata))
+				{
+					group.v_pack_raw_size[i] = part_raw_size(packed_size, metadata);
+					sc.raw_size += group.v_pack_raw_size[i];
+				}
+
+			v_group_stream[delta_id] = true;
+		}
+
+		if (group_id < no_raw_groups)
+			no_raw_seqs += group.no_seqs;
+		else if (group.no_seqs)
+		{
+			++no_lz_groups;
+			no_deltas += group.no_seqs - 1;
+		}
+	}
+
+	// Remaining streams
+	uint64_t total_packed_size = 0;
+	uint64_t collection_packed_size = 0;
+
+	for (int i = 0; i < (int)in_archive->GetNoStreams(); ++i)
+	{
+		size_t stream_packed_size = in_archive->GetStreamPackedSize(i);
+		total_packed_size += stream_packed_size;
+
+		if (v_group_stream[i])
+			continue;
+
+		string stream_name = in_archive->GetStreamName(i);
+		string class_name;
+
+		if (stream_name.compare(0, 11, "collection-") == 0)
+		{
+			class_name = "collection";
+			collection_packed_size += stream_packed_size;
+		}
+		else if (stream_name == "params" || stream_name == "splitters" || stream_name == "segment-splitters" || stream_name == "file_type_info" || stream_name == "contig-hashes")
+			class_name = stream_name;
+		else if (stream_name == "splitters-ef")
+			class_name = "splitters";
+		else if (stream_name == "segment-splitters-col")
+			class_name = "segment-splitters";
+		else if (stream_name == "delta-dict")
+			class_name = "dictionaries";
+		else
+			class_name = "other";
+
+		auto& sc = m_stream_classes[class_name];
+		size_t no_parts = in_archive->GetNoParts(i);
+		size_t packed_size;
+		uint64_t metadata;
+
+		++sc.no_streams;
+		sc.no_parts += no_parts;
+		sc.packed_size += stream_packed_size;
+
+		// Only in collection streams metadata of a part is its raw size, the remaining streams are stored as is
+		if (class_name == "collection")
+		{
+			for (size_t j = 0; j < no_parts; ++j)
+				if (in_archive->GetPartInfo(i, (int)j, packed_size, metadata))
+					sc.raw_size += part_raw_size(packed_size, metadata);
+		}
+		else
+			sc.raw_size += stream_packed_size;
+	}
+
+	// Estimated decoding cost of samples (bytes to unpack when segments are decoded one by one)
+	for (size_t i = 0; i < v_samples.size(); ++i)
+	{
+		collection_desc->get_sample_desc(v_samples[i], sample_desc);
+
+		for (auto& ctg : sample_desc)
+			for (auto& seg : ctg.second)
+			{
+				auto& group = v_groups[seg.group_id];
+				uint64_t cost = seg.raw_length;
+				size_t part_id;
+
+				if (seg.group_id < no_raw_groups)
+					part_id = seg.in_group_id / pack_cardinality;
+				else
+				{
+					cost += group.ref_raw_size;
+					part_id = seg.in_group_id ? (seg.in_group_id - 1) / pack_cardinality : group.v_pack_raw_size.size();
+				}
+
+				if (part_id < group.v_pack_raw_size.size())
+					cost += group.v_pack_raw_size[part_id];
+
+				v_sample_stats[i].est_decode_bytes += cost;
+			}
+	}
+
+	// Group size distribution
+	vector<uint64_t> v_hist_seqs;
+	vector<uint64_t> v_group_packed;
+
+	for (uint32_t group_id = no_raw_groups; group_id < v_groups.size(); ++group_id)
+	{
+		auto& group = v_groups[group_id];
+
+		if (!group.no_seqs)
+			continue;
+
+		uint32_t bin = 0;
+		while ((1u << (bin + 1)) <= group.no_seqs)
+			++bin;
+
+		if (bin >= v_hist_seqs.size())
+			v_hist_seqs.resize(bin + 1, 0);
+		++v_hist_seqs[bin];
+
+		v_group_packed.emplace_back(group.packed_size);
+	}
+
+	sort(v_group_packed.begin(), v_group_packed.end());
+
+	auto quantile = [&](double q) -> uint64_t {
+		if (v_group_packed.empty())
+			return 0;
+		return v_group_packed[(size_t)(q * (v_group_packed.size() - 1))];
+	};
+
+	// Optional timed decompression of a single sample
+	double timed_s = -1;
+	uint64_t timed_length = 0;
+
+	if (!timed_sample.empty())
+	{
+		vector<pair<string, vector<uint8_t>>> v_contig_seq;
+
+		auto t1 = chrono::high_resolution_clock::now();
+		if (!GetSampleSequences(timed_sample, v_contig_seq, no_threads))
+			return false;
+		auto t2 = chrono::high_resolution_clock::now();
+
+		timed_s = chrono::duration<double>(t2 - t1).count();
+
+		for (auto& x : v_contig_seq)
+			timed_length += x.second.size();
+	}
+
+	// JSON output
+	string ref_name;
+	collection_desc->get_reference_name(ref_name);
+
+	uint64_t file_size = 0;
+	error_code ec;
+
+	if (!in_archive_name.empty())
+	{
+		file_size = std::filesystem::file_size(in_archive_name, ec);
+		if (ec)
+			file_size = 0;
+	}
+
+	ostringstream oss;
+
+	oss << "{\n";
+	oss << "  \"archive\": {\n";
+	oss << "    \"file_name\": " << json_str(in_archive_name) << ",\n";
+	oss << "    \"file_size\": " << file_size << ",\n";
+	oss << "    \"version\": " << archive_version << ",\n";
+	oss << "    \"no_samples\": " << v_samples.size() << ",\n";
+	oss << "    \"reference\": " << json_str(ref_name) << ",\n";
+	oss << "    \"kmer_length\": " << kmer_length << ",\n";
+	oss << "    \"min_match_len\": " << min_match_len << ",\n";
+	oss << "    \"pack_cardinality\": " << pack_cardinality << ",\n";
+	oss << "    \"segment_size\": " << segment_size << "\n";
+	oss << "  },\n";
+
+	oss << "  \"streams\": {\n";
+	for (auto p = m_stream_classes.begin(); p != m_stream_classes.end(); ++p)
+	{
+		oss << "    " << json_str(p->first) << ": {\"no_streams\": " << p->second.no_streams << ", \"no_parts\": " << p->second.no_parts
+			<< ", \"packed_size\": " << p->second.packed_size << ", \"raw_size\": " << p->second.raw_size << "}";
+		oss << (next(p) != m_stream_classes.end() ? ",\n" : "\n");
+	}
+	oss << "  },\n";
+
+	oss << "  \"groups\": {\n";
+	oss << "    \"no_groups\": " << v_groups.size() << ",\n";
+	oss << "    \"no_raw_groups\": " << no_raw_groups << ",\n";
+	oss << "    \"no_lz_groups\": " << no_lz_groups << ",\n";
+	oss << "    \"no_references\": " << no_references << ",\n";
+	oss << "    \"no_deltas\": " << no_deltas << ",\n";
+	oss << "    \"no_raw_seqs\": " << no_raw_seqs << ",\n";
+	oss << "    \"in_group_histogram\": [";
+	for (size_t i = 0; i < v_hist_seqs.size(); ++i)
+		oss << (i ? ", " : "") << "{\"min\": " << (1ull << i) << ", \"max\": " << (1ull << (i + 1)) - 1 << ", \"no_groups\": " << v_hist_seqs[i] << "}";
+	oss << "],\n";
+	oss << "    \"packed_size_quantiles\": {\"min\": " << quantile(0) << ", \"p50\": " << quantile(0.5) << ", \"p90\": " << quantile(0.9)
+		<< ", \"p99\": " << quantile(0.99) << ", \"max\": " << quantile(1.0) << "}\n";
+	oss << "  },\n";
+
+	oss << "  \"collection_metadata\": {\"packed_size\": " << collection_packed_size << ", \"share\": "
+		<< (total_packed_size ? (double)collection_packed_size / total_packed_size : 0.0) << "},\n";
+
+	oss << "  \"samples\": [\n";
+	for (size_t i = 0; i < v_sample_stats.size(); ++i)
+	{
+		auto& ss = v_sample_stats[i];
+		oss << "    {\"name\": " << json_str(ss.name) << ", \"no_contigs\": " << ss.no_contigs << ", \"no_segments\": " << ss.no_segments
+			<< ", \"length\": " << ss.length << ", \"est_decode_bytes\": " << ss.est_decode_bytes << "}";
+		oss << (i + 1 < v_sample_stats.size() ? ",\n" : "\n");
+	}
+	oss << "  ]";
+
+	if (!timed_sample.empty())
+	{
+		oss << ",\n  \"timed_decode\": {\"sample\": " << json_str(timed_sample) << ", \"no_threads\": " << no_threads << ", \"length\": " << timed_length
+			<< ", \"time_s\": " << timed_s << ", \"throughput_MBps\": " << (timed_s > 0 ? timed_length / timed_s / 1e6 : 0.0) << "}";
+	}
+
+	oss << "\n}\n";
+
+	json_stats = oss.str();
+
+	return true;
+}
+
 // EOF
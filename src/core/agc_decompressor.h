@@ -12,15 +12,71 @@
 // *******************************************************************************************
 
 #include "../common/agc_decompressor_lib.h"
+#include "../common/numa.h"
+#include "bgzf.h"
+#include "utils_adv.h"
 #include <refresh/compression/lib/gz_wrapper.h>
 
 // *******************************************************************************************
 // Class supporting only decompression of AGC files - extended version (can store also in gzipped files)
 class CAGCDecompressor : public CAGCDecompressorLibrary
 {
-	void start_decompressing_threads(vector<thread>& v_threads, const uint32_t n_t, uint32_t gzip_level = 0, uint32_t line_len = 0, bool fast = false);
+	// Contig of the current window of group-major decompression (segments are filled by group decoders)
+	struct window_contig_t {
+		string sample_name;
+		string contig_name;
+		vector<segment_desc_t> segments;
+		vector<contig_t> v_seg_data;
+
+		window_contig_t() = default;
+		window_contig_t(const string& _sample_name, const string& _contig_name, vector<segment_desc_t>&& _segments) :
+			sample_name(_sample_name), contig_name(_contig_name), segments(move(_segments)), v_seg_data(segments.size()) {}
+	};
+
+	// All requested sequences from a single group (sorted by in_group_id before decoding)
+	struct group_task_t {
+		uint32_t group_id;
+		uint64_t cost;
+		vector<pair<uint32_t, contig_t*>> v_req;
+
+		group_task_t(const uint32_t _group_id = 0) : group_id(_group_id), cost(0) {}
+	};
+
+	// State of the window of group-major decompression shared by the workers of the pool
+	struct window_state_t {
+		vector<window_contig_t> v_contigs;
+		vector<group_task_t> v_group_tasks;
+		size_t first_priority = 0;
+		atomic<size_t> next_task_id{ 0 };
+		atomic<size_t> next_contig_id{ 0 };
+		atomic<bool> all_ok{ true };
+		atomic<uint64_t> queued_bytes{ 0 };			// size of assembled contigs waiting for the saving thread
+		bool completed = false;
+	};
+
+	// Raw size of the segments decoded at once by the group-major decompression (getcol)
+	const uint64_t group_major_window_size = 1ull << 30;
+	const uint64_t group_major_window_size_fast = 4ull << 30;
+
+	shared_ptr<CNumaTopology> numa_topology;			// NUMA mode (nullptr - disabled)
+
+	// BGZF output (with .fai and .gzi indexes) of getcol and getset
+	bool bgzf_mode = false;
+	const uint32_t default_bgzf_level = 6;
+
+	void pin_worker(const uint32_t worker_id, const uint32_t no_workers);
+
+	void start_decompressing_threads(vector<thread>& v_threads, const uint32_t n_t, uint32_t gzip_level = 0, uint32_t line_len = 0, bool fast = false, bool bgzf = false);
 
 	void gzip_contig(contig_t& ctg, contig_t& working_space, refresh::gz_in_memory& gzip_compressor);
+	void bgzf_contig(const string& contig_name, contig_t& ctg, contig_t& working_space, CBgzfCompressor& bgzf_compressor);
+
+	void decompress_groups(window_state_t& ws, ZSTD_DCtx* zstd_ctx);
+	void assemble_contigs(window_state_t& ws, contig_t& ctg, contig_t& working_space, refresh::gz_in_memory& gzip_compressor, CBgzfCompressor& bgzf_compressor,
+		uint32_t gzip_level, uint32_t line_len, bool bgzf);
+	bool assemble_contig(window_contig_t& contig, contig_t& ctg);
+
+	string json_str(const string& s);
 
 public:
 	CAGCDecompressor(bool _is_app_mode);
@@ -34,7 +90,12 @@ public:
 
 	bool GetSampleSequences(const string& sample_name, vector<pair<string, vector<uint8_t>>> &v_contig_seq, const uint32_t no_threads);
 
+	bool GetArchiveStats(string& json_stats, const string& timed_sample, const uint32_t no_threads);
+
 	bool AssignArchive(const CAGCBasic &agc_basic);
+
+	void SetNuma(const uint32_t no_nodes);
+	void SetBgzf(const bool enable);
 };
 
 // EOF
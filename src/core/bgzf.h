@@ -0,0 +1,236 @@
+#ifndef _BGZF_H
+#define _BGZF_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <libdeflate.h>
+#include "../common/defs.h"
+
+using namespace std;
+
+// *******************************************************************************************
+// BGZF (blocked gzip) compression of FASTA output.
+//
+// BGZF file is a series of gzip members (blocks) of at most 64 KiB, each storing its size in the extra field, and ends
+// with an empty block (EOF marker). Such files can be decompressed by any gzip tool and accessed randomly by htslib
+// (samtools faidx) using the .fai and .gzi indexes.
+// Each contig (with its header line) is compressed into its own blocks, so contigs can be compressed in parallel by
+// the decompression threads and the saving thread only writes the blocks and builds the indexes.
+class CBgzfCompressor
+{
+	static const size_t max_block_input = 0xff00;			// as in htslib, so each block fits in 64 KiB
+	static const size_t max_block_size = 1 << 16;
+	static const size_t header_size = 18;
+	static const size_t footer_size = 8;
+
+	int compression_level;
+	libdeflate_compressor* ld_comp = nullptr;
+
+	// *******************************************************************************************
+	static void store16(uint8_t* p, const uint32_t x)
+	{
+		p[0] = (uint8_t)x;
+		p[1] = (uint8_t)(x >> 8);
+	}
+
+	// *******************************************************************************************
+	static void store32(uint8_t* p, const uint32_t x)
+	{
+		store16(p, x);
+		store16(p + 2, x >> 16);
+	}
+
+	// *******************************************************************************************
+	// Deflate stream of a single stored (not compressed) block
+	static size_t store_raw(const uint8_t* src, const size_t src_size, uint8_t* dest)
+	{
+		dest[0] = 1;
+		store16(dest + 1, (uint32_t)src_size);
+		store16(dest + 3, (uint32_t)~src_size);
+		memcpy(dest + 5, src, src_size);
+
+		return src_size + 5;
+	}
+
+public:
+	// *******************************************************************************************
+	CBgzfCompressor(const int _compression_level = 6) :
+		compression_level(_compression_level < 1 ? 1 : (_compression_level > 12 ? 12 : _compression_level))
+	{}
+
+	CBgzfCompressor(const CBgzfCompressor&) = delete;
+	CBgzfCompressor& operator=(const CBgzfCompressor&) = delete;
+
+	// *******************************************************************************************
+	~CBgzfCompressor()
+	{
+		if (ld_comp)
+			libdeflate_free_compressor(ld_comp);
+	}
+
+	// *******************************************************************************************
+	// Compress the data into a series of BGZF blocks
+	void Compress(const uint8_t* src, const size_t src_size, contig_t& dest)
+	{
+		if (!ld_comp)
+			ld_comp = libdeflate_alloc_compressor(compression_level);
+
+		size_t no_blocks = (src_size + max_block_input - 1) / max_block_input;
+
+		dest.resize(no_blocks * max_block_size);
+		size_t dest_pos = 0;
+
+		for (size_t src_pos = 0; src_pos < src_size; src_pos += max_block_input)
+		{
+			size_t in_size = min(max_block_input, src_size - src_pos);
+			uint8_t* block = dest.data() + dest_pos;
+
+			size_t packed_size = libdeflate_deflate_compress(ld_comp, src + src_pos, in_size, block + header_size, max_block_size - header_size - footer_size);
+			if (packed_size == 0)
+				packed_size = store_raw(src + src_pos, in_size, block + header_size);
+
+			size_t block_size = header_size + packed_size + footer_size;
+
+			const uint8_t header[header_size] = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+			memcpy(block, header, header_size);
+			store16(block + 16, (uint32_t)(block_size - 1));
+
+			store32(block + header_size + packed_size, libdeflate_crc32(0, src + src_pos, in_size));
+			store32(block + header_size + packed_size + 4, (uint32_t)in_size);
+
+			dest_pos += block_size;
+		}
+
+		dest.resize(dest_pos);
+	}
+
+	// *******************************************************************************************
+	// Empty block marking the end of BGZF file
+	static const vector<uint8_t>& EofBlock()
+	{
+		static const vector<uint8_t> eof_block = { 0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0x1b, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+		return eof_block;
+	}
+
+	// *******************************************************************************************
+	// Visit blocks of BGZF data: fun(compressed size, uncompressed size)
+	template<typename FUN>
+	static bool ForEachBlock(const uint8_t* data, const size_t size, FUN&& fun)
+	{
+		for (size_t pos = 0; pos < size; )
+		{
+			if (size - pos < header_size + footer_size)
+				return false;
+
+			size_t block_size = (size_t)data[pos + 16] + ((size_t)data[pos + 17] << 8) + 1;
+			if (block_size > size - pos)
+				return false;
+
+			auto p = data + pos + block_size - 4;
+			uint32_t in_size = (uint32_t)p[0] + ((uint32_t)p[1] << 8) + ((uint32_t)p[2] << 16) + ((uint32_t)p[3] << 24);
+
+			fun(block_size, in_size);
+			pos += block_size;
+		}
+
+		return true;
+	}
+};
+
+// *******************************************************************************************
+// Indexes of BGZF-compressed FASTA file built on the fly from the contigs written to the file:
+// .fai (contig name, length, offset of the first base, bases and bytes per line) and
+// .gzi (compressed and uncompressed offsets of all blocks except the first one).
+// Names in .fai must be unique, so only the first of contigs of the same name (e.g., from many samples) is indexed.
+class CBgzfIndex
+{
+	vector<pair<uint64_t, uint64_t>> v_gzi;
+	string fai;
+	unordered_set<string> s_names;
+	uint64_t no_duplicates = 0;
+	uint64_t c_offset = 0;
+	uint64_t u_offset = 0;
+
+	// *******************************************************************************************
+	static bool write64(FILE* f, uint64_t x)
+	{
+		uint8_t buf[8];
+
+		for (int i = 0; i < 8; ++i, x >>= 8)
+			buf[i] = (uint8_t)x;
+
+		return fwrite(buf, 1, 8, f) == 8;
+	}
+
+public:
+	// *******************************************************************************************
+	// Contig compressed with its header line (of header_size bytes) into data, with lines of line_length bases (0 - single line)
+	bool AddContig(const string& id, const uint64_t seq_length, const uint32_t line_length, const uint64_t header_size, const contig_t& data)
+	{
+		// Only the first word of the header is the name of the sequence
+		string name = id.substr(0, id.find_first_of(" \t"));
+		uint64_t line_bases = line_length ? line_length : seq_length;
+
+		if (!s_names.insert(name).second)
+			++no_duplicates;
+		else
+			fai += name + "\t" + to_string(seq_length) + "\t" + to_string(u_offset + header_size) + "\t" + to_string(line_bases) + "\t" + to_string(line_bases + 1) + "\n";
+
+		return CBgzfCompressor::ForEachBlock(data.data(), data.size(), [&](const uint64_t c_size, const uint64_t u_size) {
+			if (c_offset)
+				v_gzi.emplace_back(c_offset, u_offset);
+
+			c_offset += c_size;
+			u_offset += u_size;
+			});
+	}
+
+	// *******************************************************************************************
+	// No. of contigs not indexed in .fai, as their names were already used
+	uint64_t NoDuplicates() const
+	{
+		return no_duplicates;
+	}
+
+	// *******************************************************************************************
+	bool Save(const string& file_name)
+	{
+		FILE* f_fai = fopen((file_name + ".fai").c_str(), "wb");
+		if (!f_fai)
+			return false;
+
+		bool r = fwrite(fai.data(), 1, fai.size(), f_fai) == fai.size();
+		fclose(f_fai);
+
+		FILE* f_gzi = fopen((file_name + ".gzi").c_str(), "wb");
+		if (!f_gzi)
+			return false;
+
+		r &= write64(f_gzi, v_gzi.size());
+
+		for (auto& x : v_gzi)
+			r &= write64(f_gzi, x.first) && write64(f_gzi, x.second);
+
+		fclose(f_gzi);
+
+		return r;
+	}
+};
+
+// EOF
+#endif
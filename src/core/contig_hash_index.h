@@ -0,0 +1,424 @@
+#ifndef _CONTIG_HASH_INDEX_H
+#define _CONTIG_HASH_INDEX_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <cinttypes>
+#include "../common/defs.h"
+#include "../common/collection.h"
+
+using namespace std;
+
+// *******************************************************************************************
+// Content-hash index of whole contigs used to skip compression of exact duplicates (e.g., chrM, plasmids, resubmitted assemblies).
+//
+// A contig is identified by 128-bit MurmurHash3 of its raw sequence and its length. A duplicate is registered in the collection,
+// but is not compressed. Instead, when the synchronization round it was read in is registered (so segments of its source are placed),
+// the segment list of the source contig is copied to it. For archive readers a duplicate is thus a regular contig.
+//
+// Segment lists of sources from the current run are retained after their round (the collection drops them once a batch of samples
+// is stored) as long as the memory budget allows; sources that were not retained are no longer used to detect duplicates.
+// Sources from the input archive (appending) are read from the archive when needed.
+class CContigHashIndex
+{
+public:
+	struct contig_pos_t {
+		uint32_t sample_id;
+		uint32_t contig_id;
+
+		bool operator<(const contig_pos_t& x) const
+		{
+			return sample_id != x.sample_id ? sample_id < x.sample_id : contig_id < x.contig_id;
+		}
+	};
+
+	struct key_t {
+		uint64_t h1;
+		uint64_t h2;
+		uint64_t length;
+
+		bool operator==(const key_t& x) const
+		{
+			return h1 == x.h1 && h2 == x.h2 && length == x.length;
+		}
+	};
+
+private:
+	enum class state_t : uint8_t { archived, pending, retained, stale };
+
+	struct entry_t {
+		contig_pos_t pos;
+		uint32_t no_pending_refs;
+		state_t state;
+	};
+
+	struct alias_t {
+		uint32_t round;
+		contig_pos_t pos;
+		key_t src;
+	};
+
+	struct key_hash_t {
+		size_t operator()(const key_t& x) const noexcept
+		{
+			return (size_t) x.h1;
+		}
+	};
+
+	mutex mtx;
+	unordered_map<key_t, entry_t, key_hash_t> m_entries;
+	unordered_map<key_t, vector<segment_desc_t>, key_hash_t> m_retained;
+	vector<alias_t> v_aliases;
+	vector<pair<uint32_t, key_t>> v_pending;
+
+	const uint64_t min_contig_length;
+	const uint64_t max_retained_segments;
+	uint64_t no_retained_segments = 0;
+	uint64_t no_duplicates = 0;
+
+	// *******************************************************************************************
+	static uint64_t rotl64(const uint64_t x, const int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	// *******************************************************************************************
+	static uint64_t fmix64(uint64_t k)
+	{
+		k ^= k >> 33;
+		k *= 0xff51afd7ed558ccdull;
+		k ^= k >> 33;
+		k *= 0xc4ceb9fe1a85ec53ull;
+		k ^= k >> 33;
+
+		return k;
+	}
+
+	// *******************************************************************************************
+	static void append_fixed(vector<uint8_t>& v, uint64_t x, const uint32_t no_bytes)
+	{
+		for (uint32_t i = 0; i < no_bytes; ++i, x >>= 8)
+			v.emplace_back((uint8_t)x);
+	}
+
+	// *******************************************************************************************
+	static bool read_fixed(const uint8_t*& p, const uint8_t* p_end, uint64_t& x, const uint32_t no_bytes)
+	{
+		if (p_end - p < (ptrdiff_t)no_bytes)
+			return false;
+
+		x = 0;
+		for (uint32_t i = 0; i < no_bytes; ++i)
+			x += ((uint64_t)*p++) << (8 * i);
+
+		return true;
+	}
+
+	// *******************************************************************************************
+	static void append_varint(vector<uint8_t>& v, uint64_t x)
+	{
+		for (; x >= 0x80; x >>= 7)
+			v.emplace_back((uint8_t)(x | 0x80));
+		v.emplace_back((uint8_t)x);
+	}
+
+	// *******************************************************************************************
+	static bool read_varint(const uint8_t*& p, const uint8_t* p_end, uint64_t& x)
+	{
+		x = 0;
+
+		for (uint32_t shift = 0; p < p_end && shift < 64; shift += 7)
+		{
+			uint8_t c = *p++;
+			x |= ((uint64_t)(c & 0x7f)) << shift;
+
+			if (!(c & 0x80))
+				return true;
+		}
+
+		return false;
+	}
+
+public:
+	// *******************************************************************************************
+	CContigHashIndex(const uint64_t _min_contig_length = 1000, const uint64_t max_retained_bytes = 256ull << 20) :
+		min_contig_length(_min_contig_length), max_retained_segments(max_retained_bytes / sizeof(segment_desc_t))
+	{}
+
+	CContigHashIndex(const CContigHashIndex&) = delete;
+	CContigHashIndex& operator=(const CContigHashIndex&) = delete;
+
+	// *******************************************************************************************
+	// MurmurHash3 (x64, 128-bit variant)
+	static key_t Hash(const contig_t& contig)
+	{
+		const uint64_t c1 = 0x87c37b91114253d5ull;
+		const uint64_t c2 = 0x4cf5ad432745937full;
+		const size_t n = contig.size();
+		const uint8_t* data = contig.data();
+
+		uint64_t h1 = 0x9368e53c2f6af274ull;
+		uint64_t h2 = 0x586dcd208f7cd3fdull;
+
+		for (size_t i = 0; i < n / 16; ++i, data += 16)
+		{
+			uint64_t k1, k2;
+			memcpy(&k1, data, 8);
+			memcpy(&k2, data + 8, 8);
+
+			k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+			h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+			k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+			h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+		}
+
+		uint64_t k1 = 0;
+		uint64_t k2 = 0;
+		const size_t tail = n % 16;
+
+		for (size_t i = tail; i > 8; --i)
+			k2 ^= ((uint64_t)data[i - 1]) << (8 * (i - 9));
+		if (tail > 8)
+		{
+			k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		}
+
+		for (size_t i = min<size_t>(tail, 8); i > 0; --i)
+			k1 ^= ((uint64_t)data[i - 1]) << (8 * (i - 1));
+		if (tail)
+		{
+			k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		}
+
+		h1 ^= (uint64_t)n; h2 ^= (uint64_t)n;
+
+		h1 += h2;
+		h2 += h1;
+
+		h1 = fmix64(h1);
+		h2 = fmix64(h2);
+
+		h1 += h2;
+		h2 += h1;
+
+		return key_t{ h1, h2, (uint64_t)n };
+	}
+
+	// *******************************************************************************************
+	// Short contigs are not worth indexing
+	bool IsIndexable(const contig_t& contig) const
+	{
+		return contig.size() >= min_contig_length;
+	}
+
+	// *******************************************************************************************
+	// Returns true if an identical contig was indexed before (the contig at pos becomes its alias and must not be compressed).
+	// Otherwise the contig is indexed. Round is the no. of the synchronization round the contig is processed in.
+	bool FindOrInsert(const key_t& key, const contig_pos_t pos, const uint32_t round)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		auto p = m_entries.find(key);
+
+		if (p == m_entries.end())
+		{
+			m_entries.emplace(key, entry_t{ pos, 0, state_t::pending });
+			v_pending.emplace_back(round, key);
+
+			return false;
+		}
+
+		if (p->second.state == state_t::stale)
+			return false;
+
+		++p->second.no_pending_refs;
+		v_aliases.emplace_back(alias_t{ round, pos, key });
+		++no_duplicates;
+
+		return true;
+	}
+
+	// *******************************************************************************************
+	// Must be called when segments of all contigs of rounds up to round are placed in the collection (and before the batch of samples is stored)
+	// get_segments(pos, v_segments) -> bool: reads the segment list of a contig (from the collection or the input archive)
+	// set_segments(pos, v_segments): sets the segment list of a contig in the collection
+	template<typename GET_SEGMENTS, typename SET_SEGMENTS>
+	bool Resolve(const uint32_t round, GET_SEGMENTS get_segments, SET_SEGMENTS set_segments)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		vector<segment_desc_t> v_segments;
+		bool ok = true;
+
+		// Aliases (and pending contigs) are in the order of rounds
+		auto p_aliases_end = find_if(v_aliases.begin(), v_aliases.end(), [round](const auto& x) {return x.round > round; });
+
+		for (auto p = v_aliases.begin(); p != p_aliases_end; ++p)
+		{
+			auto& entry = m_entries[p->src];
+			--entry.no_pending_refs;
+
+			if (entry.state == state_t::retained)
+				set_segments(p->pos, m_retained[p->src]);
+			else if (get_segments(entry.pos, v_segments))
+				set_segments(p->pos, v_segments);
+			else
+				ok = false;
+		}
+
+		v_aliases.erase(v_aliases.begin(), p_aliases_end);
+
+		auto p_pending_end = find_if(v_pending.begin(), v_pending.end(), [round](const auto& x) {return x.first > round; });
+
+		for (auto p = v_pending.begin(); p != p_pending_end; ++p)
+		{
+			auto& entry = m_entries[p->second];
+
+			// Contigs that have unresolved aliases (read ahead) must be retained regardless of the budget
+			if (get_segments(entry.pos, v_segments) &&
+				(entry.no_pending_refs || no_retained_segments + v_segments.size() <= max_retained_segments))
+			{
+				no_retained_segments += v_segments.size();
+				m_retained[p->second] = move(v_segments);
+				entry.state = state_t::retained;
+			}
+			else if (entry.no_pending_refs)
+				ok = false;
+			else
+				entry.state = state_t::stale;
+		}
+
+		v_pending.erase(v_pending.begin(), p_pending_end);
+
+		return ok;
+	}
+
+	// *******************************************************************************************
+	uint64_t GetNoDuplicates()
+	{
+		lock_guard<mutex> lck(mtx);
+
+		return no_duplicates;
+	}
+
+	// *******************************************************************************************
+	size_t GetSize()
+	{
+		lock_guard<mutex> lck(mtx);
+
+		return m_entries.size();
+	}
+
+	// *******************************************************************************************
+	// Entries are sorted by positions in the collection, which are delta-coded; hashes are stored as is.
+	// Only entries of the first no_samples samples are stored. Returns the no. of stored entries.
+	uint64_t Serialize(vector<uint8_t>& v_out, const uint32_t no_samples = ~0u)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		vector<pair<contig_pos_t, key_t>> v_items;
+		v_items.reserve(m_entries.size());
+
+		for (const auto& x : m_entries)
+			if (x.second.pos.sample_id < no_samples)
+				v_items.emplace_back(x.second.pos, x.first);
+
+		sort(v_items.begin(), v_items.end(), [](const auto& x, const auto& y) {return x.first < y.first; });
+
+		v_out.clear();
+		append_fixed(v_out, v_items.size(), 8);
+
+		contig_pos_t prev{ 0, 0 };
+
+		for (const auto& x : v_items)
+		{
+			append_varint(v_out, x.first.sample_id - prev.sample_id);
+			append_varint(v_out, x.first.sample_id == prev.sample_id ? x.first.contig_id - prev.contig_id : x.first.contig_id);
+			append_varint(v_out, x.second.length);
+			append_fixed(v_out, x.second.h1, 8);
+			append_fixed(v_out, x.second.h2, 8);
+
+			prev = x.first;
+		}
+
+		return v_items.size();
+	}
+
+	// *******************************************************************************************
+	// Loaded entries refer to contigs stored in the input archive
+	bool Deserialize(const vector<uint8_t>& v_in)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		m_entries.clear();
+
+		return import(v_in, nullptr);
+	}
+
+	// *******************************************************************************************
+	// Add entries of the index of another archive (merging archives). Sample ids are mapped by v_sample_map
+	// (entries of samples mapped to ~0u are skipped); already present contigs keep their positions.
+	bool Import(const vector<uint8_t>& v_in, const vector<uint32_t>& v_sample_map)
+	{
+		lock_guard<mutex> lck(mtx);
+
+		return import(v_in, &v_sample_map);
+	}
+
+private:
+	// *******************************************************************************************
+	bool import(const vector<uint8_t>& v_in, const vector<uint32_t>* v_sample_map)
+	{
+		const uint8_t* p = v_in.data();
+		const uint8_t* p_end = p + v_in.size();
+		uint64_t n;
+
+		if (!read_fixed(p, p_end, n, 8))
+			return false;
+
+		m_entries.reserve(m_entries.size() + n);
+
+		contig_pos_t prev{ 0, 0 };
+
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			uint64_t d_sample_id, contig_id;
+			key_t key;
+
+			if (!read_varint(p, p_end, d_sample_id) || !read_varint(p, p_end, contig_id) || !read_varint(p, p_end, key.length) ||
+				!read_fixed(p, p_end, key.h1, 8) || !read_fixed(p, p_end, key.h2, 8))
+				return false;
+
+			contig_pos_t pos{ (uint32_t)(prev.sample_id + d_sample_id), (uint32_t)(d_sample_id ? contig_id : prev.contig_id + contig_id) };
+			prev = pos;
+
+			if (v_sample_map)
+			{
+				if (pos.sample_id >= v_sample_map->size() || (*v_sample_map)[pos.sample_id] == ~0u)
+					continue;
+				pos.sample_id = (*v_sample_map)[pos.sample_id];
+			}
+
+			m_entries.emplace(key, entry_t{ pos, 0, state_t::archived });
+		}
+
+		return p == p_end;
+	}
+};
+
+// EOF
+#endif
@@ -23,6 +23,7 @@ CGenomeIO::CGenomeIO()
 
 	is_gzipped = false;
 	use_stdout = false;
+	is_bgzf = false;
 
 	buffer = nullptr;
 	buffer_pos = 0;
@@ -41,13 +42,19 @@ CGenomeIO::~CGenomeIO()
 }
 
 // *******************************************************************************************
-bool CGenomeIO::Open(const string& _file_name, const bool _writing)
+// In BGZF mode (writing only) the contigs must be saved by SaveContigBgzf; the indexes (.fai, .gzi) are saved by Close
+bool CGenomeIO::Open(const string& _file_name, const bool _writing, const bool _bgzf)
 {
 	if (out || sif)
 		return false;
 
+	file_name = _file_name;
 	use_stdout = _file_name.empty();
 	writing = _writing;
+	is_bgzf = _bgzf && _writing;
+
+	if (is_bgzf && !use_stdout)
+		bgzf_index = new CBgzfIndex;
 
 	if (writing)
 	{
@@ -89,13 +96,21 @@ bool CGenomeIO::Open(const string& _file_name, const bool _writing)
 // *******************************************************************************************
 bool CGenomeIO::Close()
 {
+	bool r = true;
+
 	if (writing)
 	{
 		if (out)
 		{
-			fflush(out);
+			if (is_bgzf)
+			{
+				auto& eof_block = CBgzfCompressor::EofBlock();
+				r &= fwrite(eof_block.data(), 1, eof_block.size(), out) == eof_block.size();
+			}
+
+			r &= fflush(out) == 0;
 			if(!use_stdout)
-				fclose(out);
+				r &= fclose(out) == 0;
 			out = nullptr;
 		}
 	}
@@ -110,11 +125,20 @@ bool CGenomeIO::Close()
 		}
 	}
 
+	if (bgzf_index)
+	{
+		r &= bgzf_index->Save(file_name);
+		delete bgzf_index;
+		bgzf_index = nullptr;
+	}
+
+	is_bgzf = false;
+
 	if (buffer)
 		delete[] buffer;
 	buffer = nullptr;
 
-	return true;
+	return r;
 }
 
 // *******************************************************************************************
@@ -179,6 +203,23 @@ bool CGenomeIO::SaveContigDirectly(const string& id, const contig_t& contig, con
 	return save_contig_directly(id, contig, gzip_level);
 }
 
+// *******************************************************************************************
+// Contig (with its header line) already compressed into BGZF blocks
+bool CGenomeIO::SaveContigBgzf(const string& id, const contig_t& contig, const uint64_t seq_length, const uint32_t line_length)
+{
+	if (bgzf_index && !bgzf_index->AddContig(id, seq_length, line_length, id.size() + 2, contig))
+		return false;
+
+	return fwrite(contig.data(), 1, contig.size(), out) == contig.size();
+}
+
+// *******************************************************************************************
+// No. of contigs saved in BGZF mode that are not in .fai (as the contigs of the same names are already there)
+uint64_t CGenomeIO::NoDuplicatedIndexNames() const
+{
+	return bgzf_index ? bgzf_index->NoDuplicates() : 0;
+}
+
 // *******************************************************************************************
 bool CGenomeIO::fill_buffer()
 {
@@ -16,6 +16,7 @@
 #include <string>
 #include <cinttypes>
 #include "../common/defs.h"
+#include "bgzf.h"
 #include <refresh/compression/lib/file_wrapper.h>
 #include <refresh/compression/lib/gz_wrapper.h>
 
@@ -58,6 +59,9 @@ class CGenomeIO
 	refresh::gz_in_memory gzip_zero_compressor{ 1 };
 	vector<uint8_t> gzip_zero_compressor_buffer;
 
+	bool is_bgzf;
+	CBgzfIndex* bgzf_index = nullptr;
+
 	uint8_t* buffer;
 	const size_t write_buffer_size = 32 << 20;
 	const size_t read_buffer_size = 4 << 20;
@@ -84,7 +88,7 @@ public:
 	CGenomeIO();
 	~CGenomeIO();
 
-	bool Open(const string &_file_name, const bool _writing);
+	bool Open(const string &_file_name, const bool _writing, const bool _bgzf = false);
 	bool Close();
 	size_t FileSize();
 
@@ -93,6 +97,8 @@ public:
 	bool ReadContigRaw(string& id, contig_t& contig);
 
 	bool SaveContigDirectly(const string& id, const contig_t& contig, const uint32_t gzip_level);
+	bool SaveContigBgzf(const string& id, const contig_t& contig, const uint64_t seq_length, const uint32_t line_length);
+	uint64_t NoDuplicatedIndexNames() const;
 #if 0
 	bool SaveContig(const string& id, const contig_t& contig, const uint32_t line_length);
 	bool SaveContigConverted(const string& id, const contig_t& contig, const uint32_t line_length);
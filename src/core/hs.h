@@ -24,6 +24,7 @@
 #include <vector>
 #include <utility>
 #include <iterator>
+#include <thread>
 
 #if defined(_MSC_VER)  /* Visual Studio */
 #define FORCE_INLINE __forceinline
@@ -473,6 +474,67 @@ template<typename Key_t,
 			return true;
 		}
 
+		// *******************************************************************************************
+		// Insert many keys using many threads (the table is resized at most once).
+		// Each thread fills its own range of slots. Keys that would be placed beyond the range
+		// (due to linear probing) are inserted serially at the end.
+		template<typename Container>
+		void insert_parallel(const Container& keys, const uint32_t no_threads)
+		{
+			size_t requested = (size_t)((no_elements + keys.size()) / max_fill_factor) + 2;
+			if (requested > allocated)
+				restruct(requested);
+
+			if (no_threads < 2 || keys.size() < 4096)
+			{
+				for (auto& x : keys)
+					insert_fast(x);
+				return;
+			}
+
+			size_t region_size = (allocated + no_threads - 1) / no_threads;
+			std::vector<std::vector<key_type>> v_overflow(no_threads);
+			std::vector<size_t> v_no_inserted(no_threads, 0);
+			std::vector<std::thread> v_threads;
+			v_threads.reserve(no_threads);
+
+			for (uint32_t t = 0; t < no_threads; ++t)
+				v_threads.emplace_back([&, t] {
+					size_t region_begin = t * region_size;
+					size_t region_end = std::min(region_begin + region_size, allocated);
+
+					for (auto& x : keys)
+					{
+						size_t h = hash(x) & allocated_mask;
+
+						if (h < region_begin || h >= region_end)
+							continue;
+
+						while (!compare(data[h], empty_key) && !compare(data[h], x))
+							if (++h == region_end)
+								break;
+
+						if (h == region_end)
+							v_overflow[t].emplace_back(x);
+						else if (compare(data[h], empty_key))
+						{
+							data[h] = x;
+							++v_no_inserted[t];
+						}
+					}
+				});
+
+			for (auto& thr : v_threads)
+				thr.join();
+
+			for (uint32_t t = 0; t < no_threads; ++t)
+				no_elements += v_no_inserted[t];
+
+			for (auto& v : v_overflow)
+				for (auto& x : v)
+					insert_fast(x);
+		}
+
 		// *******************************************************************************************
 		iterator find(const key_type& key)
 		{
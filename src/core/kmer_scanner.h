@@ -0,0 +1,153 @@
+#ifndef _KMER_SCANNER_H
+#define _KMER_SCANNER_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include "../common/defs.h"
+#include <type_traits>
+
+using namespace std;
+
+// *******************************************************************************************
+// Scanner of all k-mers of a sequence (k-mers with non-ACGT symbols are skipped).
+// K-mers are represented as in CKmer (canonical mode), i.e., direct and rev. comp. codes are aligned
+// to the highest bits. The k-mer length is a template parameter (0 - given at runtime).
+template<uint32_t K>
+class CKmerScanner
+{
+	const uint8_t* seq;
+	const uint64_t seq_size;
+	const uint32_t k;
+	const uint32_t shift;
+	const uint32_t rc_shift;
+
+	uint64_t pos = 0;
+	uint64_t kmer_dir = 0;				// aligned to the lowest bits (higher bits are garbage)
+	uint64_t kmer_rc = 0;				// aligned to the lowest bits
+	uint32_t cur_size = 0;
+
+	// *******************************************************************************************
+	// Codes are kept aligned to the lowest bits, so the dependency chains are short (no masking);
+	// after a non-ACGT symbol the old symbols are shifted out before the next k-mer is complete
+	// Returns true if the k-mer ending at the current position is complete
+	inline bool insert(const uint64_t x)
+	{
+		if (x > 3)
+		{
+			cur_size = 0;
+			return false;
+		}
+
+		kmer_dir = (kmer_dir << 2) | x;
+		kmer_rc = (kmer_rc >> 2) | ((3ull - x) << rc_shift);
+
+		return ++cur_size >= k;
+	}
+
+	// *******************************************************************************************
+	uint64_t dir() const
+	{
+		return kmer_dir << shift;
+	}
+
+	// *******************************************************************************************
+	uint64_t rc() const
+	{
+		return kmer_rc << shift;
+	}
+
+public:
+	// *******************************************************************************************
+	CKmerScanner(const contig_t& ctg, const uint32_t _k) :
+		seq(ctg.data()), seq_size(ctg.size()), k(K ? K : _k), shift(64 - 2 * k), rc_shift(2 * k - 2)
+	{}
+
+	// *******************************************************************************************
+	bool Done() const
+	{
+		return pos >= seq_size;
+	}
+
+	// *******************************************************************************************
+	// Calls fun(pos, kmer_dir, kmer_rc) for each k-mer (pos - position of its last symbol)
+	template<typename FUN>
+	void ForEach(FUN&& fun)
+	{
+		for (; pos < seq_size; ++pos)
+			if (insert(seq[pos]))
+				fun(pos, dir(), rc());
+	}
+
+	// *******************************************************************************************
+	// Stores canonical k-mers (and positions of their last symbols) ending in the next block of symbols
+	uint32_t NextBlock(const uint32_t block_size, uint64_t* v_kmers, uint64_t* v_pos)
+	{
+		uint64_t block_end = pos + block_size;
+		uint32_t n = 0;
+
+		if (block_end > seq_size)
+			block_end = seq_size;
+
+		for (; pos < block_end; ++pos)
+			if (insert(seq[pos]))
+			{
+				uint64_t d = dir();
+				uint64_t r = rc();
+
+				v_kmers[n] = d < r ? d : r;
+				v_pos[n++] = pos;
+			}
+
+		return n;
+	}
+};
+
+// *******************************************************************************************
+// Calls fun with integral_constant<uint32_t, k> for the supported k-mer lengths (17-32) to select specialized code
+// and with integral_constant<uint32_t, 0> (k-mer length known at runtime only) otherwise
+template<typename FUN>
+auto dispatch_kmer_length(const uint32_t k, FUN&& fun)
+{
+	switch (k)
+	{
+	case 17: return fun(integral_constant<uint32_t, 17>{});
+	case 18: return fun(integral_constant<uint32_t, 18>{});
+	case 19: return fun(integral_constant<uint32_t, 19>{});
+	case 20: return fun(integral_constant<uint32_t, 20>{});
+	case 21: return fun(integral_constant<uint32_t, 21>{});
+	case 22: return fun(integral_constant<uint32_t, 22>{});
+	case 23: return fun(integral_constant<uint32_t, 23>{});
+	case 24: return fun(integral_constant<uint32_t, 24>{});
+	case 25: return fun(integral_constant<uint32_t, 25>{});
+	case 26: return fun(integral_constant<uint32_t, 26>{});
+	case 27: return fun(integral_constant<uint32_t, 27>{});
+	case 28: return fun(integral_constant<uint32_t, 28>{});
+	case 29: return fun(integral_constant<uint32_t, 29>{});
+	case 30: return fun(integral_constant<uint32_t, 30>{});
+	case 31: return fun(integral_constant<uint32_t, 31>{});
+	case 32: return fun(integral_constant<uint32_t, 32>{});
+	default: return fun(integral_constant<uint32_t, 0>{});
+	}
+}
+
+// *******************************************************************************************
+// Calls fun(pos, kmer_dir, kmer_rc) for all k-mers of the sequence
+template<typename FUN>
+void for_each_kmer(const contig_t& ctg, const uint32_t k, FUN&& fun)
+{
+	dispatch_kmer_length(k, [&](auto k_tag) {
+		CKmerScanner<decltype(k_tag)::value> scanner(ctg, k);
+		scanner.ForEach(fun);
+		});
+}
+
+// EOF
+#endif
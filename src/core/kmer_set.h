@@ -0,0 +1,165 @@
+#ifndef _KMER_SET_H
+#define _KMER_SET_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <cinttypes>
+#include <algorithm>
+
+using namespace std;
+
+// *******************************************************************************************
+// Static set of k-mers (exact membership queries).
+// K-mers are stored in sorted order and split into buckets by their highest bits. For each bucket only
+// the position of its first k-mer is stored; k-mers themselves are stored without the bucket bits in
+// a bit-packed array. With ~64 k-mers per bucket it takes about (2k - log2(n) + 7) bits per k-mer.
+class CKmerSet
+{
+	uint32_t no_low_bits = 0;
+	uint64_t low_mask = 0;
+	uint64_t no_items = 0;
+
+	vector<uint64_t> v_bucket_starts;
+	vector<uint64_t> v_packed;
+
+	static constexpr uint32_t items_per_bucket_log = 6;
+
+	// *******************************************************************************************
+	uint64_t bucket_id(const uint64_t x) const
+	{
+		return no_low_bits >= 64 ? 0 : x >> no_low_bits;
+	}
+
+	// *******************************************************************************************
+	uint64_t get(const uint64_t i) const
+	{
+		if (no_low_bits == 0)
+			return 0;
+
+		uint64_t bit_pos = i * no_low_bits;
+		uint64_t word = bit_pos >> 6;
+		uint32_t shift = bit_pos & 63;
+
+		uint64_t r = v_packed[word] >> shift;
+		if (shift + no_low_bits > 64)
+			r |= v_packed[word + 1] << (64 - shift);
+
+		return r & low_mask;
+	}
+
+	// *******************************************************************************************
+	void set(const uint64_t i, const uint64_t x)
+	{
+		if (no_low_bits == 0)
+			return;
+
+		uint64_t bit_pos = i * no_low_bits;
+		uint64_t word = bit_pos >> 6;
+		uint32_t shift = bit_pos & 63;
+
+		v_packed[word] |= x << shift;
+		if (shift + no_low_bits > 64)
+			v_packed[word + 1] |= x >> (64 - shift);
+	}
+
+public:
+	// *******************************************************************************************
+	void clear()
+	{
+		no_items = 0;
+		v_bucket_starts.clear();
+		v_bucket_starts.shrink_to_fit();
+		v_packed.clear();
+		v_packed.shrink_to_fit();
+	}
+
+	// *******************************************************************************************
+	// Build the set from two sorted ranges of k-mers (k-mers must be unique over both ranges)
+	template<typename Iter1, typename Iter2>
+	void assign(Iter1 first1, Iter1 last1, Iter2 first2, Iter2 last2, const uint32_t no_key_bits)
+	{
+		clear();
+
+		no_items = (uint64_t) (distance(first1, last1) + distance(first2, last2));
+
+		uint32_t no_bucket_bits = 0;
+		while (no_bucket_bits < no_key_bits && (no_items >> (no_bucket_bits + items_per_bucket_log)) > 1)
+			++no_bucket_bits;
+
+		no_low_bits = no_key_bits - no_bucket_bits;
+		low_mask = no_low_bits >= 64 ? ~0ull : (1ull << no_low_bits) - 1;
+
+		v_bucket_starts.assign((1ull << no_bucket_bits) + 1, 0);
+		v_packed.assign((no_items * no_low_bits + 63) / 64 + 1, 0);
+
+		uint64_t i = 0;
+		auto store = [&](const uint64_t x) {
+			++v_bucket_starts[bucket_id(x) + 1];
+			set(i++, x & low_mask);
+		};
+
+		while (first1 != last1 && first2 != last2)
+			store(*first1 < *first2 ? *first1++ : *first2++);
+		while (first1 != last1)
+			store(*first1++);
+		while (first2 != last2)
+			store(*first2++);
+
+		for (size_t j = 1; j < v_bucket_starts.size(); ++j)
+			v_bucket_starts[j] += v_bucket_starts[j - 1];
+	}
+
+	// *******************************************************************************************
+	bool check(const uint64_t x) const
+	{
+		if (no_items == 0)
+			return false;
+
+		uint64_t b = bucket_id(x);
+		if (b + 1 >= v_bucket_starts.size())
+			return false;
+
+		uint64_t lo = v_bucket_starts[b];
+		uint64_t hi = v_bucket_starts[b + 1];
+		uint64_t key = x & low_mask;
+
+		while (lo < hi)
+		{
+			uint64_t mid = lo + (hi - lo) / 2;
+			uint64_t y = get(mid);
+
+			if (y == key)
+				return true;
+			if (y < key)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		return false;
+	}
+
+	// *******************************************************************************************
+	uint64_t size() const
+	{
+		return no_items;
+	}
+
+	// *******************************************************************************************
+	uint64_t memory_usage() const
+	{
+		return (v_bucket_starts.size() + v_packed.size()) * sizeof(uint64_t);
+	}
+};
+
+// EOF
+#endif
@@ -0,0 +1,299 @@
+#ifndef _RAW_CLUSTERER_H
+#define _RAW_CLUSTERER_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <numeric>
+#include <atomic>
+#include <future>
+#include <cinttypes>
+#include "../common/defs.h"
+#include "../common/utils.h"
+
+using namespace std;
+
+// *******************************************************************************************
+// Clustering of segments without splitters (that would be stored in raw groups) by similarity.
+//
+// Each segment is described by two bottom-s MinHash sketches: of its k-mers and of the k-mers of its reverse complement.
+// Segments are visited from the longest one. A segment joins the cluster of the representative sharing the most
+// (at least min_shared) hashes with its direct or reverse-complemented sketch; otherwise it becomes a new representative.
+// Clusters (of at least 2 segments) are stored in their own groups, so representatives of the clusters are kept in the
+// index and segments of later rounds can join them. The no. of indexed clusters is limited, so the memory is bounded.
+// Sketches are computed in parallel; the greedy assignment is sequential (deterministic), but its cost is bounded
+// by the sketch size and the limit of representatives checked per hash.
+class CRawSegmentClusterer
+{
+public:
+	struct member_t {
+		uint32_t id;
+		bool rev_comp;						// member is similar to reverse complement of the representative
+	};
+
+	struct cluster_t {
+		uint32_t group_id;
+		vector<member_t> v_members;
+	};
+
+private:
+	const uint32_t kmer_length;
+	const uint32_t sketch_size;
+	const uint32_t min_shared;
+	const uint32_t max_clusters;
+	const uint32_t max_reps_per_hash = 16;
+	const uint32_t min_jobs_size = 64;
+
+	unordered_map<uint64_t, vector<uint32_t>, MurMur64Hash> m_index;		// hash -> clusters of representatives having it
+	vector<uint32_t> v_group_ids;										// groups of indexed clusters
+
+	struct sketch_t {
+		vector<uint64_t> dir;
+		vector<uint64_t> rc;
+	};
+
+	// *******************************************************************************************
+	void compute_sketch(const contig_t& seq, sketch_t& sketch) const
+	{
+		const uint64_t mask = (kmer_length == 32) ? ~0ull : (1ull << (2 * kmer_length)) - 1;
+		const uint32_t rc_shift = 2 * (kmer_length - 1);
+		MurMur64Hash mmh;
+
+		uint64_t k_dir = 0;
+		uint64_t k_rc = 0;
+		uint32_t len = 0;
+
+		sketch.dir.clear();
+		sketch.rc.clear();
+
+		if (seq.size() < kmer_length)
+			return;
+
+		sketch.dir.reserve(seq.size());
+		sketch.rc.reserve(seq.size());
+
+		for (auto c : seq)
+		{
+			if (c > 3)
+			{
+				len = 0;
+				k_dir = k_rc = 0;
+				continue;
+			}
+
+			k_dir = ((k_dir << 2) + c) & mask;
+			k_rc = (k_rc >> 2) + ((uint64_t)(3 - c) << rc_shift);
+
+			if (++len >= kmer_length)
+			{
+				sketch.dir.emplace_back(mmh(k_dir));
+				sketch.rc.emplace_back(mmh(k_rc));
+			}
+		}
+
+		bottom(sketch.dir);
+		bottom(sketch.rc);
+	}
+
+	// *******************************************************************************************
+	void bottom(vector<uint64_t>& v) const
+	{
+		sort(v.begin(), v.end());
+		v.erase(unique(v.begin(), v.end()), v.end());
+
+		if (v.size() > sketch_size)
+			v.resize(sketch_size);
+		v.shrink_to_fit();
+	}
+
+	// *******************************************************************************************
+	template<typename FUN>
+	void for_each_match(const vector<uint64_t>& v_hashes, FUN&& fun) const
+	{
+		for (auto h : v_hashes)
+			if (auto p = m_index.find(h); p != m_index.end())
+				for (auto c : p->second)
+					fun(c);
+	}
+
+	// *******************************************************************************************
+	void index_rep(const vector<uint64_t>& v_hashes, const uint32_t c)
+	{
+		for (auto h : v_hashes)
+		{
+			auto& v = m_index[h];
+			if (v.size() < max_reps_per_hash)
+				v.emplace_back(c);
+		}
+	}
+
+	// *******************************************************************************************
+	void unindex_rep(const vector<uint64_t>& v_hashes, const uint32_t c)
+	{
+		for (auto h : v_hashes)
+			if (auto p = m_index.find(h); p != m_index.end())
+			{
+				if (auto q = find(p->second.begin(), p->second.end(), c); q != p->second.end())
+					p->second.erase(q);
+				if (p->second.empty())
+					m_index.erase(p);
+			}
+	}
+
+public:
+	// *******************************************************************************************
+	CRawSegmentClusterer(const uint32_t _kmer_length = 20, const uint32_t _sketch_size = 64, const uint32_t _min_shared = 8, const uint32_t _max_clusters = 1u << 16) :
+		kmer_length(clamp<uint32_t>(_kmer_length, 1, 32)),
+		sketch_size(max<uint32_t>(_sketch_size, 1)),
+		min_shared(clamp<uint32_t>(_min_shared, 1, max<uint32_t>(_sketch_size, 1))),
+		max_clusters(_max_clusters)
+	{}
+
+	// *******************************************************************************************
+	// Returns clusters the segments (of a single round) are assigned to. Clusters of earlier rounds have group ids lower
+	// than first_group_id and contain only the new members. New clusters (at least 2 segments) get consecutive group ids
+	// from first_group_id; their representative (the longest segment) is the first member and is not reversed.
+	vector<cluster_t> Cluster(const vector<const contig_t*>& v_seqs, const uint32_t first_group_id, uint32_t no_threads)
+	{
+		vector<cluster_t> v_clusters;
+		const uint32_t n = (uint32_t)v_seqs.size();
+
+		if (n == 0 || (n == 1 && v_group_ids.empty()))
+			return v_clusters;
+
+		vector<sketch_t> v_sketches(n);
+		atomic<uint32_t> seq_id{ 0 };
+
+		auto job = [&] {
+			for (uint32_t i = seq_id++; i < n; i = seq_id++)
+				compute_sketch(*v_seqs[i], v_sketches[i]);
+			};
+
+		no_threads = clamp<uint32_t>(n / min_jobs_size, 1u, no_threads);
+
+		vector<future<void>> v_fut;
+		v_fut.reserve(no_threads);
+
+		for (uint32_t i = 0; i < no_threads - 1; ++i)
+			v_fut.emplace_back(async(launch::async, job));
+
+		job();
+
+		for (auto& f : v_fut)
+			f.wait();
+
+		vector<uint32_t> v_order(n);
+		iota(v_order.begin(), v_order.end(), 0u);
+		stable_sort(v_order.begin(), v_order.end(), [&](const uint32_t a, const uint32_t b) {
+			return v_seqs[a]->size() > v_seqs[b]->size();
+			});
+
+		// Cluster ids: indexed clusters (of earlier rounds) first, then representatives of the current round
+		const uint32_t no_old = (uint32_t)v_group_ids.size();
+		vector<vector<member_t>> v_all(no_old);
+		vector<uint32_t> v_new_reps;
+		vector<uint32_t> v_cnt_dir(no_old, 0), v_cnt_rc(no_old, 0);
+		vector<uint32_t> v_touched;
+
+		for (auto i : v_order)
+		{
+			auto& sketch = v_sketches[i];
+
+			if (sketch.dir.size() < min_shared)
+				continue;
+
+			for_each_match(sketch.dir, [&](const uint32_t c) {
+				if (v_cnt_dir[c] == 0 && v_cnt_rc[c] == 0)
+					v_touched.emplace_back(c);
+				++v_cnt_dir[c];
+				});
+
+			for_each_match(sketch.rc, [&](const uint32_t c) {
+				if (v_cnt_dir[c] == 0 && v_cnt_rc[c] == 0)
+					v_touched.emplace_back(c);
+				++v_cnt_rc[c];
+				});
+
+			uint32_t best_cnt = min_shared - 1;
+			uint32_t best_cluster = ~0u;
+			bool best_rc = false;
+
+			sort(v_touched.begin(), v_touched.end());
+
+			for (auto c : v_touched)
+			{
+				if (v_cnt_dir[c] > best_cnt)
+				{
+					best_cnt = v_cnt_dir[c];
+					best_cluster = c;
+					best_rc = false;
+				}
+				if (v_cnt_rc[c] > best_cnt)
+				{
+					best_cnt = v_cnt_rc[c];
+					best_cluster = c;
+					best_rc = true;
+				}
+
+				v_cnt_dir[c] = v_cnt_rc[c] = 0;
+			}
+
+			v_touched.clear();
+
+			if (best_cluster != ~0u)
+			{
+				v_all[best_cluster].emplace_back(member_t{ i, best_rc });
+				continue;
+			}
+
+			uint32_t c = (uint32_t)v_all.size();
+			v_all.emplace_back(1, member_t{ i, false });
+			v_cnt_dir.emplace_back(0);
+			v_cnt_rc.emplace_back(0);
+			v_new_reps.emplace_back(i);
+
+			index_rep(sketch.dir, c);
+		}
+
+		for (uint32_t c = 0; c < no_old; ++c)
+			if (!v_all[c].empty())
+				v_clusters.emplace_back(cluster_t{ v_group_ids[c], move(v_all[c]) });
+
+		// Representatives of the current round are indexed further only if they start new clusters (up to the limit)
+		for (uint32_t j = 0; j < (uint32_t)v_new_reps.size(); ++j)
+			unindex_rep(v_sketches[v_new_reps[j]].dir, no_old + j);
+
+		uint32_t group_id = first_group_id;
+
+		for (uint32_t j = 0; j < (uint32_t)v_new_reps.size(); ++j)
+		{
+			auto& v = v_all[no_old + j];
+
+			if (v.size() < 2)
+				continue;
+
+			if (v_group_ids.size() < max_clusters)
+			{
+				index_rep(v_sketches[v_new_reps[j]].dir, (uint32_t)v_group_ids.size());
+				v_group_ids.emplace_back(group_id);
+			}
+
+			v_clusters.emplace_back(cluster_t{ group_id++, move(v) });
+		}
+
+		return v_clusters;
+	}
+};
+
+// EOF
+#endif
@@ -0,0 +1,432 @@
+#ifndef _SPLITTERS_CODEC_H
+#define _SPLITTERS_CODEC_H
+
+// *******************************************************************************************
+// This file is a part of AGC software distributed under MIT license.
+// The homepage of the AGC project is https://github.com/refresh-bio/agc
+//
+// Copyright(C) 2021-2024, S.Deorowicz, A.Danek, H.Li
+//
+// Version: 3.2
+// Date   : 2024-11-21
+// *******************************************************************************************
+
+#include <vector>
+#include <array>
+#include <atomic>
+#include <cinttypes>
+#include <algorithm>
+#include <future>
+#include <bit>
+#include <zstd/lib/zstd.h>
+
+using namespace std;
+
+// *******************************************************************************************
+// Compact encodings of the splitters and of the segment map (pairs of splitters -> group id).
+//
+// Splitters (sorted, unique) are stored in Elias-Fano representation. K-mer codes are aligned to the highest bits,
+// so they are shifted to the lowest bits first, i.e., about 2 + log2(4^k / n) bits per splitter are necessary.
+//
+// Segment map records (sorted by splitter pairs) are stored in columns in independently zstd-packed partitions,
+// so they can be decoded in parallel. Splitters are stored as their ranks in the splitter set (varint-coded;
+// for the 1st splitter differentially). Values absent in the set (possible only in some corner cases) are escaped.
+class CSplittersCodec
+{
+public:
+	using segment_map_item_t = pair<pair<uint64_t, uint64_t>, uint32_t>;
+
+private:
+	static constexpr size_t records_per_partition = 1 << 20;
+	static constexpr int zstd_level = 6;
+	static constexpr uint32_t no_columns = 4;			// 1st splitter, 2nd splitter, group id, escaped values
+
+	// *******************************************************************************************
+	static void append_fixed(vector<uint8_t>& v, uint64_t x, const uint32_t no_bytes)
+	{
+		for (uint32_t i = 0; i < no_bytes; ++i, x >>= 8)
+			v.emplace_back((uint8_t)x);
+	}
+
+	// *******************************************************************************************
+	static bool read_fixed(const uint8_t*& p, const uint8_t* p_end, uint64_t& x, const uint32_t no_bytes)
+	{
+		if (p_end - p < (ptrdiff_t)no_bytes)
+			return false;
+
+		x = 0;
+		for (uint32_t i = 0; i < no_bytes; ++i)
+			x += ((uint64_t)*p++) << (8 * i);
+
+		return true;
+	}
+
+	// *******************************************************************************************
+	static void append_varint(vector<uint8_t>& v, uint64_t x)
+	{
+		for (; x >= 0x80; x >>= 7)
+			v.emplace_back((uint8_t)(x | 0x80));
+		v.emplace_back((uint8_t)x);
+	}
+
+	// *******************************************************************************************
+	static bool read_varint(const uint8_t*& p, const uint8_t* p_end, uint64_t& x)
+	{
+		x = 0;
+
+		for (uint32_t shift = 0; p < p_end && shift < 64; shift += 7)
+		{
+			uint8_t c = *p++;
+			x |= ((uint64_t)(c & 0x7f)) << shift;
+
+			if (!(c & 0x80))
+				return true;
+		}
+
+		return false;
+	}
+
+	// *******************************************************************************************
+	static uint64_t zigzag(const int64_t x)
+	{
+		return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+	}
+
+	// *******************************************************************************************
+	static int64_t unzigzag(const uint64_t x)
+	{
+		return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+	}
+
+	// *******************************************************************************************
+	// Rank of the splitter (n - ~0ull, n+1 - escaped value)
+	static uint64_t splitter_code(const vector<uint64_t>& v_splitters, const uint64_t x)
+	{
+		if (x == ~0ull)
+			return v_splitters.size();
+
+		auto p = lower_bound(v_splitters.begin(), v_splitters.end(), x);
+
+		if (p != v_splitters.end() && *p == x)
+			return (uint64_t)(p - v_splitters.begin());
+
+		return v_splitters.size() + 1;
+	}
+
+	// *******************************************************************************************
+	static void encode_partition(const segment_map_item_t* p_items, const size_t n, const vector<uint64_t>& v_splitters, vector<uint8_t>& v_out)
+	{
+		array<vector<uint8_t>, no_columns> a_cols;
+		int64_t prev_code1 = 0;
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			auto& x = p_items[i];
+			uint64_t code1 = splitter_code(v_splitters, x.first.first);
+			uint64_t code2 = splitter_code(v_splitters, x.first.second);
+
+			append_varint(a_cols[0], zigzag((int64_t)code1 - prev_code1));
+			append_varint(a_cols[1], code2);
+			append_varint(a_cols[2], x.second);
+
+			if (code1 == v_splitters.size() + 1)
+				append_fixed(a_cols[3], x.first.first, 8);
+			if (code2 == v_splitters.size() + 1)
+				append_fixed(a_cols[3], x.first.second, 8);
+
+			prev_code1 = (int64_t)code1;
+		}
+
+		ZSTD_CCtx* cctx = ZSTD_createCCtx();
+		vector<uint8_t> v_packed;
+
+		v_out.clear();
+		append_fixed(v_out, n, 8);
+
+		for (auto& col : a_cols)
+		{
+			v_packed.resize(ZSTD_compressBound(col.size()));
+			v_packed.resize(ZSTD_compressCCtx(cctx, v_packed.data(), v_packed.size(), col.data(), col.size(), zstd_level));
+
+			append_fixed(v_out, col.size(), 8);
+			append_fixed(v_out, v_packed.size(), 8);
+			v_out.insert(v_out.end(), v_packed.begin(), v_packed.end());
+		}
+
+		ZSTD_freeCCtx(cctx);
+	}
+
+	// *******************************************************************************************
+	static bool decode_partition(const uint8_t* p, const uint8_t* p_end, const vector<uint64_t>& v_splitters, segment_map_item_t* p_items, const size_t n)
+	{
+		array<vector<uint8_t>, no_columns> a_cols;
+		uint64_t n_stored;
+
+		if (!read_fixed(p, p_end, n_stored, 8) || n_stored != n)
+			return false;
+
+		ZSTD_DCtx* dctx = ZSTD_createDCtx();
+		bool ok = true;
+
+		for (auto& col : a_cols)
+		{
+			uint64_t raw_size, packed_size;
+
+			if (!read_fixed(p, p_end, raw_size, 8) || !read_fixed(p, p_end, packed_size, 8) || p_end - p < (ptrdiff_t)packed_size)
+			{
+				ok = false;
+				break;
+			}
+
+			col.resize(raw_size);
+			if (ZSTD_decompressDCtx(dctx, col.data(), col.size(), p, packed_size) != raw_size)
+			{
+				ok = false;
+				break;
+			}
+
+			p += packed_size;
+		}
+
+		ZSTD_freeDCtx(dctx);
+
+		if (!ok)
+			return false;
+
+		const uint8_t* q[no_columns];
+		const uint8_t* q_end[no_columns];
+		for (uint32_t i = 0; i < no_columns; ++i)
+		{
+			q[i] = a_cols[i].data();
+			q_end[i] = q[i] + a_cols[i].size();
+		}
+
+		const uint64_t n_splitters = v_splitters.size();
+		int64_t prev_code1 = 0;
+
+		auto decode_splitter = [&](const uint64_t code, uint64_t& x) {
+			if (code < n_splitters)
+				x = v_splitters[code];
+			else if (code == n_splitters)
+				x = ~0ull;
+			else
+				return read_fixed(q[3], q_end[3], x, 8);
+
+			return true;
+			};
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			uint64_t d1, code2, group_id;
+
+			if (!read_varint(q[0], q_end[0], d1) || !read_varint(q[1], q_end[1], code2) || !read_varint(q[2], q_end[2], group_id))
+				return false;
+
+			int64_t code1 = prev_code1 + unzigzag(d1);
+			prev_code1 = code1;
+
+			if (!decode_splitter((uint64_t)code1, p_items[i].first.first) || !decode_splitter(code2, p_items[i].first.second))
+				return false;
+
+			p_items[i].second = (uint32_t)group_id;
+		}
+
+		return true;
+	}
+
+public:
+	// *******************************************************************************************
+	// Splitters must be sorted and unique; returns false if some value is not a k-mer code aligned to the highest bits
+	static bool EncodeSplitters(const vector<uint64_t>& v_splitters, const uint32_t kmer_length, vector<uint8_t>& v_out)
+	{
+		const uint32_t shift = 64 - 2 * kmer_length;
+		const uint64_t n = v_splitters.size();
+
+		v_out.clear();
+
+		if (shift && any_of(v_splitters.begin(), v_splitters.end(), [shift](const uint64_t x) {return (x << (64 - shift)) != 0; }))
+			return false;
+
+		const uint64_t max_val = n ? v_splitters.back() >> shift : 0;
+		const uint32_t no_low_bits = (n && max_val / n) ? 63 - countl_zero(max_val / n) : 0;
+
+		vector<uint64_t> v_low((n * no_low_bits + 63) / 64 + 1, 0);
+		vector<uint64_t> v_high((n + (max_val >> no_low_bits) + 1 + 63) / 64, 0);
+
+		for (uint64_t i = 0; i < n; ++i)
+		{
+			uint64_t x = v_splitters[i] >> shift;
+
+			if (no_low_bits)
+			{
+				uint64_t low = x & ((1ull << no_low_bits) - 1);
+				uint64_t bit_pos = i * no_low_bits;
+
+				v_low[bit_pos / 64] |= low << (bit_pos % 64);
+				if (bit_pos % 64 + no_low_bits > 64)
+					v_low[bit_pos / 64 + 1] |= low >> (64 - bit_pos % 64);
+			}
+
+			uint64_t high_pos = (x >> no_low_bits) + i;
+			v_high[high_pos / 64] |= 1ull << (high_pos % 64);
+		}
+
+		v_out.reserve(17 + 8 * (v_low.size() + v_high.size()));
+
+		append_fixed(v_out, n, 8);
+		append_fixed(v_out, no_low_bits, 1);
+		append_fixed(v_out, v_high.size(), 8);
+
+		for (auto x : v_low)
+			append_fixed(v_out, x, 8);
+		for (auto x : v_high)
+			append_fixed(v_out, x, 8);
+
+		return true;
+	}
+
+	// *******************************************************************************************
+	static bool DecodeSplitters(const vector<uint8_t>& v_in, const uint32_t kmer_length, vector<uint64_t>& v_splitters)
+	{
+		const uint32_t shift = 64 - 2 * kmer_length;
+		const uint8_t* p = v_in.data();
+		const uint8_t* p_end = p + v_in.size();
+		uint64_t n, no_low_bits, high_size;
+
+		v_splitters.clear();
+
+		if (!read_fixed(p, p_end, n, 8) || !read_fixed(p, p_end, no_low_bits, 1) || !read_fixed(p, p_end, high_size, 8) || no_low_bits >= 64)
+			return false;
+
+		const uint64_t low_size = (n * no_low_bits + 63) / 64 + 1;
+
+		if ((uint64_t)(p_end - p) != 8 * (low_size + high_size))
+			return false;
+
+		vector<uint64_t> v_low(low_size);
+		for (auto& x : v_low)
+			read_fixed(p, p_end, x, 8);
+
+		const uint64_t low_mask = no_low_bits ? (1ull << no_low_bits) - 1 : 0;
+
+		v_splitters.resize(n);
+
+		uint64_t i = 0;
+		for (uint64_t j = 0; j < high_size && i < n; ++j)
+		{
+			uint64_t w = 0;
+			read_fixed(p, p_end, w, 8);
+
+			for (; w && i < n; w &= w - 1, ++i)
+			{
+				uint64_t high = j * 64 + countr_zero(w) - i;
+				uint64_t low = 0;
+
+				if (no_low_bits)
+				{
+					uint64_t bit_pos = i * no_low_bits;
+
+					low = v_low[bit_pos / 64] >> (bit_pos % 64);
+					if (bit_pos % 64 + no_low_bits > 64)
+						low |= v_low[bit_pos / 64 + 1] << (64 - bit_pos % 64);
+					low &= low_mask;
+				}
+
+				v_splitters[i] = ((high << no_low_bits) | low) << shift;
+			}
+		}
+
+		return i == n;
+	}
+
+	// *******************************************************************************************
+	static void EncodeSegmentMap(const vector<segment_map_item_t>& v_map, const vector<uint64_t>& v_splitters, vector<uint8_t>& v_out, const uint32_t no_threads)
+	{
+		const size_t no_parts = (v_map.size() + records_per_partition - 1) / records_per_partition;
+		vector<vector<uint8_t>> v_parts(no_parts);
+		atomic<size_t> next_part = 0;
+		vector<future<void>> v_fut;
+
+		for (uint32_t t = 0; t < max<uint32_t>(1, min<uint32_t>(no_threads, (uint32_t)no_parts)); ++t)
+			v_fut.emplace_back(async(launch::async, [&] {
+				for (size_t i = next_part++; i < no_parts; i = next_part++)
+				{
+					size_t first = i * records_per_partition;
+					size_t n = min(records_per_partition, v_map.size() - first);
+
+					encode_partition(v_map.data() + first, n, v_splitters, v_parts[i]);
+				}
+			}));
+
+		for (auto& f : v_fut)
+			f.get();
+
+		v_out.clear();
+		append_fixed(v_out, v_map.size(), 8);
+		append_fixed(v_out, no_parts, 8);
+
+		for (auto& part : v_parts)
+			append_fixed(v_out, part.size(), 8);
+		for (auto& part : v_parts)
+			v_out.insert(v_out.end(), part.begin(), part.end());
+	}
+
+	// *******************************************************************************************
+	static bool DecodeSegmentMap(const vector<uint8_t>& v_in, const vector<uint64_t>& v_splitters, vector<segment_map_item_t>& v_map, const uint32_t no_threads)
+	{
+		const uint8_t* p = v_in.data();
+		const uint8_t* p_end = p + v_in.size();
+		uint64_t n, no_parts;
+
+		v_map.clear();
+
+		if (!read_fixed(p, p_end, n, 8) || !read_fixed(p, p_end, no_parts, 8) || no_parts != (n + records_per_partition - 1) / records_per_partition)
+			return false;
+
+		vector<pair<const uint8_t*, const uint8_t*>> v_parts(no_parts);
+
+		if ((uint64_t)(p_end - p) < 8 * no_parts)
+			return false;
+
+		const uint8_t* q = p + 8 * no_parts;
+		for (auto& part : v_parts)
+		{
+			uint64_t size = 0;
+			read_fixed(p, p_end, size, 8);
+
+			if ((uint64_t)(p_end - q) < size)
+				return false;
+
+			part = make_pair(q, q + size);
+			q += size;
+		}
+
+		v_map.resize(n);
+
+		atomic<size_t> next_part = 0;
+		atomic<bool> ok = true;
+		vector<future<void>> v_fut;
+
+		for (uint32_t t = 0; t < max<uint32_t>(1, min<uint32_t>(no_threads, (uint32_t)no_parts)); ++t)
+			v_fut.emplace_back(async(launch::async, [&] {
+				for (size_t i = next_part++; i < no_parts; i = next_part++)
+				{
+					size_t first = i * records_per_partition;
+
+					if (!decode_partition(v_parts[i].first, v_parts[i].second, v_splitters, v_map.data() + first, min<size_t>(records_per_partition, n - first)))
+						ok = false;
+				}
+			}));
+
+		for (auto& f : v_fut)
+			f.get();
+
+		if (!ok)
+			v_map.clear();
+
+		return ok;
+	}
+};
+
+// EOF
+#endif
@@ -12,6 +12,7 @@
 // *******************************************************************************************
 
 #include "../common/defs.h"
+#include "../common/instrumentation.h"
 #include <mutex>
 #if defined(ARCH_X64)
 #include <nmmintrin.h>
@@ -24,6 +25,7 @@
 #include <algorithm>
 #include <condition_variable>
 #include <atomic>
+#include <thread>
 #include <functional>
 #include <cstddef>
 
@@ -117,8 +119,12 @@ public:
 	{
 	}
 
-	void arrive_and_wait()
+	// Waiting time is accounted to the given phase (e.g., to tell the idle time after storing segments apart)
+	void arrive_and_wait(const instr_phase_t phase = instr_phase_t::barrier_wait)
 	{
+		AGC_INSTR_SCOPE_AS(phase);
+		AGC_INSTR_COUNT(barrier_arrivals, 1);
+
 		int32_t old_generation = a_generation.load();
 
 		if (!a_count.fetch_sub(1, memory_order_relaxed))
@@ -242,6 +248,19 @@ public:
 		allocate(size);
 	}
 
+	// Copy is allocated and filled by the calling thread (e.g., a replica for a NUMA node)
+	bloom_set_t(const bloom_set_t& src) : no_elements(src.no_elements), allocated(src.allocated), mask(src.mask), mask_shift(src.mask_shift)
+	{
+		raw_arr = new uint64_t[allocated / 64 + 7];
+		arr = raw_arr;
+		while (((uint64_t)arr) % 64 != 0)
+			++arr;
+
+		copy_n(src.arr, allocated / 64, arr);
+	}
+
+	bloom_set_t& operator=(const bloom_set_t&) = delete;
+
 	~bloom_set_t()
 	{
 		if (raw_arr)
@@ -265,6 +284,41 @@ public:
 		insert_impl(x);
 	}
 
+	// Each thread sets bits only in its own range of words, so no synchronization is necessary
+	void insert_parallel(const vector<uint64_t>& v_keys, const uint32_t no_threads)
+	{
+		if (no_threads < 2 || v_keys.size() < 4096)
+		{
+			insert(v_keys.begin(), v_keys.end());
+			return;
+		}
+
+		size_t no_words = allocated / 64;
+		size_t region_size = (no_words + no_threads - 1) / no_threads;
+		vector<thread> v_threads;
+		v_threads.reserve(no_threads);
+
+		for (uint32_t t = 0; t < no_threads; ++t)
+			v_threads.emplace_back([&, t] {
+				uint64_t region_begin = t * region_size;
+				uint64_t region_end = region_begin + region_size;
+
+				for (auto x : v_keys)
+				{
+					uint64_t h = mmh(x);
+					uint64_t pos = (h & mask) >> mask_shift;
+
+					if (pos >= region_begin && pos < region_end)
+						arr[pos] |= (1ull << (h & 63)) | (1ull << ((h >> 6) & 63)) | (1ull << ((h >> 12) & 63));
+				}
+			});
+
+		for (auto& thr : v_threads)
+			thr.join();
+
+		no_elements += v_keys.size();
+	}
+
 	bool check(uint64_t x)
 	{
 		uint64_t h = mmh(x);
@@ -275,6 +329,31 @@ public:
 		//		return (arr[pos] & (1ull << (h & 63))) && (arr[pos] & (1ull << ((h >> 6) & 63)));
 	}
 
+	// Batched queries: hash and prefetch a number of keys first, then check them
+	uint64_t hash(uint64_t x) const
+	{
+		return mmh(x);
+	}
+
+	void prefetch(uint64_t h) const
+	{
+		const uint64_t* p = arr + ((h & mask) >> mask_shift);
+
+#if defined(ARCH_X64)
+		_mm_prefetch((const char*)p, _MM_HINT_T0);
+#elif defined(__GNUC__)
+		__builtin_prefetch(p);
+#endif
+	}
+
+	bool check_hashed(uint64_t h) const
+	{
+		uint64_t w = arr[(h & mask) >> mask_shift];
+		uint64_t m = (1ull << (h & 63)) | (1ull << ((h >> 6) & 63)) | (1ull << ((h >> 12) & 63));
+
+		return (w & m) == m;
+	}
+
 	double filling_factor()
 	{
 		return (double)no_hashes * no_elements / allocated;
@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# *******************************************************************************************
+# This file is a part of AGC software distributed under MIT license.
+# The homepage of the AGC project is https://github.com/refresh-bio/agc
+#
+# Validation of BGZF output: content, blocks (header, size, CRC, isize), EOF marker and,
+# optionally, the .gzi and .fai indexes saved next to the file.
+# Usage: bgzf_check.py <file.fa.gz> <expected.fa> [--index]
+# *******************************************************************************************
+
+import gzip
+import struct
+import sys
+import zlib
+
+EOF_BLOCK = bytes.fromhex('1f8b08040000000000ff0600424302001b0003000000000000000000')
+
+
+def fail(msg):
+    print('BGZF check failed: %s: %s' % (sys.argv[1], msg))
+    sys.exit(1)
+
+
+def check_blocks(data):
+    blocks = []
+    c_pos = u_pos = 0
+    while c_pos < len(data):
+        header = data[c_pos:c_pos + 18]
+        if len(header) < 18 or header[:4] != b'\x1f\x8b\x08\x04' or header[12:14] != b'BC':
+            fail('bad block header at %d' % c_pos)
+        block_size = struct.unpack('<H', header[16:18])[0] + 1
+        block = data[c_pos:c_pos + block_size]
+        if len(block) != block_size:
+            fail('truncated block at %d' % c_pos)
+        raw = zlib.decompress(block[18:-8], -15)
+        crc, isize = struct.unpack('<II', block[-8:])
+        if isize != len(raw) or crc != zlib.crc32(raw):
+            fail('bad CRC or isize of block at %d' % c_pos)
+        blocks.append((c_pos, u_pos))
+        c_pos += block_size
+        u_pos += isize
+    if not data.endswith(EOF_BLOCK):
+        fail('no EOF block')
+    return blocks
+
+
+def check_gzi(file_name, blocks):
+    try:
+        gzi = open(file_name + '.gzi', 'rb').read()
+    except OSError:
+        fail('no .gzi index')
+    n = struct.unpack('<Q', gzi[:8])[0]
+    if len(gzi) != 8 + 16 * n:
+        fail('bad size of .gzi')
+    entries = [struct.unpack('<QQ', gzi[8 + 16 * i:24 + 16 * i]) for i in range(n)]
+    # All blocks except the first one (and the EOF block)
+    if entries != blocks[1:-1]:
+        fail('.gzi entries do not match the blocks')
+
+
+def check_fai(file_name, text):
+    try:
+        fai = open(file_name + '.fai').readlines()
+    except OSError:
+        fail('no .fai index')
+    # Only the first of contigs of the same name is indexed
+    names = []
+    for header in text.split(b'\n>'):
+        name = header.split(b'\n')[0].lstrip(b'>').split()[0].decode()
+        if name not in names:
+            names.append(name)
+    if [line.split('\t')[0] for line in fai] != names:
+        fail('.fai does not list all contigs')
+    for line in fai:
+        name, length, offset, line_bases, line_width = line.rstrip('\n').split('\t')
+        length, offset, line_bases, line_width = map(int, (length, offset, line_bases, line_width))
+        if text[offset - 1:offset] != b'\n':
+            fail('offset of %s does not follow the header line' % name)
+        header_pos = text.rfind(b'>', 0, offset)
+        if text[header_pos + 1:offset - 1].split()[0].decode() != name:
+            fail('offset of %s points to other contig' % name)
+        seq = bytearray()
+        pos = offset
+        while len(seq) < length:
+            seq += text[pos:pos + min(line_bases, length - len(seq))]
+            pos += line_width
+        if b'\n' in seq or b'>' in seq:
+            fail('bad line layout of %s' % name)
+        end = offset + length + (length + line_bases - 1) // line_bases if length else offset
+        if text[end:end + 1] not in (b'>', b''):
+            fail('bad length of %s' % name)
+
+
+file_name, expected_name = sys.argv[1], sys.argv[2]
+try:
+    data = open(file_name, 'rb').read()
+    text = open(expected_name, 'rb').read()
+except OSError as e:
+    fail(str(e))
+
+try:
+    if gzip.decompress(data) != text:
+        fail('content differs from %s' % expected_name)
+except (OSError, EOFError) as e:
+    fail(str(e))
+
+blocks = check_blocks(data)
+
+if '--index' in sys.argv[3:]:
+    check_gzi(file_name, blocks)
+    check_fai(file_name, text)
+
+# EOF
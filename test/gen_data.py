@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+# *******************************************************************************************
+# This file is a part of AGC software distributed under MIT license.
+# The homepage of the AGC project is https://github.com/refresh-bio/agc
+#
+# Generator of a small synthetic collection for the roundtrip tests:
+# s0.fa is a random genome, s1.fa..s8.fa are its variants (SNPs, indels, runs of N, extra contig
+# in every third sample), s9.fa is a copy of s2.fa.
+# Usage: gen_data.py <output_dir>
+# *******************************************************************************************
+
+import os
+import random
+import sys
+
+random.seed(7)
+out_dir = sys.argv[1]
+
+
+def rand_seq(n):
+    return [random.choice('ACGT') for _ in range(n)]
+
+
+def mutate(s, rate):
+    out = []
+    i = 0
+    while i < len(s):
+        r = random.random()
+        if r < rate:
+            out.append(random.choice('ACGT'))
+            i += 1
+        elif r < rate * 1.1:
+            i += random.randint(1, 20)
+        elif r < rate * 1.2:
+            out.extend(rand_seq(random.randint(1, 20)))
+            out.append(s[i])
+            i += 1
+        elif r < rate * 1.21:
+            out.extend('N' * random.randint(5, 100))
+            i += 1
+        else:
+            out.append(s[i])
+            i += 1
+    return out
+
+
+def write(name, contigs):
+    with open(os.path.join(out_dir, name + '.fa'), 'w') as f:
+        for ctg_name, seq in contigs:
+            f.write('>' + ctg_name + '\n')
+            seq = ''.join(seq)
+            for j in range(0, len(seq), 80):
+                f.write(seq[j:j + 80] + '\n')
+
+
+ref = rand_seq(400000)
+chr1 = ref[:250000]
+chr2 = ref[250000:]
+plasmid = rand_seq(8000)
+
+samples = [[('chr1', chr1), ('chr2', chr2), ('pl', plasmid)]]
+for k in range(1, 9):
+    contigs = [('chr1', mutate(chr1, 0.002 * k)), ('chr2', mutate(chr2, 0.002 * k)), ('pl', plasmid)]
+    if k % 3 == 0:
+        contigs.append(('extra', rand_seq(30000)))
+    samples.append(contigs)
+samples.append(samples[2])
+
+for k, contigs in enumerate(samples):
+    write('s%d' % k, contigs)
+
+# EOF
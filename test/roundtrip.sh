@@ -0,0 +1,200 @@
+#!/bin/bash
+# *******************************************************************************************
+# This file is a part of AGC software distributed under MIT license.
+# The homepage of the AGC project is https://github.com/refresh-bio/agc
+#
+# Roundtrip tests: archives built by create, append (copying and in-place), subset, merge and resumed
+# (checkpointed) compression are decompressed by getset, getcol and getctg and compared with
+# the input samples. BGZF output and its .fai and .gzi indexes are validated by bgzf_check.py.
+# Usage: roundtrip.sh <path to agc> [work_dir]
+# *******************************************************************************************
+
+AGC=$(realpath "${1:-./bin/agc}")
+TEST_DIR=$(dirname "$(realpath "$0")")
+WORK_DIR=${2:-$(mktemp -d)}
+
+[ -x "$AGC" ] || { echo "No agc binary: $AGC"; exit 1; }
+
+mkdir -p "$WORK_DIR/data" || exit 1
+cd "$WORK_DIR" || exit 1
+D=$WORK_DIR/data
+ALL="0 1 2 3 4 5 6 7 8 9"
+
+python3 "$TEST_DIR/gen_data.py" "$D" || { echo "Cannot generate test data"; exit 1; }
+
+no_failed=0
+no_passed=0
+
+# *******************************************************************************************
+files() {
+	for i in "$@"; do echo "$D/s$i.fa"; done
+}
+
+# *******************************************************************************************
+# verify <test_name> <archive> <sample ids...>
+verify() {
+	local name=$1 archive=$2
+	shift 2
+	local ok=1
+
+	if [ "$($AGC listset "$archive" 2>/dev/null | wc -l)" != "$#" ]; then
+		echo "  $name: wrong no. of samples in $archive"; ok=0
+	fi
+
+	for i in "$@"; do
+		$AGC getset -t 4 "$archive" s$i > out.fa 2>/dev/null
+		cmp -s out.fa "$D/s$i.fa" || { echo "  $name: getset s$i differs"; ok=0; }
+	done
+
+	rm -rf col && mkdir col
+	$AGC getcol -t 4 -o col "$archive" 2>/dev/null
+	for i in "$@"; do
+		cmp -s col/s$i.fa "$D/s$i.fa" || { echo "  $name: getcol s$i differs"; ok=0; }
+	done
+
+	local last=${!#}
+	$AGC getctg -l 2000000000 "$archive" chr2@s$last:1000-1999 2>/dev/null | tail -n +2 > out.txt
+	awk '/^>/{p=($0==">chr2"); next} p' "$D/s$last.fa" | tr -d '\n' | cut -c 1001-2000 > exp.txt
+	cmp -s out.txt exp.txt || { echo "  $name: getctg range of s$last differs"; ok=0; }
+
+	report "$name" $ok
+}
+
+# *******************************************************************************************
+report() {
+	if [ "$2" = 1 ]; then
+		echo "passed: $1"; no_passed=$((no_passed + 1))
+	else
+		echo "FAILED: $1"; no_failed=$((no_failed + 1))
+	fi
+}
+
+# *******************************************************************************************
+# Create and append
+$AGC create -t 4 -o a.agc $(files 0 1 2 3 4 5) 2>/dev/null
+verify "create" a.agc 0 1 2 3 4 5
+
+$AGC append -t 4 -o b.agc a.agc $(files 6 7 8 9) 2>/dev/null
+verify "append" b.agc $ALL
+
+cp a.agc u.agc
+$AGC append -t 4 -u u.agc $(files 6 7) 2>/dev/null
+$AGC append -t 4 -u u.agc $(files 8) 2>/dev/null
+$AGC append -t 4 -u u.agc $(files 9) 2>/dev/null
+verify "append in-place" u.agc $ALL
+[ ! -e u.agc.journal ] || report "append in-place: journal removed" 0
+
+$AGC create -t 4 -a -o ad.agc $(files 0 1 2 3) 2>/dev/null
+$AGC append -t 4 -a -u ad.agc $(files 4 5 6 7 8 9) 2>/dev/null
+verify "adaptive mode, append in-place" ad.agc $ALL
+
+# Binary delta coder (-e 3) must be kept by appending
+$AGC create -t 4 -e 3 -o e3.agc $(files 0 1 2 3 4 5) 2>/dev/null
+verify "create -e 3" e3.agc 0 1 2 3 4 5
+$AGC append -t 4 -o e3b.agc e3.agc $(files 6 7 8 9) 2>/dev/null
+verify "create -e 3, append" e3b.agc $ALL
+cp e3.agc e3u.agc
+$AGC append -t 4 -u e3u.agc $(files 6 7) 2>/dev/null
+$AGC append -t 4 -u e3u.agc $(files 8 9) 2>/dev/null
+verify "create -e 3, append in-place" e3u.agc $ALL
+for a in e3b.agc e3u.agc; do
+	$AGC info -v 1 $a 2>&1 | grep -q "file_version_minor : 1" || report "create -e 3: minor version of $a" 0
+done
+
+# zstd dictionaries trained at creation (and reused by appending) or at appending
+$AGC create -t 4 -z 2 -v 2 -o z.agc $(files 0 1 2 3) 2> z.log
+grep -q "Dictionary for delta packs trained" z.log || report "dictionaries: trained at create" 0
+$AGC append -t 4 -o z2.agc z.agc $(files 4 5 6) 2>/dev/null
+$AGC append -t 4 -u z2.agc $(files 7 8 9) 2>/dev/null
+verify "dictionaries, append" z2.agc $ALL
+
+$AGC create -t 4 -o za.agc $(files 0 1 2) 2>/dev/null
+$AGC append -t 4 -z 2 -v 2 -u za.agc $(files 3 4 5 6 7 8 9) 2> za.log
+grep -q "Dictionary for delta packs trained" za.log || report "dictionaries: trained at append" 0
+verify "dictionaries trained at in-place append" za.agc $ALL
+
+# *******************************************************************************************
+# Merge
+$AGC create -t 2 -b 2 -o base.agc $(files 0) 2>/dev/null
+$AGC append -t 2 -o sh1.agc base.agc $(files 1 2 3 4) 2>/dev/null &
+$AGC append -t 2 -o sh2.agc base.agc $(files 5 6 7) 2>/dev/null &
+$AGC append -t 2 -o sh3.agc base.agc $(files 8 9) 2>/dev/null &
+wait
+$AGC merge -t 4 -o m1.agc sh1.agc sh2.agc sh3.agc 2>/dev/null
+verify "merge of appended shards" m1.agc $ALL
+
+$AGC create -t 2 -o c1.agc $(files 0 1 2 3) 2>/dev/null
+$AGC create -t 2 -o c2.agc $(files 3 4 5 6) 2>/dev/null
+$AGC merge -t 4 -o m2.agc c1.agc c2.agc 2>/dev/null
+$AGC append -t 4 -o m3.agc m2.agc $(files 7 8 9) 2>/dev/null
+verify "merge of archives with different references, append" m3.agc $ALL
+
+# *******************************************************************************************
+# Subset (copied parts and truncated metadata streams are reused by appending)
+$AGC subset -t 4 -o sub.agc b.agc s1 s2 s5 2>/dev/null
+verify "subset" sub.agc 1 2 5
+$AGC append -t 4 -o sub2.agc sub.agc $(files 6 7) 2>/dev/null
+verify "subset, append" sub2.agc 1 2 5 6 7
+$AGC append -t 4 -u sub2.agc $(files 8 9) 2>/dev/null
+verify "subset, append, append in-place" sub2.agc 1 2 5 6 7 8 9
+
+$AGC subset -t 4 -x -o subx.agc u.agc s0 s3 s4 s9 2>/dev/null
+verify "subset -x" subx.agc 1 2 5 6 7 8
+$AGC append -t 4 -u subx.agc $(files 3 9) 2>/dev/null
+verify "subset -x, append in-place" subx.agc 1 2 5 6 7 8 3 9
+
+# *******************************************************************************************
+# Checkpoints and resume
+$AGC create -t 4 -b 2 --checkpoint 2 -o r1.agc $(files 0 1 2 3) 2>/dev/null
+$AGC create -t 4 -b 2 --checkpoint 2 --resume -o r1.agc $(files $ALL) 2>/dev/null
+verify "resume of completed part" r1.agc $ALL
+
+# Compression killed at some point (before the first checkpoint, after one of them or after the end)
+$AGC create -t 2 -b 1 --checkpoint 1 -o r2.agc $(files $ALL) 2>/dev/null &
+pid=$!
+for _ in $(seq 100); do
+	[ "$($AGC listset r2.agc 2>/dev/null | wc -l)" -ge 3 ] && break
+	kill -0 $pid 2>/dev/null || break
+	sleep 0.05
+done
+kill -9 $pid 2>/dev/null
+wait $pid 2>/dev/null
+$AGC create -t 2 -b 1 --checkpoint 1 --resume -o r2.agc $(files $ALL) 2>/dev/null
+verify "resume of killed compression" r2.agc $ALL
+[ ! -e r2.agc.journal ] || report "resume: journal removed" 0
+
+# Batch size of appending is taken from the archive
+$AGC create -t 4 -b 1 -o r3.agc $(files 0 1 2 3 4 5) 2>/dev/null
+$AGC append -t 4 --checkpoint 1 -u r3.agc $(files 6 7) 2>/dev/null
+$AGC append -t 4 --checkpoint 1 -u --resume r3.agc $(files 6 7 8 9) 2>/dev/null
+verify "resume of in-place append" r3.agc $ALL
+
+# *******************************************************************************************
+# BGZF output
+ok=1
+$AGC getset -t 4 -o s3.fa b.agc s3 2>/dev/null
+$AGC getset -t 4 --bgzf -o s3.fa.gz b.agc s3 2>/dev/null
+python3 "$TEST_DIR/bgzf_check.py" s3.fa.gz s3.fa --index || ok=0
+$AGC getset -t 4 --bgzf -g 1 -l 60 -o s3_60.fa.gz b.agc s3 2>/dev/null
+$AGC getset -t 4 -l 60 -o s3_60.fa b.agc s3 2>/dev/null
+python3 "$TEST_DIR/bgzf_check.py" s3_60.fa.gz s3_60.fa --index || ok=0
+report "getset --bgzf" $ok
+
+ok=1
+rm -rf col_gz && mkdir col_gz
+$AGC getcol -t 4 --bgzf -o col_gz b.agc 2>/dev/null
+for i in $ALL; do
+	python3 "$TEST_DIR/bgzf_check.py" col_gz/s$i.fa.gz "$D/s$i.fa" --index || ok=0
+done
+report "getcol --bgzf" $ok
+
+# *******************************************************************************************
+echo "Tests passed: $no_passed, failed: $no_failed"
+
+if [ $no_failed = 0 ] && [ -z "$2" ]; then
+	rm -rf "$WORK_DIR"
+fi
+
+[ $no_failed = 0 ]
+
+# EOF